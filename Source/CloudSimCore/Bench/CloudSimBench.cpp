@@ -0,0 +1,424 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+//command line front end for the layout benchmark suite, only built by the standalone CMake build
+//UnrealBuildTool picks up every source file in the module so the whole file is compiled out there
+#if defined(CLOUDSIM_STANDALONE) && CLOUDSIM_STANDALONE
+
+#include "CloudSimBenchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+	void PrintUsage()
+	{
+		std::printf(
+			"usage: cloudsim_bench [options]\n"
+			"  --size XxYxZ[,XxYxZ...]     lattice sizes (default 50x50x16)\n"
+			"  --layouts name[,name...]    Solver, AoS, SoA, Morton, Bricked, Padded or all (default all)\n"
+			"  --threads n[,n...]          thread counts, 0 for every hardware thread (default 1)\n"
+			"  --stages name[,name...]     Velocity, Diffuse, Advect1, Advect2, Transition, Step or all (default all)\n"
+			"  --warmup n                  samples thrown away first (default 3)\n"
+			"  --reps n                    samples measured (default 20)\n"
+			"  --seed n                    seed for the lattice values (default 1)\n"
+			"  --csv path                  also write every result to a csv file\n"
+			"  --order name                cell order of the solver's lattice, Linear or Morton (default Linear)\n"
+			"  --block XxYxZ               stencil block size of the solver, 0 along an axis for the whole lattice (default 0x0x0)\n"
+			"  --wavefront XxYxZ           run the stencil stages as diagonals of tiles this size, 0 along an axis for one tile per thread\n"
+			"  --fuse                      run Diffuse with Velocity and Transition with Advect2, the Velocity and Advect2 stages then time both\n"
+			"  --coloured-scatter XxYxZ    run the scatter on every thread as parity coloured tiles this size, 0 along an axis for 16\n"
+			"  --private-scatter           run the scatter on every thread, each into its own accumulators summed afterwards\n"
+			"  --release-scratch           free the advection scratch blocks after every step instead of keeping them\n"
+			"  --tune-blocks               time a range of stencil block sizes on the first --size and --threads and run with the fastest\n"
+			"\n"
+			"scenario mode, runs full steps from one of the simulator's starting states instead of the layout suite:\n"
+			"  --scenario name             VaporSource, HalfandHalf or DifferentDensities\n"
+			"  --steps n                   steps measured (default 100), --warmup sets the steps thrown away first\n"
+			"  --json path                 write the report as json, --csv writes it as csv\n"
+			"  --sparse threshold          run the sparse brick solver, freeing bricks with every value within threshold of 0\n"
+			"  --activity threshold        skip tiles whose inputs changed by no more than threshold, 0 keeps results exact\n"
+			"  --packed velocity[,water]   run the packed solver with velocity and water stored as Float32, Float16 or Fixed16\n"
+			"                              and report each channel's error against the float solver (default water is velocity's)\n"
+			"  --fixed-range v,w           range either side of 0 of Fixed16 velocity and water channels (default 256,64)\n"
+			"  --texture format            write the droplets into an R8 or R16F texture atlas after every step and time it\n"
+			"  --texture-regions n,f       bands of n rows of each slice count as uploaded when a texel moved by more than f (default 8,0)\n"
+			"  only the first --size and --threads are used\n");
+	}
+
+	std::vector<std::string> SplitList(const std::string& list)
+	{
+		std::vector<std::string> items;
+		std::stringstream stream(list);
+		std::string item;
+		while(std::getline(stream, item, ','))
+		{
+			if(!item.empty())
+			{
+				items.push_back(item);
+			}
+		}
+		return items;
+	}
+
+	bool ParseSize(const std::string& text, FCloudCellCoord& out_size)
+	{
+		return std::sscanf(text.c_str(), "%dx%dx%d", &out_size.x, &out_size.y, &out_size.z) == 3 && out_size.x > 0 && out_size.y > 0 && out_size.z > 0;
+	}
+
+	//peak resident memory of this process, 0 where it cannot be found
+	size_t PeakProcessMemory()
+	{
+#if defined(__APPLE__)
+		rusage usage;
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss : 0;
+#elif defined(__unix__)
+		rusage usage;
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss * 1024 : 0;
+#else
+		return 0;
+#endif
+	}
+
+	//sets config's stencil block to the fastest one found on its first size and thread count
+	//the table goes to stderr so a scenario's json on stdout stays clean
+	void TuneBlocks(FCloudBenchConfig& config)
+	{
+		const FCloudCellCoord size = config.sizes.empty() ? FCloudScenarioConfig().size : config.sizes.front();
+		const int32_t threads = config.thread_counts.empty() ? 1 : config.thread_counts.front();
+		const FCloudBlockTuneResult result = CloudTuneStencilBlock(size, config.params, threads == 1 ? FCloudParallelFor::Serial() : FCloudParallelFor::ThreadPool(threads), config.repetitions, config.seed);
+
+		std::fprintf(stderr, "%-14s %12s\n", "block", "p50_us");
+		for(const FCloudBlockTiming& timing : result.timings)
+		{
+			std::fprintf(stderr, "%4dx%4dx%4d %12.1f\n", timing.block.x, timing.block.y, timing.block.z, timing.p50_us);
+		}
+		std::fprintf(stderr, "best block %dx%dx%d\n", result.best.x, result.best.y, result.best.z);
+
+		config.params.stencil_block = result.best;
+	}
+
+	int RunScenario(const FCloudBenchConfig& config, ECloudScenario scenario, int32_t steps, bool sparse, bool packed, const FCloudScenarioConfig& texture, const std::string& json_path, const std::string& csv_path)
+	{
+		FCloudScenarioConfig scenario_config;
+		scenario_config.size = config.sizes.empty() ? scenario_config.size : config.sizes.front();
+		scenario_config.scenario = scenario;
+		scenario_config.warmup_steps = config.warmup;
+		scenario_config.steps = steps;
+		scenario_config.sparse = sparse;
+		scenario_config.packed = packed;
+		scenario_config.write_texture = texture.write_texture;
+		scenario_config.texture_format = texture.texture_format;
+		scenario_config.texture_threshold = texture.texture_threshold;
+		scenario_config.texture_region_rows = texture.texture_region_rows;
+		scenario_config.params = config.params;
+
+		const int32_t threads = config.thread_counts.empty() ? 1 : config.thread_counts.front();
+		FCloudScenarioReport report = RunCloudScenario(scenario_config, threads == 1 ? FCloudParallelFor::Serial() : FCloudParallelFor::ThreadPool(threads));
+		report.peak_memory_bytes = PeakProcessMemory();
+
+		WriteCloudScenarioJson(std::cout, report);
+
+		if(!json_path.empty())
+		{
+			std::ofstream json(json_path);
+			if(!json)
+			{
+				std::fprintf(stderr, "could not open %s\n", json_path.c_str());
+				return 1;
+			}
+			WriteCloudScenarioJson(json, report);
+		}
+		if(!csv_path.empty())
+		{
+			std::ofstream csv(csv_path);
+			if(!csv)
+			{
+				std::fprintf(stderr, "could not open %s\n", csv_path.c_str());
+				return 1;
+			}
+			WriteCloudScenarioCsv(csv, report);
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	FCloudBenchConfig config;
+	std::string csv_path;
+	std::string json_path;
+	bool scenario_mode = false;
+	ECloudScenario scenario = ECloudScenario::VaporSource;
+	int32_t steps = 100;
+	bool sparse = false;
+	bool packed = false;
+	//only the texture settings are read from here
+	FCloudScenarioConfig texture;
+	bool tune_blocks = false;
+
+	for(int arg = 1; arg < argc; arg++)
+	{
+		const std::string name = argv[arg];
+		if(name == "--help" || name == "-h")
+		{
+			PrintUsage();
+			return 0;
+		}
+		if(name == "--tune-blocks")
+		{
+			tune_blocks = true;
+			continue;
+		}
+		if(name == "--fuse")
+		{
+			config.params.fuse_stages = true;
+			continue;
+		}
+		if(name == "--private-scatter")
+		{
+			config.params.private_scatter = true;
+			continue;
+		}
+		if(name == "--release-scratch")
+		{
+			config.params.release_scratch = true;
+			continue;
+		}
+		if(arg + 1 >= argc)
+		{
+			std::fprintf(stderr, "missing value for %s\n", name.c_str());
+			PrintUsage();
+			return 1;
+		}
+		const std::string value = argv[++arg];
+
+		if(name == "--size")
+		{
+			config.sizes.clear();
+			for(const std::string& item : SplitList(value))
+			{
+				FCloudCellCoord size;
+				if(!ParseSize(item, size))
+				{
+					std::fprintf(stderr, "bad size %s\n", item.c_str());
+					return 1;
+				}
+				config.sizes.push_back(size);
+			}
+		}
+		else if(name == "--layouts")
+		{
+			if(value != "all")
+			{
+				config.layouts.clear();
+				for(const std::string& item : SplitList(value))
+				{
+					ECloudBenchLayout layout;
+					if(!ParseCloudBenchLayout(item, layout))
+					{
+						std::fprintf(stderr, "unknown layout %s\n", item.c_str());
+						return 1;
+					}
+					config.layouts.push_back(layout);
+				}
+			}
+		}
+		else if(name == "--threads")
+		{
+			config.thread_counts.clear();
+			for(const std::string& item : SplitList(value))
+			{
+				config.thread_counts.push_back(std::atoi(item.c_str()));
+			}
+		}
+		else if(name == "--stages")
+		{
+			if(value != "all")
+			{
+				config.stages.clear();
+				for(const std::string& item : SplitList(value))
+				{
+					ECloudBenchStage stage;
+					if(!ParseCloudBenchStage(item, stage))
+					{
+						std::fprintf(stderr, "unknown stage %s\n", item.c_str());
+						return 1;
+					}
+					config.stages.push_back(stage);
+				}
+			}
+		}
+		else if(name == "--warmup")
+		{
+			config.warmup = std::atoi(value.c_str());
+		}
+		else if(name == "--reps")
+		{
+			config.repetitions = std::atoi(value.c_str());
+		}
+		else if(name == "--seed")
+		{
+			config.seed = (uint32_t)std::strtoul(value.c_str(), nullptr, 10);
+		}
+		else if(name == "--csv")
+		{
+			csv_path = value;
+		}
+		else if(name == "--order")
+		{
+			if(!ParseCloudCellOrder(value, config.params.cell_order))
+			{
+				std::fprintf(stderr, "unknown cell order %s\n", value.c_str());
+				return 1;
+			}
+		}
+		else if(name == "--block")
+		{
+			FCloudCellCoord& block = config.params.stencil_block;
+			if(std::sscanf(value.c_str(), "%dx%dx%d", &block.x, &block.y, &block.z) != 3)
+			{
+				std::fprintf(stderr, "bad block size %s\n", value.c_str());
+				return 1;
+			}
+		}
+		else if(name == "--wavefront")
+		{
+			FCloudCellCoord& tile = config.params.wavefront_tile;
+			if(std::sscanf(value.c_str(), "%dx%dx%d", &tile.x, &tile.y, &tile.z) != 3)
+			{
+				std::fprintf(stderr, "bad wavefront tile size %s\n", value.c_str());
+				return 1;
+			}
+			config.params.wavefront = true;
+		}
+		else if(name == "--coloured-scatter")
+		{
+			FCloudCellCoord& tile = config.params.scatter_tile;
+			if(std::sscanf(value.c_str(), "%dx%dx%d", &tile.x, &tile.y, &tile.z) != 3)
+			{
+				std::fprintf(stderr, "bad scatter tile size %s\n", value.c_str());
+				return 1;
+			}
+			config.params.coloured_scatter = true;
+		}
+		else if(name == "--scenario")
+		{
+			if(!ParseCloudScenario(value, scenario))
+			{
+				std::fprintf(stderr, "unknown scenario %s\n", value.c_str());
+				return 1;
+			}
+			scenario_mode = true;
+		}
+		else if(name == "--steps")
+		{
+			steps = std::atoi(value.c_str());
+		}
+		else if(name == "--json")
+		{
+			json_path = value;
+		}
+		else if(name == "--sparse")
+		{
+			sparse = true;
+			config.params.sparse_threshold = (float)std::atof(value.c_str());
+		}
+		else if(name == "--activity")
+		{
+			config.params.activity_mask = true;
+			config.params.activity_threshold = (float)std::atof(value.c_str());
+		}
+		else if(name == "--packed")
+		{
+			const std::vector<std::string> items = SplitList(value);
+			ECloudPrecision velocity;
+			ECloudPrecision water;
+			if(items.empty() || items.size() > 2 || !ParseCloudPrecision(items[0], velocity) || !ParseCloudPrecision(items.back(), water))
+			{
+				std::fprintf(stderr, "bad precisions %s\n", value.c_str());
+				return 1;
+			}
+			for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+			{
+				config.params.precision[channel] = channel < (int32_t)ECloudChannel::WaterVapor ? velocity : water;
+			}
+			packed = true;
+		}
+		else if(name == "--fixed-range")
+		{
+			float velocity;
+			float water;
+			if(std::sscanf(value.c_str(), "%f,%f", &velocity, &water) != 2 || velocity <= 0.f || water <= 0.f)
+			{
+				std::fprintf(stderr, "bad fixed ranges %s\n", value.c_str());
+				return 1;
+			}
+			for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+			{
+				config.params.fixed_range[channel] = channel < (int32_t)ECloudChannel::WaterVapor ? velocity : water;
+			}
+		}
+		else if(name == "--texture")
+		{
+			if(!ParseCloudTextureFormat(value, texture.texture_format))
+			{
+				std::fprintf(stderr, "unknown texture format %s\n", value.c_str());
+				return 1;
+			}
+			texture.write_texture = true;
+		}
+		else if(name == "--texture-regions")
+		{
+			if(std::sscanf(value.c_str(), "%d,%f", &texture.texture_region_rows, &texture.texture_threshold) != 2)
+			{
+				std::fprintf(stderr, "bad texture regions %s\n", value.c_str());
+				return 1;
+			}
+		}
+		else
+		{
+			std::fprintf(stderr, "unknown option %s\n", name.c_str());
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if(tune_blocks)
+	{
+		TuneBlocks(config);
+	}
+
+	if(scenario_mode)
+	{
+		return RunScenario(config, scenario, steps, sparse, packed, texture, json_path, csv_path);
+	}
+
+	std::printf("%s\n", CloudBenchTableHeader().c_str());
+	const std::vector<FCloudBenchResult> results = RunCloudBenchmarks(config, [](const FCloudBenchResult& result)
+	{
+		std::printf("%s\n", FormatCloudBenchResult(result).c_str());
+		std::fflush(stdout);
+	});
+
+	if(!csv_path.empty())
+	{
+		std::ofstream csv(csv_path);
+		if(!csv)
+		{
+			std::fprintf(stderr, "could not open %s\n", csv_path.c_str());
+			return 1;
+		}
+		WriteCloudBenchCsv(csv, results);
+	}
+
+	return 0;
+}
+
+#endif
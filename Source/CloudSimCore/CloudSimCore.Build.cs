@@ -0,0 +1,15 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+using UnrealBuildTool;
+
+//engine free simulation core, also builds on its own through CMakeLists.txt
+public class CloudSimCore : ModuleRules
+{
+	public CloudSimCore(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		//only the module entry point uses the engine
+		PrivateDependencyModuleNames.AddRange(new string[] { "Core" });
+	}
+}
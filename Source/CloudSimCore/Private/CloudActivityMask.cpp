@@ -0,0 +1,22 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudActivityMask.h"
+
+void FCloudActivityMask::Init(int32_t in_y_size, int32_t in_z_size)
+{
+	y_size = std::max(in_y_size, 0);
+	z_size = std::max(in_z_size, 0);
+	tiles_y = (y_size + CloudActivityTileSize - 1) >> CloudActivityTileBits;
+	tiles_z = (z_size + CloudActivityTileSize - 1) >> CloudActivityTileBits;
+	bits.assign((size_t)tiles_y * tiles_z, (uint16_t)ECloudActivity::All);
+}
+
+void FCloudActivityMask::MarkAll()
+{
+	std::fill(bits.begin(), bits.end(), (uint16_t)ECloudActivity::All);
+}
+
+int32_t FCloudActivityMask::Count(ECloudActivity bit) const
+{
+	return (int32_t)std::count_if(bits.begin(), bits.end(), [bit](uint16_t tile_bits) { return (tile_bits & (uint16_t)bit) != 0; });
+}
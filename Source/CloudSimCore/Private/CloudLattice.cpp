@@ -0,0 +1,294 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudLattice.h"
+#include <algorithm>
+
+void FCloudLattice::Init(int32_t in_x_size, int32_t in_y_size, int32_t in_z_size)
+{
+	x_size = std::max(in_x_size, 0);
+	y_size = std::max(in_y_size, 0);
+	z_size = std::max(in_z_size, 0);
+	UpdatePitches();
+
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+	{
+		if(IsTransient((ECloudChannel)channel))
+		{
+			FCloudChannelArray().swap(channels[channel]);
+			continue;
+		}
+		channels[channel].assign(NumStored(), 0.f);
+	}
+
+	SetDoubleBuffered(double_buffered);
+}
+
+void FCloudLattice::SetDoubleBuffered(bool in_double_buffered)
+{
+	double_buffered = in_double_buffered;
+
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+	{
+		if(double_buffered && HasBackBuffer((ECloudChannel)channel))
+		{
+			//start the back buffer as a copy so cells a stage does not write keep their value after a swap
+			back_channels[channel] = channels[channel];
+		}
+		else
+		{
+			FCloudChannelArray().swap(back_channels[channel]);
+		}
+	}
+}
+
+void FCloudLattice::UpdatePitches()
+{
+	pitch_x = x_size + (2 * halo);
+	pitch_y = y_size + (2 * halo);
+	pitch_z = z_size + (2 * halo);
+
+	if(cell_order != ECloudCellOrder::Morton)
+	{
+		num_stored = pitch_x * pitch_y * pitch_z;
+		std::vector<int32_t>().swap(morton_x);
+		std::vector<int32_t>().swap(morton_y);
+		std::vector<int32_t>().swap(morton_z);
+		return;
+	}
+
+	const int32_t pitches[3] = { pitch_x, pitch_y, pitch_z };
+	std::vector<int32_t>* tables[3] = { &morton_x, &morton_y, &morton_z };
+
+	//bits needed to hold every coordinate along each axis
+	int32_t bits[3] = { 0, 0, 0 };
+	for(int32_t axis = 0; axis < 3; axis++)
+	{
+		while((1 << bits[axis]) < pitches[axis])
+		{
+			bits[axis]++;
+		}
+		tables[axis]->assign(pitches[axis], 0);
+	}
+
+	//the bits of the index are handed out x, y, z, x, y, z... from the lowest up, skipping any axis that has run out of bits
+	int32_t index_bit = 0;
+	for(int32_t bit = 0; bit < std::max(std::max(bits[0], bits[1]), bits[2]); bit++)
+	{
+		for(int32_t axis = 0; axis < 3; axis++)
+		{
+			if(bit >= bits[axis])
+			{
+				continue;
+			}
+			std::vector<int32_t>& table = *tables[axis];
+			for(int32_t coordinate = 0; coordinate < pitches[axis]; coordinate++)
+			{
+				table[coordinate] |= ((coordinate >> bit) & 1) << index_bit;
+			}
+			index_bit++;
+		}
+	}
+
+	num_stored = (pitch_x * pitch_y * pitch_z) == 0 ? 0 : 1 << index_bit;
+}
+
+void FCloudLattice::SetPadded(bool in_padded)
+{
+	const int32_t new_halo = in_padded ? 1 : 0;
+	if(new_halo != halo)
+	{
+		Relayout(cell_order, new_halo);
+	}
+}
+
+void FCloudLattice::SetCellOrder(ECloudCellOrder in_cell_order)
+{
+	if(in_cell_order != cell_order)
+	{
+		Relayout(in_cell_order, halo);
+	}
+}
+
+void FCloudLattice::Relayout(ECloudCellOrder new_cell_order, int32_t new_halo)
+{
+	//copy every cell inside the lattice across to its place in the new layout, a row at a time when both layouts keep rows together
+	const FCloudLattice old_layout = *this;
+	cell_order = new_cell_order;
+	halo = new_halo;
+	UpdatePitches();
+
+	const bool copy_rows = HasContiguousRows() && old_layout.HasContiguousRows();
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+	{
+		if(channels[channel].empty())
+		{
+			continue;
+		}
+		channels[channel].assign(NumStored(), 0.f);
+		const float* source = old_layout.channels[channel].data();
+		float* target = channels[channel].data();
+		for(int32_t z = 0; z < z_size; z++)
+		{
+			for(int32_t y = 0; y < y_size; y++)
+			{
+				if(copy_rows)
+				{
+					std::copy(source + old_layout.Index(0, y, z), source + old_layout.Index(0, y, z) + x_size, target + Index(0, y, z));
+					continue;
+				}
+				for(int32_t x = 0; x < x_size; x++)
+				{
+					target[Index(x, y, z)] = source[old_layout.Index(x, y, z)];
+				}
+			}
+		}
+	}
+
+	SetDoubleBuffered(double_buffered);
+}
+
+void FCloudLattice::RefreshHalo(ECloudChannel channel, ECloudBoundary boundary, float inflow_value)
+{
+	if(halo == 0 || Num() == 0)
+	{
+		return;
+	}
+
+	float* data = Channel(channel);
+
+	auto wrap = [](int32_t value, int32_t size)
+	{
+		return value < 0 ? value + size : (value >= size ? value - size : value);
+	};
+	auto clamp = [](int32_t value, int32_t size)
+	{
+		return value < 0 ? 0 : (value >= size ? size - 1 : value);
+	};
+
+	auto halo_value = [&](int32_t x, int32_t y, int32_t z)
+	{
+		switch(boundary)
+		{
+		default:
+		case(ECloudBoundary::Zero):
+			return 0.f;
+
+		case(ECloudBoundary::Clamp):
+			return data[Index(clamp(x, x_size), clamp(y, y_size), clamp(z, z_size))];
+
+		case(ECloudBoundary::Periodic):
+			return data[Index(wrap(x, x_size), wrap(y, y_size), wrap(z, z_size))];
+
+		case(ECloudBoundary::Inflow):
+			return inflow_value;
+		}
+	};
+
+	//rows in the halo planes are filled whole, rows inside the lattice only have their two ends in the halo
+	for(int32_t z = -halo; z < z_size + halo; z++)
+	{
+		for(int32_t y = -halo; y < y_size + halo; y++)
+		{
+			if(y < 0 || y >= y_size || z < 0 || z >= z_size)
+			{
+				for(int32_t x = -halo; x < x_size + halo; x++)
+				{
+					data[Index(x, y, z)] = halo_value(x, y, z);
+				}
+				continue;
+			}
+			data[Index(-1, y, z)] = halo_value(-1, y, z);
+			data[Index(x_size, y, z)] = halo_value(x_size, y, z);
+		}
+	}
+}
+
+void FCloudLattice::SwapChannel(ECloudChannel channel)
+{
+	if(double_buffered && HasBackBuffer(channel))
+	{
+		channels[(int32_t)channel].swap(back_channels[(int32_t)channel]);
+	}
+}
+
+void FCloudLattice::SwapVelocity()
+{
+	SwapChannel(ECloudChannel::VelocityX);
+	SwapChannel(ECloudChannel::VelocityY);
+	SwapChannel(ECloudChannel::VelocityZ);
+}
+
+void FCloudLattice::SwapChannels(ECloudChannel a, ECloudChannel b)
+{
+	channels[(int32_t)a].swap(channels[(int32_t)b]);
+}
+
+void FCloudLattice::SwapChannelStorage(ECloudChannel channel, FCloudChannelArray& storage)
+{
+	channels[(int32_t)channel].swap(storage);
+}
+
+void FCloudLattice::ZeroChannel(ECloudChannel channel)
+{
+	std::fill(channels[(int32_t)channel].begin(), channels[(int32_t)channel].end(), 0.f);
+}
+
+void FCloudLattice::Zero()
+{
+	for(FCloudChannelArray& channel : channels)
+	{
+		std::fill(channel.begin(), channel.end(), 0.f);
+	}
+	for(FCloudChannelArray& channel : back_channels)
+	{
+		std::fill(channel.begin(), channel.end(), 0.f);
+	}
+}
+
+void FCloudLattice::Empty()
+{
+	x_size = 0;
+	y_size = 0;
+	z_size = 0;
+	UpdatePitches();
+
+	for(FCloudChannelArray& channel : channels)
+	{
+		FCloudChannelArray().swap(channel);
+	}
+	for(FCloudChannelArray& channel : back_channels)
+	{
+		FCloudChannelArray().swap(channel);
+	}
+}
+
+void FCloudLattice::CopyFrom(const FCloudLattice& other)
+{
+	x_size = other.x_size;
+	y_size = other.y_size;
+	z_size = other.z_size;
+	halo = other.halo;
+	cell_order = other.cell_order;
+	UpdatePitches();
+	double_buffered = false;
+
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+	{
+		channels[channel] = other.channels[channel];
+		FCloudChannelArray().swap(back_channels[channel]);
+	}
+}
+
+size_t FCloudLattice::GetAllocatedSize() const
+{
+	size_t bytes = 0;
+	for(const FCloudChannelArray& channel : channels)
+	{
+		bytes += channel.capacity() * sizeof(float);
+	}
+	for(const FCloudChannelArray& channel : back_channels)
+	{
+		bytes += channel.capacity() * sizeof(float);
+	}
+	return bytes;
+}
@@ -0,0 +1,450 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudPackedLattice.h"
+#include "CloudSimd.h"
+#include <algorithm>
+#include <cstring>
+
+//F16C converts halves in hardware, MSVC has no macro for it but every AVX2 processor has it
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+	#include <immintrin.h>
+	#define CLOUDSIM_HALF_F16C 1
+#endif
+
+namespace
+{
+	inline uint32_t FloatBits(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	inline float BitsFloat(uint32_t bits)
+	{
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	//round to nearest even, overflow becomes infinity and NaN stays NaN
+	//subnormal halves are rounded by adding a magic number whose exponent leaves exactly the half's mantissa bits in the float's mantissa
+	inline uint16_t FloatToHalf(float value)
+	{
+		static constexpr uint32_t float_infinity = 255u << 23;
+		static constexpr uint32_t half_overflow = (127u + 16u) << 23;
+		static constexpr uint32_t smallest_normal_half = 113u << 23;
+		static constexpr uint32_t subnormal_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+		uint32_t bits = FloatBits(value);
+		const uint32_t sign = bits & 0x80000000u;
+		bits ^= sign;
+
+		uint32_t half;
+		if(bits >= half_overflow)
+		{
+			half = bits > float_infinity ? 0x7e00u : 0x7c00u;
+		}
+		else if(bits < smallest_normal_half)
+		{
+			half = FloatBits(BitsFloat(bits) + BitsFloat(subnormal_magic)) - subnormal_magic;
+		}
+		else
+		{
+			const uint32_t mantissa_odd = (bits >> 13) & 1u;
+			bits += ((15u - 127u) << 23) + 0xfffu + mantissa_odd;
+			half = bits >> 13;
+		}
+		return (uint16_t)(half | (sign >> 16));
+	}
+
+	inline float HalfToFloat(uint16_t half)
+	{
+		static constexpr uint32_t shifted_exponent = 0x7c00u << 13;
+		static constexpr uint32_t subnormal_magic = 113u << 23;
+
+		uint32_t bits = (half & 0x7fffu) << 13;
+		const uint32_t exponent = bits & shifted_exponent;
+		bits += (127u - 15u) << 23;
+
+		if(exponent == shifted_exponent)
+		{
+			//infinity or NaN
+			bits += (128u - 16u) << 23;
+		}
+		else if(exponent == 0)
+		{
+			//0 or subnormal, renormalised by the float subtraction
+			bits = FloatBits(BitsFloat(bits + (1u << 23)) - BitsFloat(subnormal_magic));
+		}
+		return BitsFloat(bits | ((uint32_t)(half & 0x8000u) << 16));
+	}
+
+	inline uint16_t FloatToFixed(float value, float scale)
+	{
+		const float scaled = value * scale;
+		const float clamped = scaled < -32767.f ? -32767.f : (scaled < 32767.f ? scaled : 32767.f);
+
+		//NaN fails both comparisons and ends up as 32767, so the simulation blowing up still shows
+		const int32_t fixed = (int32_t)(clamped + (clamped < 0.f ? -0.5f : 0.5f));
+		return (uint16_t)(int16_t)fixed;
+	}
+
+	inline float FixedToFloat(uint16_t fixed, float step)
+	{
+		return (float)(int16_t)fixed * step;
+	}
+
+#if CLOUDSIM_SIMD_SSE
+	//4 lanes of FloatToHalf(), each half in the low 16 bits of its lane, the branches become masks
+	inline __m128i FloatToHalf4(__m128 value)
+	{
+		const __m128i sign_mask = _mm_set1_epi32((int32_t)0x80000000u);
+		const __m128i half_overflow = _mm_set1_epi32((127 + 16) << 23);
+		const __m128i smallest_normal_half = _mm_set1_epi32(113 << 23);
+		const __m128i subnormal_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normal_bias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+		const __m128i bits = _mm_castps_si128(value);
+		const __m128i sign = _mm_and_si128(bits, sign_mask);
+		const __m128i magnitude = _mm_xor_si128(bits, sign);
+
+		const __m128i is_nan = _mm_castps_si128(_mm_cmpunord_ps(value, value));
+		const __m128i overflow_half = _mm_or_si128(_mm_and_si128(is_nan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+		const __m128 subnormal_sum = _mm_add_ps(_mm_castsi128_ps(magnitude), _mm_castsi128_ps(subnormal_magic));
+		const __m128i subnormal_half = _mm_sub_epi32(_mm_castps_si128(subnormal_sum), subnormal_magic);
+
+		const __m128i mantissa_odd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+		const __m128i normal_half = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(magnitude, normal_bias), mantissa_odd), 13);
+
+		const __m128i is_subnormal = _mm_cmpgt_epi32(smallest_normal_half, magnitude);
+		const __m128i in_range = _mm_cmpgt_epi32(half_overflow, magnitude);
+		const __m128i finite_half = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal_half), _mm_andnot_si128(is_subnormal, normal_half));
+		const __m128i half = _mm_or_si128(_mm_and_si128(in_range, finite_half), _mm_andnot_si128(in_range, overflow_half));
+		return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+	}
+
+	//4 lanes of HalfToFloat(), each half in the low 16 bits of its lane
+	inline __m128 HalfToFloat4(__m128i half)
+	{
+		const __m128i shifted_exponent = _mm_set1_epi32(0x7c00 << 13);
+		const __m128i exponent_adjust = _mm_set1_epi32((127 - 15) << 23);
+		const __m128 subnormal_magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+
+		__m128i bits = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x7fff)), 13);
+		const __m128i exponent = _mm_and_si128(bits, shifted_exponent);
+		bits = _mm_add_epi32(bits, exponent_adjust);
+
+		const __m128i is_special = _mm_cmpeq_epi32(exponent, shifted_exponent);
+		bits = _mm_add_epi32(bits, _mm_and_si128(is_special, exponent_adjust));
+
+		const __m128i is_subnormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+		const __m128i renormalised = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(1 << 23))), subnormal_magic));
+		bits = _mm_or_si128(_mm_and_si128(is_subnormal, renormalised), _mm_andnot_si128(is_subnormal, bits));
+		return _mm_castsi128_ps(_mm_or_si128(bits, _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x8000)), 16)));
+	}
+
+	//narrows 8 lanes holding 16 bit values to 8 uint16s, sign extending first so the saturating pack leaves them as they are
+	inline void Store8(uint16_t* out, __m128i low, __m128i high)
+	{
+		low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+		high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+		_mm_storeu_si128((__m128i*)out, _mm_packs_epi32(low, high));
+	}
+#endif
+}
+
+void CloudPackValues(const float* values, uint16_t* out_packed, int32_t count, ECloudPrecision precision, float range)
+{
+	int32_t i = 0;
+	if(precision == ECloudPrecision::Fixed16)
+	{
+		const float scale = 32767.f / range;
+#if CLOUDSIM_SIMD_SSE
+		//min before max so NaN ends up at 32767 like FloatToFixed()
+		const __m128 scale4 = _mm_set1_ps(scale);
+		auto to_fixed = [scale4](__m128 value)
+		{
+			const __m128 clamped = _mm_max_ps(_mm_min_ps(_mm_mul_ps(value, scale4), _mm_set1_ps(32767.f)), _mm_set1_ps(-32767.f));
+			const __m128 rounding = _mm_or_ps(_mm_and_ps(clamped, _mm_castsi128_ps(_mm_set1_epi32((int32_t)0x80000000u))), _mm_set1_ps(0.5f));
+			return _mm_cvttps_epi32(_mm_add_ps(clamped, rounding));
+		};
+		for(; i + 8 <= count; i += 8)
+		{
+			_mm_storeu_si128((__m128i*)(out_packed + i), _mm_packs_epi32(to_fixed(_mm_loadu_ps(values + i)), to_fixed(_mm_loadu_ps(values + i + 4))));
+		}
+#endif
+		for(; i < count; i++)
+		{
+			out_packed[i] = FloatToFixed(values[i], scale);
+		}
+		return;
+	}
+
+#if CLOUDSIM_HALF_F16C
+	for(; i + 4 <= count; i += 4)
+	{
+		_mm_storel_epi64((__m128i*)(out_packed + i), _mm_cvtps_ph(_mm_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+	}
+#elif CLOUDSIM_SIMD_SSE
+	for(; i + 8 <= count; i += 8)
+	{
+		Store8(out_packed + i, FloatToHalf4(_mm_loadu_ps(values + i)), FloatToHalf4(_mm_loadu_ps(values + i + 4)));
+	}
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	for(; i + 4 <= count; i += 4)
+	{
+		vst1_u16(out_packed + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(values + i))));
+	}
+#endif
+	for(; i < count; i++)
+	{
+		out_packed[i] = FloatToHalf(values[i]);
+	}
+}
+
+void CloudUnpackValues(const uint16_t* packed, float* out_values, int32_t count, ECloudPrecision precision, float range)
+{
+	int32_t i = 0;
+	if(precision == ECloudPrecision::Fixed16)
+	{
+		const float step = range / 32767.f;
+#if CLOUDSIM_SIMD_SSE
+		const __m128 step4 = _mm_set1_ps(step);
+		for(; i + 8 <= count; i += 8)
+		{
+			const __m128i fixed = _mm_loadu_si128((const __m128i*)(packed + i));
+			_mm_storeu_ps(out_values + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(fixed, fixed), 16)), step4));
+			_mm_storeu_ps(out_values + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(fixed, fixed), 16)), step4));
+		}
+#endif
+		for(; i < count; i++)
+		{
+			out_values[i] = FixedToFloat(packed[i], step);
+		}
+		return;
+	}
+
+#if CLOUDSIM_HALF_F16C
+	for(; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(out_values + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(packed + i))));
+	}
+#elif CLOUDSIM_SIMD_SSE
+	for(; i + 8 <= count; i += 8)
+	{
+		const __m128i half = _mm_loadu_si128((const __m128i*)(packed + i));
+		_mm_storeu_ps(out_values + i, HalfToFloat4(_mm_unpacklo_epi16(half, _mm_setzero_si128())));
+		_mm_storeu_ps(out_values + i + 4, HalfToFloat4(_mm_unpackhi_epi16(half, _mm_setzero_si128())));
+	}
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	for(; i + 4 <= count; i += 4)
+	{
+		vst1q_f32(out_values + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(packed + i))));
+	}
+#endif
+	for(; i < count; i++)
+	{
+		out_values[i] = HalfToFloat(packed[i]);
+	}
+}
+
+void FCloudPackedLattice::Init(int32_t in_x_size, int32_t in_y_size, int32_t in_z_size)
+{
+	x_size = std::max(in_x_size, 0);
+	y_size = std::max(in_y_size, 0);
+	z_size = std::max(in_z_size, 0);
+
+	for(FChannel& channel : channels)
+	{
+		Allocate(channel);
+	}
+}
+
+void FCloudPackedLattice::Allocate(FChannel& channel)
+{
+	if(channel.precision == ECloudPrecision::Float32)
+	{
+		channel.floats.assign(Num(), 0.f);
+		std::vector<uint16_t>().swap(channel.packed);
+	}
+	else
+	{
+		channel.packed.assign(Num(), 0);
+		std::vector<float>().swap(channel.floats);
+	}
+}
+
+void FCloudPackedLattice::Zero()
+{
+	//a packed 0 is all bits clear at either 16 bit precision
+	for(FChannel& channel : channels)
+	{
+		std::fill(channel.floats.begin(), channel.floats.end(), 0.f);
+		std::fill(channel.packed.begin(), channel.packed.end(), (uint16_t)0);
+	}
+}
+
+void FCloudPackedLattice::Empty()
+{
+	Init(0, 0, 0);
+	for(FChannel& channel : channels)
+	{
+		std::vector<float>().swap(channel.floats);
+		std::vector<uint16_t>().swap(channel.packed);
+	}
+}
+
+void FCloudPackedLattice::CopyFrom(const FCloudPackedLattice& other)
+{
+	x_size = other.x_size;
+	y_size = other.y_size;
+	z_size = other.z_size;
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+	{
+		channels[channel].precision = other.channels[channel].precision;
+		channels[channel].range = other.channels[channel].range;
+		channels[channel].floats = other.channels[channel].floats;
+		channels[channel].packed = other.channels[channel].packed;
+	}
+}
+
+void FCloudPackedLattice::SetPrecision(const ECloudPrecision* precision, const float* fixed_range)
+{
+	std::vector<float> values;
+	for(int32_t index = 0; index < (int32_t)ECloudChannel::AdvectWaterVapor; index++)
+	{
+		FChannel& channel = channels[index];
+		const float range = fixed_range[index] > 0.f ? fixed_range[index] : 1.f;
+		if(channel.precision == precision[index] && (channel.precision != ECloudPrecision::Fixed16 || channel.range == range))
+		{
+			continue;
+		}
+
+		values.resize(Num());
+		Unpack((ECloudChannel)index, 0, Num(), values.data());
+		channel.precision = precision[index];
+		channel.range = range;
+		Allocate(channel);
+		Pack((ECloudChannel)index, 0, Num(), values.data());
+	}
+}
+
+void FCloudPackedLattice::LoadFrom(const FCloudLattice& dense)
+{
+	Init(dense.GetXSize(), dense.GetYSize(), dense.GetZSize());
+
+	std::vector<float> row(x_size);
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+	{
+		const float* source = dense.Channel((ECloudChannel)channel);
+		for(int32_t z = 0; z < z_size; z++)
+		{
+			for(int32_t y = 0; y < y_size; y++)
+			{
+				if(dense.HasContiguousRows())
+				{
+					Pack((ECloudChannel)channel, Index(0, y, z), x_size, source + dense.Index(0, y, z));
+					continue;
+				}
+				for(int32_t x = 0; x < x_size; x++)
+				{
+					row[x] = source[dense.Index(x, y, z)];
+				}
+				Pack((ECloudChannel)channel, Index(0, y, z), x_size, row.data());
+			}
+		}
+	}
+}
+
+void FCloudPackedLattice::StoreTo(FCloudLattice& dense) const
+{
+	dense.Init(x_size, y_size, z_size);
+
+	std::vector<float> row(x_size);
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+	{
+		float* target = dense.Channel((ECloudChannel)channel);
+		for(int32_t z = 0; z < z_size; z++)
+		{
+			for(int32_t y = 0; y < y_size; y++)
+			{
+				if(dense.HasContiguousRows())
+				{
+					Unpack((ECloudChannel)channel, Index(0, y, z), x_size, target + dense.Index(0, y, z));
+					continue;
+				}
+				Unpack((ECloudChannel)channel, Index(0, y, z), x_size, row.data());
+				for(int32_t x = 0; x < x_size; x++)
+				{
+					target[dense.Index(x, y, z)] = row[x];
+				}
+			}
+		}
+	}
+
+	//back buffers start as a copy of the front ones, see FCloudLattice::SetDoubleBuffered()
+	dense.SetDoubleBuffered(dense.IsDoubleBuffered());
+}
+
+float FCloudPackedLattice::Get(ECloudChannel channel, int32_t x, int32_t y, int32_t z) const
+{
+	return IsValidCell(x, y, z) ? Get(channel, Index(x, y, z)) : 0.f;
+}
+
+float FCloudPackedLattice::Get(ECloudChannel channel, int32_t i) const
+{
+	if(!IsStored(channel))
+	{
+		return 0.f;
+	}
+
+	const FChannel& values = channels[(int32_t)channel];
+	switch(values.precision)
+	{
+	case(ECloudPrecision::Float16): return HalfToFloat(values.packed[i]);
+	case(ECloudPrecision::Fixed16): return FixedToFloat(values.packed[i], values.range / 32767.f);
+	default: return values.floats[i];
+	}
+}
+
+void FCloudPackedLattice::Set(ECloudChannel channel, int32_t x, int32_t y, int32_t z, float value)
+{
+	if(IsStored(channel) && IsValidCell(x, y, z))
+	{
+		Pack(channel, Index(x, y, z), 1, &value);
+	}
+}
+
+void FCloudPackedLattice::Unpack(ECloudChannel channel, int32_t i, int32_t count, float* out_values) const
+{
+	const FChannel& values = channels[(int32_t)channel];
+	if(values.precision == ECloudPrecision::Float32)
+	{
+		std::copy(values.floats.data() + i, values.floats.data() + i + count, out_values);
+		return;
+	}
+	CloudUnpackValues(values.packed.data() + i, out_values, count, values.precision, values.range);
+}
+
+void FCloudPackedLattice::Pack(ECloudChannel channel, int32_t i, int32_t count, const float* in_values)
+{
+	FChannel& values = channels[(int32_t)channel];
+	if(values.precision == ECloudPrecision::Float32)
+	{
+		std::copy(in_values, in_values + count, values.floats.data() + i);
+		return;
+	}
+	CloudPackValues(in_values, values.packed.data() + i, count, values.precision, values.range);
+}
+
+size_t FCloudPackedLattice::GetAllocatedSize() const
+{
+	size_t size = 0;
+	for(const FChannel& channel : channels)
+	{
+		size += (channel.floats.capacity() * sizeof(float)) + (channel.packed.capacity() * sizeof(uint16_t));
+	}
+	return size;
+}
@@ -0,0 +1,351 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudPackedSolver.h"
+#include "CloudSimKernels.h"
+#include <algorithm>
+
+namespace
+{
+	inline float Clamp(float value, float min, float max)
+	{
+		return value < min ? min : (value < max ? value : max);
+	}
+
+	inline float Lerp(float a, float b, float alpha)
+	{
+		return a + alpha * (b - a);
+	}
+
+	inline int32_t DivideAndRoundUp(int32_t dividend, int32_t divisor)
+	{
+		return (dividend + divisor - 1) / divisor;
+	}
+
+	static constexpr ECloudChannel VelocityChannels[3] = { ECloudChannel::VelocityX, ECloudChannel::VelocityY, ECloudChannel::VelocityZ };
+}
+
+FCloudPackedSolver::FCloudPackedSolver()
+	: parallel_for(FCloudParallelFor::Serial())
+{
+}
+
+void FCloudPackedSolver::Init(int32_t x_size, int32_t y_size, int32_t z_size)
+{
+	lattice.SetPrecision(params.precision, params.fixed_range);
+	lattice.Init(x_size, y_size, z_size);
+	ReturnAccumulators(false);
+	scratch.SetBlockSize(lattice.Num());
+	active_advection_scheme = params.advection_scheme;
+	thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+}
+
+void FCloudPackedSolver::ApplyPendingSettings()
+{
+	lattice.SetPrecision(params.precision, params.fixed_range);
+
+	//the lattice can have been loaded or resized since Init(), which frees any blocks of the old size
+	scratch.SetBlockSize(lattice.Num());
+	if((int32_t)A_water_vapor.size() != lattice.Num() || active_advection_scheme != params.advection_scheme)
+	{
+		//gathering leaves old values behind in the accumulators, the scatter needs them to start at 0
+		ReturnAccumulators(false);
+		active_advection_scheme = params.advection_scheme;
+	}
+}
+
+void FCloudPackedSolver::AcquireAccumulators(bool zeroed)
+{
+	if(A_water_vapor.empty())
+	{
+		scratch.Acquire(A_water_vapor, zeroed);
+		scratch.Acquire(A_water_droplets, zeroed);
+	}
+}
+
+void FCloudPackedSolver::ReturnAccumulators(bool zeroed)
+{
+	scratch.Return(A_water_vapor, zeroed);
+	scratch.Return(A_water_droplets, zeroed);
+}
+
+void FCloudPackedSolver::SweepStencil(ECloudSimStage stage)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t z_size = lattice.GetZSize();
+	const int32_t min_ys = DivideAndRoundUp(std::max(params.min_batch_size, 1), std::max(x_size * z_size, 1));
+
+	CloudParallelForBatches(parallel_for, lattice.GetYSize(), min_ys, [this, stage, x_size, z_size](int32_t y_begin, int32_t y_end)
+	{
+		//velocity keeps 3 rows of each component and diffusion 3 rows of water vapor, the row below as updated and this row and the one above as they were
+		const int32_t num_channels = stage == ECloudSimStage::Velocity ? 3 : 1;
+		std::vector<float> rows(3 * num_channels * x_size);
+		auto row = [&rows, num_channels, x_size](int32_t z, int32_t channel)
+		{
+			return rows.data() + ((((z % 3) + 3) % 3) * num_channels + channel) * x_size;
+		};
+		auto channel_of = [stage](int32_t channel)
+		{
+			return stage == ECloudSimStage::Velocity ? VelocityChannels[channel] : ECloudChannel::WaterVapor;
+		};
+
+		for(int32_t y = y_begin; y < y_end; y++)
+		{
+			for(int32_t channel = 0; channel < num_channels; channel++)
+			{
+				lattice.Unpack(channel_of(channel), lattice.Index(0, y, 0), x_size, row(0, channel));
+			}
+
+			for(int32_t z = 0; z < z_size; z++)
+			{
+				const bool top = z + 1 >= z_size;
+				for(int32_t channel = 0; channel < num_channels && !top; channel++)
+				{
+					lattice.Unpack(channel_of(channel), lattice.Index(0, y, z + 1), x_size, row(z + 1, channel));
+				}
+
+				if(stage == ECloudSimStage::Diffuse)
+				{
+					CloudSimKernels::DiffuseRow(row(z, 0), z > 0 ? row(z - 1, 0) : nullptr, row(z, 0), x_size, params.vapour_diffusion);
+				}
+				else
+				{
+					CloudSimKernels::FVelocityRow velocity;
+					for(int32_t channel = 0; channel < 3; channel++)
+					{
+						velocity.center[channel] = row(z, channel);
+						velocity.zminus[channel] = z > 0 ? row(z - 1, channel) : nullptr;
+						velocity.zplus[channel] = top ? nullptr : row(z + 1, channel);
+						velocity.out[channel] = row(z, channel);
+					}
+					CloudSimKernels::VelocityRow(velocity, x_size, params.viscosity_ratio, params.pressure_effect);
+				}
+
+				for(int32_t channel = 0; channel < num_channels; channel++)
+				{
+					lattice.Pack(channel_of(channel), lattice.Index(0, y, z), x_size, row(z, channel));
+				}
+			}
+		}
+		cells_processed += (int64_t)(y_end - y_begin) * x_size * z_size;
+	});
+}
+
+//the same weights, and the same order of targets, as FCloudSolver::Advect1Cell
+void FCloudPackedSolver::SweepScatter()
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t z_size = lattice.GetZSize();
+	AcquireAccumulators(true);
+
+	std::vector<float> rows(5 * x_size);
+	float* velocity_x = rows.data();
+	float* velocity_y = velocity_x + x_size;
+	float* velocity_z = velocity_y + x_size;
+	float* water_vapor = velocity_z + x_size;
+	float* water_droplets = water_vapor + x_size;
+
+	for(int32_t z = 0; z < z_size; z++)
+	{
+		for(int32_t y = 0; y < y_size; y++)
+		{
+			const int32_t row_start = lattice.Index(0, y, z);
+			lattice.Unpack(ECloudChannel::VelocityX, row_start, x_size, velocity_x);
+			lattice.Unpack(ECloudChannel::VelocityY, row_start, x_size, velocity_y);
+			lattice.Unpack(ECloudChannel::VelocityZ, row_start, x_size, velocity_z);
+			lattice.Unpack(ECloudChannel::WaterVapor, row_start, x_size, water_vapor);
+			lattice.Unpack(ECloudChannel::WaterDroplets, row_start, x_size, water_droplets);
+
+			for(int32_t x = 0; x < x_size; x++)
+			{
+				const int l = (int)velocity_x[x];
+				const int m = (int)velocity_y[x];
+				const int n = (int)velocity_z[x];
+
+				if((l > 0 && l < x_size-1) && (m > 0 && m < y_size-1) && (n > 0 && n < z_size-1))
+				{
+					const float weightX = velocity_x[x] - l;
+					const float weightY = velocity_x[x] - m;
+					const float weightZ = velocity_x[x] - n;
+
+					auto add = [this, &water_vapor, &water_droplets, x](int32_t target, float weight)
+					{
+						A_water_vapor[target] += water_vapor[x] * weight;
+						A_water_droplets[target] += water_droplets[x] * weight;
+					};
+
+					add(lattice.Index(l, m, n), (1 - weightX) * (1 - weightY) * (1 - weightZ));
+					add(lattice.Index(l + 1, m, n), weightX * (1 - weightY) * (1 - weightZ));
+					add(lattice.Index(l, m + 1, n), (1 - weightX) * weightY * (1 - weightZ));
+					add(lattice.Index(l, m, n + 1), (1 - weightX) * (1 - weightY) * weightZ);
+					add(lattice.Index(l + 1, m + 1, n), weightX * weightY * (1 - weightZ));
+					add(lattice.Index(l + 1, m, n + 1), (1 - weightX) * weightY * weightZ);
+					add(lattice.Index(l, m + 1, n + 1), weightX * (1 - weightY) * weightZ);
+					add(lattice.Index(l + 1, m + 1, n + 1), weightX * weightY * weightZ);
+				}
+			}
+		}
+	}
+
+	cells_processed += lattice.Num();
+}
+
+//the same sampling as FCloudSolver::AdvectGatherCell, each sample is unpacked from the lattice as it is read
+void FCloudPackedSolver::SweepGather()
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t z_size = lattice.GetZSize();
+	const int32_t min_rows = DivideAndRoundUp(std::max(params.min_batch_size, 1), std::max(x_size, 1));
+	AcquireAccumulators(false);
+
+	CloudParallelForBatches(parallel_for, y_size * z_size, min_rows, [this, x_size, y_size, z_size](int32_t row_begin, int32_t row_end)
+	{
+		std::vector<float> rows(3 * x_size);
+		float* velocity[3] = { rows.data(), rows.data() + x_size, rows.data() + (2 * x_size) };
+
+		for(int32_t row = row_begin; row < row_end; row++)
+		{
+			const int32_t y = row % y_size;
+			const int32_t z = row / y_size;
+			const int32_t row_start = lattice.Index(0, y, z);
+			for(int32_t channel = 0; channel < 3; channel++)
+			{
+				lattice.Unpack(VelocityChannels[channel], row_start, x_size, velocity[channel]);
+			}
+
+			for(int32_t x = 0; x < x_size; x++)
+			{
+				const float source_x = Clamp(x - velocity[0][x], 0.f, (float)(x_size - 1));
+				const float source_y = Clamp(y - velocity[1][x], 0.f, (float)(y_size - 1));
+				const float source_z = Clamp(z - velocity[2][x], 0.f, (float)(z_size - 1));
+
+				const int32_t x0 = (int32_t)source_x;
+				const int32_t y0 = (int32_t)source_y;
+				const int32_t z0 = (int32_t)source_z;
+				const int32_t x1 = std::min(x0 + 1, x_size - 1);
+				const int32_t y1 = std::min(y0 + 1, y_size - 1);
+				const int32_t z1 = std::min(z0 + 1, z_size - 1);
+
+				const float weightX = source_x - x0;
+				const float weightY = source_y - y0;
+				const float weightZ = source_z - z0;
+
+				auto trilinear = [&](ECloudChannel channel)
+				{
+					const float bottom = Lerp(Lerp(lattice.Get(channel, x0, y0, z0), lattice.Get(channel, x1, y0, z0), weightX), Lerp(lattice.Get(channel, x0, y1, z0), lattice.Get(channel, x1, y1, z0), weightX), weightY);
+					const float top = Lerp(Lerp(lattice.Get(channel, x0, y0, z1), lattice.Get(channel, x1, y0, z1), weightX), Lerp(lattice.Get(channel, x0, y1, z1), lattice.Get(channel, x1, y1, z1), weightX), weightY);
+					return Lerp(bottom, top, weightZ);
+				};
+
+				A_water_vapor[row_start + x] = trilinear(ECloudChannel::WaterVapor);
+				A_water_droplets[row_start + x] = trilinear(ECloudChannel::WaterDroplets);
+			}
+		}
+		cells_processed += (int64_t)(row_end - row_begin) * x_size;
+	});
+
+	//the gathered values become the new water values, as in FCloudSolver::FinishGather
+	lattice.Pack(ECloudChannel::WaterVapor, 0, lattice.Num(), A_water_vapor.data());
+	lattice.Pack(ECloudChannel::WaterDroplets, 0, lattice.Num(), A_water_droplets.data());
+	ReturnAccumulators(false);
+}
+
+void FCloudPackedSolver::SweepRows(ECloudSimStage stage)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t min_rows = DivideAndRoundUp(std::max(params.min_batch_size, 1), std::max(x_size, 1));
+
+	CloudParallelForBatches(parallel_for, y_size * lattice.GetZSize(), min_rows, [this, stage, x_size, y_size](int32_t row_begin, int32_t row_end)
+	{
+		std::vector<float> rows(2 * x_size);
+		float* water_vapor = rows.data();
+		float* water_droplets = water_vapor + x_size;
+
+		for(int32_t row = row_begin; row < row_end; row++)
+		{
+			const int32_t z = row / y_size;
+			const int32_t row_start = row * x_size;
+			lattice.Unpack(ECloudChannel::WaterVapor, row_start, x_size, water_vapor);
+			lattice.Unpack(ECloudChannel::WaterDroplets, row_start, x_size, water_droplets);
+
+			if(stage == ECloudSimStage::Advect2)
+			{
+				for(int32_t x = 0; x < x_size; x++)
+				{
+					water_vapor[x] += A_water_vapor[row_start + x];
+					A_water_vapor[row_start + x] = 0.f;
+					water_droplets[x] += A_water_droplets[row_start + x];
+					A_water_droplets[row_start + x] = 0.f;
+				}
+			}
+			else
+			{
+				CloudSimKernels::TransitionRange(water_vapor, water_droplets, x_size, MaxWaterVapor(z), params.phase_transition_rate);
+			}
+
+			lattice.Pack(ECloudChannel::WaterVapor, row_start, x_size, water_vapor);
+			lattice.Pack(ECloudChannel::WaterDroplets, row_start, x_size, water_droplets);
+		}
+		cells_processed += (int64_t)(row_end - row_begin) * x_size;
+	});
+}
+
+ECloudSimStage FCloudPackedSolver::SweepStage(ECloudSimStage stage)
+{
+	switch(stage)
+	{
+	default:
+		return stage;
+
+	case(ECloudSimStage::Velocity):
+		SweepStencil(stage);
+		return ECloudSimStage::Diffuse;
+
+	case(ECloudSimStage::Diffuse):
+		SweepStencil(stage);
+		return ECloudSimStage::Advect1;
+
+	case(ECloudSimStage::Advect1):
+		if(active_advection_scheme == ECloudAdvectionScheme::Gather)
+		{
+			SweepGather();
+			return ECloudSimStage::Transition;
+		}
+		SweepScatter();
+		return ECloudSimStage::Advect2;
+
+	//every accumulator is cleared as it is folded in
+	case(ECloudSimStage::Advect2):
+		AcquireAccumulators(true);
+		SweepRows(stage);
+		ReturnAccumulators(true);
+		return ECloudSimStage::Transition;
+
+	case(ECloudSimStage::Transition):
+		thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+		SweepRows(stage);
+		if(params.release_scratch)
+		{
+			scratch.Release();
+		}
+		completed_steps++;
+		return ECloudSimStage::Done;
+	}
+}
+
+void FCloudPackedSolver::RunStep()
+{
+	ApplyPendingSettings();
+
+	for(ECloudSimStage stage = ECloudSimStage::Velocity; stage != ECloudSimStage::Done;)
+	{
+		stage = SweepStage(stage);
+	}
+}
+
+size_t FCloudPackedSolver::GetAllocatedSize() const
+{
+	return lattice.GetAllocatedSize() + scratch.GetAllocatedSize() + ((A_water_vapor.capacity() + A_water_droplets.capacity()) * sizeof(float));
+}
@@ -0,0 +1,66 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudScratchArena.h"
+#include <algorithm>
+
+void FCloudScratchArena::SetBlockSize(int32_t in_block_size)
+{
+	in_block_size = std::max(in_block_size, 0);
+	if(in_block_size != block_size)
+	{
+		block_size = in_block_size;
+		Release();
+	}
+}
+
+void FCloudScratchArena::Acquire(FCloudChannelArray& out_block, bool zeroed)
+{
+	if(free_blocks.empty())
+	{
+		FCloudChannelArray(block_size, 0.f).swap(out_block);
+		return;
+	}
+
+	//a block that is already clear saves a pass over it
+	auto found = free_blocks.end() - 1;
+	if(zeroed)
+	{
+		found = std::find_if(free_blocks.begin(), free_blocks.end(), [](const FBlock& block) { return block.zeroed; });
+		found = found == free_blocks.end() ? free_blocks.end() - 1 : found;
+	}
+
+	out_block.swap(found->values);
+	if(zeroed && !found->zeroed)
+	{
+		std::fill(out_block.begin(), out_block.end(), 0.f);
+	}
+	free_blocks.erase(found);
+}
+
+void FCloudScratchArena::Return(FCloudChannelArray& block, bool zeroed)
+{
+	if((int32_t)block.size() != block_size || block_size == 0)
+	{
+		FCloudChannelArray().swap(block);
+		return;
+	}
+
+	free_blocks.emplace_back();
+	free_blocks.back().values.swap(block);
+	free_blocks.back().zeroed = zeroed;
+}
+
+void FCloudScratchArena::Release()
+{
+	std::vector<FBlock>().swap(free_blocks);
+}
+
+size_t FCloudScratchArena::GetAllocatedSize() const
+{
+	size_t bytes = 0;
+	for(const FBlock& block : free_blocks)
+	{
+		bytes += block.values.capacity() * sizeof(float);
+	}
+	return bytes;
+}
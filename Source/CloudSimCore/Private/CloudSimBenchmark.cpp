@@ -0,0 +1,1345 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSimBenchmark.h"
+#include "CloudSimKernels.h"
+#include "CloudPackedSolver.h"
+#include "CloudSparseSolver.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <thread>
+
+namespace
+{
+	static constexpr int32_t NumChannels = (int32_t)ECloudChannel::Num;
+
+	//index functions for each layout, every layout but AoS stores its channels one after another in a single array
+
+	struct FAoSLayout
+	{
+		static constexpr bool Interleaved = true;
+
+		int32_t x_size = 0;
+		int32_t y_size = 0;
+		int32_t z_size = 0;
+
+		void Init(int32_t x, int32_t y, int32_t z) { x_size = x; y_size = y; z_size = z; }
+		size_t Capacity() const { return (size_t)x_size * y_size * z_size; }
+		int32_t Index(int32_t x, int32_t y, int32_t z) const { return x + (y * x_size) + (z * x_size * y_size); }
+	};
+
+	struct FSoALayout : FAoSLayout
+	{
+		static constexpr bool Interleaved = false;
+	};
+
+	struct FMortonLayout
+	{
+		static constexpr bool Interleaved = false;
+
+		int32_t extent = 1;
+
+		void Init(int32_t x, int32_t y, int32_t z)
+		{
+			const int32_t largest = std::max(std::max(x, y), std::max(z, 1));
+			extent = 1;
+			while(extent < largest)
+			{
+				extent <<= 1;
+			}
+		}
+
+		size_t Capacity() const { return (size_t)extent * extent * extent; }
+
+		//spreads the low 10 bits of value out so there are two 0 bits between each of them
+		static uint32_t Part1By2(uint32_t value)
+		{
+			value &= 0x000003ff;
+			value = (value ^ (value << 16)) & 0xff0000ff;
+			value = (value ^ (value << 8)) & 0x0300f00f;
+			value = (value ^ (value << 4)) & 0x030c30c3;
+			value = (value ^ (value << 2)) & 0x09249249;
+			return value;
+		}
+
+		int32_t Index(int32_t x, int32_t y, int32_t z) const
+		{
+			return (int32_t)(Part1By2((uint32_t)x) | (Part1By2((uint32_t)y) << 1) | (Part1By2((uint32_t)z) << 2));
+		}
+	};
+
+	struct FBrickedLayout
+	{
+		static constexpr bool Interleaved = false;
+		static constexpr int32_t BrickBits = 3;
+		static constexpr int32_t BrickSize = 1 << BrickBits;
+		static constexpr int32_t BrickMask = BrickSize - 1;
+
+		int32_t bricks_x = 0;
+		int32_t bricks_y = 0;
+		int32_t bricks_z = 0;
+
+		void Init(int32_t x, int32_t y, int32_t z)
+		{
+			bricks_x = (x + BrickMask) >> BrickBits;
+			bricks_y = (y + BrickMask) >> BrickBits;
+			bricks_z = (z + BrickMask) >> BrickBits;
+		}
+
+		size_t Capacity() const { return (size_t)bricks_x * bricks_y * bricks_z * BrickSize * BrickSize * BrickSize; }
+
+		int32_t Index(int32_t x, int32_t y, int32_t z) const
+		{
+			const int32_t brick = (x >> BrickBits) + ((y >> BrickBits) * bricks_x) + ((z >> BrickBits) * bricks_x * bricks_y);
+			const int32_t cell = (x & BrickMask) + ((y & BrickMask) << BrickBits) + ((z & BrickMask) << (2 * BrickBits));
+			return (brick << (3 * BrickBits)) + cell;
+		}
+	};
+
+	struct FPaddedLayout
+	{
+		static constexpr bool Interleaved = false;
+		static constexpr int32_t RowAlignment = 16;
+
+		int32_t pitch_x = 0;
+		int32_t pitch_y = 0;
+		int32_t pitch_z = 0;
+
+		void Init(int32_t x, int32_t y, int32_t z)
+		{
+			pitch_x = ((x + 2 + RowAlignment - 1) / RowAlignment) * RowAlignment;
+			pitch_y = y + 2;
+			pitch_z = z + 2;
+		}
+
+		size_t Capacity() const { return (size_t)pitch_x * pitch_y * pitch_z; }
+		int32_t Index(int32_t x, int32_t y, int32_t z) const { return (x + 1) + ((y + 1) * pitch_x) + ((z + 1) * pitch_x * pitch_y); }
+	};
+
+	//lattice stored in one of the layouts above, running the same scalar maths as the solver's per cell kernels
+	template<typename TLayout>
+	class TBenchLattice
+	{
+	public:
+		void Init(FCloudCellCoord in_size)
+		{
+			size = in_size;
+			layout.Init(size.x, size.y, size.z);
+			capacity = layout.Capacity();
+			data.assign(capacity * NumChannels, 0.f);
+		}
+
+		size_t GetAllocatedSize() const { return data.capacity() * sizeof(float); }
+
+		inline int32_t Index(int32_t x, int32_t y, int32_t z) const { return layout.Index(x, y, z); }
+
+		inline float& At(ECloudChannel channel, int32_t i)
+		{
+			return TLayout::Interleaved ? data[((size_t)i * NumChannels) + (size_t)channel] : data[((size_t)channel * capacity) + i];
+		}
+
+		void VelocityRows(const FCloudSimParams& params, int32_t y_begin, int32_t y_end)
+		{
+			for(int32_t z = 0; z < size.z; z++)
+			{
+				for(int32_t y = y_begin; y < y_end; y++)
+				{
+					for(int32_t x = 0; x < size.x; x++)
+					{
+						const int32_t i = Index(x, y, z);
+						float cell_zminus[3] = { 0.f, 0.f, 0.f };
+						float cell_xminus_zplus[3] = { 0.f, 0.f, 0.f };
+						float cell_xplus_zminus[3] = { 0.f, 0.f, 0.f };
+						float cell_velocity[3];
+
+						for(int32_t c = 0; c < 3; c++)
+						{
+							const ECloudChannel channel = (ECloudChannel)c;
+							if(z > 0)
+							{
+								cell_zminus[c] = At(channel, Index(x, y, z - 1));
+								if(x < size.x-1)
+								{
+									cell_xplus_zminus[c] = At(channel, Index(x + 1, y, z - 1));
+								}
+							}
+							if(x > 0 && z < size.z-1)
+							{
+								cell_xminus_zplus[c] = At(channel, Index(x - 1, y, z + 1));
+							}
+							cell_velocity[c] = At(channel, i);
+						}
+
+						for(int32_t c = 0; c < 3; c++)
+						{
+							At((ECloudChannel)c, i) = CloudSimKernels::VelocityScalar(cell_velocity[c], cell_zminus[c], cell_xminus_zplus[c], cell_xplus_zminus[c], params.viscosity_ratio, params.pressure_effect);
+						}
+					}
+				}
+			}
+		}
+
+		void DiffuseRows(const FCloudSimParams& params, int32_t y_begin, int32_t y_end)
+		{
+			for(int32_t z = 0; z < size.z; z++)
+			{
+				for(int32_t y = y_begin; y < y_end; y++)
+				{
+					for(int32_t x = 0; x < size.x; x++)
+					{
+						const float zminus = z > 0 ? At(ECloudChannel::WaterVapor, Index(x, y, z - 1)) : 0.f;
+						float& water_vapor = At(ECloudChannel::WaterVapor, Index(x, y, z));
+						water_vapor = CloudSimKernels::DiffuseScalar(water_vapor, zminus, params.vapour_diffusion);
+					}
+				}
+			}
+		}
+
+		//the scatter, kept exactly as FCloudSolver does it
+		void Advect1All()
+		{
+			for(int32_t z = 0; z < size.z; z++)
+			{
+				for(int32_t y = 0; y < size.y; y++)
+				{
+					for(int32_t x = 0; x < size.x; x++)
+					{
+						const int32_t i = Index(x, y, z);
+						const float velocity_x = At(ECloudChannel::VelocityX, i);
+						const int l = (int)velocity_x;
+						const int m = (int)At(ECloudChannel::VelocityY, i);
+						const int n = (int)At(ECloudChannel::VelocityZ, i);
+
+						if((l > 0 && l < size.x-1) && (m > 0 && m < size.y-1) && (n > 0 && n < size.z-1))
+						{
+							const float water_vapor = At(ECloudChannel::WaterVapor, i);
+							const float water_droplets = At(ECloudChannel::WaterDroplets, i);
+							const float weightX = velocity_x - l;
+							const float weightY = velocity_x - m;
+							const float weightZ = velocity_x - n;
+
+							auto add = [&](int32_t target, float weight)
+							{
+								At(ECloudChannel::AdvectWaterVapor, target) += water_vapor * weight;
+								At(ECloudChannel::AdvectWaterDroplets, target) += water_droplets * weight;
+							};
+							add(Index(l, m, n), (1 - weightX) * (1 - weightY) * (1 - weightZ));
+							add(Index(l + 1, m, n), weightX * (1 - weightY) * (1 - weightZ));
+							add(Index(l, m + 1, n), (1 - weightX) * weightY * (1 - weightZ));
+							add(Index(l, m, n + 1), (1 - weightX) * (1 - weightY) * weightZ);
+							add(Index(l + 1, m + 1, n), weightX * weightY * (1 - weightZ));
+							add(Index(l + 1, m, n + 1), (1 - weightX) * weightY * weightZ);
+							add(Index(l, m + 1, n + 1), weightX * (1 - weightY) * weightZ);
+							add(Index(l + 1, m + 1, n + 1), weightX * weightY * weightZ);
+						}
+					}
+				}
+			}
+		}
+
+		void Advect2Rows(int32_t row_begin, int32_t row_end)
+		{
+			for(int32_t row = row_begin; row < row_end; row++)
+			{
+				const int32_t y = row % size.y;
+				const int32_t z = row / size.y;
+				for(int32_t x = 0; x < size.x; x++)
+				{
+					const int32_t i = Index(x, y, z);
+					At(ECloudChannel::WaterVapor, i) += At(ECloudChannel::AdvectWaterVapor, i);
+					At(ECloudChannel::AdvectWaterVapor, i) = 0.f;
+					At(ECloudChannel::WaterDroplets, i) += At(ECloudChannel::AdvectWaterDroplets, i);
+					At(ECloudChannel::AdvectWaterDroplets, i) = 0.f;
+				}
+			}
+		}
+
+		void TransitionRows(const FCloudSimParams& params, const std::vector<float>& w_max, int32_t row_begin, int32_t row_end)
+		{
+			for(int32_t row = row_begin; row < row_end; row++)
+			{
+				const int32_t y = row % size.y;
+				const int32_t z = row / size.y;
+				for(int32_t x = 0; x < size.x; x++)
+				{
+					const int32_t i = Index(x, y, z);
+					float& water_vapor = At(ECloudChannel::WaterVapor, i);
+					float& water_droplets = At(ECloudChannel::WaterDroplets, i);
+					water_droplets = water_droplets + (params.phase_transition_rate * (water_vapor - w_max[z]));
+					water_vapor = water_vapor - (params.phase_transition_rate * (water_vapor - w_max[z]));
+				}
+			}
+		}
+
+		FCloudCellCoord size;
+		TLayout layout;
+		size_t capacity = 0;
+		std::vector<float, TCloudAlignedAllocator<float, CloudChannelAlignment>> data;
+	};
+
+	//one sample's worth of work for some layout
+	class FBenchTarget
+	{
+	public:
+		virtual ~FBenchTarget() {}
+		virtual void Fill(uint32_t seed) = 0;
+		virtual void Run(ECloudBenchStage stage) = 0;
+		virtual size_t GetAllocatedSize() const = 0;
+	};
+
+	//the same values for every layout, cell by cell in x fastest order
+	//velocities are spread over the lattice so the scatter lands inside it, water is between 0 and 1
+	template<typename TSetter>
+	void FillCells(FCloudCellCoord size, uint32_t seed, TSetter&& set)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		for(int32_t z = 0; z < size.z; z++)
+		{
+			for(int32_t y = 0; y < size.y; y++)
+			{
+				for(int32_t x = 0; x < size.x; x++)
+				{
+					set(x, y, z, ECloudChannel::VelocityX, unit(random) * size.x);
+					set(x, y, z, ECloudChannel::VelocityY, unit(random) * size.y);
+					set(x, y, z, ECloudChannel::VelocityZ, unit(random) * size.z);
+					set(x, y, z, ECloudChannel::WaterVapor, unit(random));
+					set(x, y, z, ECloudChannel::WaterDroplets, unit(random));
+					set(x, y, z, ECloudChannel::AdvectWaterVapor, 0.f);
+					set(x, y, z, ECloudChannel::AdvectWaterDroplets, 0.f);
+				}
+			}
+		}
+	}
+
+	class FSolverTarget : public FBenchTarget
+	{
+	public:
+		FSolverTarget(FCloudCellCoord in_size, const FCloudSimParams& params, const FCloudParallelFor& parallel_for)
+			: size(in_size)
+		{
+			solver.GetParams() = params;
+			solver.SetParallelFor(parallel_for);
+			solver.Init(size.x, size.y, size.z);
+		}
+
+		virtual void Fill(uint32_t seed) override
+		{
+			FCloudLattice& lattice = solver.GetLattice();
+			FillCells(size, seed, [&lattice](int32_t x, int32_t y, int32_t z, ECloudChannel channel, float value)
+			{
+				//the advection channels are only attached while a step is using them
+				if(lattice.HasChannel(channel))
+				{
+					lattice.Channel(channel)[lattice.Index(x, y, z)] = value;
+				}
+			});
+		}
+
+		virtual void Run(ECloudBenchStage stage) override
+		{
+			if(stage == ECloudBenchStage::Step)
+			{
+				solver.RunStep();
+				return;
+			}
+			solver.SweepStage((ECloudSimStage)stage);
+		}
+
+		virtual size_t GetAllocatedSize() const override { return solver.GetAllocatedSize(); }
+
+		FCloudSimParams& GetParams() { return solver.GetParams(); }
+
+	private:
+		FCloudCellCoord size;
+		FCloudSolver solver;
+	};
+
+	template<typename TLayout>
+	class TLayoutTarget : public FBenchTarget
+	{
+	public:
+		TLayoutTarget(FCloudCellCoord size, const FCloudSimParams& in_params, const FCloudParallelFor& in_parallel_for)
+			: params(in_params)
+			, parallel_for(in_parallel_for)
+		{
+			lattice.Init(size);
+			FCloudThermodynamics thermodynamics;
+			thermodynamics.Update(size.z, params.z_world_size, params.lapse_profile);
+			w_max = thermodynamics.GetMaxWaterVapor();
+		}
+
+		virtual void Fill(uint32_t seed) override
+		{
+			FillCells(lattice.size, seed, [this](int32_t x, int32_t y, int32_t z, ECloudChannel channel, float value)
+			{
+				lattice.At(channel, lattice.Index(x, y, z)) = value;
+			});
+		}
+
+		//split the same way as FCloudSolver::SweepStage
+		virtual void Run(ECloudBenchStage stage) override
+		{
+			const FCloudCellCoord size = lattice.size;
+			const int32_t min_batch = std::max(params.min_batch_size, 1);
+			const int32_t min_planes = std::max((min_batch + (size.x * size.z) - 1) / std::max(size.x * size.z, 1), 1);
+			const int32_t min_rows = std::max((min_batch + size.x - 1) / std::max(size.x, 1), 1);
+			const int32_t num_rows = size.y * size.z;
+
+			switch(stage)
+			{
+			default:
+				break;
+
+			case(ECloudBenchStage::Velocity):
+				CloudParallelForBatches(parallel_for, size.y, min_planes, [this](int32_t begin, int32_t end) { lattice.VelocityRows(params, begin, end); });
+				break;
+
+			case(ECloudBenchStage::Diffuse):
+				CloudParallelForBatches(parallel_for, size.y, min_planes, [this](int32_t begin, int32_t end) { lattice.DiffuseRows(params, begin, end); });
+				break;
+
+			case(ECloudBenchStage::Advect1):
+				lattice.Advect1All();
+				break;
+
+			case(ECloudBenchStage::Advect2):
+				CloudParallelForBatches(parallel_for, num_rows, min_rows, [this](int32_t begin, int32_t end) { lattice.Advect2Rows(begin, end); });
+				break;
+
+			case(ECloudBenchStage::Transition):
+				CloudParallelForBatches(parallel_for, num_rows, min_rows, [this](int32_t begin, int32_t end) { lattice.TransitionRows(params, w_max, begin, end); });
+				break;
+
+			case(ECloudBenchStage::Step):
+				for(int32_t step_stage = 0; step_stage < (int32_t)ECloudBenchStage::Step; step_stage++)
+				{
+					Run((ECloudBenchStage)step_stage);
+				}
+				break;
+			}
+		}
+
+		virtual size_t GetAllocatedSize() const override { return lattice.GetAllocatedSize(); }
+
+	private:
+		FCloudSimParams params;
+		FCloudParallelFor parallel_for;
+		TBenchLattice<TLayout> lattice;
+		std::vector<float> w_max;
+	};
+
+	std::unique_ptr<FBenchTarget> MakeTarget(ECloudBenchLayout layout, FCloudCellCoord size, const FCloudSimParams& params, const FCloudParallelFor& parallel_for)
+	{
+		switch(layout)
+		{
+		case(ECloudBenchLayout::Solver): return std::unique_ptr<FBenchTarget>(new FSolverTarget(size, params, parallel_for));
+		case(ECloudBenchLayout::AoS): return std::unique_ptr<FBenchTarget>(new TLayoutTarget<FAoSLayout>(size, params, parallel_for));
+		case(ECloudBenchLayout::SoA): return std::unique_ptr<FBenchTarget>(new TLayoutTarget<FSoALayout>(size, params, parallel_for));
+		case(ECloudBenchLayout::Morton): return std::unique_ptr<FBenchTarget>(new TLayoutTarget<FMortonLayout>(size, params, parallel_for));
+		case(ECloudBenchLayout::Bricked): return std::unique_ptr<FBenchTarget>(new TLayoutTarget<FBrickedLayout>(size, params, parallel_for));
+		case(ECloudBenchLayout::Padded): return std::unique_ptr<FBenchTarget>(new TLayoutTarget<FPaddedLayout>(size, params, parallel_for));
+		default: return nullptr;
+		}
+	}
+
+	//nearest rank percentile of already sorted samples
+	double Percentile(const std::vector<double>& sorted, double percent)
+	{
+		if(sorted.empty())
+		{
+			return 0.0;
+		}
+		const size_t rank = (size_t)std::max(1.0, std::ceil(percent / 100.0 * sorted.size()));
+		return sorted[std::min(rank, sorted.size()) - 1];
+	}
+
+	int32_t StagesInSample(ECloudBenchStage stage, const FCloudSimParams& params, ECloudBenchLayout layout)
+	{
+		if(stage != ECloudBenchStage::Step)
+		{
+			return 1;
+		}
+		//the solver skips Advect2 when gathering
+		return (layout == ECloudBenchLayout::Solver && params.advection_scheme == ECloudAdvectionScheme::Gather) ? 4 : 5;
+	}
+
+	bool EqualsIgnoreCase(const std::string& a, const char* b)
+	{
+		const std::string other(b);
+		return a.size() == other.size() && std::equal(a.begin(), a.end(), other.begin(), [](char x, char y) { return std::tolower((unsigned char)x) == std::tolower((unsigned char)y); });
+	}
+}
+
+const char* CloudBenchLayoutName(ECloudBenchLayout layout)
+{
+	switch(layout)
+	{
+	case(ECloudBenchLayout::Solver): return "Solver";
+	case(ECloudBenchLayout::AoS): return "AoS";
+	case(ECloudBenchLayout::SoA): return "SoA";
+	case(ECloudBenchLayout::Morton): return "Morton";
+	case(ECloudBenchLayout::Bricked): return "Bricked";
+	case(ECloudBenchLayout::Padded): return "Padded";
+	default: return "Unknown";
+	}
+}
+
+const char* CloudBenchStageName(ECloudBenchStage stage)
+{
+	switch(stage)
+	{
+	case(ECloudBenchStage::Velocity): return "Velocity";
+	case(ECloudBenchStage::Diffuse): return "Diffuse";
+	case(ECloudBenchStage::Advect1): return "Advect1";
+	case(ECloudBenchStage::Advect2): return "Advect2";
+	case(ECloudBenchStage::Transition): return "Transition";
+	case(ECloudBenchStage::Step): return "Step";
+	default: return "Unknown";
+	}
+}
+
+bool ParseCloudBenchLayout(const std::string& name, ECloudBenchLayout& out_layout)
+{
+	for(int32_t layout = 0; layout < (int32_t)ECloudBenchLayout::Num; layout++)
+	{
+		if(EqualsIgnoreCase(name, CloudBenchLayoutName((ECloudBenchLayout)layout)))
+		{
+			out_layout = (ECloudBenchLayout)layout;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ParseCloudBenchStage(const std::string& name, ECloudBenchStage& out_stage)
+{
+	for(int32_t stage = 0; stage < (int32_t)ECloudBenchStage::Num; stage++)
+	{
+		if(EqualsIgnoreCase(name, CloudBenchStageName((ECloudBenchStage)stage)))
+		{
+			out_stage = (ECloudBenchStage)stage;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<FCloudBenchResult> RunCloudBenchmarks(const FCloudBenchConfig& config, const std::function<void(const FCloudBenchResult&)>& on_result)
+{
+	typedef std::chrono::steady_clock FClock;
+
+	std::vector<FCloudBenchResult> results;
+	const int32_t repetitions = std::max(config.repetitions, 1);
+
+	for(int32_t threads : config.thread_counts)
+	{
+		threads = threads > 0 ? threads : (int32_t)std::max(std::thread::hardware_concurrency(), 1u);
+		const FCloudParallelFor parallel_for = threads == 1 ? FCloudParallelFor::Serial() : FCloudParallelFor::ThreadPool(threads);
+
+		for(const FCloudCellCoord& size : config.sizes)
+		{
+			if(size.x <= 0 || size.y <= 0 || size.z <= 0)
+			{
+				continue;
+			}
+
+			for(ECloudBenchLayout layout : config.layouts)
+			{
+				std::unique_ptr<FBenchTarget> target = MakeTarget(layout, size, config.params, parallel_for);
+				if(!target)
+				{
+					continue;
+				}
+
+				for(ECloudBenchStage stage : config.stages)
+				{
+					std::vector<double> samples;
+					samples.reserve(repetitions);
+
+					for(int32_t sample = 0; sample < config.warmup + repetitions; sample++)
+					{
+						//refilled every time so values never run away into infinities and every sample does the same work
+						target->Fill(config.seed);
+
+						const FClock::time_point start = FClock::now();
+						target->Run(stage);
+						const double elapsed_us = std::chrono::duration<double, std::micro>(FClock::now() - start).count();
+
+						if(sample >= config.warmup)
+						{
+							samples.push_back(elapsed_us);
+						}
+					}
+
+					std::sort(samples.begin(), samples.end());
+
+					FCloudBenchResult result;
+					result.layout = layout;
+					result.size = size;
+					result.threads = threads;
+					result.stage = stage;
+					result.repetitions = repetitions;
+					result.min_us = samples.front();
+					result.max_us = samples.back();
+					for(double sample : samples)
+					{
+						result.mean_us += sample / samples.size();
+					}
+					result.p50_us = Percentile(samples, 50.0);
+					result.p90_us = Percentile(samples, 90.0);
+					result.p99_us = Percentile(samples, 99.0);
+
+					const double cells = (double)size.x * size.y * size.z * StagesInSample(stage, config.params, layout);
+					result.cells_per_second = result.p50_us > 0.0 ? cells / (result.p50_us / 1000000.0) : 0.0;
+					result.bytes = target->GetAllocatedSize();
+
+					results.push_back(result);
+					if(on_result)
+					{
+						on_result(result);
+					}
+				}
+			}
+		}
+	}
+
+	return results;
+}
+
+void WriteCloudBenchCsv(std::ostream& out, const std::vector<FCloudBenchResult>& results)
+{
+	out << "layout,x,y,z,threads,stage,repetitions,min_us,mean_us,p50_us,p90_us,p99_us,max_us,cells_per_second,bytes\n";
+	for(const FCloudBenchResult& result : results)
+	{
+		out << CloudBenchLayoutName(result.layout) << ',' << result.size.x << ',' << result.size.y << ',' << result.size.z << ','
+			<< result.threads << ',' << CloudBenchStageName(result.stage) << ',' << result.repetitions << ','
+			<< result.min_us << ',' << result.mean_us << ',' << result.p50_us << ',' << result.p90_us << ',' << result.p99_us << ',' << result.max_us << ','
+			<< result.cells_per_second << ',' << result.bytes << '\n';
+	}
+}
+
+FCloudBlockTuneResult CloudTuneStencilBlock(FCloudCellCoord size, const FCloudSimParams& params, const FCloudParallelFor& parallel_for, int32_t repetitions, uint32_t seed)
+{
+	typedef std::chrono::steady_clock FClock;
+
+	FCloudBlockTuneResult result;
+	if(size.x <= 0 || size.y <= 0 || size.z <= 0)
+	{
+		return result;
+	}
+
+	FSolverTarget target(size, params, parallel_for);
+	repetitions = std::max(repetitions, 1);
+
+	auto time_block = [&](FCloudCellCoord block)
+	{
+		target.GetParams().stencil_block = block;
+		std::vector<double> samples;
+		for(int32_t sample = 0; sample <= repetitions; sample++)
+		{
+			target.Fill(seed);
+			const FClock::time_point start = FClock::now();
+			//with fused stages the velocity sweep already runs the diffusion
+			target.Run(ECloudBenchStage::Velocity);
+			if(!params.fuse_stages || params.activity_mask)
+			{
+				target.Run(ECloudBenchStage::Diffuse);
+			}
+			const double elapsed_us = std::chrono::duration<double, std::micro>(FClock::now() - start).count();
+
+			//the first sample warms the caches and is thrown away
+			if(sample > 0)
+			{
+				samples.push_back(elapsed_us);
+			}
+		}
+		std::sort(samples.begin(), samples.end());
+
+		FCloudBlockTiming timing;
+		timing.block = block;
+		timing.p50_us = Percentile(samples, 50.0);
+		result.timings.push_back(timing);
+		return timing.p50_us;
+	};
+
+	double best_us = time_block(result.best);
+
+	//indexed x, y, z, tried in the order below
+	const int32_t extents[3] = { size.x, size.y, size.z };
+	const int32_t smallest[3] = { 8, 1, 2 };
+	const int32_t axes[3] = { 1, 2, 0 };
+	for(int32_t axis : axes)
+	{
+		for(int32_t block_size = smallest[axis]; block_size < extents[axis]; block_size <<= 1)
+		{
+			FCloudCellCoord block = result.best;
+			(axis == 0 ? block.x : (axis == 1 ? block.y : block.z)) = block_size;
+
+			const double block_us = time_block(block);
+			if(block_us < best_us)
+			{
+				best_us = block_us;
+				result.best = block;
+			}
+		}
+	}
+
+	return result;
+}
+
+const char* CloudCellOrderName(ECloudCellOrder cell_order)
+{
+	switch(cell_order)
+	{
+	case(ECloudCellOrder::Linear): return "Linear";
+	case(ECloudCellOrder::Morton): return "Morton";
+	default: return "Unknown";
+	}
+}
+
+bool ParseCloudCellOrder(const std::string& name, ECloudCellOrder& out_cell_order)
+{
+	for(int32_t cell_order = 0; cell_order <= (int32_t)ECloudCellOrder::Morton; cell_order++)
+	{
+		if(EqualsIgnoreCase(name, CloudCellOrderName((ECloudCellOrder)cell_order)))
+		{
+			out_cell_order = (ECloudCellOrder)cell_order;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* CloudPrecisionName(ECloudPrecision precision)
+{
+	switch(precision)
+	{
+	case(ECloudPrecision::Float32): return "Float32";
+	case(ECloudPrecision::Float16): return "Float16";
+	case(ECloudPrecision::Fixed16): return "Fixed16";
+	default: return "Unknown";
+	}
+}
+
+bool ParseCloudPrecision(const std::string& name, ECloudPrecision& out_precision)
+{
+	for(int32_t precision = 0; precision < (int32_t)ECloudPrecision::Num; precision++)
+	{
+		if(EqualsIgnoreCase(name, CloudPrecisionName((ECloudPrecision)precision)))
+		{
+			out_precision = (ECloudPrecision)precision;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* CloudTextureFormatName(ECloudTextureFormat format)
+{
+	switch(format)
+	{
+	case(ECloudTextureFormat::R8): return "R8";
+	case(ECloudTextureFormat::R16F): return "R16F";
+	default: return "Unknown";
+	}
+}
+
+bool ParseCloudTextureFormat(const std::string& name, ECloudTextureFormat& out_format)
+{
+	for(int32_t format = 0; format < (int32_t)ECloudTextureFormat::Num; format++)
+	{
+		if(EqualsIgnoreCase(name, CloudTextureFormatName((ECloudTextureFormat)format)))
+		{
+			out_format = (ECloudTextureFormat)format;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string CloudBenchTableHeader()
+{
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-8s %-13s %7s %-10s %10s %10s %10s %10s %14s %12s", "layout", "size", "threads", "stage", "min_us", "p50_us", "p90_us", "p99_us", "cells/s", "bytes");
+	return line;
+}
+
+std::string FormatCloudBenchResult(const FCloudBenchResult& result)
+{
+	char size[32];
+	std::snprintf(size, sizeof(size), "%dx%dx%d", result.size.x, result.size.y, result.size.z);
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-8s %-13s %7d %-10s %10.1f %10.1f %10.1f %10.1f %14.4g %12zu", CloudBenchLayoutName(result.layout), size, result.threads, CloudBenchStageName(result.stage),
+		result.min_us, result.p50_us, result.p90_us, result.p99_us, result.cells_per_second, result.bytes);
+	return line;
+}
+
+namespace
+{
+	typedef std::chrono::steady_clock FScenarioClock;
+
+	double MicrosecondsSince(FScenarioClock::time_point start)
+	{
+		return std::chrono::duration<double, std::micro>(FScenarioClock::now() - start).count();
+	}
+
+	FCloudScenarioTiming MakeTiming(std::vector<double> samples, double cells_per_run)
+	{
+		FCloudScenarioTiming timing;
+		if(samples.empty())
+		{
+			return timing;
+		}
+
+		std::sort(samples.begin(), samples.end());
+		timing.runs = (int32_t)samples.size();
+		for(double sample : samples)
+		{
+			timing.total_us += sample;
+		}
+		timing.min_us = samples.front();
+		timing.max_us = samples.back();
+		timing.mean_us = timing.total_us / samples.size();
+		timing.p50_us = Percentile(samples, 50.0);
+		timing.p90_us = Percentile(samples, 90.0);
+		timing.p99_us = Percentile(samples, 99.0);
+		timing.cells_per_second = timing.total_us > 0.0 ? (cells_per_run * samples.size()) / (timing.total_us / 1000000.0) : 0.0;
+		return timing;
+	}
+
+	void WriteTimingJson(std::ostream& out, const FCloudScenarioTiming& timing)
+	{
+		out << "{ \"runs\": " << timing.runs << ", \"total_us\": " << timing.total_us << ", \"min_us\": " << timing.min_us << ", \"mean_us\": " << timing.mean_us
+			<< ", \"p50_us\": " << timing.p50_us << ", \"p90_us\": " << timing.p90_us << ", \"p99_us\": " << timing.p99_us << ", \"max_us\": " << timing.max_us
+			<< ", \"cells_per_second\": " << timing.cells_per_second << " }";
+	}
+
+	void WriteTimingCsv(std::ostream& out, const FCloudScenarioReport& report, const char* name, const FCloudScenarioTiming& timing, double active_tiles)
+	{
+		out << CloudScenarioName(report.scenario) << ',' << report.size.x << ',' << report.size.y << ',' << report.size.z << ',' << report.threads << ',' << name << ','
+			<< timing.runs << ',' << timing.total_us << ',' << timing.min_us << ',' << timing.mean_us << ',' << timing.p50_us << ',' << timing.p90_us << ',' << timing.p99_us << ',' << timing.max_us << ','
+			<< timing.cells_per_second << ',' << report.thread_utilisation << ',' << report.lattice_bytes << ',' << report.active_bricks << ',' << active_tiles << ',' << report.num_tiles << ',' << report.peak_memory_bytes << '\n';
+	}
+}
+
+const char* CloudScenarioName(ECloudScenario scenario)
+{
+	switch(scenario)
+	{
+	case(ECloudScenario::VaporSource): return "VaporSource";
+	case(ECloudScenario::HalfandHalf): return "HalfandHalf";
+	case(ECloudScenario::DifferentDensities): return "DifferentDensities";
+	default: return "Unknown";
+	}
+}
+
+bool ParseCloudScenario(const std::string& name, ECloudScenario& out_scenario)
+{
+	for(int32_t scenario = 0; scenario < (int32_t)ECloudScenario::Num; scenario++)
+	{
+		if(EqualsIgnoreCase(name, CloudScenarioName((ECloudScenario)scenario)))
+		{
+			out_scenario = (ECloudScenario)scenario;
+			return true;
+		}
+	}
+	return false;
+}
+
+void CloudAddVaporSource(FCloudLattice& lattice)
+{
+	float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor);
+	for(int32_t y = 0; y < lattice.GetYSize(); y++)
+	{
+		for(int32_t x = 0; x < lattice.GetXSize(); x++)
+		{
+			water_vapor[lattice.Index(x, y, 0)] += 0.1;
+		}
+	}
+}
+
+void CloudAddVaporSource(FCloudSparseLattice& lattice)
+{
+	for(int32_t y = 0; y < lattice.GetYSize(); y++)
+	{
+		for(int32_t x = 0; x < lattice.GetXSize(); x++)
+		{
+			float water_vapor = lattice.Get(ECloudChannel::WaterVapor, x, y, 0);
+			water_vapor += 0.1;
+			lattice.Set(ECloudChannel::WaterVapor, x, y, 0, water_vapor);
+		}
+	}
+}
+
+void CloudAddVaporSource(FCloudPackedLattice& lattice)
+{
+	for(int32_t y = 0; y < lattice.GetYSize(); y++)
+	{
+		for(int32_t x = 0; x < lattice.GetXSize(); x++)
+		{
+			float water_vapor = lattice.Get(ECloudChannel::WaterVapor, x, y, 0);
+			water_vapor += 0.1;
+			lattice.Set(ECloudChannel::WaterVapor, x, y, 0, water_vapor);
+		}
+	}
+}
+
+namespace
+{
+	//writes the starting droplets of a scenario into a zeroed lattice through set_droplets(x, y, z, value), cells left at 0 are skipped
+	template<typename TLattice, typename TSetDroplets>
+	void FillScenarioDroplets(const TLattice& lattice, ECloudScenario scenario, TSetDroplets&& set_droplets)
+	{
+		const int32_t x_size = lattice.GetXSize();
+		const int32_t y_size = lattice.GetYSize();
+		const int32_t z_size = lattice.GetZSize();
+
+		switch(scenario)
+		{
+		default:
+			break;
+
+		case(ECloudScenario::HalfandHalf):
+			for(int32_t z = 0; z < z_size; z++)
+			{
+				for(int32_t y = 0; y < y_size; y++)
+				{
+					for(int32_t x = (x_size / 2) + 1; x < x_size; x++)
+					{
+						set_droplets(x, y, z, 1.f);
+					}
+				}
+			}
+			break;
+
+		case(ECloudScenario::DifferentDensities):
+		{
+			//indexed by +x, +y, +z
+			static const float densities[8] = { 0, 0.25, 0.1, 0.4, 0.55, 0.85, 0.7, 1 };
+			for(int32_t z = 0; z < z_size; z++)
+			{
+				for(int32_t y = 0; y < y_size; y++)
+				{
+					for(int32_t x = 0; x < x_size; x++)
+					{
+						const int32_t octant = (x >= (x_size / 2) ? 1 : 0) + (y >= (y_size / 2) ? 2 : 0) + (z >= (z_size / 2) ? 4 : 0);
+						if(densities[octant] != 0.f)
+						{
+							set_droplets(x, y, z, densities[octant]);
+						}
+					}
+				}
+			}
+			break;
+		}
+		}
+	}
+}
+
+void CloudFillScenario(FCloudLattice& lattice, ECloudScenario scenario)
+{
+	lattice.Zero();
+	if(scenario == ECloudScenario::VaporSource)
+	{
+		CloudAddVaporSource(lattice);
+		return;
+	}
+
+	float* water_droplets = lattice.Channel(ECloudChannel::WaterDroplets);
+	FillScenarioDroplets(lattice, scenario, [&lattice, water_droplets](int32_t x, int32_t y, int32_t z, float value)
+	{
+		water_droplets[lattice.Index(x, y, z)] = value;
+	});
+}
+
+void CloudFillScenario(FCloudSparseLattice& lattice, ECloudScenario scenario)
+{
+	lattice.Zero();
+	if(scenario == ECloudScenario::VaporSource)
+	{
+		CloudAddVaporSource(lattice);
+		return;
+	}
+
+	FillScenarioDroplets(lattice, scenario, [&lattice](int32_t x, int32_t y, int32_t z, float value)
+	{
+		lattice.Set(ECloudChannel::WaterDroplets, x, y, z, value);
+	});
+}
+
+void CloudFillScenario(FCloudPackedLattice& lattice, ECloudScenario scenario)
+{
+	lattice.Zero();
+	if(scenario == ECloudScenario::VaporSource)
+	{
+		CloudAddVaporSource(lattice);
+		return;
+	}
+
+	FillScenarioDroplets(lattice, scenario, [&lattice](int32_t x, int32_t y, int32_t z, float value)
+	{
+		lattice.Set(ECloudChannel::WaterDroplets, x, y, z, value);
+	});
+}
+
+namespace
+{
+	int32_t ActiveBricks(const FCloudSolver&) { return 0; }
+	int32_t ActiveBricks(const FCloudSparseSolver& solver) { return solver.GetLattice().NumAllocatedBricks(); }
+	int32_t ActiveBricks(const FCloudPackedSolver&) { return 0; }
+	int32_t ActiveTiles(const FCloudSolver& solver, ECloudSimStage stage) { return solver.GetActiveTiles(stage); }
+	int32_t ActiveTiles(const FCloudSparseSolver&, ECloudSimStage) { return 0; }
+	int32_t ActiveTiles(const FCloudPackedSolver&, ECloudSimStage) { return 0; }
+	int32_t NumTiles(const FCloudSolver& solver) { return solver.GetNumTiles(); }
+	int32_t NumTiles(const FCloudSparseSolver&) { return 0; }
+	int32_t NumTiles(const FCloudPackedSolver&) { return 0; }
+	int64_t ScatterFallbackCells(const FCloudSolver& solver) { return solver.GetScatterFallbackCells(); }
+	int64_t ScatterFallbackCells(const FCloudSparseSolver&) { return 0; }
+	int64_t ScatterFallbackCells(const FCloudPackedSolver&) { return 0; }
+	size_t LatticeBytes(const FCloudSolver& solver) { return solver.GetAllocatedSize(); }
+	size_t LatticeBytes(const FCloudSparseSolver& solver) { return solver.GetLattice().GetAllocatedSize(); }
+	size_t LatticeBytes(const FCloudPackedSolver& solver) { return solver.GetAllocatedSize(); }
+
+	//indexed by ECloudChannel
+	const char* const ChannelNames[(int32_t)ECloudChannel::Num] = { "VelocityX", "VelocityY", "VelocityZ", "WaterVapor", "WaterDroplets", "AdvectWaterVapor", "AdvectWaterDroplets" };
+
+	//compares every stored channel of the packed solver's lattice with the same cells of FCloudSolver's
+	void MeasurePrecisionError(const FCloudPackedLattice& packed, const FCloudLattice& reference, FCloudScenarioReport& report)
+	{
+		for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+		{
+			FCloudPrecisionError& error = report.errors[channel];
+			const float* reference_values = reference.Channel((ECloudChannel)channel);
+			double sum_squares = 0.0;
+			int64_t count = 0;
+
+			for(int32_t z = 0; z < reference.GetZSize(); z++)
+			{
+				for(int32_t y = 0; y < reference.GetYSize(); y++)
+				{
+					for(int32_t x = 0; x < reference.GetXSize(); x++)
+					{
+						const double expected = reference_values[reference.Index(x, y, z)];
+						const double actual = packed.Get((ECloudChannel)channel, x, y, z);
+						if(!std::isfinite(expected) || !std::isfinite(actual))
+						{
+							error.non_finite += std::isfinite(expected) != std::isfinite(actual) ? 1 : 0;
+							continue;
+						}
+
+						const double difference = std::fabs(actual - expected);
+						error.max_error = std::max(error.max_error, difference);
+						error.max_relative_error = std::max(error.max_relative_error, difference / std::max(std::fabs(expected), 1e-3));
+						sum_squares += difference * difference;
+						count++;
+					}
+				}
+			}
+			error.rms_error = count > 0 ? std::sqrt(sum_squares / count) : 0.0;
+		}
+	}
+
+	//runs the warmup and measured steps of a scenario on solver, which has already been filled, and fills in the timings of report
+	//texture_writer writes the droplets after each step when config.write_texture is set, keeping its copy of the texture between steps
+	template<typename TSolver>
+	void RunScenarioSteps(TSolver& solver, const FCloudScenarioConfig& config, FCloudTextureWriter& texture_writer, std::atomic<int64_t>& busy_ns, std::atomic<int32_t>& parallel_calls, FCloudScenarioReport& report)
+	{
+		std::vector<double> stage_samples[(int32_t)ECloudSimStage::Done];
+		std::vector<double> step_samples;
+		std::vector<double> texture_samples;
+
+		const FCloudTextureLayout texture_layout = FCloudTextureLayout::Make(config.size, config.texture_format);
+		std::vector<FCloudTextureRegion> texture_regions;
+		std::vector<uint8_t> upload;
+		double upload_bytes = 0.0;
+		int64_t regions = 0;
+		int64_t active_tiles[(int32_t)ECloudSimStage::Done] = {};
+		int64_t fallback_cells = 0;
+		double busy_us = 0.0;
+		double wall_us = 0.0;
+
+		for(int32_t step = 0; step < config.warmup_steps + config.steps; step++)
+		{
+			const bool measured = step >= config.warmup_steps;
+			const FScenarioClock::time_point step_start = FScenarioClock::now();
+
+			solver.ApplyPendingSettings();
+			for(ECloudSimStage stage = ECloudSimStage::Velocity; stage != ECloudSimStage::Done;)
+			{
+				const int32_t calls_before = parallel_calls;
+				const int64_t busy_before = busy_ns;
+				const FScenarioClock::time_point stage_start = FScenarioClock::now();
+
+				const ECloudSimStage next_stage = solver.SweepStage(stage);
+
+				const double stage_us = MicrosecondsSince(stage_start);
+				if(measured)
+				{
+					stage_samples[(int32_t)stage].push_back(stage_us);
+					active_tiles[(int32_t)stage] += ActiveTiles(solver, stage);
+					fallback_cells += stage == ECloudSimStage::Advect1 ? ScatterFallbackCells(solver) : 0;
+					busy_us += parallel_calls != calls_before ? (busy_ns - busy_before) / 1000.0 : stage_us;
+				}
+				stage = next_stage;
+			}
+
+			if(measured)
+			{
+				const double step_us = MicrosecondsSince(step_start);
+				step_samples.push_back(step_us);
+				wall_us += step_us;
+			}
+
+			if(config.write_texture)
+			{
+				//the changed regions are packed into an upload buffer like the simulator's texture pass, which is counted in the time
+				const FScenarioClock::time_point texture_start = FScenarioClock::now();
+				texture_writer.WriteChanged(solver.GetLattice(), ECloudChannel::WaterDroplets, 1.f, texture_layout, config.texture_threshold, texture_regions);
+				const size_t packed_bytes = (size_t)texture_writer.GetPackedRowPitch(texture_regions) * FCloudTextureWriter::GetPackedRows(texture_regions);
+				upload.resize(std::max(upload.size(), packed_bytes));
+				texture_writer.PackRegions(texture_regions, upload.data());
+				if(measured)
+				{
+					texture_samples.push_back(MicrosecondsSince(texture_start));
+					upload_bytes += packed_bytes;
+					regions += (int64_t)texture_regions.size();
+				}
+			}
+			report.lattice_bytes = std::max(report.lattice_bytes, LatticeBytes(solver));
+		}
+
+		const double cells = (double)config.size.x * config.size.y * config.size.z;
+		int32_t stages_per_step = 0;
+		for(int32_t stage = 0; stage < (int32_t)ECloudSimStage::Done; stage++)
+		{
+			report.stages[stage] = MakeTiming(stage_samples[stage], cells);
+			report.active_tiles[stage] = stage_samples[stage].empty() ? 0.0 : (double)active_tiles[stage] / stage_samples[stage].size();
+			stages_per_step += stage_samples[stage].empty() ? 0 : 1;
+		}
+		report.step = MakeTiming(step_samples, cells * stages_per_step);
+		report.steps = report.step.runs;
+		report.texture = MakeTiming(texture_samples, cells);
+		report.texture_width = config.write_texture ? texture_layout.GetWidth() : 0;
+		report.texture_height = config.write_texture ? texture_layout.GetHeight() : 0;
+		report.texture_bytes = config.write_texture ? texture_layout.GetDataSize() : 0;
+		report.texture_upload_bytes = texture_samples.empty() ? 0.0 : upload_bytes / texture_samples.size();
+		report.texture_regions = texture_samples.empty() ? 0.0 : (double)regions / texture_samples.size();
+		report.thread_utilisation = wall_us > 0.0 ? std::min(busy_us / (wall_us * report.threads), 1.0) : 0.0;
+		report.scatter_fallback = step_samples.empty() || cells <= 0.0 ? 0.0 : fallback_cells / (cells * step_samples.size());
+		report.active_bricks = ActiveBricks(solver);
+		report.num_tiles = NumTiles(solver);
+	}
+}
+
+FCloudScenarioReport RunCloudScenario(const FCloudScenarioConfig& config, const FCloudParallelFor& parallel_for)
+{
+	FCloudScenarioReport report;
+	report.scenario = config.scenario;
+	report.size = config.size;
+	report.threads = std::max(parallel_for.max_tasks, 1);
+	report.advection_scheme = config.params.advection_scheme;
+	report.double_buffered = config.params.double_buffered;
+	report.use_simd = config.params.use_simd;
+	report.sparse = config.sparse;
+	report.packed = config.packed && !config.sparse;
+	const bool dense = !report.sparse && !report.packed;
+	report.activity_mask = config.params.activity_mask && dense;
+	report.cell_order = dense ? config.params.cell_order : ECloudCellOrder::Linear;
+	report.stencil_block = config.params.stencil_block;
+	report.wavefront = config.params.wavefront && dense;
+	report.fuse_stages = config.params.fuse_stages && !config.params.activity_mask && dense;
+	report.coloured_scatter = config.params.coloured_scatter && !config.params.activity_mask && dense && report.threads > 1;
+	report.private_scatter = config.params.private_scatter && !report.coloured_scatter && !config.params.activity_mask && dense && report.threads > 1;
+	report.scatter_tile = config.params.scatter_tile;
+	report.write_texture = config.write_texture;
+	report.texture_format = config.texture_format;
+	report.texture_threshold = config.texture_threshold;
+	report.texture_region_rows = config.texture_region_rows;
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor && report.packed; channel++)
+	{
+		report.precision[channel] = config.params.precision[channel];
+	}
+
+	if(config.size.x <= 0 || config.size.y <= 0 || config.size.z <= 0)
+	{
+		return report;
+	}
+
+	//time spent inside tasks, summed over every thread, so utilisation can be worked out per stage
+	std::atomic<int64_t> busy_ns { 0 };
+	std::atomic<int32_t> parallel_calls { 0 };
+
+	FCloudParallelFor timed_parallel_for = parallel_for;
+	timed_parallel_for.run = [&parallel_for, &busy_ns, &parallel_calls](int32_t num_tasks, const std::function<void(int32_t)>& body)
+	{
+		parallel_calls++;
+		parallel_for.run(num_tasks, [&body, &busy_ns](int32_t task)
+		{
+			const FScenarioClock::time_point start = FScenarioClock::now();
+			body(task);
+			busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(FScenarioClock::now() - start).count();
+		});
+	};
+
+	//the texture pass runs between steps on the simulator's threads, so it is left out of the stage utilisation
+	FCloudTextureWriter texture_writer;
+	texture_writer.SetParallelFor(parallel_for);
+	texture_writer.SetMinBatchSize(config.params.min_batch_size);
+	texture_writer.SetRegionRows(config.texture_region_rows);
+
+	if(config.sparse)
+	{
+		FCloudSparseSolver solver;
+		solver.GetParams() = config.params;
+		solver.SetParallelFor(timed_parallel_for);
+		solver.Init(config.size.x, config.size.y, config.size.z);
+		CloudFillScenario(solver.GetLattice(), config.scenario);
+		RunScenarioSteps(solver, config, texture_writer, busy_ns, parallel_calls, report);
+	}
+	else if(report.packed)
+	{
+		FCloudPackedSolver solver;
+		solver.GetParams() = config.params;
+		solver.SetParallelFor(timed_parallel_for);
+		solver.Init(config.size.x, config.size.y, config.size.z);
+		CloudFillScenario(solver.GetLattice(), config.scenario);
+		RunScenarioSteps(solver, config, texture_writer, busy_ns, parallel_calls, report);
+
+		//the reference runs the warmup steps as well so both solvers stop on the same step
+		FCloudSolver reference;
+		reference.GetParams() = config.params;
+		reference.SetParallelFor(parallel_for);
+		reference.Init(config.size.x, config.size.y, config.size.z);
+		CloudFillScenario(reference.GetLattice(), config.scenario);
+		for(int32_t step = 0; step < config.warmup_steps + config.steps; step++)
+		{
+			reference.RunStep();
+			report.reference_lattice_bytes = std::max(report.reference_lattice_bytes, reference.GetAllocatedSize());
+		}
+		MeasurePrecisionError(solver.GetLattice(), reference.GetLattice(), report);
+	}
+	else
+	{
+		FCloudSolver solver;
+		solver.GetParams() = config.params;
+		solver.SetParallelFor(timed_parallel_for);
+		solver.Init(config.size.x, config.size.y, config.size.z);
+		CloudFillScenario(solver.GetLattice(), config.scenario);
+		RunScenarioSteps(solver, config, texture_writer, busy_ns, parallel_calls, report);
+	}
+
+	return report;
+}
+
+void WriteCloudScenarioJson(std::ostream& out, const FCloudScenarioReport& report)
+{
+	out << "{\n";
+	out << "\t\"scenario\": \"" << CloudScenarioName(report.scenario) << "\",\n";
+	out << "\t\"size\": [" << report.size.x << ", " << report.size.y << ", " << report.size.z << "],\n";
+	out << "\t\"steps\": " << report.steps << ",\n";
+	out << "\t\"threads\": " << report.threads << ",\n";
+	out << "\t\"advection_scheme\": \"" << (report.advection_scheme == ECloudAdvectionScheme::Gather ? "Gather" : "Scatter") << "\",\n";
+	out << "\t\"double_buffered\": " << (report.double_buffered ? "true" : "false") << ",\n";
+	out << "\t\"use_simd\": " << (report.use_simd ? "true" : "false") << ",\n";
+	out << "\t\"sparse\": " << (report.sparse ? "true" : "false") << ",\n";
+	out << "\t\"activity_mask\": " << (report.activity_mask ? "true" : "false") << ",\n";
+	out << "\t\"cell_order\": \"" << CloudCellOrderName(report.cell_order) << "\",\n";
+	out << "\t\"stencil_block\": [" << report.stencil_block.x << ", " << report.stencil_block.y << ", " << report.stencil_block.z << "],\n";
+	out << "\t\"wavefront\": " << (report.wavefront ? "true" : "false") << ",\n";
+	out << "\t\"fuse_stages\": " << (report.fuse_stages ? "true" : "false") << ",\n";
+	out << "\t\"private_scatter\": " << (report.private_scatter ? "true" : "false") << ",\n";
+	out << "\t\"coloured_scatter\": " << (report.coloured_scatter ? "true" : "false") << ",\n";
+	out << "\t\"scatter_tile\": [" << report.scatter_tile.x << ", " << report.scatter_tile.y << ", " << report.scatter_tile.z << "],\n";
+	out << "\t\"scatter_fallback\": " << report.scatter_fallback << ",\n";
+	out << "\t\"packed\": " << (report.packed ? "true" : "false") << ",\n";
+	out << "\t\"precision\": {";
+	for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+	{
+		out << (channel == 0 ? " " : ", ") << "\"" << ChannelNames[channel] << "\": \"" << CloudPrecisionName(report.precision[channel]) << "\"";
+	}
+	out << " },\n";
+	out << "\t\"stages\": {\n";
+
+	bool first = true;
+	for(int32_t stage = 0; stage < (int32_t)ECloudSimStage::Done; stage++)
+	{
+		if(report.stages[stage].runs == 0)
+		{
+			continue;
+		}
+		out << (first ? "" : ",\n") << "\t\t\"" << CloudBenchStageName((ECloudBenchStage)stage) << "\": ";
+		WriteTimingJson(out, report.stages[stage]);
+		first = false;
+	}
+
+	out << "\n\t},\n";
+	out << "\t\"step\": ";
+	WriteTimingJson(out, report.step);
+	out << ",\n";
+	if(report.write_texture)
+	{
+		out << "\t\"texture\": { \"format\": \"" << CloudTextureFormatName(report.texture_format) << "\", \"width\": " << report.texture_width << ", \"height\": " << report.texture_height
+			<< ", \"threshold\": " << report.texture_threshold << ", \"region_rows\": " << report.texture_region_rows << ", \"bytes\": " << report.texture_bytes
+			<< ", \"upload_bytes\": " << report.texture_upload_bytes << ", \"regions\": " << report.texture_regions << ", \"timing\": ";
+		WriteTimingJson(out, report.texture);
+		out << " },\n";
+	}
+	out << "\t\"thread_utilisation\": " << report.thread_utilisation << ",\n";
+	out << "\t\"lattice_bytes\": " << report.lattice_bytes << ",\n";
+	if(report.packed)
+	{
+		out << "\t\"reference_lattice_bytes\": " << report.reference_lattice_bytes << ",\n";
+		out << "\t\"errors\": {\n";
+		for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor; channel++)
+		{
+			const FCloudPrecisionError& error = report.errors[channel];
+			out << "\t\t\"" << ChannelNames[channel] << "\": { \"max_error\": " << error.max_error << ", \"rms_error\": " << error.rms_error
+				<< ", \"max_relative_error\": " << error.max_relative_error << ", \"non_finite\": " << error.non_finite << " }"
+				<< (channel + 1 < (int32_t)ECloudChannel::AdvectWaterVapor ? ",\n" : "\n");
+		}
+		out << "\t},\n";
+	}
+	out << "\t\"active_bricks\": " << report.active_bricks << ",\n";
+	out << "\t\"active_tiles\": {";
+	first = true;
+	for(int32_t stage = 0; stage < (int32_t)ECloudSimStage::Done; stage++)
+	{
+		if(report.stages[stage].runs == 0)
+		{
+			continue;
+		}
+		out << (first ? " " : ", ") << "\"" << CloudBenchStageName((ECloudBenchStage)stage) << "\": " << report.active_tiles[stage];
+		first = false;
+	}
+	out << " },\n";
+	out << "\t\"num_tiles\": " << report.num_tiles << ",\n";
+	out << "\t\"peak_memory_bytes\": " << report.peak_memory_bytes << "\n";
+	out << "}\n";
+}
+
+void WriteCloudScenarioCsv(std::ostream& out, const FCloudScenarioReport& report)
+{
+	out << "scenario,x,y,z,threads,stage,runs,total_us,min_us,mean_us,p50_us,p90_us,p99_us,max_us,cells_per_second,thread_utilisation,lattice_bytes,active_bricks,active_tiles,num_tiles,peak_memory_bytes\n";
+	double step_active_tiles = 0.0;
+	for(int32_t stage = 0; stage < (int32_t)ECloudSimStage::Done; stage++)
+	{
+		if(report.stages[stage].runs > 0)
+		{
+			WriteTimingCsv(out, report, CloudBenchStageName((ECloudBenchStage)stage), report.stages[stage], report.active_tiles[stage]);
+			step_active_tiles += report.active_tiles[stage];
+		}
+	}
+	WriteTimingCsv(out, report, "Step", report.step, step_active_tiles);
+	if(report.texture.runs > 0)
+	{
+		WriteTimingCsv(out, report, "Texture", report.texture, 0.0);
+	}
+}
@@ -0,0 +1,228 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSimKernels.h"
+#include "CloudSimd.h"
+
+namespace CloudSimKernels
+{
+	template<bool bHasZMinus, bool bHasZPlus>
+	static void VelocityRowImpl(const FVelocityRow& row, int32_t x_size, float viscosity_ratio, float pressure_effect)
+	{
+		const CloudSimd::FFloat4 viscosity = CloudSimd::Set1(viscosity_ratio);
+		const CloudSimd::FFloat4 pressure = CloudSimd::Set1(pressure_effect);
+		const CloudSimd::FFloat4 six = CloudSimd::Set1(6.f);
+		const CloudSimd::FFloat4 zero = CloudSimd::Zero();
+
+		for(int32_t c = 0; c < 3; c++)
+		{
+			const float* center = row.center[c];
+			const float* zminus = row.zminus[c];
+			const float* zplus = row.zplus[c];
+			float* out = row.out[c];
+
+			auto scalar_cell = [&](int32_t x)
+			{
+				const float cell_zminus = bHasZMinus ? zminus[x] : 0.f;
+				const float cell_xplus_zminus = (bHasZMinus && x < x_size-1) ? zminus[x + 1] : 0.f;
+				const float cell_xminus_zplus = (bHasZPlus && x > 0) ? zplus[x - 1] : 0.f;
+				out[x] = VelocityScalar(center[x], cell_zminus, cell_xminus_zplus, cell_xplus_zminus, viscosity_ratio, pressure_effect);
+			};
+
+			//x = 0 has no x-1 neighbour
+			scalar_cell(0);
+
+			//every cell in [1, x_size-1) has both x neighbours, so the only remaining boundaries are the z ones fixed by the template
+			int32_t x = 1;
+			for(; x + SimdWidth <= x_size-1; x += SimdWidth)
+			{
+				const CloudSimd::FFloat4 v = CloudSimd::Load(center + x);
+				const CloudSimd::FFloat4 cell_zminus = bHasZMinus ? CloudSimd::Load(zminus + x) : zero;
+				const CloudSimd::FFloat4 cell_xplus_zminus = bHasZMinus ? CloudSimd::Load(zminus + x + 1) : zero;
+				const CloudSimd::FFloat4 cell_xminus_zplus = bHasZPlus ? CloudSimd::Load(zplus + x - 1) : zero;
+
+				const CloudSimd::FFloat4 viscosity_term = CloudSimd::Subtract(CloudSimd::Multiply(viscosity, cell_zminus), CloudSimd::Multiply(six, v));
+				const CloudSimd::FFloat4 pressure_term = CloudSimd::Multiply(pressure, CloudSimd::Subtract(CloudSimd::Negate(cell_xminus_zplus), cell_xplus_zminus));
+				CloudSimd::Store(CloudSimd::Add(CloudSimd::Add(v, viscosity_term), pressure_term), out + x);
+			}
+
+			//scalar tail, including x = x_size-1 which has no x+1 neighbour
+			for(; x < x_size; x++)
+			{
+				scalar_cell(x);
+			}
+		}
+	}
+
+	void VelocityRow(const FVelocityRow& row, int32_t x_size, float viscosity_ratio, float pressure_effect)
+	{
+		if(x_size <= 0)
+		{
+			return;
+		}
+
+		const bool has_zminus = row.zminus[0] != nullptr;
+		const bool has_zplus = row.zplus[0] != nullptr;
+
+		if(has_zminus && has_zplus)
+		{
+			VelocityRowImpl<true, true>(row, x_size, viscosity_ratio, pressure_effect);
+		}
+		else if(has_zminus)
+		{
+			VelocityRowImpl<true, false>(row, x_size, viscosity_ratio, pressure_effect);
+		}
+		else if(has_zplus)
+		{
+			VelocityRowImpl<false, true>(row, x_size, viscosity_ratio, pressure_effect);
+		}
+		else
+		{
+			VelocityRowImpl<false, false>(row, x_size, viscosity_ratio, pressure_effect);
+		}
+	}
+
+	void VelocityRowPadded(const FVelocityRow& row, int32_t x_size, float viscosity_ratio, float pressure_effect)
+	{
+		const CloudSimd::FFloat4 viscosity = CloudSimd::Set1(viscosity_ratio);
+		const CloudSimd::FFloat4 pressure = CloudSimd::Set1(pressure_effect);
+		const CloudSimd::FFloat4 six = CloudSimd::Set1(6.f);
+
+		for(int32_t c = 0; c < 3; c++)
+		{
+			const float* center = row.center[c];
+			const float* zminus = row.zminus[c];
+			const float* zplus = row.zplus[c];
+			float* out = row.out[c];
+
+			int32_t x = 0;
+			for(; x + SimdWidth <= x_size; x += SimdWidth)
+			{
+				const CloudSimd::FFloat4 v = CloudSimd::Load(center + x);
+				const CloudSimd::FFloat4 viscosity_term = CloudSimd::Subtract(CloudSimd::Multiply(viscosity, CloudSimd::Load(zminus + x)), CloudSimd::Multiply(six, v));
+				const CloudSimd::FFloat4 pressure_term = CloudSimd::Multiply(pressure, CloudSimd::Subtract(CloudSimd::Negate(CloudSimd::Load(zplus + x - 1)), CloudSimd::Load(zminus + x + 1)));
+				CloudSimd::Store(CloudSimd::Add(CloudSimd::Add(v, viscosity_term), pressure_term), out + x);
+			}
+
+			for(; x < x_size; x++)
+			{
+				out[x] = VelocityScalar(center[x], zminus[x], zplus[x - 1], zminus[x + 1], viscosity_ratio, pressure_effect);
+			}
+		}
+	}
+
+	template<bool bHasZMinus>
+	static void DiffuseRowImpl(const float* water_vapor, const float* zminus, float* out_water_vapor, int32_t x_size, float vapour_diffusion)
+	{
+		const CloudSimd::FFloat4 diffusion = CloudSimd::Set1(vapour_diffusion);
+		const CloudSimd::FFloat4 six = CloudSimd::Set1(6.f);
+		const CloudSimd::FFloat4 zero = CloudSimd::Zero();
+
+		int32_t x = 0;
+		for(; x + SimdWidth <= x_size; x += SimdWidth)
+		{
+			const CloudSimd::FFloat4 w = CloudSimd::Load(water_vapor + x);
+			const CloudSimd::FFloat4 cell_zminus = bHasZMinus ? CloudSimd::Load(zminus + x) : zero;
+			CloudSimd::Store(CloudSimd::Add(w, CloudSimd::Subtract(CloudSimd::Multiply(diffusion, cell_zminus), CloudSimd::Multiply(six, w))), out_water_vapor + x);
+		}
+
+		for(; x < x_size; x++)
+		{
+			out_water_vapor[x] = DiffuseScalar(water_vapor[x], bHasZMinus ? zminus[x] : 0.f, vapour_diffusion);
+		}
+	}
+
+	void DiffuseRow(const float* water_vapor, const float* zminus, float* out_water_vapor, int32_t x_size, float vapour_diffusion)
+	{
+		if(zminus)
+		{
+			DiffuseRowImpl<true>(water_vapor, zminus, out_water_vapor, x_size, vapour_diffusion);
+		}
+		else
+		{
+			DiffuseRowImpl<false>(water_vapor, zminus, out_water_vapor, x_size, vapour_diffusion);
+		}
+	}
+
+	void TransitionRange(float* water_vapor, float* water_droplets, int32_t count, float w_max, float phase_transition_rate)
+	{
+		const CloudSimd::FFloat4 saturation = CloudSimd::Set1(w_max);
+		const CloudSimd::FFloat4 rate = CloudSimd::Set1(phase_transition_rate);
+
+		int32_t i = 0;
+		for(; i + SimdWidth <= count; i += SimdWidth)
+		{
+			const CloudSimd::FFloat4 vapor = CloudSimd::Load(water_vapor + i);
+			const CloudSimd::FFloat4 change = CloudSimd::Multiply(rate, CloudSimd::Subtract(vapor, saturation));
+			CloudSimd::Store(CloudSimd::Add(CloudSimd::Load(water_droplets + i), change), water_droplets + i);
+			CloudSimd::Store(CloudSimd::Subtract(vapor, change), water_vapor + i);
+		}
+
+		for(; i < count; i++)
+		{
+			water_droplets[i] = water_droplets[i] + (phase_transition_rate * (water_vapor[i] - w_max));
+			water_vapor[i] = water_vapor[i] - (phase_transition_rate * (water_vapor[i] - w_max));
+		}
+	}
+
+	//exp(x) = 2^n * exp(r) with n the nearest whole number to x / ln2, so |r| <= ln2 / 2, and exp(r) from Cephes' expf polynomial
+	//ln2 is split in two so r keeps its low bits, x is clamped so 2^n stays a normal float
+	//the vector and scalar forms do the same operations in the same order
+	static CloudSimd::FFloat4 Exp(CloudSimd::FFloat4 x)
+	{
+		using namespace CloudSimd;
+		x = Min(Max(x, Set1(-87.f)), Set1(88.f));
+		const FFloat4 n = Round(Multiply(x, Set1(1.44269504f)));
+		const FFloat4 r = Subtract(Subtract(x, Multiply(n, Set1(0.693359375f))), Multiply(n, Set1(-2.12194440e-4f)));
+
+		FFloat4 p = Set1(1.9875691500e-4f);
+		p = Add(Multiply(p, r), Set1(1.3981999507e-3f));
+		p = Add(Multiply(p, r), Set1(8.3334519073e-3f));
+		p = Add(Multiply(p, r), Set1(4.1665795894e-2f));
+		p = Add(Multiply(p, r), Set1(1.6666665459e-1f));
+		p = Add(Multiply(p, r), Set1(5.0000001201e-1f));
+		p = Add(Add(Multiply(Multiply(p, r), r), r), Set1(1.f));
+		return Multiply(p, Pow2(n));
+	}
+
+	static float ExpScalar(float x)
+	{
+		x = CloudSimd::Min(CloudSimd::Max(x, -87.f), 88.f);
+		const float n = CloudSimd::Round(x * 1.44269504f);
+		const float r = (x - (n * 0.693359375f)) - (n * -2.12194440e-4f);
+
+		float p = 1.9875691500e-4f;
+		p = (p * r) + 1.3981999507e-3f;
+		p = (p * r) + 8.3334519073e-3f;
+		p = (p * r) + 4.1665795894e-2f;
+		p = (p * r) + 1.6666665459e-1f;
+		p = (p * r) + 5.0000001201e-1f;
+		p = (((p * r) * r) + r) + 1.f;
+		return p * CloudSimd::Pow2(n);
+	}
+
+	void SaturationRange(const float* temperature, float* out_w_max, int32_t count)
+	{
+		const CloudSimd::FFloat4 scale = CloudSimd::Set1(217.f);
+		const CloudSimd::FFloat4 a = CloudSimd::Set1(19.482f);
+		const CloudSimd::FFloat4 b = CloudSimd::Set1(4303.4f);
+		const CloudSimd::FFloat4 c = CloudSimd::Set1(29.5f);
+
+		int32_t i = 0;
+		for(; i + SimdWidth <= count; i += SimdWidth)
+		{
+			const CloudSimd::FFloat4 t = CloudSimd::Load(temperature + i);
+			const CloudSimd::FFloat4 exponent = CloudSimd::Subtract(a, CloudSimd::Divide(b, CloudSimd::Subtract(t, c)));
+			CloudSimd::Store(CloudSimd::Divide(CloudSimd::Multiply(scale, Exp(exponent)), t), out_w_max + i);
+		}
+
+		for(; i < count; i++)
+		{
+			out_w_max[i] = SaturationScalar(temperature[i]);
+		}
+	}
+
+	float SaturationScalar(float temperature)
+	{
+		return (217.f * ExpScalar(19.482f - (4303.4f / (temperature - 29.5f)))) / temperature;
+	}
+}
@@ -0,0 +1,185 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSimParallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	//fixed set of threads that work through one batch of tasks at a time, the submitting thread takes tasks as well
+	class FCloudThreadPool
+	{
+	public:
+		explicit FCloudThreadPool(int32_t num_threads)
+		{
+			for(int32_t i = 1; i < num_threads; i++)
+			{
+				threads.emplace_back([this]() { WorkerLoop(); });
+			}
+		}
+
+		~FCloudThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				shutting_down = true;
+			}
+			wake.notify_all();
+			for(std::thread& thread : threads)
+			{
+				thread.join();
+			}
+		}
+
+		int32_t NumThreads() const { return (int32_t)threads.size() + 1; }
+
+		void Run(int32_t num_tasks, const std::function<void(int32_t)>& body)
+		{
+			if(num_tasks <= 0)
+			{
+				return;
+			}
+			if(num_tasks == 1 || threads.empty())
+			{
+				for(int32_t task = 0; task < num_tasks; task++)
+				{
+					body(task);
+				}
+				return;
+			}
+
+			//only one batch is in flight at a time
+			std::lock_guard<std::mutex> submit_lock(submit_mutex);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job_body = &body;
+				job_num_tasks = num_tasks;
+				next_task.store(0);
+				tasks_left.store(num_tasks);
+				job_id++;
+			}
+			wake.notify_all();
+
+			RunTasks(body, num_tasks);
+
+			//workers still holding this job must let go of it before body goes out of scope
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [this]() { return tasks_left.load() == 0 && active_workers == 0; });
+			job_body = nullptr;
+		}
+
+	private:
+		void RunTasks(const std::function<void(int32_t)>& body, int32_t num_tasks)
+		{
+			for(int32_t task = next_task.fetch_add(1); task < num_tasks; task = next_task.fetch_add(1))
+			{
+				body(task);
+				if(tasks_left.fetch_sub(1) == 1)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					finished.notify_all();
+				}
+			}
+		}
+
+		void WorkerLoop()
+		{
+			uint64_t seen_job = 0;
+			for(;;)
+			{
+				const std::function<void(int32_t)>* body;
+				int32_t num_tasks;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this, seen_job]() { return shutting_down || (job_body && job_id != seen_job); });
+					if(shutting_down)
+					{
+						return;
+					}
+					seen_job = job_id;
+					body = job_body;
+					num_tasks = job_num_tasks;
+					active_workers++;
+				}
+				RunTasks(*body, num_tasks);
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					active_workers--;
+				}
+				finished.notify_all();
+			}
+		}
+
+		std::vector<std::thread> threads;
+
+		std::mutex submit_mutex;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable finished;
+		bool shutting_down = false;
+
+		const std::function<void(int32_t)>* job_body = nullptr;
+		int32_t job_num_tasks = 0;
+		uint64_t job_id = 0;
+		int32_t active_workers = 0;
+		std::atomic<int32_t> next_task { 0 };
+		std::atomic<int32_t> tasks_left { 0 };
+	};
+}
+
+FCloudParallelFor FCloudParallelFor::Serial()
+{
+	FCloudParallelFor parallel_for;
+	parallel_for.run = [](int32_t num_tasks, const std::function<void(int32_t)>& body)
+	{
+		for(int32_t task = 0; task < num_tasks; task++)
+		{
+			body(task);
+		}
+	};
+	parallel_for.max_tasks = 1;
+	return parallel_for;
+}
+
+FCloudParallelFor FCloudParallelFor::ThreadPool(int32_t num_threads)
+{
+	if(num_threads <= 0)
+	{
+		num_threads = std::max((int32_t)std::thread::hardware_concurrency(), 1);
+	}
+
+	std::shared_ptr<FCloudThreadPool> pool = std::make_shared<FCloudThreadPool>(num_threads);
+
+	FCloudParallelFor parallel_for;
+	parallel_for.run = [pool](int32_t num_tasks, const std::function<void(int32_t)>& body)
+	{
+		pool->Run(num_tasks, body);
+	};
+	parallel_for.max_tasks = pool->NumThreads();
+	return parallel_for;
+}
+
+void CloudParallelForBatches(const FCloudParallelFor& parallel_for, int32_t num, int32_t min_batch, const std::function<void(int32_t begin, int32_t end)>& body)
+{
+	if(num <= 0)
+	{
+		return;
+	}
+
+	const int32_t num_batches = std::min(std::max(num / std::max(min_batch, 1), 1), std::max(parallel_for.max_tasks, 1));
+	if(num_batches == 1 || !parallel_for.run)
+	{
+		body(0, num);
+		return;
+	}
+
+	parallel_for.run(num_batches, [num, num_batches, &body](int32_t batch)
+	{
+		body((int32_t)((int64_t)num * batch / num_batches), (int32_t)((int64_t)num * (batch + 1) / num_batches));
+	});
+}
@@ -0,0 +1,1491 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSolver.h"
+#include "CloudSimKernels.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	inline int32_t Clamp(int32_t value, int32_t min, int32_t max)
+	{
+		return value < min ? min : (value < max ? value : max);
+	}
+
+	inline float Clamp(float value, float min, float max)
+	{
+		return value < min ? min : (value < max ? value : max);
+	}
+
+	inline float Lerp(float a, float b, float alpha)
+	{
+		return a + alpha * (b - a);
+	}
+
+	inline int32_t DivideAndRoundUp(int32_t dividend, int32_t divisor)
+	{
+		return (dividend + divisor - 1) / divisor;
+	}
+
+	//size of the coloured scatter tiles along any axis params.scatter_tile leaves at 0
+	static constexpr int32_t DefaultScatterTile = 16;
+
+	//NaN counts as a change so a simulation that has blown up keeps running everywhere
+	inline bool Changed(float before, float after, float threshold)
+	{
+		return !(std::fabs(after - before) <= threshold);
+	}
+
+	inline bool RowChanged(const float* before, const float* after, int32_t count, float threshold)
+	{
+		for(int32_t x = 0; x < count; x++)
+		{
+			if(Changed(before[x], after[x], threshold))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline ECloudActivity RanBit(ECloudSimStage stage)
+	{
+		return (ECloudActivity)((uint16_t)ECloudActivity::RanVelocity << (int32_t)stage);
+	}
+
+	//every setting that changes what a stage does to a cell, any change means no tile can be assumed to be settled
+	bool SameActivitySettings(const FCloudSimParams& a, const FCloudSimParams& b)
+	{
+		for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+		{
+			if(a.inflow[channel] != b.inflow[channel])
+			{
+				return false;
+			}
+		}
+		return a.viscosity_ratio == b.viscosity_ratio && a.pressure_effect == b.pressure_effect && a.vapour_diffusion == b.vapour_diffusion
+			&& a.phase_transition_rate == b.phase_transition_rate && a.z_world_size == b.z_world_size && a.lapse_profile == b.lapse_profile && a.double_buffered == b.double_buffered
+			&& a.advection_scheme == b.advection_scheme && a.padded == b.padded && a.boundary == b.boundary && a.activity_threshold == b.activity_threshold;
+	}
+}
+
+FCloudSolver::FCloudSolver()
+	: parallel_for(FCloudParallelFor::Serial())
+{
+}
+
+void FCloudSolver::Init(int32_t x_size, int32_t y_size, int32_t z_size)
+{
+	lattice.SetDoubleBuffered(params.double_buffered);
+	lattice.SetCellOrder(params.cell_order);
+	lattice.SetPadded(params.padded && lattice.HasContiguousRows());
+	lattice.Init(x_size, y_size, z_size);
+	scratch.SetBlockSize(lattice.NumStored());
+	active_advection_scheme = params.advection_scheme;
+	thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+
+	activity_active = params.activity_mask && lattice.HasContiguousRows();
+	activity.Init(lattice.GetYSize(), lattice.GetZSize());
+	activity_params = params;
+	num_tiles = activity.NumTiles();
+}
+
+void FCloudSolver::ApplyPendingSettings()
+{
+	if(lattice.IsDoubleBuffered() != params.double_buffered)
+	{
+		lattice.SetDoubleBuffered(params.double_buffered);
+	}
+	if(lattice.GetCellOrder() != params.cell_order)
+	{
+		lattice.SetCellOrder(params.cell_order);
+	}
+	if(lattice.IsPadded() != (params.padded && lattice.HasContiguousRows()))
+	{
+		lattice.SetPadded(params.padded && lattice.HasContiguousRows());
+	}
+	scratch.SetBlockSize(lattice.NumStored());
+	if(active_advection_scheme != params.advection_scheme)
+	{
+		//gathering leaves old values behind in the advection channels, the scatter needs them to start at 0
+		//they are normally detached between steps, so this only matters when a step was left part way through
+		DetachAdvectionScratch(false);
+		active_advection_scheme = params.advection_scheme;
+	}
+	thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+
+	if(activity_active != (params.activity_mask && lattice.HasContiguousRows()) || activity.GetYSize() != lattice.GetYSize() || activity.GetZSize() != lattice.GetZSize())
+	{
+		activity_active = params.activity_mask && lattice.HasContiguousRows();
+		activity.Init(lattice.GetYSize(), lattice.GetZSize());
+		num_tiles = activity.NumTiles();
+	}
+	else if(!SameActivitySettings(params, activity_params))
+	{
+		MarkAllActive();
+	}
+	activity_params = params;
+}
+
+//V*(x,y,z) = V(x,y,z) + Kv[V(x,y,z-1) - 6V(x,y,z)] + Kp[-V(x-1,y,z+1) - V(x+1,y,z-1)]
+//Where: V* = velocity we're trying to calculate, V = current velocity, (x,y,z) = cell position in lattice, Kv = viscosity ratio, Kp = coefficient of pressure effect
+//neighbours are always read from the front buffer, the result goes to the back buffer (which is the front buffer unless double buffered)
+inline void FCloudSolver::VelocityCell(int32_t x, int32_t y, int32_t z, int32_t i)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t z_size = lattice.GetZSize();
+
+	//the neighbours are read for all three components before any is written, as the velocity is updated in place when not double buffered
+	float cell_zminus[3] = { 0.f, 0.f, 0.f };
+	float cell_xminus_zplus[3] = { 0.f, 0.f, 0.f };
+	float cell_xplus_zminus[3] = { 0.f, 0.f, 0.f };
+	float cell_velocity[3];
+
+	for(int32_t c = 0; c < 3; c++)
+	{
+		const float* velocity = lattice.Channel((ECloudChannel)((int32_t)ECloudChannel::VelocityX + c));
+		if(z > 0)
+		{
+			cell_zminus[c] = velocity[lattice.Neighbour(i, x, y, z, 0, 0, -1)];
+			if(x < x_size-1)
+			{
+				cell_xplus_zminus[c] = velocity[lattice.Neighbour(i, x, y, z, 1, 0, -1)];
+			}
+		}
+		if(x > 0 && z < z_size-1)
+		{
+			cell_xminus_zplus[c] = velocity[lattice.Neighbour(i, x, y, z, -1, 0, 1)];
+		}
+		cell_velocity[c] = velocity[i];
+	}
+
+	for(int32_t c = 0; c < 3; c++)
+	{
+		lattice.BackChannel((ECloudChannel)((int32_t)ECloudChannel::VelocityX + c))[i] = CloudSimKernels::VelocityScalar(cell_velocity[c], cell_zminus[c], cell_xminus_zplus[c], cell_xplus_zminus[c], params.viscosity_ratio, params.pressure_effect);
+	}
+}
+
+inline void FCloudSolver::VelocityCellPadded(int32_t i)
+{
+	const int32_t stride_z = lattice.StrideZ();
+
+	float cell_velocity[3];
+	float cell_zminus[3];
+	float cell_xminus_zplus[3];
+	float cell_xplus_zminus[3];
+
+	for(int32_t c = 0; c < 3; c++)
+	{
+		const float* velocity = lattice.Channel((ECloudChannel)((int32_t)ECloudChannel::VelocityX + c));
+		cell_velocity[c] = velocity[i];
+		cell_zminus[c] = velocity[i - stride_z];
+		cell_xminus_zplus[c] = velocity[i - 1 + stride_z];
+		cell_xplus_zminus[c] = velocity[i + 1 - stride_z];
+	}
+
+	for(int32_t c = 0; c < 3; c++)
+	{
+		lattice.BackChannel((ECloudChannel)((int32_t)ECloudChannel::VelocityX + c))[i] = CloudSimKernels::VelocityScalar(cell_velocity[c], cell_zminus[c], cell_xminus_zplus[c], cell_xplus_zminus[c], params.viscosity_ratio, params.pressure_effect);
+	}
+}
+
+//Wv*(x,y,z) = Wv(x,y,z) + Kdw[Wv(x,y,z) - 6Wv(x,y,z)]
+//Where: Wv* = water vapor we're trying to calculate, Wv = current water vapor, (x,y,z) = cell position in lattice, Kdw = coefficient of water vapor diffusion
+inline void FCloudSolver::DiffuseCell(int32_t x, int32_t y, int32_t z, int32_t i)
+{
+	const float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor);
+
+	float zminus = 0.f;
+	if(z > 0){zminus = water_vapor[lattice.Neighbour(i, x, y, z, 0, 0, -1)];}
+
+	lattice.BackChannel(ECloudChannel::WaterVapor)[i] = CloudSimKernels::DiffuseScalar(water_vapor[i], zminus, params.vapour_diffusion);
+}
+
+inline void FCloudSolver::DiffuseCellPadded(int32_t i)
+{
+	const float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor);
+	lattice.BackChannel(ECloudChannel::WaterVapor)[i] = CloudSimKernels::DiffuseScalar(water_vapor[i], water_vapor[i - lattice.StrideZ()], params.vapour_diffusion);
+}
+
+//scatters a cell's water into the advection accumulators of the 8 cells around the position given by its velocity
+//the range check on l, m and n depends on the velocity rather than the cell's position, so it stays even on a padded lattice
+inline void FCloudSolver::Advect1Cell(int32_t i, float* A_water_vapor, float* A_water_droplets)
+{
+	const float velocity_x = lattice.Channel(ECloudChannel::VelocityX)[i];
+
+	//l, m, and n are the x, y and z integer portions of velocity
+	const int l = (int)velocity_x;
+	const int m = (int)lattice.Channel(ECloudChannel::VelocityY)[i];
+	const int n = (int)lattice.Channel(ECloudChannel::VelocityZ)[i];
+
+	if((l > 0 && l < lattice.GetXSize()-1) && (m > 0 && m < lattice.GetYSize()-1) && (n > 0 && n < lattice.GetZSize()-1))
+	{
+		const float water_vapor = lattice.Channel(ECloudChannel::WaterVapor)[i];
+		const float water_droplets = lattice.Channel(ECloudChannel::WaterDroplets)[i];
+
+		//the scatter runs on one thread with the activity mask on, so the tiles it writes into can be marked as it goes
+		if(activity_active)
+		{
+			activity.SetAround(m, n, ECloudActivity::Received);
+		}
+
+		//weightX, weightY and weightZ are the x, y and z fractional portions of velocity
+		const float weightX = velocity_x - l;
+		const float weightY = velocity_x - m;
+		const float weightZ = velocity_x - n;
+
+		//Add cell values to adjacent cells weighted based on velocity
+		const int32_t target = lattice.Index(l, m, n);
+		const int32_t target_x = lattice.Neighbour(target, l, m, n, 1, 0, 0);
+		const int32_t target_y = lattice.Neighbour(target, l, m, n, 0, 1, 0);
+		const int32_t target_z = lattice.Neighbour(target, l, m, n, 0, 0, 1);
+		const int32_t target_xy = lattice.Neighbour(target, l, m, n, 1, 1, 0);
+		const int32_t target_xz = lattice.Neighbour(target, l, m, n, 1, 0, 1);
+		const int32_t target_yz = lattice.Neighbour(target, l, m, n, 0, 1, 1);
+		const int32_t target_xyz = lattice.Neighbour(target, l, m, n, 1, 1, 1);
+
+		A_water_vapor[target] += water_vapor * ((1 - weightX) * (1 - weightY) * (1 - weightZ));
+		A_water_droplets[target] += water_droplets * ((1 - weightX) * (1 - weightY) * (1 - weightZ));
+
+		A_water_vapor[target_x] += water_vapor * (weightX * (1 - weightY) * (1 - weightZ));
+		A_water_droplets[target_x] += water_droplets * (weightX * (1 - weightY) * (1 - weightZ));
+
+		A_water_vapor[target_y] += water_vapor * ((1 - weightX) * weightY * (1 - weightZ));
+		A_water_droplets[target_y] += water_droplets * ((1 - weightX) * weightY * (1 - weightZ));
+
+		A_water_vapor[target_z] += water_vapor * ((1 - weightX) * (1 - weightY) * weightZ);
+		A_water_droplets[target_z] += water_droplets * ((1 - weightX) * (1 - weightY) * weightZ);
+
+		A_water_vapor[target_xy] += water_vapor * (weightX * weightY * (1 - weightZ));
+		A_water_droplets[target_xy] += water_droplets * (weightX * weightY * (1 - weightZ));
+
+		A_water_vapor[target_xz] += water_vapor * ((1 - weightX) * weightY * weightZ);
+		A_water_droplets[target_xz] += water_droplets * ((1 - weightX) * weightY * weightZ);
+
+		A_water_vapor[target_yz] += water_vapor * (weightX * (1 - weightY) * weightZ);
+		A_water_droplets[target_yz] += water_droplets * (weightX * (1 - weightY) * weightZ);
+
+		A_water_vapor[target_xyz] += water_vapor * (weightX * weightY * weightZ);
+		A_water_droplets[target_xyz] += water_droplets * (weightX * weightY * weightZ);
+	}
+}
+
+//add advection data onto current data then zero advection data
+inline void FCloudSolver::Advect2Cell(int32_t i)
+{
+	float* A_water_vapor = lattice.Channel(ECloudChannel::AdvectWaterVapor);
+	float* A_water_droplets = lattice.Channel(ECloudChannel::AdvectWaterDroplets);
+
+	lattice.Channel(ECloudChannel::WaterVapor)[i] += A_water_vapor[i];
+	A_water_vapor[i] = 0.f;
+	lattice.Channel(ECloudChannel::WaterDroplets)[i] += A_water_droplets[i];
+	A_water_droplets[i] = 0.f;
+}
+
+//semi-lagrangian advection, traces back along the cell's velocity and takes the trilinearly interpolated water found there
+//reads only the water channels and writes only the advection channels, so cells can be processed in any order
+inline void FCloudSolver::AdvectGatherCell(int32_t x, int32_t y, int32_t z, int32_t i)
+{
+	const float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor);
+	const float* water_droplets = lattice.Channel(ECloudChannel::WaterDroplets);
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t z_size = lattice.GetZSize();
+
+	//source position one step back along the velocity, clamped so samples outside the lattice take the value at its edge
+	const float source_x = Clamp(x - lattice.Channel(ECloudChannel::VelocityX)[i], 0.f, (float)(x_size - 1));
+	const float source_y = Clamp(y - lattice.Channel(ECloudChannel::VelocityY)[i], 0.f, (float)(y_size - 1));
+	const float source_z = Clamp(z - lattice.Channel(ECloudChannel::VelocityZ)[i], 0.f, (float)(z_size - 1));
+
+	const int32_t x0 = (int32_t)source_x;
+	const int32_t y0 = (int32_t)source_y;
+	const int32_t z0 = (int32_t)source_z;
+	const int32_t x1 = std::min(x0 + 1, x_size - 1);
+	const int32_t y1 = std::min(y0 + 1, y_size - 1);
+	const int32_t z1 = std::min(z0 + 1, z_size - 1);
+
+	const float weightX = source_x - x0;
+	const float weightY = source_y - y0;
+	const float weightZ = source_z - z0;
+
+	const int32_t c000 = lattice.Index(x0, y0, z0);
+	const int32_t c100 = lattice.Index(x1, y0, z0);
+	const int32_t c010 = lattice.Index(x0, y1, z0);
+	const int32_t c110 = lattice.Index(x1, y1, z0);
+	const int32_t c001 = lattice.Index(x0, y0, z1);
+	const int32_t c101 = lattice.Index(x1, y0, z1);
+	const int32_t c011 = lattice.Index(x0, y1, z1);
+	const int32_t c111 = lattice.Index(x1, y1, z1);
+
+	auto trilinear = [&](const float* channel)
+	{
+		const float bottom = Lerp(Lerp(channel[c000], channel[c100], weightX), Lerp(channel[c010], channel[c110], weightX), weightY);
+		const float top = Lerp(Lerp(channel[c001], channel[c101], weightX), Lerp(channel[c011], channel[c111], weightX), weightY);
+		return Lerp(bottom, top, weightZ);
+	};
+
+	lattice.Channel(ECloudChannel::AdvectWaterVapor)[i] = trilinear(water_vapor);
+	lattice.Channel(ECloudChannel::AdvectWaterDroplets)[i] = trilinear(water_droplets);
+}
+
+//the gathered values become the new water values by swapping channel storage, no second pass over the lattice is needed
+void FCloudSolver::FinishGather()
+{
+	lattice.SwapChannels(ECloudChannel::WaterVapor, ECloudChannel::AdvectWaterVapor);
+	lattice.SwapChannels(ECloudChannel::WaterDroplets, ECloudChannel::AdvectWaterDroplets);
+}
+
+void FCloudSolver::AttachAdvectionScratch(ECloudSimStage stage)
+{
+	if(stage != ECloudSimStage::Advect1 && stage != ECloudSimStage::Advect2)
+	{
+		return;
+	}
+
+	//the lattice can have been resized or loaded from outside since the blocks were sized
+	scratch.SetBlockSize(lattice.NumStored());
+
+	//the scatter adds into the accumulators so they have to start at 0, the gather writes every cell before anything reads it
+	const bool zeroed = active_advection_scheme == ECloudAdvectionScheme::Scatter;
+	for(ECloudChannel channel : { ECloudChannel::AdvectWaterVapor, ECloudChannel::AdvectWaterDroplets })
+	{
+		if(!lattice.HasChannel(channel))
+		{
+			FCloudChannelArray block;
+			scratch.Acquire(block, zeroed);
+			lattice.SwapChannelStorage(channel, block);
+		}
+	}
+}
+
+void FCloudSolver::DetachAdvectionScratch(bool zeroed)
+{
+	for(ECloudChannel channel : { ECloudChannel::AdvectWaterVapor, ECloudChannel::AdvectWaterDroplets })
+	{
+		if(lattice.HasChannel(channel))
+		{
+			FCloudChannelArray block;
+			lattice.SwapChannelStorage(channel, block);
+			scratch.Return(block, zeroed);
+		}
+	}
+}
+
+inline void FCloudSolver::TransitionCell(int32_t z, int32_t i)
+{
+	float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor);
+	float* water_droplets = lattice.Channel(ECloudChannel::WaterDroplets);
+
+	const float w_max = MaxWaterVapor(z);
+
+	//Wl* = Wl + a(Wv - w_max)
+	//Where: Wl* = new amount of water droplets, Wl = current amount of water droplets, a = phase transition rate constant, Wv = current amount of water vapor
+	water_droplets[i] = water_droplets[i] + (params.phase_transition_rate * (water_vapor[i] - w_max));
+
+	//Wv* = Wv - a(Wv - w_max)
+	//Where: Wv* = new amount of water vapor, Wv = current amount of water vapor, a = phase transition rate constant
+	water_vapor[i] = water_vapor[i] - (params.phase_transition_rate * (water_vapor[i] - w_max));
+}
+
+void FCloudSolver::BeginStage(ECloudSimStage stage)
+{
+	if(stage == ECloudSimStage::Transition)
+	{
+		thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+	}
+	AttachAdvectionScratch(stage);
+
+	if(!lattice.IsPadded())
+	{
+		return;
+	}
+
+	switch(stage)
+	{
+	default:
+		break;
+
+	case(ECloudSimStage::Velocity):
+		for(int32_t c = 0; c < 3; c++)
+		{
+			const ECloudChannel channel = (ECloudChannel)((int32_t)ECloudChannel::VelocityX + c);
+			lattice.RefreshHalo(channel, params.boundary, params.inflow[(int32_t)channel]);
+		}
+		break;
+
+	case(ECloudSimStage::Diffuse):
+		lattice.RefreshHalo(ECloudChannel::WaterVapor, params.boundary, params.inflow[(int32_t)ECloudChannel::WaterVapor]);
+		break;
+	}
+}
+
+void FCloudSolver::RunStage(ECloudSimStage stage, FCloudCellCoord begin, FCloudCellCoord end)
+{
+	MarkAllActive();
+	AttachAdvectionScratch(stage);
+	RunBox(stage, begin, end);
+}
+
+void FCloudSolver::RunBox(ECloudSimStage stage, FCloudCellCoord begin, FCloudCellCoord end)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t x_begin = Clamp(begin.x, 0, x_size);
+	const int32_t y_begin = Clamp(begin.y, 0, lattice.GetYSize());
+	const int32_t z_begin = Clamp(begin.z, 0, lattice.GetZSize());
+	const int32_t x_end = Clamp(end.x, x_begin, x_size);
+	const int32_t y_end = Clamp(end.y, y_begin, lattice.GetYSize());
+	const int32_t z_end = Clamp(end.z, z_begin, lattice.GetZSize());
+
+	for(int32_t z = z_begin; z < z_end; z++)
+	{
+		RunBoxPlane(stage, x_begin, x_end, y_begin, y_end, z);
+
+		//each stage of a fused pair still walks its cells in the same order, so the plane is still in cache when the second one reaches it
+		if(fused_stage != ECloudSimStage::Done)
+		{
+			RunBoxPlane(fused_stage, x_begin, x_end, y_begin, y_end, z);
+		}
+	}
+}
+
+void FCloudSolver::RunBoxPlane(ECloudSimStage stage, int32_t x_begin, int32_t x_end, int32_t y_begin, int32_t y_end, int32_t z)
+{
+	//whole rows of one z plane lie next to each other and share the same w_max, so they are one run for the phase transition
+	const int32_t x_size = lattice.GetXSize();
+	if(stage == ECloudSimStage::Transition && params.use_simd && x_begin == 0 && x_end == x_size && lattice.HasContiguousPlanes())
+	{
+		const int32_t start = lattice.Index(0, y_begin, z);
+		CloudSimKernels::TransitionRange(lattice.Channel(ECloudChannel::WaterVapor) + start, lattice.Channel(ECloudChannel::WaterDroplets) + start, (y_end - y_begin) * x_size, MaxWaterVapor(z), params.phase_transition_rate);
+		return;
+	}
+
+	for(int32_t y = y_begin; y < y_end; y++)
+	{
+		RunRow(stage, x_begin, x_end, y, z);
+	}
+}
+
+//runs a stage over the cells [x_begin, x_end) of one row with the vectorised kernels when use_simd is set
+//only the unpadded velocity kernel checks for the ends of the row, so it needs the whole row, the others take any run of cells
+void FCloudSolver::RunRow(ECloudSimStage stage, int32_t x_begin, int32_t x_end, int32_t y, int32_t z)
+{
+	//a Morton lattice has no rows to hand to the vectorised kernels, so every cell looks up its own index
+	if(!lattice.HasContiguousRows())
+	{
+		for(int32_t x = x_begin; x < x_end; x++)
+		{
+			RunCell(stage, x, y, z);
+		}
+		return;
+	}
+
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t row_start = lattice.Index(0, y, z);
+	const int32_t run_start = row_start + x_begin;
+	const int32_t run_count = x_end - x_begin;
+	const bool simd_row = params.use_simd && x_begin == 0 && x_end == x_size;
+	const int32_t stride_z = lattice.StrideZ();
+	const bool padded = lattice.IsPadded();
+
+	switch(stage)
+	{
+	default:
+		break;
+
+	case(ECloudSimStage::Velocity):
+		if(padded)
+		{
+			if(params.use_simd)
+			{
+				CloudSimKernels::FVelocityRow row;
+				for(int32_t c = 0; c < 3; c++)
+				{
+					const ECloudChannel channel = (ECloudChannel)((int32_t)ECloudChannel::VelocityX + c);
+					row.center[c] = lattice.Channel(channel) + run_start;
+					row.zminus[c] = row.center[c] - stride_z;
+					row.zplus[c] = row.center[c] + stride_z;
+					row.out[c] = lattice.BackChannel(channel) + run_start;
+				}
+				CloudSimKernels::VelocityRowPadded(row, run_count, params.viscosity_ratio, params.pressure_effect);
+				break;
+			}
+			for(int32_t x = x_begin; x < x_end; x++)
+			{
+				VelocityCellPadded(row_start + x);
+			}
+			break;
+		}
+		if(simd_row)
+		{
+			CloudSimKernels::FVelocityRow row;
+			for(int32_t c = 0; c < 3; c++)
+			{
+				const ECloudChannel channel = (ECloudChannel)((int32_t)ECloudChannel::VelocityX + c);
+				row.center[c] = lattice.Channel(channel) + row_start;
+				row.zminus[c] = z > 0 ? row.center[c] - stride_z : nullptr;
+				row.zplus[c] = z < lattice.GetZSize()-1 ? row.center[c] + stride_z : nullptr;
+				row.out[c] = lattice.BackChannel(channel) + row_start;
+			}
+			CloudSimKernels::VelocityRow(row, x_size, params.viscosity_ratio, params.pressure_effect);
+			break;
+		}
+		for(int32_t x = x_begin; x < x_end; x++)
+		{
+			VelocityCell(x, y, z, row_start + x);
+		}
+		break;
+
+	case(ECloudSimStage::Diffuse):
+		if(padded && !params.use_simd)
+		{
+			for(int32_t x = x_begin; x < x_end; x++)
+			{
+				DiffuseCellPadded(row_start + x);
+			}
+			break;
+		}
+		if(params.use_simd)
+		{
+			//the halo row below z = 0 stands in for the missing neighbours when padded
+			const float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor) + run_start;
+			CloudSimKernels::DiffuseRow(water_vapor, (padded || z > 0) ? water_vapor - stride_z : nullptr, lattice.BackChannel(ECloudChannel::WaterVapor) + run_start, run_count, params.vapour_diffusion);
+			break;
+		}
+		for(int32_t x = x_begin; x < x_end; x++)
+		{
+			DiffuseCell(x, y, z, row_start + x);
+		}
+		break;
+
+	case(ECloudSimStage::Advect1):
+		if(active_advection_scheme == ECloudAdvectionScheme::Gather)
+		{
+			for(int32_t x = x_begin; x < x_end; x++)
+			{
+				AdvectGatherCell(x, y, z, row_start + x);
+			}
+			break;
+		}
+		for(int32_t x = x_begin; x < x_end; x++)
+		{
+			Advect1Cell(row_start + x, lattice.Channel(ECloudChannel::AdvectWaterVapor), lattice.Channel(ECloudChannel::AdvectWaterDroplets));
+		}
+		break;
+
+	case(ECloudSimStage::Advect2):
+		for(int32_t x = x_begin; x < x_end; x++)
+		{
+			Advect2Cell(row_start + x);
+		}
+		break;
+
+	case(ECloudSimStage::Transition):
+		if(params.use_simd)
+		{
+			CloudSimKernels::TransitionRange(lattice.Channel(ECloudChannel::WaterVapor) + run_start, lattice.Channel(ECloudChannel::WaterDroplets) + run_start, run_count, MaxWaterVapor(z), params.phase_transition_rate);
+			break;
+		}
+		for(int32_t x = x_begin; x < x_end; x++)
+		{
+			TransitionCell(z, row_start + x);
+		}
+		break;
+	}
+}
+
+void FCloudSolver::RunCell(ECloudSimStage stage, int32_t x, int32_t y, int32_t z)
+{
+	const int32_t i = lattice.Index(x, y, z);
+	switch(stage)
+	{
+	default:
+		break;
+
+	case(ECloudSimStage::Velocity):
+		VelocityCell(x, y, z, i);
+		break;
+
+	case(ECloudSimStage::Diffuse):
+		DiffuseCell(x, y, z, i);
+		break;
+
+	case(ECloudSimStage::Advect1):
+		if(active_advection_scheme == ECloudAdvectionScheme::Gather)
+		{
+			AdvectGatherCell(x, y, z, i);
+			break;
+		}
+		Advect1Cell(i, lattice.Channel(ECloudChannel::AdvectWaterVapor), lattice.Channel(ECloudChannel::AdvectWaterDroplets));
+		break;
+
+	case(ECloudSimStage::Advect2):
+		Advect2Cell(i);
+		break;
+
+	case(ECloudSimStage::Transition):
+		TransitionCell(z, i);
+		break;
+	}
+}
+
+void FCloudSolver::RunStageRows(ECloudSimStage stage, int32_t row_begin, int32_t row_end)
+{
+	MarkAllActive();
+	AttachAdvectionScratch(stage);
+	RunRows(stage, row_begin, row_end);
+}
+
+//splits the range wherever it crosses a z plane
+void FCloudSolver::RunRows(ECloudSimStage stage, int32_t row_begin, int32_t row_end)
+{
+	const int32_t y_size = lattice.GetYSize();
+	for(int32_t row = row_begin; row < row_end;)
+	{
+		const int32_t y = row % y_size;
+		const int32_t z = row / y_size;
+		const int32_t y_end = std::min(y_size, y + (row_end - row));
+		RunBox(stage, { 0, y, z }, { lattice.GetXSize(), y_end, z + 1 });
+		row += y_end - y;
+	}
+}
+
+bool FCloudSolver::ProgressStageRows(ECloudSimStage stage, FCloudSimCursor& cursor, int32_t cells)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t num_rows = y_size * lattice.GetZSize();
+	if(num_rows <= 0 || x_size <= 0)
+	{
+		cursor = FCloudSimCursor();
+		return true;
+	}
+
+	MarkAllActive();
+
+	int32_t row = cursor.y + (y_size * cursor.z);
+	if(row == 0 && cursor.x == 0)
+	{
+		BeginStage(stage);
+	}
+	AttachAdvectionScratch(stage);
+
+	//finish off a row a per cell cursor left part way through
+	if(cursor.x > 0)
+	{
+		RunBox(stage, { cursor.x, cursor.y, cursor.z }, { x_size, cursor.y + 1, cursor.z + 1 });
+		cursor.iteration += x_size - cursor.x;
+		cells_processed += x_size - cursor.x;
+		cells -= x_size - cursor.x;
+		cursor.x = 0;
+		row++;
+	}
+
+	const int32_t row_end = std::min(row + std::max(DivideAndRoundUp(cells, x_size), 0), num_rows);
+	RunRows(stage, row, row_end);
+	cursor.iteration += (row_end - row) * x_size;
+	cells_processed += (row_end - row) * x_size;
+
+	if(row_end >= num_rows)
+	{
+		cursor = FCloudSimCursor();
+		return true;
+	}
+
+	cursor.y = row_end % y_size;
+	cursor.z = row_end / y_size;
+	return false;
+}
+
+ECloudSimStage FCloudSolver::FinishStage(ECloudSimStage stage)
+{
+	switch(stage)
+	{
+	default:
+		return stage;
+
+	case(ECloudSimStage::Velocity):
+		lattice.SwapVelocity();
+		return ECloudSimStage::Diffuse;
+
+	case(ECloudSimStage::Diffuse):
+		lattice.SwapChannel(ECloudChannel::WaterVapor);
+		return ECloudSimStage::Advect1;
+
+	case(ECloudSimStage::Advect1):
+		//gathering finishes in one pass, so skip Advect2 and go straight to the phase transition
+		if(active_advection_scheme == ECloudAdvectionScheme::Gather)
+		{
+			//the advection channels are left holding the old water values
+			FinishGather();
+			DetachAdvectionScratch(false);
+			return ECloudSimStage::Transition;
+		}
+		return ECloudSimStage::Advect2;
+
+	//Advect2 clears every accumulator it adds in, and the tiles it skips were never scattered into
+	case(ECloudSimStage::Advect2):
+		DetachAdvectionScratch(true);
+		return ECloudSimStage::Transition;
+
+	case(ECloudSimStage::Transition):
+		if(params.release_scratch)
+		{
+			scratch.Release();
+		}
+		completed_steps++;
+		return ECloudSimStage::Done;
+	}
+}
+
+//the velocity and diffusion stencils only read neighbours with the same y, so each task takes a slab of whole x-z planes
+//and RunBox walks them in the same order as the time sliced path, giving a bit identical result even when updating in place
+void FCloudSolver::SweepPlanes(ECloudSimStage stage)
+{
+	const int32_t min_planes = DivideAndRoundUp(std::max(params.min_batch_size, 1), std::max(lattice.GetXSize() * lattice.GetZSize(), 1));
+	CloudParallelForBatches(parallel_for, lattice.GetYSize(), min_planes, [this, stage](int32_t y_begin, int32_t y_end)
+	{
+		RunBlocks(stage, y_begin, y_end);
+	});
+}
+
+//planes of different y never read each other, so the y blocks can go in any order
+//within a plane the z bands go from the bottom up and the blocks of a band from the highest x down, so like the row by row walk
+//every cell reads the cells below it after they were updated and the cell above and behind it before
+void FCloudSolver::RunBlocks(ECloudSimStage stage, int32_t y_begin, int32_t y_end)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t z_size = lattice.GetZSize();
+	const int32_t block_x = params.stencil_block.x > 0 ? std::min(params.stencil_block.x, x_size) : x_size;
+	const int32_t block_y = params.stencil_block.y > 0 ? std::min(params.stencil_block.y, y_end - y_begin) : y_end - y_begin;
+	const int32_t block_z = params.stencil_block.z > 0 ? std::min(params.stencil_block.z, z_size) : z_size;
+
+	if(block_x <= 0 || block_y <= 0 || block_z <= 0)
+	{
+		return;
+	}
+
+	const int32_t blocks_x = DivideAndRoundUp(x_size, block_x);
+	for(int32_t y = y_begin; y < y_end; y += block_y)
+	{
+		const int32_t y_block_end = std::min(y + block_y, y_end);
+		for(int32_t z = 0; z < z_size; z += block_z)
+		{
+			const int32_t z_block_end = std::min(z + block_z, z_size);
+			for(int32_t block = blocks_x - 1; block >= 0; block--)
+			{
+				const int32_t x = block * block_x;
+				RunBox(stage, { x, y, z }, { std::min(x + block_x, x_size), y_block_end, z_block_end });
+			}
+		}
+	}
+}
+
+//a cell reads the updated cells at (x, z - 1) and (x + 1, z - 1) and the cell at (x - 1, z + 1) before it is updated, all in its own plane
+//so a tile reads the updated tiles below it and below to its right, and, when its band is more than one plane tall, the updated tile to its right
+//numbering the tiles of a band from the highest x down, tile (i, band) only needs diagonal i + band - 1 to have finished, and each tile
+//runs before the tiles to its left and above it read its cells, with one plane per band no tile of a band reads another and the diagonals are the bands
+//planes of different y never read each other, so every slab of a diagonal runs in parallel too
+void FCloudSolver::SweepWavefront(ECloudSimStage stage)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t z_size = lattice.GetZSize();
+	if(x_size <= 0 || y_size <= 0 || z_size <= 0)
+	{
+		return;
+	}
+
+	const int32_t tasks = std::max(parallel_for.max_tasks, 1);
+	const int32_t tile_x = params.wavefront_tile.x > 0 ? std::min(params.wavefront_tile.x, x_size) : DivideAndRoundUp(x_size, tasks);
+	const int32_t tile_y = params.wavefront_tile.y > 0 ? std::min(params.wavefront_tile.y, y_size) : DivideAndRoundUp(y_size, tasks);
+	const int32_t tile_z = params.wavefront_tile.z > 0 ? std::min(params.wavefront_tile.z, z_size) : DivideAndRoundUp(z_size, tasks);
+	const int32_t tiles_x = DivideAndRoundUp(x_size, tile_x);
+	const int32_t tiles_y = DivideAndRoundUp(y_size, tile_y);
+	const int32_t tiles_z = DivideAndRoundUp(z_size, tile_z);
+
+	const int32_t skew = tile_z > 1 ? 1 : 0;
+	const int32_t diagonals = (skew * (tiles_x - 1)) + tiles_z;
+
+	for(int32_t diagonal = 0; diagonal < diagonals; diagonal++)
+	{
+		//bands on this diagonal, each holding one tile of it, or every tile of the band when skew is 0
+		const int32_t band_begin = std::max(diagonal - (skew * (tiles_x - 1)), 0);
+		const int32_t band_end = std::min(diagonal, tiles_z - 1) + 1;
+		const int32_t tiles_per_band = skew ? 1 : tiles_x;
+		const int32_t num_tiles = (band_end - band_begin) * tiles_per_band;
+
+		//consecutive tasks share a tile of x and z so a batch keeps to neighbouring slabs
+		CloudParallelForBatches(parallel_for, num_tiles * tiles_y, 1, [&](int32_t begin, int32_t end)
+		{
+			for(int32_t task = begin; task < end; task++)
+			{
+				const int32_t tile = task / tiles_y;
+				const int32_t band = band_begin + (tile / tiles_per_band);
+				const int32_t tile_index = skew ? diagonal - band : tile % tiles_per_band;
+				const int32_t x = (tiles_x - 1 - tile_index) * tile_x;
+				const int32_t y = (task % tiles_y) * tile_y;
+				const int32_t z = band * tile_z;
+				RunBox(stage, { x, y, z }, { std::min(x + tile_x, x_size), std::min(y + tile_y, y_size), std::min(z + tile_z, z_size) });
+			}
+		});
+	}
+}
+
+//every cell only writes itself, so whole rows can be handed out in any order
+void FCloudSolver::SweepRows(ECloudSimStage stage)
+{
+	const int32_t min_rows = DivideAndRoundUp(std::max(params.min_batch_size, 1), std::max(lattice.GetXSize(), 1));
+	CloudParallelForBatches(parallel_for, lattice.GetYSize() * lattice.GetZSize(), min_rows, [this, stage](int32_t row_begin, int32_t row_end)
+	{
+		RunRows(stage, row_begin, row_end);
+	});
+}
+
+//every task scatters into its own accumulators, so no two tasks ever write the same float
+//within a task each target still receives its += in the serial order, only the task totals are added together afterwards
+void FCloudSolver::SweepScatterPrivate()
+{
+	const int32_t num_rows = lattice.GetYSize() * lattice.GetZSize();
+	const int32_t tasks = std::max(std::min(parallel_for.max_tasks, num_rows), 1);
+	AcquirePrivateAccumulators(tasks);
+
+	parallel_for.run(tasks, [this, num_rows, tasks](int32_t task)
+	{
+		const int32_t row_begin = (int32_t)(((int64_t)num_rows * task) / tasks);
+		const int32_t row_end = (int32_t)(((int64_t)num_rows * (task + 1)) / tasks);
+		ScatterRows(row_begin, row_end, private_accumulators[2 * task].data(), private_accumulators[(2 * task) + 1].data());
+		private_used[task] = 1;
+	});
+
+	FoldPrivateAccumulators();
+}
+
+//the targets of a cell are the 2x2x2 cells at the whole part of its velocity, wherever the cell itself is
+//a tile's cells may write up to margin = tile / 2 cells past each side of it, the nearest tile of the same colour starts a whole tile further on,
+//and as 2 * margin <= tile the last cell one tile can write is still before the first the other can, so no two tiles running at once reach the same cell
+//every tile of a colour is split between the same task slots, so the per task accumulators do not depend on which thread runs what
+void FCloudSolver::SweepScatterColoured()
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t z_size = lattice.GetZSize();
+	if(x_size <= 0 || y_size <= 0 || z_size <= 0)
+	{
+		return;
+	}
+
+	const int32_t tile_x = std::min(params.scatter_tile.x > 0 ? params.scatter_tile.x : DefaultScatterTile, x_size);
+	const int32_t tile_y = std::min(params.scatter_tile.y > 0 ? params.scatter_tile.y : DefaultScatterTile, y_size);
+	const int32_t tile_z = std::min(params.scatter_tile.z > 0 ? params.scatter_tile.z : DefaultScatterTile, z_size);
+	const int32_t tiles_x = DivideAndRoundUp(x_size, tile_x);
+	const int32_t tiles_y = DivideAndRoundUp(y_size, tile_y);
+	const int32_t tiles_z = DivideAndRoundUp(z_size, tile_z);
+
+	const int32_t tasks = std::max(parallel_for.max_tasks, 1);
+	AcquirePrivateAccumulators(tasks);
+
+	float* A_water_vapor = lattice.Channel(ECloudChannel::AdvectWaterVapor);
+	float* A_water_droplets = lattice.Channel(ECloudChannel::AdvectWaterDroplets);
+	std::atomic<int64_t> fallback_cells { 0 };
+
+	for(int32_t colour = 0; colour < 8; colour++)
+	{
+		const int32_t parity_x = colour & 1;
+		const int32_t parity_y = (colour >> 1) & 1;
+		const int32_t parity_z = (colour >> 2) & 1;
+
+		//tiles of this colour along each axis
+		const int32_t colour_x = (tiles_x - parity_x + 1) / 2;
+		const int32_t colour_y = (tiles_y - parity_y + 1) / 2;
+		const int32_t colour_z = (tiles_z - parity_z + 1) / 2;
+		const int32_t num_tiles = colour_x * colour_y * colour_z;
+		if(num_tiles <= 0)
+		{
+			continue;
+		}
+
+		parallel_for.run(tasks, [&, num_tiles](int32_t task)
+		{
+			float* task_water_vapor = private_accumulators[2 * task].data();
+			float* task_water_droplets = private_accumulators[(2 * task) + 1].data();
+			int64_t task_fallback_cells = 0;
+
+			const int32_t tile_begin = (int32_t)(((int64_t)num_tiles * task) / tasks);
+			const int32_t tile_end = (int32_t)(((int64_t)num_tiles * (task + 1)) / tasks);
+			for(int32_t tile = tile_begin; tile < tile_end; tile++)
+			{
+				const int32_t x_begin = (((tile % colour_x) * 2) + parity_x) * tile_x;
+				const int32_t y_begin = ((((tile / colour_x) % colour_y) * 2) + parity_y) * tile_y;
+				const int32_t z_begin = (((tile / (colour_x * colour_y)) * 2) + parity_z) * tile_z;
+				const int32_t x_end = std::min(x_begin + tile_x, x_size);
+				const int32_t y_end = std::min(y_begin + tile_y, y_size);
+				const int32_t z_end = std::min(z_begin + tile_z, z_size);
+
+				//the lowest and highest cell a target box may start at, the box reaches one cell past its start along each axis
+				const int32_t l_min = x_begin - (tile_x / 2);
+				const int32_t l_max = x_end + (tile_x / 2) - 2;
+				const int32_t m_min = y_begin - (tile_y / 2);
+				const int32_t m_max = y_end + (tile_y / 2) - 2;
+				const int32_t n_min = z_begin - (tile_z / 2);
+				const int32_t n_max = z_end + (tile_z / 2) - 2;
+
+				for(int32_t z = z_begin; z < z_end; z++)
+				{
+					for(int32_t y = y_begin; y < y_end; y++)
+					{
+						for(int32_t x = x_begin; x < x_end; x++)
+						{
+							const int32_t i = lattice.Index(x, y, z);
+							const int l = (int)lattice.Channel(ECloudChannel::VelocityX)[i];
+							const int m = (int)lattice.Channel(ECloudChannel::VelocityY)[i];
+							const int n = (int)lattice.Channel(ECloudChannel::VelocityZ)[i];
+							if(l >= l_min && l <= l_max && m >= m_min && m <= m_max && n >= n_min && n <= n_max)
+							{
+								Advect1Cell(i, A_water_vapor, A_water_droplets);
+								continue;
+							}
+
+							//Advect1Cell() drops cells whose targets leave the lattice, they only count when something is written
+							if((l > 0 && l < x_size-1) && (m > 0 && m < y_size-1) && (n > 0 && n < z_size-1))
+							{
+								Advect1Cell(i, task_water_vapor, task_water_droplets);
+								task_fallback_cells++;
+							}
+						}
+					}
+				}
+			}
+
+			if(task_fallback_cells > 0)
+			{
+				private_used[task] = 1;
+				fallback_cells += task_fallback_cells;
+			}
+		});
+	}
+
+	scatter_fallback_cells = fallback_cells.load();
+	FoldPrivateAccumulators();
+}
+
+void FCloudSolver::AcquirePrivateAccumulators(int32_t tasks)
+{
+	private_accumulators.resize(2 * tasks);
+	for(FCloudChannelArray& block : private_accumulators)
+	{
+		scratch.Acquire(block);
+	}
+	private_used.assign(tasks, 0);
+}
+
+//the totals are added in task order whatever thread runs each batch, and each block is cleared as it is read so it goes back ready for the next step
+void FCloudSolver::FoldPrivateAccumulators()
+{
+	const int32_t tasks = (int32_t)private_used.size();
+	float* A_water_vapor = lattice.Channel(ECloudChannel::AdvectWaterVapor);
+	float* A_water_droplets = lattice.Channel(ECloudChannel::AdvectWaterDroplets);
+
+	if(std::find(private_used.begin(), private_used.end(), 1) != private_used.end())
+	{
+		CloudParallelForBatches(parallel_for, lattice.NumStored(), std::max(params.min_batch_size, 1), [this, tasks, A_water_vapor, A_water_droplets](int32_t begin, int32_t end)
+		{
+			for(int32_t task = 0; task < tasks; task++)
+			{
+				if(!private_used[task])
+				{
+					continue;
+				}
+				float* task_water_vapor = private_accumulators[2 * task].data();
+				float* task_water_droplets = private_accumulators[(2 * task) + 1].data();
+				for(int32_t i = begin; i < end; i++)
+				{
+					A_water_vapor[i] += task_water_vapor[i];
+					task_water_vapor[i] = 0.f;
+					A_water_droplets[i] += task_water_droplets[i];
+					task_water_droplets[i] = 0.f;
+				}
+			}
+		});
+	}
+
+	//blocks that were never written are still clear
+	for(FCloudChannelArray& block : private_accumulators)
+	{
+		scratch.Return(block, true);
+	}
+}
+
+void FCloudSolver::ScatterRows(int32_t row_begin, int32_t row_end, float* A_water_vapor, float* A_water_droplets)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	for(int32_t row = row_begin; row < row_end; row++)
+	{
+		const int32_t y = row % y_size;
+		const int32_t z = row / y_size;
+		for(int32_t x = 0; x < x_size; x++)
+		{
+			Advect1Cell(lattice.Index(x, y, z), A_water_vapor, A_water_droplets);
+		}
+	}
+}
+
+ECloudSimStage FCloudSolver::FusedStage(ECloudSimStage stage) const
+{
+	if(!params.fuse_stages || activity_active)
+	{
+		return ECloudSimStage::Done;
+	}
+
+	switch(stage)
+	{
+	default:
+		return ECloudSimStage::Done;
+
+	case(ECloudSimStage::Velocity):
+		return ECloudSimStage::Diffuse;
+
+	case(ECloudSimStage::Advect2):
+		return ECloudSimStage::Transition;
+	}
+}
+
+ECloudSimStage FCloudSolver::SweepStage(ECloudSimStage stage)
+{
+	BeginStage(stage);
+	fused_stage = FusedStage(stage);
+	BeginStage(fused_stage);
+
+	if(activity_active && stage < ECloudSimStage::Done)
+	{
+		SweepActiveTiles(stage);
+		return FinishStage(stage);
+	}
+
+	switch(stage)
+	{
+	default:
+		return stage;
+
+	case(ECloudSimStage::Velocity):
+	case(ECloudSimStage::Diffuse):
+		if(params.wavefront)
+		{
+			SweepWavefront(stage);
+			break;
+		}
+		SweepPlanes(stage);
+		break;
+
+	case(ECloudSimStage::Advect1):
+		scatter_fallback_cells = 0;
+		if(active_advection_scheme == ECloudAdvectionScheme::Gather)
+		{
+			SweepRows(stage);
+			break;
+		}
+
+		if(params.coloured_scatter && parallel_for.max_tasks > 1)
+		{
+			SweepScatterColoured();
+			break;
+		}
+		if(params.private_scatter && parallel_for.max_tasks > 1)
+		{
+			SweepScatterPrivate();
+			break;
+		}
+
+		//the scatter can write into any cell of the lattice, so it stays on one thread to keep the += order identical to the serial path
+		RunRows(stage, 0, lattice.GetYSize() * lattice.GetZSize());
+		break;
+
+	case(ECloudSimStage::Advect2):
+	case(ECloudSimStage::Transition):
+		SweepRows(stage);
+		break;
+	}
+
+	cells_processed += lattice.Num();
+	active_tiles[(int32_t)stage] = num_tiles.load();
+	const ECloudSimStage next_stage = FinishStage(stage);
+	if(fused_stage == ECloudSimStage::Done)
+	{
+		return next_stage;
+	}
+
+	const ECloudSimStage second_stage = fused_stage;
+	fused_stage = ECloudSimStage::Done;
+	cells_processed += lattice.Num();
+	active_tiles[(int32_t)second_stage] = num_tiles.load();
+	return FinishStage(second_stage);
+}
+
+//decides which tiles run before any of them do, as the decision for a tile reads the dirty bits of the tiles around it
+//a tile is skipped when nothing it reads has changed since the stage last ran, as running it would only give back the values it holds,
+//or when running it cannot change anything, like advecting a tile where every velocity is 0
+void FCloudSolver::SweepActiveTiles(ECloudSimStage stage)
+{
+	if(activity.GetYSize() != lattice.GetYSize() || activity.GetZSize() != lattice.GetZSize())
+	{
+		activity.Init(lattice.GetYSize(), lattice.GetZSize());
+		num_tiles = activity.NumTiles();
+	}
+	if(activity_reset.exchange(false))
+	{
+		activity.MarkAll();
+	}
+
+	const int32_t tiles_y = activity.GetTilesY();
+	const int32_t tiles_z = activity.GetTilesZ();
+	const ECloudActivity ran = RanBit(stage);
+	const bool scatter = stage == ECloudSimStage::Advect1 && active_advection_scheme == ECloudAdvectionScheme::Scatter;
+
+	//the halo of a periodic lattice holds the top plane below the bottom one and the bottom plane above the top one
+	const bool periodic = lattice.IsPadded() && params.boundary == ECloudBoundary::Periodic;
+	auto dirty = [this, tiles_z, periodic](int32_t tile_y, int32_t tile_z, ECloudActivity bit)
+	{
+		if(tile_z < 0 || tile_z >= tiles_z)
+		{
+			if(!periodic)
+			{
+				return false;
+			}
+			tile_z = (tile_z + tiles_z) % tiles_z;
+		}
+		return activity.Has(activity.TileIndex(tile_y, tile_z), bit);
+	};
+
+	int32_t active = 0;
+	for(int32_t tile_y = 0; tile_y < tiles_y; tile_y++)
+	{
+		//the stencils update in place walking up through z, so every tile above one that runs reads changed values
+		bool below_ran = false;
+		for(int32_t tile_z = 0; tile_z < tiles_z; tile_z++)
+		{
+			const int32_t tile = activity.TileIndex(tile_y, tile_z);
+			bool run = false;
+			switch(stage)
+			{
+			default:
+				break;
+
+			//V* reads the planes above and below, which can be in the tiles above and below
+			case(ECloudSimStage::Velocity):
+				run = below_ran || dirty(tile_y, tile_z - 1, ECloudActivity::DirtyVelocity) || dirty(tile_y, tile_z, ECloudActivity::DirtyVelocity) || dirty(tile_y, tile_z + 1, ECloudActivity::DirtyVelocity);
+				break;
+
+			//Wv* only reads the plane below
+			case(ECloudSimStage::Diffuse):
+				run = below_ran || dirty(tile_y, tile_z, ECloudActivity::DirtyDiffuse) || (tile_z == 0 && dirty(tile_y, -1, ECloudActivity::DirtyDiffuse));
+				break;
+
+			case(ECloudSimStage::Advect1):
+				run = activity.Has(tile, ECloudActivity::Moving);
+				break;
+
+			case(ECloudSimStage::Advect2):
+				run = activity.Has(tile, ECloudActivity::Received);
+				break;
+
+			case(ECloudSimStage::Transition):
+				run = activity.Has(tile, ECloudActivity::DirtyTransition);
+				break;
+			}
+
+			below_ran = run;
+			if(run)
+			{
+				activity.Set(tile, ran);
+				active++;
+			}
+			else
+			{
+				activity.Clear(tile, ran);
+			}
+		}
+	}
+
+	//the stage is about to read everything these bits stand for, changes it makes are marked again as its tiles run
+	ECloudActivity consumed = ECloudActivity::All;
+	switch(stage)
+	{
+	default:
+		break;
+	case(ECloudSimStage::Velocity): consumed = ECloudActivity::DirtyVelocity; break;
+	case(ECloudSimStage::Diffuse): consumed = ECloudActivity::DirtyDiffuse; break;
+	case(ECloudSimStage::Advect1): consumed = scatter ? ECloudActivity::Received : ECloudActivity::All; break;
+	case(ECloudSimStage::Advect2): consumed = ECloudActivity::Received; break;
+	case(ECloudSimStage::Transition): consumed = ECloudActivity::DirtyTransition; break;
+	}
+	if(consumed != ECloudActivity::All)
+	{
+		for(int32_t tile = 0; tile < activity.NumTiles(); tile++)
+		{
+			activity.Clear(tile, consumed);
+		}
+	}
+
+	const int32_t x_size = lattice.GetXSize();
+	if(scatter)
+	{
+		//the rows keep the order of a full sweep so the += into each target cell happens in the same order
+		int64_t cells = 0;
+		for(int32_t z = 0; z < lattice.GetZSize(); z++)
+		{
+			for(int32_t y = 0; y < lattice.GetYSize(); y++)
+			{
+				if(activity.Has(activity.TileOfRow(y, z), ran))
+				{
+					RunRow(stage, 0, x_size, y, z);
+					cells += x_size;
+				}
+			}
+		}
+		cells_processed += cells;
+	}
+	else
+	{
+		//tasks take whole columns of tiles, so each one only writes the bits of its own tiles
+		const int32_t min_tile_rows = DivideAndRoundUp(std::max(params.min_batch_size, 1), std::max(x_size * CloudActivityTileSize * lattice.GetZSize(), 1));
+		CloudParallelForBatches(parallel_for, tiles_y, min_tile_rows, [this, stage, tiles_z, ran, x_size](int32_t tile_y_begin, int32_t tile_y_end)
+		{
+			std::vector<float> before;
+			int64_t cells = 0;
+			for(int32_t tile_y = tile_y_begin; tile_y < tile_y_end; tile_y++)
+			{
+				for(int32_t tile_z = 0; tile_z < tiles_z; tile_z++)
+				{
+					if(!activity.Has(activity.TileIndex(tile_y, tile_z), ran))
+					{
+						SkipTile(stage, tile_y, tile_z);
+						continue;
+					}
+					RunActiveTile(stage, tile_y, tile_z, before);
+					cells += (int64_t)x_size * (activity.TileYEnd(tile_y) - activity.TileYBegin(tile_y)) * (activity.TileZEnd(tile_z) - activity.TileZBegin(tile_z));
+				}
+			}
+			cells_processed += cells;
+		});
+	}
+
+	active_tiles[(int32_t)stage] = active;
+}
+
+//runs a stage over one tile and marks the stages that read what it changed
+void FCloudSolver::RunActiveTile(ECloudSimStage stage, int32_t tile_y, int32_t tile_z, std::vector<float>& before)
+{
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_begin = activity.TileYBegin(tile_y);
+	const int32_t y_end = activity.TileYEnd(tile_y);
+	const int32_t z_begin = activity.TileZBegin(tile_z);
+	const int32_t z_end = activity.TileZEnd(tile_z);
+	const int32_t tile = activity.TileIndex(tile_y, tile_z);
+	const float threshold = params.activity_threshold;
+
+	auto for_each_row = [&](auto&& body)
+	{
+		for(int32_t z = z_begin; z < z_end; z++)
+		{
+			for(int32_t y = y_begin; y < y_end; y++)
+			{
+				body(lattice.Index(0, y, z), z);
+			}
+		}
+	};
+
+	auto mark_water_changed = [this, tile]()
+	{
+		activity.Set(tile, ECloudActivity::DirtyDiffuse);
+		activity.Set(tile, ECloudActivity::DirtyTransition);
+	};
+
+	switch(stage)
+	{
+	default:
+		break;
+
+	case(ECloudSimStage::Velocity):
+	case(ECloudSimStage::Diffuse):
+	{
+		const int32_t first_channel = stage == ECloudSimStage::Velocity ? (int32_t)ECloudChannel::VelocityX : (int32_t)ECloudChannel::WaterVapor;
+		const int32_t last_channel = stage == ECloudSimStage::Velocity ? (int32_t)ECloudChannel::VelocityZ : (int32_t)ECloudChannel::WaterVapor;
+
+		//updating in place overwrites the old values, so they are kept to compare against, double buffering leaves them in the front buffer
+		const bool in_place = !lattice.IsDoubleBuffered();
+		if(in_place)
+		{
+			before.clear();
+			for_each_row([&](int32_t row, int32_t)
+			{
+				for(int32_t channel = first_channel; channel <= last_channel; channel++)
+				{
+					const float* values = lattice.Channel((ECloudChannel)channel) + row;
+					before.insert(before.end(), values, values + x_size);
+				}
+			});
+		}
+
+		RunBox(stage, { 0, y_begin, z_begin }, { x_size, y_end, z_end });
+
+		bool changed = false;
+		bool moving = false;
+		size_t offset = 0;
+		for_each_row([&](int32_t row, int32_t)
+		{
+			for(int32_t channel = first_channel; channel <= last_channel; channel++)
+			{
+				const float* after = lattice.BackChannel((ECloudChannel)channel) + row;
+				const float* old = in_place ? before.data() + offset : lattice.Channel((ECloudChannel)channel) + row;
+				offset += x_size;
+				changed = changed || RowChanged(old, after, x_size, threshold);
+				moving = moving || std::any_of(after, after + x_size, [](float value) { return value != 0.f; });
+			}
+		});
+
+		if(stage == ECloudSimStage::Velocity)
+		{
+			if(changed)
+			{
+				activity.Set(tile, ECloudActivity::DirtyVelocity);
+			}
+			if(moving)
+			{
+				activity.Set(tile, ECloudActivity::Moving);
+			}
+			else
+			{
+				activity.Clear(tile, ECloudActivity::Moving);
+			}
+		}
+		else if(changed)
+		{
+			mark_water_changed();
+		}
+		break;
+	}
+
+	//only reached when gathering, the scatter is run row by row by SweepActiveTiles()
+	case(ECloudSimStage::Advect1):
+	{
+		RunBox(stage, { 0, y_begin, z_begin }, { x_size, y_end, z_end });
+
+		//the gathered values are swapped in once the stage finishes
+		bool changed = false;
+		for_each_row([&](int32_t row, int32_t)
+		{
+			changed = changed || RowChanged(lattice.Channel(ECloudChannel::WaterVapor) + row, lattice.Channel(ECloudChannel::AdvectWaterVapor) + row, x_size, threshold)
+				|| RowChanged(lattice.Channel(ECloudChannel::WaterDroplets) + row, lattice.Channel(ECloudChannel::AdvectWaterDroplets) + row, x_size, threshold);
+		});
+		if(changed)
+		{
+			mark_water_changed();
+		}
+		break;
+	}
+
+	//water only changes where something was scattered into it
+	case(ECloudSimStage::Advect2):
+	{
+		bool changed = false;
+		for_each_row([&](int32_t row, int32_t)
+		{
+			const float* A_water_vapor = lattice.Channel(ECloudChannel::AdvectWaterVapor) + row;
+			const float* A_water_droplets = lattice.Channel(ECloudChannel::AdvectWaterDroplets) + row;
+			for(int32_t x = 0; x < x_size && !changed; x++)
+			{
+				changed = Changed(0.f, A_water_vapor[x], threshold) || Changed(0.f, A_water_droplets[x], threshold);
+			}
+		});
+
+		RunBox(stage, { 0, y_begin, z_begin }, { x_size, y_end, z_end });
+		if(changed)
+		{
+			mark_water_changed();
+		}
+		break;
+	}
+
+	//a cell only changes when its vapor is not already at w_max
+	case(ECloudSimStage::Transition):
+	{
+		bool changed = false;
+		for_each_row([&](int32_t row, int32_t z)
+		{
+			const float w_max = MaxWaterVapor(z);
+			const float* water_vapor = lattice.Channel(ECloudChannel::WaterVapor) + row;
+			for(int32_t x = 0; x < x_size && !changed; x++)
+			{
+				changed = Changed(0.f, params.phase_transition_rate * (water_vapor[x] - w_max), threshold);
+			}
+		});
+
+		RunBox(stage, { 0, y_begin, z_begin }, { x_size, y_end, z_end });
+		if(changed)
+		{
+			mark_water_changed();
+		}
+		break;
+	}
+	}
+}
+
+//leaves a skipped tile holding the same values once the stage's buffers are swapped
+void FCloudSolver::SkipTile(ECloudSimStage stage, int32_t tile_y, int32_t tile_z)
+{
+	int32_t first_channel;
+	int32_t last_channel;
+	int32_t offset;
+
+	switch(stage)
+	{
+	default:
+		return;
+
+	case(ECloudSimStage::Velocity):
+	case(ECloudSimStage::Diffuse):
+		if(!lattice.IsDoubleBuffered())
+		{
+			return;
+		}
+		first_channel = stage == ECloudSimStage::Velocity ? (int32_t)ECloudChannel::VelocityX : (int32_t)ECloudChannel::WaterVapor;
+		last_channel = stage == ECloudSimStage::Velocity ? (int32_t)ECloudChannel::VelocityZ : (int32_t)ECloudChannel::WaterVapor;
+		offset = 0;
+		break;
+
+	case(ECloudSimStage::Advect1):
+		if(active_advection_scheme != ECloudAdvectionScheme::Gather)
+		{
+			return;
+		}
+		first_channel = (int32_t)ECloudChannel::WaterVapor;
+		last_channel = (int32_t)ECloudChannel::WaterDroplets;
+		offset = (int32_t)ECloudChannel::AdvectWaterVapor - (int32_t)ECloudChannel::WaterVapor;
+		break;
+	}
+
+	const int32_t x_size = lattice.GetXSize();
+	for(int32_t z = activity.TileZBegin(tile_z); z < activity.TileZEnd(tile_z); z++)
+	{
+		for(int32_t y = activity.TileYBegin(tile_y); y < activity.TileYEnd(tile_y); y++)
+		{
+			const int32_t row = lattice.Index(0, y, z);
+			for(int32_t channel = first_channel; channel <= last_channel; channel++)
+			{
+				const float* source = lattice.Channel((ECloudChannel)channel) + row;
+				float* target = offset ? lattice.Channel((ECloudChannel)(channel + offset)) + row : lattice.BackChannel((ECloudChannel)channel) + row;
+				std::copy(source, source + x_size, target);
+			}
+		}
+	}
+}
+
+void FCloudSolver::RunStep()
+{
+	ApplyPendingSettings();
+
+	for(ECloudSimStage stage = ECloudSimStage::Velocity; stage != ECloudSimStage::Done;)
+	{
+		stage = SweepStage(stage);
+	}
+}
@@ -0,0 +1,198 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSparseLattice.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void FCloudSparseLattice::Init(int32_t in_x_size, int32_t in_y_size, int32_t in_z_size)
+{
+	x_size = std::max(in_x_size, 0);
+	y_size = std::max(in_y_size, 0);
+	z_size = std::max(in_z_size, 0);
+
+	bricks_x = (x_size + CloudBrickMask) >> CloudBrickBits;
+	bricks_y = (y_size + CloudBrickMask) >> CloudBrickBits;
+	bricks_z = (z_size + CloudBrickMask) >> CloudBrickBits;
+
+	slots.assign((size_t)bricks_x * bricks_y * bricks_z, -1);
+	pool.clear();
+	free_slots.clear();
+}
+
+void FCloudSparseLattice::Zero()
+{
+	std::fill(slots.begin(), slots.end(), -1);
+	pool.clear();
+	free_slots.clear();
+}
+
+void FCloudSparseLattice::Empty()
+{
+	Init(0, 0, 0);
+	std::vector<int32_t>().swap(slots);
+	std::vector<std::unique_ptr<FCloudBrick>>().swap(pool);
+	std::vector<int32_t>().swap(free_slots);
+}
+
+void FCloudSparseLattice::CopyFrom(const FCloudSparseLattice& other)
+{
+	if(other.x_size != x_size || other.y_size != y_size || other.z_size != z_size)
+	{
+		Init(other.x_size, other.y_size, other.z_size);
+	}
+
+	//the copy is packed, with no free slots
+	Zero();
+	for(int32_t brick = 0; brick < other.NumBricks(); brick++)
+	{
+		if(const FCloudBrick* source = other.FindBrick(brick))
+		{
+			std::memcpy(FindOrAddBrick(brick).values, source->values, sizeof(source->values));
+		}
+	}
+}
+
+void FCloudSparseLattice::LoadFrom(const FCloudLattice& dense, float threshold)
+{
+	Init(dense.GetXSize(), dense.GetYSize(), dense.GetZSize());
+
+	for(int32_t z = 0; z < z_size; z++)
+	{
+		for(int32_t y = 0; y < y_size; y++)
+		{
+			for(int32_t x = 0; x < x_size; x++)
+			{
+				const int32_t i = dense.Index(x, y, z);
+				for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+				{
+					//transient channels are only attached part way through a step
+					if(!dense.HasChannel((ECloudChannel)channel))
+					{
+						continue;
+					}
+					const float value = dense.Channel((ECloudChannel)channel)[i];
+					if(std::fabs(value) > threshold)
+					{
+						Set((ECloudChannel)channel, x, y, z, value);
+					}
+				}
+			}
+		}
+	}
+}
+
+void FCloudSparseLattice::StoreTo(FCloudLattice& dense) const
+{
+	dense.Init(x_size, y_size, z_size);
+
+	for(int32_t brick_z = 0; brick_z < bricks_z; brick_z++)
+	{
+		for(int32_t brick_y = 0; brick_y < bricks_y; brick_y++)
+		{
+			for(int32_t brick_x = 0; brick_x < bricks_x; brick_x++)
+			{
+				const FCloudBrick* brick = FindBrick(BrickIndex(brick_x, brick_y, brick_z));
+				if(!brick)
+				{
+					continue;
+				}
+
+				const int32_t x_begin = brick_x << CloudBrickBits;
+				const int32_t y_begin = brick_y << CloudBrickBits;
+				const int32_t z_begin = brick_z << CloudBrickBits;
+				const int32_t x_count = std::min(CloudBrickSize, x_size - x_begin);
+
+				for(int32_t local_z = 0; local_z < std::min(CloudBrickSize, z_size - z_begin); local_z++)
+				{
+					for(int32_t local_y = 0; local_y < std::min(CloudBrickSize, y_size - y_begin); local_y++)
+					{
+						for(int32_t channel = 0; channel < (int32_t)ECloudChannel::Num; channel++)
+						{
+							if(!dense.HasChannel((ECloudChannel)channel))
+							{
+								continue;
+							}
+							const float* source = brick->values[channel] + FCloudBrick::CellIndex(0, local_y, local_z);
+							float* target = dense.Channel((ECloudChannel)channel);
+							if(dense.HasContiguousRows())
+							{
+								std::copy(source, source + x_count, target + dense.Index(x_begin, y_begin + local_y, z_begin + local_z));
+								continue;
+							}
+							for(int32_t local_x = 0; local_x < x_count; local_x++)
+							{
+								target[dense.Index(x_begin + local_x, y_begin + local_y, z_begin + local_z)] = source[local_x];
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//back buffers start as a copy of the front ones, see FCloudLattice::SetDoubleBuffered()
+	dense.SetDoubleBuffered(dense.IsDoubleBuffered());
+}
+
+FCloudBrick& FCloudSparseLattice::FindOrAddBrick(int32_t brick)
+{
+	int32_t& slot = slots[brick];
+	if(slot >= 0)
+	{
+		return *pool[slot];
+	}
+
+	if(!free_slots.empty())
+	{
+		slot = free_slots.back();
+		free_slots.pop_back();
+	}
+	else
+	{
+		slot = (int32_t)pool.size();
+		pool.emplace_back();
+	}
+
+	pool[slot].reset(new FCloudBrick());
+	return *pool[slot];
+}
+
+void FCloudSparseLattice::FreeBrick(int32_t brick)
+{
+	int32_t& slot = slots[brick];
+	if(slot < 0)
+	{
+		return;
+	}
+
+	pool[slot].reset();
+	free_slots.push_back(slot);
+	slot = -1;
+}
+
+void FCloudSparseLattice::Set(ECloudChannel channel, int32_t x, int32_t y, int32_t z, float value)
+{
+	if(!IsValidCell(x, y, z))
+	{
+		return;
+	}
+	FindOrAddBrick(BrickIndexOfCell(x, y, z)).values[(int32_t)channel][FCloudBrick::CellIndex(x & CloudBrickMask, y & CloudBrickMask, z & CloudBrickMask)] = value;
+}
+
+void FCloudSparseLattice::CollectBricks(std::vector<int32_t>& out) const
+{
+	out.clear();
+	for(int32_t brick = 0; brick < NumBricks(); brick++)
+	{
+		if(slots[brick] >= 0)
+		{
+			out.push_back(brick);
+		}
+	}
+}
+
+size_t FCloudSparseLattice::GetAllocatedSize() const
+{
+	return ((size_t)NumAllocatedBricks() * sizeof(FCloudBrick)) + (slots.capacity() * sizeof(int32_t)) + (pool.capacity() * sizeof(std::unique_ptr<FCloudBrick>)) + (free_slots.capacity() * sizeof(int32_t));
+}
@@ -0,0 +1,499 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSparseSolver.h"
+#include "CloudSimKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+	inline float Clamp(float value, float min, float max)
+	{
+		return value < min ? min : (value < max ? value : max);
+	}
+
+	inline float Lerp(float a, float b, float alpha)
+	{
+		return a + alpha * (b - a);
+	}
+
+	inline int32_t DivideAndRoundUp(int32_t dividend, int32_t divisor)
+	{
+		return (dividend + divisor - 1) / divisor;
+	}
+
+	//cells of a brick that are inside the lattice along one axis
+	inline int32_t CellsInBrick(int32_t brick, int32_t size)
+	{
+		return std::min(CloudBrickSize, size - (brick << CloudBrickBits));
+	}
+
+	inline bool IsClear(float value, float threshold)
+	{
+		return std::fabs(value) <= threshold;
+	}
+}
+
+FCloudSparseSolver::FCloudSparseSolver()
+	: parallel_for(FCloudParallelFor::Serial())
+{
+}
+
+void FCloudSparseSolver::Init(int32_t x_size, int32_t y_size, int32_t z_size)
+{
+	lattice.Init(x_size, y_size, z_size);
+	active_advection_scheme = params.advection_scheme;
+	thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+}
+
+void FCloudSparseSolver::ApplyPendingSettings()
+{
+	if(active_advection_scheme != params.advection_scheme)
+	{
+		//gathering leaves old values behind in the advection channels, the scatter needs them to start at 0
+		for(int32_t brick = 0; brick < lattice.NumBricks(); brick++)
+		{
+			if(FCloudBrick* values = lattice.FindBrick(brick))
+			{
+				std::fill_n(values->values[(int32_t)ECloudChannel::AdvectWaterVapor], CloudBrickCells, 0.f);
+				std::fill_n(values->values[(int32_t)ECloudChannel::AdvectWaterDroplets], CloudBrickCells, 0.f);
+			}
+		}
+		active_advection_scheme = params.advection_scheme;
+	}
+}
+
+void FCloudSparseSolver::Dilate()
+{
+	CollectBricks();
+
+	//V*(x,y,z) reads (x,y,z-1), (x-1,y,z+1) and (x+1,y,z-1), so a brick can change the bricks beside, above and below it with the same y
+	for(int32_t brick : bricks)
+	{
+		const int32_t brick_x = brick % lattice.GetBricksX();
+		const int32_t brick_y = (brick / lattice.GetBricksX()) % lattice.GetBricksY();
+		const int32_t brick_z = brick / (lattice.GetBricksX() * lattice.GetBricksY());
+
+		for(int32_t offset_z = -1; offset_z <= 1; offset_z++)
+		{
+			for(int32_t offset_x = -1; offset_x <= 1; offset_x++)
+			{
+				const int32_t band_x = brick_x + offset_x;
+				const int32_t band_z = brick_z + offset_z;
+				if(band_x >= 0 && band_x < lattice.GetBricksX() && band_z >= 0 && band_z < lattice.GetBricksZ())
+				{
+					lattice.FindOrAddBrick(lattice.BrickIndex(band_x, brick_y, band_z));
+				}
+			}
+		}
+	}
+}
+
+void FCloudSparseSolver::Prune()
+{
+	CollectBricks();
+
+	//the advection channels are scratch space that is either 0 or about to be overwritten, so only the other channels keep a brick alive
+	for(int32_t brick : bricks)
+	{
+		const FCloudBrick* values = lattice.FindBrick(brick);
+		bool clear = true;
+		for(int32_t channel = 0; channel < (int32_t)ECloudChannel::AdvectWaterVapor && clear; channel++)
+		{
+			clear = std::all_of(values->values[channel], values->values[channel] + CloudBrickCells, [this](float value) { return IsClear(value, params.sparse_threshold); });
+		}
+		if(clear)
+		{
+			lattice.FreeBrick(brick);
+		}
+	}
+}
+
+void FCloudSparseSolver::CollectBricks()
+{
+	lattice.CollectBricks(bricks);
+
+	bricks_by_y.resize(lattice.GetBricksY());
+	for(std::vector<int32_t>& row : bricks_by_y)
+	{
+		row.clear();
+	}
+	for(int32_t brick : bricks)
+	{
+		bricks_by_y[(brick / lattice.GetBricksX()) % lattice.GetBricksY()].push_back(brick);
+	}
+}
+
+const FCloudBrick* FCloudSparseSolver::FindBrick(int32_t brick_x, int32_t brick_y, int32_t brick_z) const
+{
+	if(brick_x < 0 || brick_x >= lattice.GetBricksX() || brick_z < 0 || brick_z >= lattice.GetBricksZ())
+	{
+		return nullptr;
+	}
+	return lattice.FindBrick(lattice.BrickIndex(brick_x, brick_y, brick_z));
+}
+
+void FCloudSparseSolver::SweepStencil(ECloudSimStage stage)
+{
+	const int32_t bricks_x = lattice.GetBricksX();
+	const int32_t bricks_xy = bricks_x * lattice.GetBricksY();
+	const int32_t min_rows = DivideAndRoundUp(std::max(params.min_batch_size, 1), CloudBrickCells * std::max(DivideAndRoundUp((int32_t)bricks.size(), std::max(lattice.GetBricksY(), 1)), 1));
+
+	CloudParallelForBatches(parallel_for, lattice.GetBricksY(), min_rows, [this, stage, bricks_x, bricks_xy](int32_t row_begin, int32_t row_end)
+	{
+		//rows of cells beyond the edge of the lattice or in a missing brick
+		static const float zero_row[CloudBrickSize] = {};
+
+		int64_t cells = 0;
+		for(int32_t brick_y = row_begin; brick_y < row_end; brick_y++)
+		{
+			const std::vector<int32_t>& row = bricks_by_y[brick_y];
+			const int32_t y_count = CellsInBrick(brick_y, lattice.GetYSize());
+
+			//bricks in a row are in z, then x order, each run of bricks with the same z is walked a plane of cells at a time
+			//so every cell below has been updated and every cell above has not, as in FCloudSolver
+			for(size_t run_begin = 0; run_begin < row.size();)
+			{
+				const int32_t brick_z = row[run_begin] / bricks_xy;
+				size_t run_end = run_begin + 1;
+				while(run_end < row.size() && row[run_end] / bricks_xy == brick_z)
+				{
+					run_end++;
+				}
+
+				for(int32_t local_z = 0; local_z < CellsInBrick(brick_z, lattice.GetZSize()); local_z++)
+				{
+					for(size_t run = run_begin; run < run_end; run++)
+					{
+						const int32_t brick_x = row[run] % bricks_x;
+						FCloudBrick& brick = *lattice.FindBrick(row[run]);
+						const int32_t x_count = CellsInBrick(brick_x, lattice.GetXSize());
+
+						//bricks holding the planes above and below, and the first cell of the brick to the +x or last cell of the brick to the -x of those planes
+						const int32_t zminus_z = local_z > 0 ? local_z - 1 : CloudBrickMask;
+						const int32_t zplus_z = local_z < CloudBrickMask ? local_z + 1 : 0;
+						const FCloudBrick* zminus = local_z > 0 ? &brick : FindBrick(brick_x, brick_y, brick_z - 1);
+						const FCloudBrick* zminus_xplus = FindBrick(brick_x + 1, brick_y, local_z > 0 ? brick_z : brick_z - 1);
+						const FCloudBrick* zplus = local_z < CloudBrickMask ? &brick : FindBrick(brick_x, brick_y, brick_z + 1);
+						const FCloudBrick* zplus_xminus = FindBrick(brick_x - 1, brick_y, local_z < CloudBrickMask ? brick_z : brick_z + 1);
+
+						//the +z plane of the top cells of the lattice is outside it
+						if((brick_z << CloudBrickBits) + local_z + 1 >= lattice.GetZSize())
+						{
+							zplus = nullptr;
+							zplus_xminus = nullptr;
+						}
+
+						for(int32_t local_y = 0; local_y < y_count; local_y++)
+						{
+							if(stage == ECloudSimStage::Diffuse)
+							{
+								float* water_vapor = brick.values[(int32_t)ECloudChannel::WaterVapor] + FCloudBrick::CellIndex(0, local_y, local_z);
+								const float* water_vapor_zminus = zminus ? zminus->values[(int32_t)ECloudChannel::WaterVapor] + FCloudBrick::CellIndex(0, local_y, zminus_z) : zero_row;
+								for(int32_t x = 0; x < x_count; x++)
+								{
+									water_vapor[x] = CloudSimKernels::DiffuseScalar(water_vapor[x], water_vapor_zminus[x], params.vapour_diffusion);
+								}
+								continue;
+							}
+
+							//the components never read each other, so each is run as a whole row, reading the rows above and below before writing
+							for(int32_t channel = (int32_t)ECloudChannel::VelocityX; channel <= (int32_t)ECloudChannel::VelocityZ; channel++)
+							{
+								float cell_zminus[CloudBrickSize + 1];
+								float cell_zplus[CloudBrickSize + 1];
+
+								const float* zminus_row = zminus ? zminus->values[channel] + FCloudBrick::CellIndex(0, local_y, zminus_z) : zero_row;
+								const float* zplus_row = zplus ? zplus->values[channel] + FCloudBrick::CellIndex(0, local_y, zplus_z) : zero_row;
+								std::copy(zminus_row, zminus_row + CloudBrickSize, cell_zminus);
+								std::copy(zplus_row, zplus_row + CloudBrickSize, cell_zplus + 1);
+								cell_zminus[CloudBrickSize] = zminus_xplus ? zminus_xplus->values[channel][FCloudBrick::CellIndex(0, local_y, zminus_z)] : 0.f;
+								cell_zplus[0] = zplus_xminus ? zplus_xminus->values[channel][FCloudBrick::CellIndex(CloudBrickMask, local_y, zplus_z)] : 0.f;
+
+								//the cells of the -z plane of the bottom cells are outside the lattice
+								if((brick_z << CloudBrickBits) + local_z == 0)
+								{
+									std::fill_n(cell_zminus, CloudBrickSize + 1, 0.f);
+								}
+
+								float* velocity = brick.values[channel] + FCloudBrick::CellIndex(0, local_y, local_z);
+								for(int32_t x = 0; x < x_count; x++)
+								{
+									velocity[x] = CloudSimKernels::VelocityScalar(velocity[x], cell_zminus[x], cell_zplus[x], cell_zminus[x + 1], params.viscosity_ratio, params.pressure_effect);
+								}
+							}
+						}
+						cells += x_count * y_count;
+					}
+				}
+				run_begin = run_end;
+			}
+		}
+		cells_processed += cells;
+	});
+}
+
+void FCloudSparseSolver::SweepScatter()
+{
+	const int32_t bricks_x = lattice.GetBricksX();
+	const int32_t bricks_xy = bricks_x * lattice.GetBricksY();
+	const int32_t x_size = lattice.GetXSize();
+	const int32_t y_size = lattice.GetYSize();
+	const int32_t z_size = lattice.GetZSize();
+	int64_t cells = 0;
+
+	//targets can be anywhere in the lattice, so bricks are added as water reaches them
+	auto add = [this](int32_t x, int32_t y, int32_t z, float water_vapor, float water_droplets, float weight)
+	{
+		FCloudBrick& target = lattice.FindOrAddBrick(lattice.BrickIndexOfCell(x, y, z));
+		const int32_t i = FCloudBrick::CellIndex(x & CloudBrickMask, y & CloudBrickMask, z & CloudBrickMask);
+		target.values[(int32_t)ECloudChannel::AdvectWaterVapor][i] += water_vapor * weight;
+		target.values[(int32_t)ECloudChannel::AdvectWaterDroplets][i] += water_droplets * weight;
+	};
+
+	//bricks are in z, then y, then x order, each run with the same z is walked a plane of cells at a time, then each run with the same y a row at a time
+	for(size_t plane_begin = 0; plane_begin < bricks.size();)
+	{
+		const int32_t brick_z = bricks[plane_begin] / bricks_xy;
+		size_t plane_end = plane_begin + 1;
+		while(plane_end < bricks.size() && bricks[plane_end] / bricks_xy == brick_z)
+		{
+			plane_end++;
+		}
+
+		for(int32_t local_z = 0; local_z < CellsInBrick(brick_z, z_size); local_z++)
+		{
+			for(size_t row_begin = plane_begin; row_begin < plane_end;)
+			{
+				const int32_t brick_y = (bricks[row_begin] / bricks_x) % lattice.GetBricksY();
+				size_t row_end = row_begin + 1;
+				while(row_end < plane_end && (bricks[row_end] / bricks_x) % lattice.GetBricksY() == brick_y)
+				{
+					row_end++;
+				}
+
+				for(int32_t local_y = 0; local_y < CellsInBrick(brick_y, y_size); local_y++)
+				{
+					for(size_t run = row_begin; run < row_end; run++)
+					{
+						const int32_t brick_x = bricks[run] % bricks_x;
+						const int32_t x_count = CellsInBrick(brick_x, x_size);
+						cells += x_count;
+
+						for(int32_t local_x = 0; local_x < x_count; local_x++)
+						{
+							//the brick is looked up again for every cell, as adding a target brick can grow the pool
+							const FCloudBrick& brick = *lattice.FindBrick(bricks[run]);
+							const int32_t i = FCloudBrick::CellIndex(local_x, local_y, local_z);
+
+							const float velocity_x = brick.values[(int32_t)ECloudChannel::VelocityX][i];
+							const int l = (int)velocity_x;
+							const int m = (int)brick.values[(int32_t)ECloudChannel::VelocityY][i];
+							const int n = (int)brick.values[(int32_t)ECloudChannel::VelocityZ][i];
+
+							const float water_vapor = brick.values[(int32_t)ECloudChannel::WaterVapor][i];
+							const float water_droplets = brick.values[(int32_t)ECloudChannel::WaterDroplets][i];
+
+							//a dry cell would only add 0 to its targets, skipping it keeps their bricks from being allocated
+							if(water_vapor == 0.f && water_droplets == 0.f)
+							{
+								continue;
+							}
+
+							if((l > 0 && l < x_size-1) && (m > 0 && m < y_size-1) && (n > 0 && n < z_size-1))
+							{
+
+								//the same weights, and the same order of targets, as FCloudSolver::Advect1Cell
+								const float weightX = velocity_x - l;
+								const float weightY = velocity_x - m;
+								const float weightZ = velocity_x - n;
+
+								add(l, m, n, water_vapor, water_droplets, (1 - weightX) * (1 - weightY) * (1 - weightZ));
+								add(l + 1, m, n, water_vapor, water_droplets, weightX * (1 - weightY) * (1 - weightZ));
+								add(l, m + 1, n, water_vapor, water_droplets, (1 - weightX) * weightY * (1 - weightZ));
+								add(l, m, n + 1, water_vapor, water_droplets, (1 - weightX) * (1 - weightY) * weightZ);
+								add(l + 1, m + 1, n, water_vapor, water_droplets, weightX * weightY * (1 - weightZ));
+								add(l + 1, m, n + 1, water_vapor, water_droplets, (1 - weightX) * weightY * weightZ);
+								add(l, m + 1, n + 1, water_vapor, water_droplets, weightX * (1 - weightY) * weightZ);
+								add(l + 1, m + 1, n + 1, water_vapor, water_droplets, weightX * weightY * weightZ);
+							}
+						}
+					}
+				}
+				row_begin = row_end;
+			}
+		}
+		plane_begin = plane_end;
+	}
+
+	cells_processed += cells;
+}
+
+void FCloudSparseSolver::RunBrick(ECloudSimStage stage, int32_t brick_index)
+{
+	FCloudBrick& brick = *lattice.FindBrick(brick_index);
+	const int32_t brick_x = brick_index % lattice.GetBricksX();
+	const int32_t brick_y = (brick_index / lattice.GetBricksX()) % lattice.GetBricksY();
+	const int32_t brick_z = brick_index / (lattice.GetBricksX() * lattice.GetBricksY());
+	const int32_t x_count = CellsInBrick(brick_x, lattice.GetXSize());
+	const int32_t y_count = CellsInBrick(brick_y, lattice.GetYSize());
+	const int32_t z_count = CellsInBrick(brick_z, lattice.GetZSize());
+
+	float* water_vapor = brick.values[(int32_t)ECloudChannel::WaterVapor];
+	float* water_droplets = brick.values[(int32_t)ECloudChannel::WaterDroplets];
+	float* A_water_vapor = brick.values[(int32_t)ECloudChannel::AdvectWaterVapor];
+	float* A_water_droplets = brick.values[(int32_t)ECloudChannel::AdvectWaterDroplets];
+
+	switch(stage)
+	{
+	default:
+		break;
+
+	//cells outside the lattice are always 0, so whole bricks can be folded in
+	case(ECloudSimStage::Advect2):
+		for(int32_t i = 0; i < CloudBrickCells; i++)
+		{
+			water_vapor[i] += A_water_vapor[i];
+			A_water_vapor[i] = 0.f;
+			water_droplets[i] += A_water_droplets[i];
+			A_water_droplets[i] = 0.f;
+		}
+		break;
+
+	//the same sampling as FCloudSolver::AdvectGatherCell, with cells in missing bricks read as 0
+	case(ECloudSimStage::Advect1):
+		for(int32_t local_z = 0; local_z < z_count; local_z++)
+		{
+			for(int32_t local_y = 0; local_y < y_count; local_y++)
+			{
+				for(int32_t local_x = 0; local_x < x_count; local_x++)
+				{
+					const int32_t i = FCloudBrick::CellIndex(local_x, local_y, local_z);
+					const int32_t x = (brick_x << CloudBrickBits) + local_x;
+					const int32_t y = (brick_y << CloudBrickBits) + local_y;
+					const int32_t z = (brick_z << CloudBrickBits) + local_z;
+
+					const float source_x = Clamp(x - brick.values[(int32_t)ECloudChannel::VelocityX][i], 0.f, (float)(lattice.GetXSize() - 1));
+					const float source_y = Clamp(y - brick.values[(int32_t)ECloudChannel::VelocityY][i], 0.f, (float)(lattice.GetYSize() - 1));
+					const float source_z = Clamp(z - brick.values[(int32_t)ECloudChannel::VelocityZ][i], 0.f, (float)(lattice.GetZSize() - 1));
+
+					const int32_t x0 = (int32_t)source_x;
+					const int32_t y0 = (int32_t)source_y;
+					const int32_t z0 = (int32_t)source_z;
+					const int32_t x1 = std::min(x0 + 1, lattice.GetXSize() - 1);
+					const int32_t y1 = std::min(y0 + 1, lattice.GetYSize() - 1);
+					const int32_t z1 = std::min(z0 + 1, lattice.GetZSize() - 1);
+
+					const float weightX = source_x - x0;
+					const float weightY = source_y - y0;
+					const float weightZ = source_z - z0;
+
+					auto trilinear = [&](ECloudChannel channel)
+					{
+						const float bottom = Lerp(Lerp(lattice.Get(channel, x0, y0, z0), lattice.Get(channel, x1, y0, z0), weightX), Lerp(lattice.Get(channel, x0, y1, z0), lattice.Get(channel, x1, y1, z0), weightX), weightY);
+						const float top = Lerp(Lerp(lattice.Get(channel, x0, y0, z1), lattice.Get(channel, x1, y0, z1), weightX), Lerp(lattice.Get(channel, x0, y1, z1), lattice.Get(channel, x1, y1, z1), weightX), weightY);
+						return Lerp(bottom, top, weightZ);
+					};
+
+					A_water_vapor[i] = trilinear(ECloudChannel::WaterVapor);
+					A_water_droplets[i] = trilinear(ECloudChannel::WaterDroplets);
+				}
+			}
+		}
+		break;
+
+	case(ECloudSimStage::Transition):
+		for(int32_t local_z = 0; local_z < z_count; local_z++)
+		{
+			const float w_max = MaxWaterVapor((brick_z << CloudBrickBits) + local_z);
+			for(int32_t local_y = 0; local_y < y_count; local_y++)
+			{
+				const int32_t row = FCloudBrick::CellIndex(0, local_y, local_z);
+				for(int32_t i = row; i < row + x_count; i++)
+				{
+					//selected rather than branched on so the row still vectorises
+					const bool clear = IsClear(water_vapor[i], params.sparse_threshold) && IsClear(water_droplets[i], params.sparse_threshold);
+					const float transition = clear ? 0.f : params.phase_transition_rate * (water_vapor[i] - w_max);
+					water_droplets[i] = water_droplets[i] + transition;
+					water_vapor[i] = water_vapor[i] - transition;
+				}
+			}
+		}
+		break;
+	}
+}
+
+void FCloudSparseSolver::SweepBricks(ECloudSimStage stage)
+{
+	const int32_t min_bricks = DivideAndRoundUp(std::max(params.min_batch_size, 1), CloudBrickCells);
+	CloudParallelForBatches(parallel_for, (int32_t)bricks.size(), min_bricks, [this, stage](int32_t begin, int32_t end)
+	{
+		for(int32_t brick = begin; brick < end; brick++)
+		{
+			RunBrick(stage, bricks[brick]);
+		}
+	});
+	cells_processed += (int64_t)bricks.size() * CloudBrickCells;
+}
+
+ECloudSimStage FCloudSparseSolver::SweepStage(ECloudSimStage stage)
+{
+	switch(stage)
+	{
+	default:
+		return stage;
+
+	case(ECloudSimStage::Velocity):
+		Dilate();
+		CollectBricks();
+		SweepStencil(stage);
+		return ECloudSimStage::Diffuse;
+
+	case(ECloudSimStage::Diffuse):
+		CollectBricks();
+		SweepStencil(stage);
+		return ECloudSimStage::Advect1;
+
+	case(ECloudSimStage::Advect1):
+		CollectBricks();
+		if(active_advection_scheme == ECloudAdvectionScheme::Gather)
+		{
+			SweepBricks(stage);
+
+			//the gathered values become the new water values, as in FCloudSolver::FinishGather
+			for(int32_t brick : bricks)
+			{
+				FCloudBrick& values = *lattice.FindBrick(brick);
+				std::swap(values.values[(int32_t)ECloudChannel::WaterVapor], values.values[(int32_t)ECloudChannel::AdvectWaterVapor]);
+				std::swap(values.values[(int32_t)ECloudChannel::WaterDroplets], values.values[(int32_t)ECloudChannel::AdvectWaterDroplets]);
+			}
+			return ECloudSimStage::Transition;
+		}
+		SweepScatter();
+		return ECloudSimStage::Advect2;
+
+	case(ECloudSimStage::Advect2):
+		CollectBricks();
+		SweepBricks(stage);
+		return ECloudSimStage::Transition;
+
+	case(ECloudSimStage::Transition):
+		thermodynamics.Update(lattice.GetZSize(), params.z_world_size, params.lapse_profile);
+		CollectBricks();
+		SweepBricks(stage);
+		Prune();
+		completed_steps++;
+		return ECloudSimStage::Done;
+	}
+}
+
+void FCloudSparseSolver::RunStep()
+{
+	ApplyPendingSettings();
+
+	for(ECloudSimStage stage = ECloudSimStage::Velocity; stage != ECloudSimStage::Done;)
+	{
+		stage = SweepStage(stage);
+	}
+}
@@ -0,0 +1,477 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudTextureWriter.h"
+#include "CloudSimd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	//NaN fails the comparison and ends up at 0, the same as the SSE path where max returns its second operand for NaN
+	inline uint8_t FloatToR8(float value, float scale)
+	{
+		const float scaled = value * scale;
+		const float clamped = scaled > 0.f ? (scaled < 1.f ? scaled : 1.f) : 0.f;
+		return (uint8_t)(int32_t)((clamped * 255.f) + 0.5f);
+	}
+
+	//values are scaled into a block on the stack this size before being handed to CloudPackValues()
+	static constexpr int32_t HalfBlock = 256;
+}
+
+void CloudConvertToR8(const float* values, uint8_t* out_texels, int32_t count, float scale)
+{
+	int32_t i = 0;
+#if CLOUDSIM_SIMD_SSE
+	const __m128 scale4 = _mm_set1_ps(scale);
+	auto to_r8 = [scale4](const float* in)
+	{
+		const __m128 clamped = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in), scale4), _mm_setzero_ps()), _mm_set1_ps(1.f));
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(255.f)), _mm_set1_ps(0.5f)));
+	};
+	for(; i + 16 <= count; i += 16)
+	{
+		const __m128i low = _mm_packs_epi32(to_r8(values + i), to_r8(values + i + 4));
+		const __m128i high = _mm_packs_epi32(to_r8(values + i + 8), to_r8(values + i + 12));
+		_mm_storeu_si128((__m128i*)(out_texels + i), _mm_packus_epi16(low, high));
+	}
+#elif CLOUDSIM_SIMD_NEON
+	const float32x4_t scale4 = vdupq_n_f32(scale);
+	auto to_r8 = [scale4](const float* in)
+	{
+		const float32x4_t clamped = vminq_f32(vmaxq_f32(vmulq_f32(vld1q_f32(in), scale4), vdupq_n_f32(0.f)), vdupq_n_f32(1.f));
+		return vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(clamped, vdupq_n_f32(255.f)), vdupq_n_f32(0.5f))));
+	};
+	for(; i + 8 <= count; i += 8)
+	{
+		vst1_u8(out_texels + i, vmovn_u16(vcombine_u16(to_r8(values + i), to_r8(values + i + 4))));
+	}
+#endif
+	for(; i < count; i++)
+	{
+		out_texels[i] = FloatToR8(values[i], scale);
+	}
+}
+
+void CloudConvertToR16F(const float* values, uint16_t* out_texels, int32_t count, float scale)
+{
+	if(scale == 1.f)
+	{
+		CloudPackValues(values, out_texels, count, ECloudPrecision::Float16, 1.f);
+		return;
+	}
+
+	float scaled[HalfBlock];
+	for(int32_t begin = 0; begin < count; begin += HalfBlock)
+	{
+		const int32_t num = std::min(HalfBlock, count - begin);
+		int32_t i = 0;
+		const CloudSimd::FFloat4 scale4 = CloudSimd::Set1(scale);
+		for(; i + CloudSimd::Width <= num; i += CloudSimd::Width)
+		{
+			CloudSimd::Store(CloudSimd::Multiply(CloudSimd::Load(values + begin + i), scale4), scaled + i);
+		}
+		for(; i < num; i++)
+		{
+			scaled[i] = values[begin + i] * scale;
+		}
+		CloudPackValues(scaled, out_texels + begin, num, ECloudPrecision::Float16, 1.f);
+	}
+}
+
+FCloudTextureLayout FCloudTextureLayout::Make(FCloudCellCoord in_size, ECloudTextureFormat in_format, int32_t in_tiles_x)
+{
+	FCloudTextureLayout layout;
+	layout.size = in_size;
+	layout.format = in_format;
+	if(in_size.x <= 0 || in_size.y <= 0 || in_size.z <= 0)
+	{
+		layout.size = FCloudCellCoord();
+		return layout;
+	}
+
+	if(in_tiles_x > 0)
+	{
+		layout.tiles_x = std::min(in_tiles_x, in_size.z);
+	}
+	else
+	{
+		//the number of tiles across that keeps the longer side of the atlas shortest
+		int64_t best_side = INT64_MAX;
+		for(int32_t tiles_x = 1; tiles_x <= in_size.z; tiles_x++)
+		{
+			const int32_t tiles_y = (in_size.z + tiles_x - 1) / tiles_x;
+			const int64_t side = std::max((int64_t)tiles_x * in_size.x, (int64_t)tiles_y * in_size.y);
+			if(side < best_side)
+			{
+				best_side = side;
+				layout.tiles_x = tiles_x;
+			}
+		}
+	}
+	layout.tiles_y = (in_size.z + layout.tiles_x - 1) / layout.tiles_x;
+	return layout;
+}
+
+namespace
+{
+	inline bool Matches(const FCloudTextureLayout& layout, int32_t x_size, int32_t y_size, int32_t z_size)
+	{
+		return layout.size.x == x_size && layout.size.y == y_size && layout.size.z == z_size && x_size * y_size * z_size > 0;
+	}
+
+	//row readers for WriteRows() and WriteChangedRows(), each returns the x values of row (y, z), either scratch filled in or the lattice's own storage
+	auto RowReader(const FCloudLattice& lattice, ECloudChannel channel)
+	{
+		const int32_t x_size = lattice.GetXSize();
+		const float* values = lattice.HasChannel(channel) ? lattice.Channel(channel) : nullptr;
+		return [&lattice, values, x_size](int32_t y, int32_t z, float* scratch) -> const float*
+		{
+			if(!values)
+			{
+				std::fill(scratch, scratch + x_size, 0.f);
+				return scratch;
+			}
+			if(lattice.HasContiguousRows())
+			{
+				return values + lattice.Index(0, y, z);
+			}
+			for(int32_t x = 0; x < x_size; x++)
+			{
+				scratch[x] = values[lattice.Index(x, y, z)];
+			}
+			return scratch;
+		};
+	}
+
+	//a row crosses one brick every CloudBrickSize cells, copying the brick's part of the row or 0 where there is no brick
+	auto RowReader(const FCloudSparseLattice& lattice, ECloudChannel channel)
+	{
+		const int32_t x_size = lattice.GetXSize();
+		return [&lattice, channel, x_size](int32_t y, int32_t z, float* scratch) -> const float*
+		{
+			const int32_t cell = FCloudBrick::CellIndex(0, y & CloudBrickMask, z & CloudBrickMask);
+			for(int32_t brick_x = 0; brick_x < lattice.GetBricksX(); brick_x++)
+			{
+				const int32_t x = brick_x << CloudBrickBits;
+				const int32_t count = std::min(CloudBrickSize, x_size - x);
+				const FCloudBrick* brick = lattice.FindBrick(lattice.BrickIndex(brick_x, y >> CloudBrickBits, z >> CloudBrickBits));
+				if(brick)
+				{
+					std::copy(brick->values[(int32_t)channel] + cell, brick->values[(int32_t)channel] + cell + count, scratch + x);
+				}
+				else
+				{
+					std::fill(scratch + x, scratch + x + count, 0.f);
+				}
+			}
+			return scratch;
+		};
+	}
+
+	auto RowReader(const FCloudPackedLattice& lattice, ECloudChannel channel)
+	{
+		const int32_t x_size = lattice.GetXSize();
+		return [&lattice, channel, x_size](int32_t y, int32_t z, float* scratch) -> const float*
+		{
+			if(!FCloudPackedLattice::IsStored(channel))
+			{
+				std::fill(scratch, scratch + x_size, 0.f);
+				return scratch;
+			}
+			lattice.Unpack(channel, lattice.Index(0, y, z), x_size, scratch);
+			return scratch;
+		};
+	}
+
+	inline void ConvertRow(const float* values, uint8_t* out_texels, int32_t count, float scale, ECloudTextureFormat format)
+	{
+		if(format == ECloudTextureFormat::R16F)
+		{
+			CloudConvertToR16F(values, (uint16_t*)out_texels, count, scale);
+		}
+		else
+		{
+			CloudConvertToR8(values, out_texels, count, scale);
+		}
+	}
+
+	//true if any texel of the row has moved by more than threshold, values scratch holds 2 * count floats for unpacking halves
+	bool RowChanged(const uint8_t* new_texels, const uint8_t* old_texels, int32_t count, ECloudTextureFormat format, float threshold, float* values)
+	{
+		if(std::memcmp(new_texels, old_texels, (size_t)count * (format == ECloudTextureFormat::R16F ? 2 : 1)) == 0)
+		{
+			return false;
+		}
+		if(threshold <= 0.f)
+		{
+			return true;
+		}
+
+		if(format == ECloudTextureFormat::R8)
+		{
+			const float threshold_steps = threshold * 255.f;
+			for(int32_t i = 0; i < count; i++)
+			{
+				if((float)std::abs((int32_t)new_texels[i] - (int32_t)old_texels[i]) > threshold_steps)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//NaN fails the comparison, so a half turning to or from NaN always counts as a change
+		CloudUnpackValues((const uint16_t*)new_texels, values, count, ECloudPrecision::Float16, 1.f);
+		CloudUnpackValues((const uint16_t*)old_texels, values + count, count, ECloudPrecision::Float16, 1.f);
+		for(int32_t i = 0; i < count; i++)
+		{
+			if(!(std::fabs(values[i] - values[count + i]) <= threshold))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+template<typename TReadRow>
+void FCloudTextureWriter::WriteRows(const FCloudTextureLayout& layout, float scale, uint8_t* out_texels, const TReadRow& read_row) const
+{
+	const int32_t x_size = layout.size.x;
+	const int32_t y_size = layout.size.y;
+	const int32_t z_size = layout.size.z;
+
+	//rows are numbered y fastest, then z, so a batch covers whole slices wherever it can
+	const int32_t min_rows = std::max(min_batch_size / std::max(x_size, 1), 1);
+	CloudParallelForBatches(parallel_for, y_size * z_size, min_rows, [&](int32_t begin, int32_t end)
+	{
+		std::vector<float> scratch(x_size);
+		for(int32_t row = begin; row < end; row++)
+		{
+			const int32_t y = row % y_size;
+			const int32_t z = row / y_size;
+			ConvertRow(read_row(y, z, scratch.data()), out_texels + layout.Offset(y, z), x_size, scale, layout.format);
+		}
+	});
+
+	//the empty tiles after the last slice, all on the bottom row of tiles
+	const int32_t empty_tiles = (layout.tiles_x * layout.tiles_y) - z_size;
+	if(empty_tiles > 0)
+	{
+		const size_t bytes = (size_t)empty_tiles * x_size * layout.GetBytesPerTexel();
+		for(int32_t y = 0; y < y_size; y++)
+		{
+			std::memset(out_texels + layout.Offset(y, z_size), 0, bytes);
+		}
+	}
+}
+
+template<typename TReadRow>
+void FCloudTextureWriter::WriteChangedRows(const FCloudTextureLayout& layout, float scale, float threshold, std::vector<FCloudTextureRegion>& out_regions, const TReadRow& read_row)
+{
+	const int32_t x_size = layout.size.x;
+	const int32_t y_size = layout.size.y;
+	const int32_t z_size = layout.size.z;
+	const size_t row_bytes = (size_t)x_size * layout.GetBytesPerTexel();
+
+	const int32_t rows = region_rows > 0 ? std::min(region_rows, y_size) : y_size;
+	const int32_t slice_bands = (y_size + rows - 1) / rows;
+
+	//a new copy starts at 0 like the empty tiles, every band of it is written whatever it holds
+	const bool fresh = layout != texels_layout || texels.size() != layout.GetDataSize();
+	if(fresh)
+	{
+		texels.assign(layout.GetDataSize(), 0);
+		texels_layout = layout;
+	}
+	changed_bands.assign((size_t)slice_bands * z_size, 0);
+
+	//each band is converted on the side and only copied over the texels once it is known to have changed
+	const int32_t min_bands = std::max(min_batch_size / std::max(x_size * rows, 1), 1);
+	CloudParallelForBatches(parallel_for, slice_bands * z_size, min_bands, [&](int32_t begin, int32_t end)
+	{
+		std::vector<float> scratch(2 * x_size);
+		std::vector<uint8_t> band_texels(rows * row_bytes);
+		for(int32_t band = begin; band < end; band++)
+		{
+			const int32_t z = band / slice_bands;
+			const int32_t y_begin = (band % slice_bands) * rows;
+			const int32_t y_end = std::min(y_begin + rows, y_size);
+
+			bool changed = fresh;
+			for(int32_t y = y_begin; y < y_end; y++)
+			{
+				uint8_t* row_texels = band_texels.data() + ((y - y_begin) * row_bytes);
+				ConvertRow(read_row(y, z, scratch.data()), row_texels, x_size, scale, layout.format);
+				changed = changed || RowChanged(row_texels, texels.data() + layout.Offset(y, z), x_size, layout.format, threshold, scratch.data());
+			}
+			if(!changed)
+			{
+				continue;
+			}
+
+			for(int32_t y = y_begin; y < y_end; y++)
+			{
+				std::memcpy(texels.data() + layout.Offset(y, z), band_texels.data() + ((y - y_begin) * row_bytes), row_bytes);
+			}
+			changed_bands[band] = 1;
+		}
+	});
+
+	out_regions.clear();
+	if(fresh)
+	{
+		out_regions.push_back({ 0, 0, layout.GetWidth(), layout.GetHeight() });
+		return;
+	}
+
+	//runs of changed bands down a slice become one region, which joins a region of the slice to its left covering the same rows
+	std::vector<int32_t> left_regions;
+	std::vector<int32_t> slice_regions;
+	for(int32_t z = 0; z < z_size; z++)
+	{
+		if(z % layout.tiles_x == 0)
+		{
+			left_regions.clear();
+		}
+		slice_regions.clear();
+
+		for(int32_t band = 0; band < slice_bands; band++)
+		{
+			if(!changed_bands[(z * slice_bands) + band])
+			{
+				continue;
+			}
+
+			const int32_t y_begin = band * rows;
+			int32_t run_end = band + 1;
+			while(run_end < slice_bands && changed_bands[(z * slice_bands) + run_end])
+			{
+				run_end++;
+			}
+			const FCloudTextureRegion run = { layout.GetSliceX(z), layout.GetSliceY(z) + y_begin, x_size, std::min(run_end * rows, y_size) - y_begin };
+			band = run_end - 1;
+
+			auto joined = std::find_if(left_regions.begin(), left_regions.end(), [&out_regions, &run](int32_t region)
+			{
+				return out_regions[region].y == run.y && out_regions[region].height == run.height;
+			});
+			if(joined != left_regions.end())
+			{
+				out_regions[*joined].width += run.width;
+				slice_regions.push_back(*joined);
+			}
+			else
+			{
+				slice_regions.push_back((int32_t)out_regions.size());
+				out_regions.push_back(run);
+			}
+		}
+		left_regions.swap(slice_regions);
+	}
+}
+
+bool FCloudTextureWriter::Write(const FCloudLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, uint8_t* out_texels) const
+{
+	if(!Matches(layout, lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize()))
+	{
+		return false;
+	}
+	WriteRows(layout, scale, out_texels, RowReader(lattice, channel));
+	return true;
+}
+
+bool FCloudTextureWriter::Write(const FCloudSparseLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, uint8_t* out_texels) const
+{
+	if(!Matches(layout, lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize()))
+	{
+		return false;
+	}
+	WriteRows(layout, scale, out_texels, RowReader(lattice, channel));
+	return true;
+}
+
+bool FCloudTextureWriter::Write(const FCloudPackedLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, uint8_t* out_texels) const
+{
+	if(!Matches(layout, lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize()))
+	{
+		return false;
+	}
+	WriteRows(layout, scale, out_texels, RowReader(lattice, channel));
+	return true;
+}
+
+bool FCloudTextureWriter::WriteChanged(const FCloudLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, float threshold, std::vector<FCloudTextureRegion>& out_regions)
+{
+	if(!Matches(layout, lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize()))
+	{
+		return false;
+	}
+	WriteChangedRows(layout, scale, threshold, out_regions, RowReader(lattice, channel));
+	return true;
+}
+
+bool FCloudTextureWriter::WriteChanged(const FCloudSparseLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, float threshold, std::vector<FCloudTextureRegion>& out_regions)
+{
+	if(!Matches(layout, lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize()))
+	{
+		return false;
+	}
+	WriteChangedRows(layout, scale, threshold, out_regions, RowReader(lattice, channel));
+	return true;
+}
+
+bool FCloudTextureWriter::WriteChanged(const FCloudPackedLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, float threshold, std::vector<FCloudTextureRegion>& out_regions)
+{
+	if(!Matches(layout, lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize()))
+	{
+		return false;
+	}
+	WriteChangedRows(layout, scale, threshold, out_regions, RowReader(lattice, channel));
+	return true;
+}
+
+void FCloudTextureWriter::Invalidate()
+{
+	std::vector<uint8_t>().swap(texels);
+	std::vector<uint8_t>().swap(changed_bands);
+	texels_layout = FCloudTextureLayout();
+}
+
+int32_t FCloudTextureWriter::GetPackedRowPitch(const std::vector<FCloudTextureRegion>& regions) const
+{
+	int32_t width = 0;
+	for(const FCloudTextureRegion& region : regions)
+	{
+		width = std::max(width, region.width);
+	}
+	return width * texels_layout.GetBytesPerTexel();
+}
+
+int32_t FCloudTextureWriter::GetPackedRows(const std::vector<FCloudTextureRegion>& regions)
+{
+	int32_t rows = 0;
+	for(const FCloudTextureRegion& region : regions)
+	{
+		rows += region.height;
+	}
+	return rows;
+}
+
+void FCloudTextureWriter::PackRegions(const std::vector<FCloudTextureRegion>& regions, uint8_t* out_texels) const
+{
+	const int32_t bytes_per_texel = texels_layout.GetBytesPerTexel();
+	const size_t pitch = (size_t)GetPackedRowPitch(regions);
+	for(const FCloudTextureRegion& region : regions)
+	{
+		for(int32_t y = region.y; y < region.y + region.height; y++)
+		{
+			std::memcpy(out_texels, texels.data() + ((size_t)y * texels_layout.GetRowPitch()) + ((size_t)region.x * bytes_per_texel), (size_t)region.width * bytes_per_texel);
+			out_texels += pitch;
+		}
+	}
+}
@@ -0,0 +1,63 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudThermodynamics.h"
+#include "CloudSimKernels.h"
+#include <algorithm>
+#include <cmath>
+
+bool FCloudThermodynamics::Update(int32_t in_z_size, float in_z_world_size, const FCloudLapseProfile& in_profile)
+{
+	in_z_size = std::max(in_z_size, 0);
+	if(in_z_size == z_size && in_z_world_size == z_world_size && in_profile == profile)
+	{
+		return false;
+	}
+
+	z_size = in_z_size;
+	z_world_size = in_z_world_size;
+	profile = in_profile;
+
+	temperatures.resize(z_size);
+	max_water_vapor.resize(z_size);
+	for(int32_t z = 0; z < z_size; z++)
+	{
+		temperatures[z] = TemperatureAt(HeightOf(z, z_size, z_world_size), profile);
+		max_water_vapor[z] = MaxWaterVaporAt(temperatures[z]);
+	}
+	return true;
+}
+
+//the original simulation divided z by z_sim_size as integers, which left every cell at ground level
+float FCloudThermodynamics::HeightOf(int32_t z, int32_t z_size, float z_world_size)
+{
+	return z_size > 0 ? ((float)z / (float)z_size) * z_world_size : 0.f;
+}
+
+float FCloudThermodynamics::TemperatureAt(float height, const FCloudLapseProfile& profile)
+{
+	float temperature = profile.surface_temperature;
+	const int32_t num_layers = (int32_t)profile.layers.size();
+	for(int32_t layer = 0; layer < num_layers; layer++)
+	{
+		const float base = layer == 0 ? 0.f : profile.layers[layer].base_height;
+		const float top = layer + 1 < num_layers ? profile.layers[layer + 1].base_height : height;
+		const float depth = std::min(height, top) - base;
+		if(depth <= 0.f && layer > 0)
+		{
+			break;
+		}
+		temperature -= profile.layers[layer].lapse_rate * depth;
+	}
+	return temperature;
+}
+
+//the table is only built when the profile changes, so it keeps the original double precision exp rather than the polynomial one
+float FCloudThermodynamics::MaxWaterVaporAt(float temperature)
+{
+	return (float)((217 * std::exp(19.482 - (4303.4 / (temperature - 29.5)))) / temperature);
+}
+
+void FCloudThermodynamics::MaxWaterVaporField(const float* temperature, float* out_max_water_vapor, int32_t count)
+{
+	CloudSimKernels::SaturationRange(temperature, out_max_water_vapor, count);
+}
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include <algorithm>
+#include <vector>
+
+//activity tiles are CloudActivityTileSize rows along y by CloudActivityTileSize planes along z and span the whole x extent,
+//so a tile is always made of whole rows and the vectorised row kernels still apply to it
+static constexpr int32_t CloudActivityTileBits = 2;
+static constexpr int32_t CloudActivityTileSize = 1 << CloudActivityTileBits;
+
+//bits held for each tile
+enum class ECloudActivity : uint16_t
+{
+	//the tile's velocity has changed since the velocity stage last started on it
+	DirtyVelocity = 1 << 0,
+	//the tile's water vapor has changed since the diffusion stage last started on it
+	DirtyDiffuse = 1 << 1,
+	//the tile's water vapor or droplets have changed since the phase transition last started on it
+	DirtyTransition = 1 << 2,
+	//some velocity in the tile is not 0, so advection can move water into or out of it
+	Moving = 1 << 3,
+	//the scatter added water into the tile's advection channels this step
+	Received = 1 << 4,
+
+	//the tile was run the last time each stage was swept, indexed from here by ECloudSimStage
+	RanVelocity = 1 << 5,
+	RanDiffuse = 1 << 6,
+	RanAdvect1 = 1 << 7,
+	RanAdvect2 = 1 << 8,
+	RanTransition = 1 << 9,
+
+	All = (1 << 10) - 1
+};
+
+//one set of ECloudActivity bits for every tile of a lattice, see FCloudSimParams::activity_mask
+//tiles are numbered tile_y + (tiles_y * tile_z), tasks working on different tile_y only ever write their own tiles
+class CLOUDSIMCORE_API FCloudActivityMask
+{
+public:
+	//sizes the mask for a lattice y_size rows wide and z_size planes tall, with every bit set
+	void Init(int32_t y_size, int32_t z_size);
+
+	//sets every bit of every tile, for when the lattice has been written by something that does not track activity
+	void MarkAll();
+
+	inline int32_t TileIndex(int32_t tile_y, int32_t tile_z) const { return tile_y + (tile_z * tiles_y); }
+
+	//tile holding a row, -1 outside the lattice
+	inline int32_t TileOfRow(int32_t y, int32_t z) const
+	{
+		return (y >= 0 && y < y_size && z >= 0 && z < z_size) ? TileIndex(y >> CloudActivityTileBits, z >> CloudActivityTileBits) : -1;
+	}
+
+	inline bool Has(int32_t tile, ECloudActivity bit) const { return (bits[tile] & (uint16_t)bit) != 0; }
+	inline void Set(int32_t tile, ECloudActivity bit) { bits[tile] |= (uint16_t)bit; }
+	inline void Clear(int32_t tile, ECloudActivity bit) { bits[tile] &= ~(uint16_t)bit; }
+	inline uint16_t GetBits(int32_t tile) const { return bits[tile]; }
+
+	//sets bit on the tiles holding the rows (y, z), (y + 1, z), (y, z + 1) and (y + 1, z + 1), the rows one scattered cell writes into
+	inline void SetAround(int32_t y, int32_t z, ECloudActivity bit)
+	{
+		const int32_t tile_y = y >> CloudActivityTileBits;
+		const int32_t tile_z = z >> CloudActivityTileBits;
+		const int32_t next_y = std::min((y + 1) >> CloudActivityTileBits, tiles_y - 1);
+		const int32_t next_z = std::min((z + 1) >> CloudActivityTileBits, tiles_z - 1);
+		Set(TileIndex(tile_y, tile_z), bit);
+		Set(TileIndex(next_y, tile_z), bit);
+		Set(TileIndex(tile_y, next_z), bit);
+		Set(TileIndex(next_y, next_z), bit);
+	}
+
+	//number of tiles with bit set
+	int32_t Count(ECloudActivity bit) const;
+
+	//first row and plane of a tile and one past the last
+	inline int32_t TileYBegin(int32_t tile_y) const { return tile_y << CloudActivityTileBits; }
+	inline int32_t TileYEnd(int32_t tile_y) const { return std::min((tile_y + 1) << CloudActivityTileBits, y_size); }
+	inline int32_t TileZBegin(int32_t tile_z) const { return tile_z << CloudActivityTileBits; }
+	inline int32_t TileZEnd(int32_t tile_z) const { return std::min((tile_z + 1) << CloudActivityTileBits, z_size); }
+
+	int32_t GetTilesY() const { return tiles_y; }
+	int32_t GetTilesZ() const { return tiles_z; }
+	int32_t NumTiles() const { return (int32_t)bits.size(); }
+
+	int32_t GetYSize() const { return y_size; }
+	int32_t GetZSize() const { return z_size; }
+
+private:
+	int32_t y_size = 0;
+	int32_t z_size = 0;
+	int32_t tiles_y = 0;
+	int32_t tiles_z = 0;
+
+	std::vector<uint16_t> bits;
+};
@@ -0,0 +1,249 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include <new>
+#include <vector>
+
+//every value stored per cell, each one lives in its own contiguous channel
+enum class ECloudChannel : uint8_t
+{
+	VelocityX,
+	VelocityY,
+	VelocityZ,
+	WaterVapor,
+	WaterDroplets,
+	AdvectWaterVapor,
+	AdvectWaterDroplets,
+	Num
+};
+
+//what the one cell halo around a padded lattice holds
+enum class ECloudBoundary : uint8_t
+{
+	//every halo cell is 0, reproducing the results of an unpadded lattice
+	Zero,
+	//each halo cell takes the value of the nearest cell inside the lattice
+	Clamp,
+	//each halo cell takes the value from the opposite side of the lattice
+	Periodic,
+	//every halo cell is a fixed value, see FCloudSimParams::inflow
+	Inflow
+};
+
+//order the cells of a lattice are stored in within each channel
+enum class ECloudCellOrder : uint8_t
+{
+	//x fastest, then y, then z, so every row along x is contiguous
+	Linear,
+	//Morton (z-order), the bits of x, y and z are interleaved so cells that are close along any axis are close in memory
+	//each axis is rounded up to a power of two, an axis that runs out of bits drops out of the interleave so flat lattices are not padded out to a cube
+	Morton
+};
+
+//channels are aligned to a cache line so whole rows can be loaded straight into vector registers
+static constexpr size_t CloudChannelAlignment = 64;
+
+//std::allocator replacement that hands out memory aligned to Alignment bytes
+template<typename T, size_t Alignment>
+struct TCloudAlignedAllocator
+{
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef TCloudAlignedAllocator<U, Alignment> other;
+	};
+
+	TCloudAlignedAllocator() = default;
+
+	template<typename U>
+	TCloudAlignedAllocator(const TCloudAlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+	}
+
+	void deallocate(T* ptr, size_t)
+	{
+		::operator delete(ptr, std::align_val_t(Alignment));
+	}
+
+	template<typename U>
+	bool operator==(const TCloudAlignedAllocator<U, Alignment>&) const { return true; }
+
+	template<typename U>
+	bool operator!=(const TCloudAlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+typedef std::vector<float, TCloudAlignedAllocator<float, CloudChannelAlignment>> FCloudChannelArray;
+
+//flat structure-of-arrays lattice
+//cells are stored x fastest, then y, then z, matching the order the simulator walks the lattice, unless set to Morton order
+//a padded lattice stores a one cell halo around every side, so stencils can read one cell past any edge without checking for it
+//cells in the halo are at x, y or z of -1 and x_size, y_size or z_size, and only hold what RefreshHalo() last put there
+//the velocity and water vapor channels can optionally be double buffered, so stencil stages read the front buffer,
+//write the back buffer and swap once the whole stage has finished instead of updating cells in place
+//the advection channels are transient, they hold no storage unless a block has been swapped in with SwapChannelStorage(),
+//which FCloudSolver does from its FCloudScratchArena for the stages that use them, so between steps a cell costs 20 bytes rather than 28
+struct CLOUDSIMCORE_API FCloudLattice
+{
+	//allocates every channel that is not transient for a lattice of the given size and sets every value to 0, transient channels are freed
+	void Init(int32_t in_x_size, int32_t in_y_size, int32_t in_z_size);
+
+	//allocates or releases the back buffers, the front buffers are left untouched
+	void SetDoubleBuffered(bool in_double_buffered);
+
+	inline bool IsDoubleBuffered() const { return double_buffered; }
+
+	//adds or removes the halo, keeping the value of every cell inside the lattice, a new halo starts at 0
+	void SetPadded(bool in_padded);
+
+	inline bool IsPadded() const { return halo > 0; }
+
+	//moves every cell to its place in the new order, keeping its value, see ECloudCellOrder
+	void SetCellOrder(ECloudCellOrder in_cell_order);
+
+	inline ECloudCellOrder GetCellOrder() const { return cell_order; }
+
+	//only the channels written by stencil stages have a back buffer
+	static inline bool HasBackBuffer(ECloudChannel channel)
+	{
+		return channel == ECloudChannel::VelocityX || channel == ECloudChannel::VelocityY || channel == ECloudChannel::VelocityZ || channel == ECloudChannel::WaterVapor;
+	}
+
+	//channels only allocated while a step is using them, see SwapChannelStorage()
+	static inline bool IsTransient(ECloudChannel channel)
+	{
+		return channel == ECloudChannel::AdvectWaterVapor || channel == ECloudChannel::AdvectWaterDroplets;
+	}
+
+	//true when the channel holds storage, always true for channels that are not transient once the lattice has been initialised
+	inline bool HasChannel(ECloudChannel channel) const { return !channels[(int32_t)channel].empty(); }
+
+	//sets every value in every channel to 0
+	void Zero();
+
+	//releases all channel memory
+	void Empty();
+
+	//makes this lattice the same size as other and copies its front buffers, back buffers are not copied
+	//existing allocations are reused when the size has not changed
+	void CopyFrom(const FCloudLattice& other);
+
+	inline int32_t Index(int32_t x, int32_t y, int32_t z) const
+	{
+		if(cell_order == ECloudCellOrder::Morton)
+		{
+			return morton_x[x + halo] | morton_y[y + halo] | morton_z[z + halo];
+		}
+		return (x + halo) + ((y + halo) * pitch_x) + ((z + halo) * pitch_x * pitch_y);
+	}
+
+	//index of the cell dx, dy and dz away from the cell (x, y, z) stored at i, a fixed stride away when the rows are contiguous
+	inline int32_t Neighbour(int32_t i, int32_t x, int32_t y, int32_t z, int32_t dx, int32_t dy, int32_t dz) const
+	{
+		return HasContiguousRows() ? i + dx + (dy * StrideY()) + (dz * StrideZ()) : Index(x + dx, y + dy, z + dz);
+	}
+
+	//distance in floats between neighbouring cells along each axis, only meaningful when HasContiguousRows()
+	inline int32_t StrideX() const { return 1; }
+	inline int32_t StrideY() const { return pitch_x; }
+	inline int32_t StrideZ() const { return pitch_x * pitch_y; }
+
+	//cells inside the lattice
+	inline int32_t Num() const { return x_size * y_size * z_size; }
+
+	//floats stored per channel, the same as Num() unless padded or in Morton order
+	inline int32_t NumStored() const { return num_stored; }
+
+	//true when every row along x is stored as one run of floats, which is what the vectorised kernels need
+	inline bool HasContiguousRows() const { return cell_order == ECloudCellOrder::Linear; }
+
+	//true when the rows of a z plane follow on from each other with no halo between them
+	inline bool HasContiguousPlanes() const { return halo == 0 && HasContiguousRows(); }
+
+	inline bool IsValidCell(int32_t x, int32_t y, int32_t z) const
+	{
+		return x >= 0 && x < x_size && y >= 0 && y < y_size && z >= 0 && z < z_size;
+	}
+
+	inline float* Channel(ECloudChannel channel)
+	{
+		return channels[(int32_t)channel].data();
+	}
+
+	inline const float* Channel(ECloudChannel channel) const
+	{
+		return channels[(int32_t)channel].data();
+	}
+
+	//buffer stages should write to, this is the front buffer itself when double buffering is off
+	inline float* BackChannel(ECloudChannel channel)
+	{
+		return (double_buffered && HasBackBuffer(channel)) ? back_channels[(int32_t)channel].data() : Channel(channel);
+	}
+
+	//makes the back buffer of a channel the front buffer, does nothing when double buffering is off
+	void SwapChannel(ECloudChannel channel);
+
+	//swaps all three velocity channels
+	void SwapVelocity();
+
+	//exchanges the storage of two front channels
+	void SwapChannels(ECloudChannel a, ECloudChannel b);
+
+	//exchanges the storage of a front channel with storage, which must be empty or hold NumStored() floats
+	//swapping a block in attaches it to a transient channel, swapping an empty array in takes the block back out
+	void SwapChannelStorage(ECloudChannel channel, FCloudChannelArray& storage);
+
+	//sets every value in one front channel to 0
+	void ZeroChannel(ECloudChannel channel);
+
+	//fills the halo of one front channel for the given boundary, inflow_value is only used by ECloudBoundary::Inflow
+	//does nothing when the lattice is not padded
+	void RefreshHalo(ECloudChannel channel, ECloudBoundary boundary, float inflow_value = 0.f);
+
+	//total bytes held by every channel, transient channels only count while they are attached
+	size_t GetAllocatedSize() const;
+
+	int32_t GetXSize() const { return x_size; }
+	int32_t GetYSize() const { return y_size; }
+	int32_t GetZSize() const { return z_size; }
+
+private:
+	int32_t x_size = 0;
+	int32_t y_size = 0;
+	int32_t z_size = 0;
+
+	//halo width on every side (0 or 1) and the stored size along each axis including it
+	int32_t halo = 0;
+	int32_t pitch_x = 0;
+	int32_t pitch_y = 0;
+	int32_t pitch_z = 0;
+
+	bool double_buffered = false;
+
+	ECloudCellOrder cell_order = ECloudCellOrder::Linear;
+
+	//part of the index held by each coordinate plus halo in Morton order, the three parts never share a bit
+	std::vector<int32_t> morton_x;
+	std::vector<int32_t> morton_y;
+	std::vector<int32_t> morton_z;
+
+	int32_t num_stored = 0;
+
+	//works out the pitches, and the Morton tables when in Morton order, from the size and halo
+	void UpdatePitches();
+
+	//moves every cell inside the lattice to its place under a new order and halo
+	void Relayout(ECloudCellOrder new_cell_order, int32_t new_halo);
+
+	FCloudChannelArray channels[(int32_t)ECloudChannel::Num];
+
+	//only allocated for channels where HasBackBuffer() is true and double buffering is on
+	FCloudChannelArray back_channels[(int32_t)ECloudChannel::Num];
+};
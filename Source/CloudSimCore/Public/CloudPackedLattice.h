@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudLattice.h"
+#include <vector>
+
+//how a channel of a FCloudPackedLattice is stored, values are always unpacked to floats before any maths is done with them
+enum class ECloudPrecision : uint8_t
+{
+	//32 bit float, exactly as FCloudLattice stores it
+	Float32,
+	//IEEE 754 half float, 11 significant bits up to +-65504, rounded to the nearest even value
+	Float16,
+	//16 bit signed fixed point, evenly spaced steps of range / 32767 between -range and range, values outside are clamped
+	Fixed16,
+
+	Num
+};
+
+//converts count values to and from 16 bit storage, precision must be Float16 or Fixed16
+CLOUDSIMCORE_API void CloudPackValues(const float* values, uint16_t* out_packed, int32_t count, ECloudPrecision precision, float range);
+CLOUDSIMCORE_API void CloudUnpackValues(const uint16_t* packed, float* out_values, int32_t count, ECloudPrecision precision, float range);
+
+//the velocity and water channels of a lattice, each stored at its own precision, cells stored x fastest, then y, then z
+//the advection channels are scratch space that only lives through a step, so they are not stored at all and read as 0
+//with every channel at Float16 or Fixed16 a cell costs 10 bytes rather than the 20 a FCloudLattice cell keeps between steps
+class CLOUDSIMCORE_API FCloudPackedLattice
+{
+public:
+	//sizes the lattice with every value at 0, keeping the precision of each channel
+	void Init(int32_t in_x_size, int32_t in_y_size, int32_t in_z_size);
+
+	//sets every value to 0
+	void Zero();
+
+	//frees every channel
+	void Empty();
+
+	//makes this lattice an exact copy of other, precisions included
+	void CopyFrom(const FCloudPackedLattice& other);
+
+	//stores each channel at precision[channel], Fixed16 channels covering fixed_range[channel] either side of 0, both indexed by ECloudChannel
+	//channels that change are converted in place, so values only lose what the new precision cannot hold
+	void SetPrecision(const ECloudPrecision* precision, const float* fixed_range);
+
+	ECloudPrecision GetPrecision(ECloudChannel channel) const { return channels[(int32_t)channel].precision; }
+	float GetFixedRange(ECloudChannel channel) const { return channels[(int32_t)channel].range; }
+
+	//sizes the lattice to match dense and packs every value of its velocity and water channels
+	void LoadFrom(const FCloudLattice& dense);
+
+	//writes every cell into dense, which is resized to match, leaving its transient advection channels unallocated
+	void StoreTo(FCloudLattice& dense) const;
+
+	//false for the advection channels
+	static inline bool IsStored(ECloudChannel channel) { return channel < ECloudChannel::AdvectWaterVapor; }
+
+	inline int32_t Index(int32_t x, int32_t y, int32_t z) const { return x + (x_size * (y + (y_size * z))); }
+
+	inline bool IsValidCell(int32_t x, int32_t y, int32_t z) const
+	{
+		return x >= 0 && x < x_size && y >= 0 && y < y_size && z >= 0 && z < z_size;
+	}
+
+	//value of a cell, 0 outside the lattice or in a channel that is not stored
+	float Get(ECloudChannel channel, int32_t x, int32_t y, int32_t z) const;
+	float Get(ECloudChannel channel, int32_t i) const;
+
+	//does nothing outside the lattice or in a channel that is not stored
+	void Set(ECloudChannel channel, int32_t x, int32_t y, int32_t z, float value);
+
+	//unpacks or packs count cells of a stored channel starting at cell i, normally a whole or part row
+	void Unpack(ECloudChannel channel, int32_t i, int32_t count, float* out_values) const;
+	void Pack(ECloudChannel channel, int32_t i, int32_t count, const float* values);
+
+	int32_t GetXSize() const { return x_size; }
+	int32_t GetYSize() const { return y_size; }
+	int32_t GetZSize() const { return z_size; }
+	int32_t Num() const { return x_size * y_size * z_size; }
+
+	size_t GetAllocatedSize() const;
+
+private:
+	struct FChannel
+	{
+		ECloudPrecision precision = ECloudPrecision::Float32;
+		float range = 1.f;
+
+		//only the one matching precision is allocated
+		std::vector<float> floats;
+		std::vector<uint16_t> packed;
+	};
+
+	//sizes storage to match precision, with every value at 0
+	void Allocate(FChannel& channel);
+
+	int32_t x_size = 0;
+	int32_t y_size = 0;
+	int32_t z_size = 0;
+
+	FChannel channels[(int32_t)ECloudChannel::AdvectWaterVapor];
+};
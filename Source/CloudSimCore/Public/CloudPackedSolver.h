@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudSolver.h"
+#include "CloudPackedLattice.h"
+#include "CloudScratchArena.h"
+#include <atomic>
+#include <vector>
+
+//the cloud simulation run over a FCloudPackedLattice, so at 16 bit precision a cell takes 18 bytes with the accumulators rather than 28 and most stages move half the memory
+//every stage unpacks the rows it works on into floats, runs the same kernels as FCloudSolver over them and packs the results back:
+//- the velocity and diffusion stencils walk each y row by row up z, keeping the updated row below as floats, so they still update in place
+//- the advection accumulators are float blocks taken from the solver's FCloudScratchArena for the advection stages rather than channels of the lattice
+//with every channel at Float32 the result matches FCloudSolver exactly, at 16 bits each stage rounds what it writes
+//stencils always update in place over whole rows and the row kernels are used throughout, so double_buffered, padded, cell_order,
+//stencil_block, wavefront, fuse_stages, activity_mask, private_scatter and use_simd are ignored
+class CLOUDSIMCORE_API FCloudPackedSolver
+{
+public:
+	FCloudPackedSolver();
+
+	//sizes the lattice with every value at 0, at the precisions in the params
+	void Init(int32_t x_size, int32_t y_size, int32_t z_size);
+
+	FCloudPackedLattice& GetLattice() { return lattice; }
+	const FCloudPackedLattice& GetLattice() const { return lattice; }
+
+	FCloudSimParams& GetParams() { return params; }
+	const FCloudSimParams& GetParams() const { return params; }
+
+	void SetParallelFor(const FCloudParallelFor& in_parallel_for) { parallel_for = in_parallel_for; }
+
+	//applies precision and advection scheme changes from the params, only call between steps
+	void ApplyPendingSettings();
+
+	ECloudAdvectionScheme GetActiveAdvectionScheme() const { return active_advection_scheme; }
+
+	//runs a whole stage, finishes it and returns the stage that follows it
+	ECloudSimStage SweepStage(ECloudSimStage stage);
+
+	//applies pending settings and sweeps every stage of one step
+	void RunStep();
+
+	//max amount of water vapor a cell at height z can hold, see FCloudSolver::MaxWaterVapor()
+	float MaxWaterVapor(int32_t z) const { return thermodynamics.MaxWaterVapor(z); }
+
+	//the lattice plus the advection accumulators, whether attached or held by the scratch arena
+	size_t GetAllocatedSize() const;
+
+	//cells run and steps finished since the last call, safe to call while other threads are simulating
+	int64_t TakeCellsProcessed() { return cells_processed.exchange(0); }
+	int32_t TakeCompletedSteps() { return completed_steps.exchange(0); }
+
+private:
+	//velocity and diffusion, a task per slab of rows along y, each y walked up z
+	void SweepStencil(ECloudSimStage stage);
+
+	//the scatter on one thread, walking every cell in the same order as FCloudSolver
+	void SweepScatter();
+
+	//the gather, a task per batch of rows, the results are packed into the water channels once every cell has sampled them
+	void SweepGather();
+
+	//Advect2 and Transition, a task per batch of rows
+	void SweepRows(ECloudSimStage stage);
+
+	//takes the accumulators from the scratch arena if they are not held already, and hands them back
+	void AcquireAccumulators(bool zeroed);
+	void ReturnAccumulators(bool zeroed);
+
+	FCloudPackedLattice lattice;
+	FCloudSimParams params;
+	FCloudParallelFor parallel_for;
+
+	ECloudAdvectionScheme active_advection_scheme = ECloudAdvectionScheme::Scatter;
+	FCloudThermodynamics thermodynamics;
+
+	//what FCloudSolver keeps in the advection channels, only held from the start of Advect1 to the end of the stage that folds them in
+	FCloudScratchArena scratch;
+	FCloudChannelArray A_water_vapor;
+	FCloudChannelArray A_water_droplets;
+
+	std::atomic<int64_t> cells_processed { 0 };
+	std::atomic<int32_t> completed_steps { 0 };
+};
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudLattice.h"
+#include <vector>
+
+//lattice sized blocks of floats for buffers that only live through part of a step, like the advection accumulators
+//every block is the same size, set once per lattice, and blocks that are handed back are kept for the next step,
+//so a running simulation allocates nothing until Release() frees them
+//blocks move in and out by swapping vector storage, so a block can be attached to a lattice channel without copying it
+//not thread safe, blocks are only taken and handed back between stages
+class CLOUDSIMCORE_API FCloudScratchArena
+{
+public:
+	//frees every block held for reuse if the size has changed
+	void SetBlockSize(int32_t in_block_size);
+
+	int32_t GetBlockSize() const { return block_size; }
+
+	//swaps a block into out_block, whatever out_block held before is freed
+	//zeroed asks for every value to be 0, otherwise the block can hold whatever it was last used for
+	void Acquire(FCloudChannelArray& out_block, bool zeroed = true);
+
+	//takes a block back for reuse and leaves block empty, zeroed says every value is already 0 so the next Acquire() can skip clearing it
+	//blocks of the wrong size are freed
+	void Return(FCloudChannelArray& block, bool zeroed);
+
+	//frees every block held for reuse, blocks handed out are not affected
+	void Release();
+
+	int32_t NumFree() const { return (int32_t)free_blocks.size(); }
+
+	//bytes of the blocks held for reuse, blocks handed out are counted by whoever holds them
+	size_t GetAllocatedSize() const;
+
+private:
+	struct FBlock
+	{
+		FCloudChannelArray values;
+		bool zeroed = false;
+	};
+
+	int32_t block_size = 0;
+	std::vector<FBlock> free_blocks;
+};
@@ -0,0 +1,298 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudSolver.h"
+#include "CloudPackedLattice.h"
+#include "CloudSparseLattice.h"
+#include "CloudTextureWriter.h"
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+//ways of storing the lattice compared by the benchmark suite
+enum class ECloudBenchLayout : uint8_t
+{
+	//FCloudSolver itself, the production structure-of-arrays lattice with the vectorised kernels
+	Solver,
+	//array of structures, every value of a cell next to each other like FCloudCellData
+	AoS,
+	//one flat array per channel, x fastest
+	SoA,
+	//one array per channel with cells in Morton (z-order) order, the extents are rounded up to a power of two cube
+	Morton,
+	//one array per channel made of 8x8x8 bricks, with the bricks and the cells inside them stored x fastest
+	Bricked,
+	//one array per channel with a one cell halo around the lattice and rows padded to a multiple of 16 floats
+	Padded,
+	Num
+};
+
+//what one benchmark sample runs, a single stage over the whole lattice or a whole step
+enum class ECloudBenchStage : uint8_t
+{
+	Velocity,
+	Diffuse,
+	Advect1,
+	Advect2,
+	Transition,
+	Step,
+	Num
+};
+
+CLOUDSIMCORE_API const char* CloudBenchLayoutName(ECloudBenchLayout layout);
+CLOUDSIMCORE_API const char* CloudBenchStageName(ECloudBenchStage stage);
+
+//turns a name given by the functions above back into its enum, ignoring case, returns false if the name is unknown
+CLOUDSIMCORE_API bool ParseCloudBenchLayout(const std::string& name, ECloudBenchLayout& out_layout);
+CLOUDSIMCORE_API bool ParseCloudBenchStage(const std::string& name, ECloudBenchStage& out_stage);
+
+//every combination of size, layout, thread count and stage is measured
+struct FCloudBenchConfig
+{
+	std::vector<FCloudCellCoord> sizes = { { 50, 50, 16 } };
+	std::vector<ECloudBenchLayout> layouts = { ECloudBenchLayout::Solver, ECloudBenchLayout::AoS, ECloudBenchLayout::SoA, ECloudBenchLayout::Morton, ECloudBenchLayout::Bricked, ECloudBenchLayout::Padded };
+	//0 uses one thread per hardware thread
+	std::vector<int32_t> thread_counts = { 1 };
+	std::vector<ECloudBenchStage> stages = { ECloudBenchStage::Velocity, ECloudBenchStage::Diffuse, ECloudBenchStage::Advect1, ECloudBenchStage::Advect2, ECloudBenchStage::Transition, ECloudBenchStage::Step };
+
+	//samples run and thrown away before measuring, then samples measured
+	int32_t warmup = 3;
+	int32_t repetitions = 20;
+
+	//the lattice is refilled from this seed before every sample, so every layout works on the same values
+	uint32_t seed = 1;
+
+	//coefficients and batching for every layout, only FCloudSolver looks at use_simd, double_buffered and advection_scheme
+	//the other layouts always update in place and scatter, like the default solver settings
+	FCloudSimParams params;
+};
+
+struct FCloudBenchResult
+{
+	ECloudBenchLayout layout = ECloudBenchLayout::Solver;
+	FCloudCellCoord size;
+	int32_t threads = 1;
+	ECloudBenchStage stage = ECloudBenchStage::Velocity;
+	int32_t repetitions = 0;
+
+	//time per sample in microseconds, percentiles are nearest rank
+	double min_us = 0.0;
+	double mean_us = 0.0;
+	double p50_us = 0.0;
+	double p90_us = 0.0;
+	double p99_us = 0.0;
+	double max_us = 0.0;
+
+	//lattice cells covered per second at the median time, a step counts every cell once per stage it runs
+	double cells_per_second = 0.0;
+
+	//memory held by the lattice
+	size_t bytes = 0;
+};
+
+//runs every combination in config, calling on_result as each one finishes
+CLOUDSIMCORE_API std::vector<FCloudBenchResult> RunCloudBenchmarks(const FCloudBenchConfig& config, const std::function<void(const FCloudBenchResult&)>& on_result = nullptr);
+
+//one line per result with a header line first
+CLOUDSIMCORE_API void WriteCloudBenchCsv(std::ostream& out, const std::vector<FCloudBenchResult>& results);
+
+//fixed width columns for reading in a terminal or log
+CLOUDSIMCORE_API std::string CloudBenchTableHeader();
+CLOUDSIMCORE_API std::string FormatCloudBenchResult(const FCloudBenchResult& result);
+
+//one stencil block size tried by CloudTuneStencilBlock()
+struct FCloudBlockTiming
+{
+	FCloudCellCoord block;
+
+	//median time of a velocity sweep followed by a diffusion sweep, in microseconds
+	double p50_us = 0.0;
+};
+
+struct FCloudBlockTuneResult
+{
+	//fastest FCloudSimParams::stencil_block found
+	FCloudCellCoord best;
+
+	//every size tried, in the order they were tried
+	std::vector<FCloudBlockTiming> timings;
+};
+
+//times the velocity and diffusion sweeps of a lattice of the given size over a range of FCloudSimParams::stencil_block sizes
+//every other setting comes from params, so the block is tuned for the cell order, buffering and SIMD the simulation will run with
+//the axes are tuned one at a time, y, then z, then x, keeping the best size found so far along the others, starting from whole lattice blocks
+//sizes are 0 and the powers of two below the lattice's extent, so a few dozen are tried at most
+CLOUDSIMCORE_API FCloudBlockTuneResult CloudTuneStencilBlock(FCloudCellCoord size, const FCloudSimParams& params, const FCloudParallelFor& parallel_for, int32_t repetitions = 5, uint32_t seed = 1);
+
+CLOUDSIMCORE_API const char* CloudCellOrderName(ECloudCellOrder cell_order);
+CLOUDSIMCORE_API bool ParseCloudCellOrder(const std::string& name, ECloudCellOrder& out_cell_order);
+
+CLOUDSIMCORE_API const char* CloudPrecisionName(ECloudPrecision precision);
+CLOUDSIMCORE_API bool ParseCloudPrecision(const std::string& name, ECloudPrecision& out_precision);
+
+CLOUDSIMCORE_API const char* CloudTextureFormatName(ECloudTextureFormat format);
+CLOUDSIMCORE_API bool ParseCloudTextureFormat(const std::string& name, ECloudTextureFormat& out_format);
+
+//starting states for a scenario run, matching the modes ACloudSimulator can be switched between
+enum class ECloudScenario : uint8_t
+{
+	//empty lattice with water vapor added along the z = 0 plane, what the Z key starts
+	VaporSource,
+	//droplets filling the positive x half of the lattice, the first pattern of the X key test
+	HalfandHalf,
+	//each of the 8 octants filled with a different droplet density, the C key test
+	DifferentDensities,
+	Num
+};
+
+CLOUDSIMCORE_API const char* CloudScenarioName(ECloudScenario scenario);
+CLOUDSIMCORE_API bool ParseCloudScenario(const std::string& name, ECloudScenario& out_scenario);
+
+//adds 0.1 water vapor to every cell of the z = 0 plane
+CLOUDSIMCORE_API void CloudAddVaporSource(FCloudLattice& lattice);
+CLOUDSIMCORE_API void CloudAddVaporSource(FCloudSparseLattice& lattice);
+CLOUDSIMCORE_API void CloudAddVaporSource(FCloudPackedLattice& lattice);
+
+//zeros the lattice and sets up the starting state of a scenario
+CLOUDSIMCORE_API void CloudFillScenario(FCloudLattice& lattice, ECloudScenario scenario);
+CLOUDSIMCORE_API void CloudFillScenario(FCloudSparseLattice& lattice, ECloudScenario scenario);
+CLOUDSIMCORE_API void CloudFillScenario(FCloudPackedLattice& lattice, ECloudScenario scenario);
+
+//a number of full solver steps run from a scenario's starting state
+struct FCloudScenarioConfig
+{
+	FCloudCellCoord size = { 50, 50, 16 };
+	ECloudScenario scenario = ECloudScenario::VaporSource;
+
+	//steps run and thrown away before measuring, then steps measured
+	int32_t warmup_steps = 0;
+	int32_t steps = 100;
+
+	//runs FCloudSparseSolver instead of FCloudSolver
+	bool sparse = false;
+
+	//runs FCloudPackedSolver at params.precision instead of FCloudSolver, then FCloudSolver untimed over the same steps to measure the error
+	//ignored when sparse is set
+	bool packed = false;
+
+	//after every step the water droplets are written into a texture atlas with FCloudTextureWriter, like the simulator's texture pass
+	//timed on its own and not counted in the step
+	bool write_texture = false;
+	ECloudTextureFormat texture_format = ECloudTextureFormat::R8;
+
+	//only the bands of texture_region_rows rows that moved by more than texture_threshold are counted as uploaded, see FCloudTextureWriter::WriteChanged()
+	float texture_threshold = 0.f;
+	int32_t texture_region_rows = 8;
+
+	FCloudSimParams params;
+};
+
+//timings of one stage, or of whole steps, over every measured step
+struct FCloudScenarioTiming
+{
+	int32_t runs = 0;
+	double total_us = 0.0;
+	double min_us = 0.0;
+	double mean_us = 0.0;
+	double p50_us = 0.0;
+	double p90_us = 0.0;
+	double p99_us = 0.0;
+	double max_us = 0.0;
+
+	//cells run per second over total_us, counting every cell of the lattice even when the sparse solver skipped it
+	double cells_per_second = 0.0;
+};
+
+//how far one channel of the packed solver ended up from FCloudSolver
+struct FCloudPrecisionError
+{
+	double max_error = 0.0;
+	double rms_error = 0.0;
+
+	//largest error over the size of FCloudSolver's value, values smaller than 1e-3 count as 1e-3 so cells near 0 do not swamp it
+	double max_relative_error = 0.0;
+
+	//cells where one solver's value is finite and the other's is not, left out of every other measure
+	//16 bit channels overflow or clamp long before floats do, so a run that blows up shows here first
+	int64_t non_finite = 0;
+};
+
+struct FCloudScenarioReport
+{
+	ECloudScenario scenario = ECloudScenario::VaporSource;
+	FCloudCellCoord size;
+	int32_t steps = 0;
+	int32_t threads = 1;
+	ECloudAdvectionScheme advection_scheme = ECloudAdvectionScheme::Scatter;
+	bool double_buffered = false;
+	bool use_simd = true;
+	bool sparse = false;
+	bool activity_mask = false;
+	ECloudCellOrder cell_order = ECloudCellOrder::Linear;
+	FCloudCellCoord stencil_block;
+	bool wavefront = false;
+	bool fuse_stages = false;
+	bool private_scatter = false;
+	bool coloured_scatter = false;
+	FCloudCellCoord scatter_tile;
+	bool packed = false;
+
+	//storage of each channel, indexed by ECloudChannel, all Float32 unless packed
+	ECloudPrecision precision[(int32_t)ECloudChannel::AdvectWaterVapor] = {};
+
+	//indexed by ECloudSimStage, stages a step skips are left with 0 runs
+	FCloudScenarioTiming stages[(int32_t)ECloudSimStage::Done];
+	FCloudScenarioTiming step;
+
+	//only filled in when write_texture, the atlas the droplets were written into and the time taken to write it
+	bool write_texture = false;
+	ECloudTextureFormat texture_format = ECloudTextureFormat::R8;
+	float texture_threshold = 0.f;
+	int32_t texture_region_rows = 0;
+	int32_t texture_width = 0;
+	int32_t texture_height = 0;
+	FCloudScenarioTiming texture;
+
+	//bytes that would be uploaded after each measured step on average, out of the whole texture's texture_bytes, and the regions they were split into
+	double texture_upload_bytes = 0.0;
+	size_t texture_bytes = 0;
+	double texture_regions = 0.0;
+
+	//time threads spent running stage work over the time all threads were available, between 0 and 1
+	//stages the solver keeps on one thread count as one busy thread
+	double thread_utilisation = 0.0;
+
+	//largest lattice allocation seen during the run, counting the advection scratch blocks the solver holds
+	size_t lattice_bytes = 0;
+
+	//only filled in when packed, the error of each channel after the last step, indexed by ECloudChannel,
+	//and the largest lattice allocation of the FCloudSolver run it was measured against
+	FCloudPrecisionError errors[(int32_t)ECloudChannel::AdvectWaterVapor];
+	size_t reference_lattice_bytes = 0;
+
+	//share of the cells the coloured scatter added into its per task accumulators, averaged over the measured steps, 0 unless coloured_scatter
+	double scatter_fallback = 0.0;
+
+	//allocated bricks at the end of the run, 0 unless sparse
+	int32_t active_bricks = 0;
+
+	//activity tiles each stage ran per measured step on average, indexed by ECloudSimStage, out of num_tiles
+	//0 for the sparse solver, every tile when activity_mask is off
+	double active_tiles[(int32_t)ECloudSimStage::Done] = {};
+	int32_t num_tiles = 0;
+
+	//peak memory of the whole process, left at 0 by RunCloudScenario() for the caller to fill in if the platform can tell
+	size_t peak_memory_bytes = 0;
+};
+
+//runs config.steps full steps on a new solver using parallel_for
+CLOUDSIMCORE_API FCloudScenarioReport RunCloudScenario(const FCloudScenarioConfig& config, const FCloudParallelFor& parallel_for);
+
+//the whole report as a single JSON object
+CLOUDSIMCORE_API void WriteCloudScenarioJson(std::ostream& out, const FCloudScenarioReport& report);
+
+//one line for each stage that ran plus one for the whole step, with a header line first
+CLOUDSIMCORE_API void WriteCloudScenarioCsv(std::ostream& out, const FCloudScenarioReport& report);
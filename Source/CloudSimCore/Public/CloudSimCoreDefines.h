@@ -0,0 +1,12 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//CloudSimCore is plain C++ so it can be built on its own with CMake as well as being an Unreal module
+//Unreal defines the export macro for the module, the CMake build leaves it empty
+#ifndef CLOUDSIMCORE_API
+	#define CLOUDSIMCORE_API
+#endif
@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+
+//explicitly vectorised versions of the per cell simulation kernels
+//each function walks one contiguous run of cells along x, SimdWidth cells per instruction, with boundary cells and leftovers done in a scalar tail
+//the arithmetic is done in exactly the same order as the scalar kernels in CloudSolver.cpp so both paths give identical results
+namespace CloudSimKernels
+{
+	static constexpr int32_t SimdWidth = 4;
+
+	//one x row of the velocity field
+	//zminus and zplus point at the rows directly below and above and are nullptr on the bottom and top of the lattice
+	//out may be the same memory as center when updating in place
+	struct FVelocityRow
+	{
+		const float* center[3];
+		const float* zminus[3];
+		const float* zplus[3];
+		float* out[3];
+	};
+
+	//V*(x,y,z) = V(x,y,z) + Kv[V(x,y,z-1) - 6V(x,y,z)] + Kp[-V(x-1,y,z+1) - V(x+1,y,z-1)]
+	CLOUDSIMCORE_API void VelocityRow(const FVelocityRow& row, int32_t x_size, float viscosity_ratio, float pressure_effect);
+
+	//VelocityRow for a padded lattice, zminus and zplus always point at a row and one cell past either end of a row can be read
+	//so every cell takes the vector path with no boundary checks, with a zero halo the result matches VelocityRow exactly
+	CLOUDSIMCORE_API void VelocityRowPadded(const FVelocityRow& row, int32_t x_size, float viscosity_ratio, float pressure_effect);
+
+	//Wv*(x,y,z) = Wv(x,y,z) + Kdw[Wv(x,y,z-1) - 6Wv(x,y,z)], zminus is nullptr on the bottom of the lattice
+	CLOUDSIMCORE_API void DiffuseRow(const float* water_vapor, const float* zminus, float* out_water_vapor, int32_t x_size, float vapour_diffusion);
+
+	//Wl* = Wl + a(Wv - w_max), Wv* = Wv - a(Wv - w_max) for count cells that share the same w_max
+	CLOUDSIMCORE_API void TransitionRange(float* water_vapor, float* water_droplets, int32_t count, float w_max, float phase_transition_rate);
+
+	//w_max = 217.0 * exp[19.482 - 4303.4 / (T-29.5)] / T for count temperatures in kelvin
+	//uses a polynomial exp rather than std::exp, within a few parts per million of the double precision formula from 120K to 340K
+	//SaturationScalar() gives the same result as each lane
+	CLOUDSIMCORE_API void SaturationRange(const float* temperature, float* out_w_max, int32_t count);
+	CLOUDSIMCORE_API float SaturationScalar(float temperature);
+
+	//scalar forms used for boundary cells and leftovers, and by the per cell kernels in CloudSolver.cpp
+	inline float VelocityScalar(float v, float zminus, float xminus_zplus, float xplus_zminus, float viscosity_ratio, float pressure_effect)
+	{
+		return v + (viscosity_ratio * (zminus) - (6 * v)) + (pressure_effect * ((-1 * xminus_zplus) - xplus_zminus));
+	}
+
+	inline float DiffuseScalar(float w, float zminus, float vapour_diffusion)
+	{
+		return w + (vapour_diffusion * (zminus) - (6 * w));
+	}
+}
@@ -0,0 +1,27 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include <functional>
+
+//how the solver spreads work over threads
+//run must call body(task) once for every task in [0, num_tasks) and only return once they have all finished
+//the engine plugs its own task system in here, standalone builds can use the thread pool below
+struct CLOUDSIMCORE_API FCloudParallelFor
+{
+	std::function<void(int32_t num_tasks, const std::function<void(int32_t task)>& body)> run;
+
+	//most tasks worth handing to run at once, normally the number of threads that will work on them
+	int32_t max_tasks = 1;
+
+	//runs every task on the calling thread
+	static FCloudParallelFor Serial();
+
+	//runs tasks on a pool of num_threads - 1 std::threads plus the calling thread, 0 uses every hardware thread
+	//the pool is shared by every copy of the returned object and shut down when the last copy is destroyed
+	static FCloudParallelFor ThreadPool(int32_t num_threads = 0);
+};
+
+//splits [0, num) into contiguous batches of at least min_batch items and runs them through parallel_for
+CLOUDSIMCORE_API void CloudParallelForBatches(const FCloudParallelFor& parallel_for, int32_t num, int32_t min_batch, const std::function<void(int32_t begin, int32_t end)>& body);
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define CLOUDSIM_SIMD_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+	#include <arm_neon.h>
+	#define CLOUDSIM_SIMD_NEON 1
+#endif
+
+//4 wide float vectors for the simulation kernels, using SSE or NEON where available and plain arrays otherwise
+//only the operations the kernels need are provided, and none of them are fused, so every lane gives exactly the same result as
+//the same scalar expression
+namespace CloudSimd
+{
+	static constexpr int32_t Width = 4;
+
+#if CLOUDSIM_SIMD_SSE
+	typedef __m128 FFloat4;
+
+	inline FFloat4 Load(const float* ptr) { return _mm_loadu_ps(ptr); }
+	inline void Store(FFloat4 value, float* ptr) { _mm_storeu_ps(ptr, value); }
+	inline FFloat4 Set1(float value) { return _mm_set1_ps(value); }
+	inline FFloat4 Zero() { return _mm_setzero_ps(); }
+	inline FFloat4 Add(FFloat4 a, FFloat4 b) { return _mm_add_ps(a, b); }
+	inline FFloat4 Subtract(FFloat4 a, FFloat4 b) { return _mm_sub_ps(a, b); }
+	inline FFloat4 Multiply(FFloat4 a, FFloat4 b) { return _mm_mul_ps(a, b); }
+	//flips the sign bit, the same as multiplying by -1
+	inline FFloat4 Negate(FFloat4 value) { return _mm_xor_ps(value, _mm_set1_ps(-0.f)); }
+	inline FFloat4 Divide(FFloat4 a, FFloat4 b) { return _mm_div_ps(a, b); }
+	inline FFloat4 Min(FFloat4 a, FFloat4 b) { return _mm_min_ps(a, b); }
+	inline FFloat4 Max(FFloat4 a, FFloat4 b) { return _mm_max_ps(a, b); }
+	//nearest whole number, ties to even
+	inline FFloat4 Round(FFloat4 value) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(value)); }
+	//2^n for whole numbers n in [-126, 127], built straight from the exponent bits
+	inline FFloat4 Pow2(FFloat4 n) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23)); }
+#elif CLOUDSIM_SIMD_NEON
+	typedef float32x4_t FFloat4;
+
+	inline FFloat4 Load(const float* ptr) { return vld1q_f32(ptr); }
+	inline void Store(FFloat4 value, float* ptr) { vst1q_f32(ptr, value); }
+	inline FFloat4 Set1(float value) { return vdupq_n_f32(value); }
+	inline FFloat4 Zero() { return vdupq_n_f32(0.f); }
+	inline FFloat4 Add(FFloat4 a, FFloat4 b) { return vaddq_f32(a, b); }
+	inline FFloat4 Subtract(FFloat4 a, FFloat4 b) { return vsubq_f32(a, b); }
+	inline FFloat4 Multiply(FFloat4 a, FFloat4 b) { return vmulq_f32(a, b); }
+	inline FFloat4 Negate(FFloat4 value) { return vnegq_f32(value); }
+	inline FFloat4 Divide(FFloat4 a, FFloat4 b) { return vdivq_f32(a, b); }
+	inline FFloat4 Min(FFloat4 a, FFloat4 b) { return vminq_f32(a, b); }
+	inline FFloat4 Max(FFloat4 a, FFloat4 b) { return vmaxq_f32(a, b); }
+	inline FFloat4 Round(FFloat4 value) { return vrndnq_f32(value); }
+	inline FFloat4 Pow2(FFloat4 n) { return vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(vcvtnq_s32_f32(n), vdupq_n_s32(127)), 23)); }
+#else
+	struct FFloat4
+	{
+		float v[Width];
+	};
+
+	inline FFloat4 Load(const float* ptr) { FFloat4 r; for(int32_t i = 0; i < Width; i++) { r.v[i] = ptr[i]; } return r; }
+	inline void Store(FFloat4 value, float* ptr) { for(int32_t i = 0; i < Width; i++) { ptr[i] = value.v[i]; } }
+	inline FFloat4 Set1(float value) { FFloat4 r; for(int32_t i = 0; i < Width; i++) { r.v[i] = value; } return r; }
+	inline FFloat4 Zero() { return Set1(0.f); }
+	inline FFloat4 Add(FFloat4 a, FFloat4 b) { for(int32_t i = 0; i < Width; i++) { a.v[i] = a.v[i] + b.v[i]; } return a; }
+	inline FFloat4 Subtract(FFloat4 a, FFloat4 b) { for(int32_t i = 0; i < Width; i++) { a.v[i] = a.v[i] - b.v[i]; } return a; }
+	inline FFloat4 Multiply(FFloat4 a, FFloat4 b) { for(int32_t i = 0; i < Width; i++) { a.v[i] = a.v[i] * b.v[i]; } return a; }
+	inline FFloat4 Negate(FFloat4 value) { for(int32_t i = 0; i < Width; i++) { value.v[i] = -value.v[i]; } return value; }
+	inline FFloat4 Divide(FFloat4 a, FFloat4 b) { for(int32_t i = 0; i < Width; i++) { a.v[i] = a.v[i] / b.v[i]; } return a; }
+	inline FFloat4 Min(FFloat4 a, FFloat4 b) { for(int32_t i = 0; i < Width; i++) { a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]; } return a; }
+	inline FFloat4 Max(FFloat4 a, FFloat4 b) { for(int32_t i = 0; i < Width; i++) { a.v[i] = b.v[i] > a.v[i] ? b.v[i] : a.v[i]; } return a; }
+	inline FFloat4 Round(FFloat4 value);
+	inline FFloat4 Pow2(FFloat4 n);
+#endif
+
+	//scalar forms of the operations above that have no plain C++ operator, giving the same result as each lane
+	inline float Min(float a, float b) { return b < a ? b : a; }
+	inline float Max(float a, float b) { return b > a ? b : a; }
+	inline float Round(float value) { return std::nearbyint(value); }
+	inline float Pow2(float n)
+	{
+		const int32_t bits = ((int32_t)n + 127) << 23;
+		float result;
+		std::memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+#if !CLOUDSIM_SIMD_SSE && !CLOUDSIM_SIMD_NEON
+	inline FFloat4 Round(FFloat4 value) { for(int32_t i = 0; i < Width; i++) { value.v[i] = Round(value.v[i]); } return value; }
+	inline FFloat4 Pow2(FFloat4 n) { for(int32_t i = 0; i < Width; i++) { n.v[i] = Pow2(n.v[i]); } return n; }
+#endif
+}
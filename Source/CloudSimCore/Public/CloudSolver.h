@@ -0,0 +1,320 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudActivityMask.h"
+#include "CloudLattice.h"
+#include "CloudPackedLattice.h"
+#include "CloudScratchArena.h"
+#include "CloudSimParallel.h"
+#include "CloudThermodynamics.h"
+#include <atomic>
+
+//simulation stages in the order a step runs them, Done is reached once the phase transition has finished
+enum class ECloudSimStage : uint8_t
+{
+	Velocity,
+	Diffuse,
+	Advect1,
+	Advect2,
+	Transition,
+	Done
+};
+
+//how water is moved along the velocity field
+enum class ECloudAdvectionScheme : uint8_t
+{
+	//each cell adds its water into the 8 cells around the position given by its velocity (Advect1), then the totals are folded back in (Advect2)
+	Scatter,
+	//each cell traces back along its velocity and takes the trilinearly interpolated water found there, finishing in a single pass with no Advect2
+	Gather
+};
+
+struct FCloudCellCoord
+{
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t z = 0;
+};
+
+struct FCloudSimParams
+{
+	//constant coefficients, the defaults are the values ACloudSimulator has always used
+	float viscosity_ratio = 2.4 * (10^-5);
+	float pressure_effect = 0.1f;
+	float vapour_diffusion = 0.5f;
+	float phase_transition_rate = 100;
+
+	//height of the simulated space in meters, used for the temperature at each height
+	float z_world_size = 1000.f;
+
+	//temperature of the air with height, which sets how much water vapor each z level can hold, see CloudThermodynamics.h
+	FCloudLapseProfile lapse_profile;
+
+	//when true whole rows of the velocity, diffusion and phase transition stages use the vectorised kernels in CloudSimKernels.h
+	bool use_simd = true;
+
+	//smallest number of cells handed to a single task by SweepStage()
+	int32_t min_batch_size = 4096;
+
+	//applied by ApplyPendingSettings() so a half finished step never loses its data
+	bool double_buffered = false;
+	ECloudAdvectionScheme advection_scheme = ECloudAdvectionScheme::Scatter;
+
+	//stores a one cell halo around the lattice so the velocity and diffusion stencils run without boundary checks
+	//also applied by ApplyPendingSettings(), the halo is refreshed from boundary at the start of every stage that reads it
+	bool padded = false;
+	ECloudBoundary boundary = ECloudBoundary::Zero;
+
+	//value held by the halo of each channel when boundary is ECloudBoundary::Inflow
+	float inflow[(int32_t)ECloudChannel::Num] = {};
+
+	//order the lattice stores its cells in, also applied by ApplyPendingSettings()
+	//Morton order has no contiguous rows, so every stage takes the per cell kernels and padded and activity_mask are ignored
+	ECloudCellOrder cell_order = ECloudCellOrder::Linear;
+
+	//size of the blocks SweepStage() walks the velocity and diffusion stencils in, so the rows a block reads are still in cache
+	//when the block above or beside it needs them, 0 along an axis takes the whole lattice, which walks it row by row
+	//every block size gives the same result, see CloudTuneStencilBlock() in CloudSimBenchmark.h for picking one
+	FCloudCellCoord stencil_block;
+
+	//when true the velocity and diffusion stages are split along x and z as well as y, into tiles of wavefront_tile cells run a diagonal at a time
+	//a tile only starts once the tiles whose updated cells it reads have finished, and before the tiles that read its cells as they were,
+	//so the result matches the serial in place sweep exactly while lattices too thin along y to give every task its own planes still use them all
+	//ignored while the activity mask is in use
+	bool wavefront = false;
+
+	//size of the wavefront tiles, 0 along an axis splits it into one tile per task
+	FCloudCellCoord wavefront_tile;
+
+	//when true SweepStage() runs Diffuse in the same pass as Velocity and Transition in the same pass as Advect2, a plane of each at a time
+	//velocity and diffusion touch different channels and Advect2 and the phase transition only touch the cell itself, so the result is unchanged
+	//advection reads water from anywhere in the lattice, so nothing is fused across it, and the gather scheme leaves Transition on its own
+	//ignored while the activity mask is in use and by FCloudSparseSolver
+	bool fuse_stages = false;
+
+	//when true the scatter runs across parallel_for, each task adding a contiguous run of rows into its own scratch accumulators,
+	//which are summed into the advection channels in task order once every task has finished
+	//each task total is added as one value, so results differ from the serial scatter in the last bits, but are the same on every run with the same max_tasks
+	//costs two lattice sized accumulators per task, ignored while the activity mask is in use
+	bool private_scatter = false;
+
+	//when true the scatter runs across parallel_for as tiles of scatter_tile cells, coloured by the parity of their position along each axis
+	//a cell whose 8 targets all lie within half a tile of its own tile adds straight into the advection channels, two tiles of the same colour
+	//are a whole tile apart, so the tiles of one colour can run at once without writing the same cell, and the 8 colours run one after another
+	//cells with targets further away add into per task accumulators like private_scatter, which are summed in once every colour has run
+	//the result is the same on every run with the same max_tasks and scatter_tile, but not bit identical to the serial scatter
+	//takes priority over private_scatter, ignored while the activity mask is in use
+	bool coloured_scatter = false;
+
+	//size of the coloured scatter tiles, 0 along an axis for 16 cells, bigger tiles reach further before falling back to the accumulators
+	FCloudCellCoord scatter_tile;
+
+	//when true the scratch blocks behind the advection channels are freed once each step finishes rather than kept for the next one,
+	//so between steps only the lattice itself is resident, at the cost of allocating them again every step
+	bool release_scratch = false;
+
+	//only used by FCloudSparseSolver, values this close to 0 count as clear air
+	float sparse_threshold = 1e-6f;
+
+	//only used by FCloudPackedSolver, how each channel is stored, indexed by ECloudChannel, the advection channels are never stored
+	//also applied by ApplyPendingSettings(), Fixed16 channels hold values up to fixed_range either side of 0
+	//velocity is in cells per step and water reaches a few tens at most, so the default ranges leave steps of ~0.008 and ~0.002
+	ECloudPrecision precision[(int32_t)ECloudChannel::Num] = {};
+	float fixed_range[(int32_t)ECloudChannel::Num] = { 256.f, 256.f, 256.f, 64.f, 64.f, 64.f, 64.f };
+
+	//when true SweepStage() only runs the tiles of the lattice whose inputs have changed since the stage last ran, see CloudActivityMask.h
+	//changes no bigger than activity_threshold are not counted, at 0 the result is the same as running every tile
+	//applied by ApplyPendingSettings(), ignored by FCloudSparseSolver
+	bool activity_mask = false;
+	float activity_threshold = 0.f;
+};
+
+//position of a time sliced stage, iteration counts the cells run so far in the current stage
+struct FCloudSimCursor
+{
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t z = 0;
+	int32_t iteration = 0;
+};
+
+//the cloud simulation without any engine types
+//owns the lattice and runs the stages over it, either a box at a time, time sliced in whole rows, or as a full parallel sweep
+//a row is every x for one y and z, rows are numbered y + (y_size * z)
+class CLOUDSIMCORE_API FCloudSolver
+{
+public:
+	FCloudSolver();
+
+	//allocates the lattice with every value at 0, applying any pending settings first
+	void Init(int32_t x_size, int32_t y_size, int32_t z_size);
+
+	FCloudLattice& GetLattice() { return lattice; }
+	const FCloudLattice& GetLattice() const { return lattice; }
+
+	FCloudSimParams& GetParams() { return params; }
+	const FCloudSimParams& GetParams() const { return params; }
+
+	void SetParallelFor(const FCloudParallelFor& in_parallel_for) { parallel_for = in_parallel_for; }
+
+	//applies double buffering, padding and advection scheme changes from the params, only call between steps
+	void ApplyPendingSettings();
+
+	//scheme the current step was started with
+	ECloudAdvectionScheme GetActiveAdvectionScheme() const { return active_advection_scheme; }
+
+	//refreshes the halo of every channel a stage reads when the lattice is padded, and attaches the advection scratch blocks for the advection stages
+	//ProgressStageRows() and SweepStage() call this when a stage starts, call it before the first RunStage() of a stage run box by box
+	void BeginStage(ECloudSimStage stage);
+
+	//runs one stage over the box of cells from begin up to but not including end, clamped to the lattice
+	//cells are visited z, then y, then x, so running a stage box by box in that order is bit identical to running it cell by cell
+	//does not start or finish the stage, see BeginStage() and FinishStage()
+	//this and the other partial stage functions do not track activity, so they mark every tile to be run by the next sweeps
+	void RunStage(ECloudSimStage stage, FCloudCellCoord begin, FCloudCellCoord end);
+
+	//runs one stage over the whole rows [row_begin, row_end)
+	void RunStageRows(ECloudSimStage stage, int32_t row_begin, int32_t row_end);
+
+	//runs at least cells more cells of a time sliced stage, rounded up to whole rows, and moves the cursor on
+	//returns true once the last row has been run, leaving the cursor reset for the next stage
+	bool ProgressStageRows(ECloudSimStage stage, FCloudSimCursor& cursor, int32_t cells);
+
+	//swaps any buffers written by a finished stage and returns the stage that follows it
+	ECloudSimStage FinishStage(ECloudSimStage stage);
+
+	//runs a whole stage across parallel_for, finishes it and returns the stage that follows it
+	//with params.fuse_stages the stage fused into it is run and finished too, and the stage after that is returned
+	//returns stage itself if there is nothing to run
+	ECloudSimStage SweepStage(ECloudSimStage stage);
+
+	//applies pending settings and sweeps every stage of one step
+	void RunStep();
+
+	//max amount of water vapor a cell at height z can hold, looked up from the tables as of the last Init(), ApplyPendingSettings() or phase transition start
+	float MaxWaterVapor(int32_t z) const { return thermodynamics.MaxWaterVapor(z); }
+
+	//the lattice plus the scratch blocks held for the advection stages
+	size_t GetAllocatedSize() const { return lattice.GetAllocatedSize() + scratch.GetAllocatedSize(); }
+
+	//frees the scratch blocks held for reuse, for when the lattice is handed to another solver
+	void ReleaseScratch() { scratch.Release(); }
+
+	//temperature and max water vapor of every z level
+	const FCloudThermodynamics& GetThermodynamics() const { return thermodynamics; }
+
+	//cells run and steps finished since the last call, safe to call while other threads are simulating
+	int64_t TakeCellsProcessed() { return cells_processed.exchange(0); }
+	int32_t TakeCompletedSteps() { return completed_steps.exchange(0); }
+
+	//true once ApplyPendingSettings() or Init() has turned params.activity_mask on
+	bool IsActivityMaskActive() const { return activity_active; }
+
+	//the activity bits of every tile, for debugging, only safe to read between stages
+	const FCloudActivityMask& GetActivityMask() const { return activity; }
+
+	//cells the last coloured scatter had to add into the per task accumulators, 0 unless params.coloured_scatter is in use
+	int64_t GetScatterFallbackCells() const { return scatter_fallback_cells; }
+
+	//tiles run by the last sweep of a stage and the number of tiles in the lattice, safe to call while other threads are simulating
+	int32_t GetActiveTiles(ECloudSimStage stage) const { return stage < ECloudSimStage::Done ? active_tiles[(int32_t)stage].load() : 0; }
+	int32_t GetNumTiles() const { return num_tiles; }
+
+	//call after writing to the lattice from outside the solver while the activity mask is on, so the next sweeps run every tile
+	void MarkAllActive() { activity_reset = true; }
+
+private:
+	//RunStage() and RunStageRows() without marking every tile active
+	void RunBox(ECloudSimStage stage, FCloudCellCoord begin, FCloudCellCoord end);
+	void RunRows(ECloudSimStage stage, int32_t row_begin, int32_t row_end);
+
+	//rows [y_begin, y_end) of one plane of a box
+	void RunBoxPlane(ECloudSimStage stage, int32_t x_begin, int32_t x_end, int32_t y_begin, int32_t y_end, int32_t z);
+
+	void RunRow(ECloudSimStage stage, int32_t x_begin, int32_t x_end, int32_t y, int32_t z);
+
+	//runs one cell of a stage, for lattices without contiguous rows
+	void RunCell(ECloudSimStage stage, int32_t x, int32_t y, int32_t z);
+
+	//per cell kernels, i is the cell's lattice index
+	void VelocityCell(int32_t x, int32_t y, int32_t z, int32_t i);
+	void DiffuseCell(int32_t x, int32_t y, int32_t z, int32_t i);
+
+	//the same kernels on a padded lattice, where the neighbours past an edge are halo cells and need no check
+	void VelocityCellPadded(int32_t i);
+	void DiffuseCellPadded(int32_t i);
+	void Advect1Cell(int32_t i, float* A_water_vapor, float* A_water_droplets);
+	void Advect2Cell(int32_t i);
+	void AdvectGatherCell(int32_t x, int32_t y, int32_t z, int32_t i);
+	void TransitionCell(int32_t z, int32_t i);
+
+	//swaps the gathered values into the water channels once a gather pass has finished
+	void FinishGather();
+
+	//swaps blocks from the scratch arena into the advection channels if they are not attached already, stage says which are needed
+	void AttachAdvectionScratch(ECloudSimStage stage);
+
+	//hands the advection channels back to the scratch arena, zeroed when the scatter has already cleared them
+	void DetachAdvectionScratch(bool zeroed);
+
+	//the scatter with params.private_scatter or params.coloured_scatter, see there
+	void SweepScatterPrivate();
+	void SweepScatterColoured();
+
+	//takes zeroed per task accumulators from the scratch arena, and adds the ones marked in private_used into the advection channels in task order before handing them back
+	void AcquirePrivateAccumulators(int32_t tasks);
+	void FoldPrivateAccumulators();
+
+	//scatters every cell of the rows [row_begin, row_end) into the given accumulators
+	void ScatterRows(int32_t row_begin, int32_t row_end, float* A_water_vapor, float* A_water_droplets);
+
+	//full sweep helpers for the stencil stages and the stages where every cell only writes itself
+	void SweepPlanes(ECloudSimStage stage);
+
+	//runs a stencil stage over the planes [y_begin, y_end) in blocks of params.stencil_block
+	void RunBlocks(ECloudSimStage stage, int32_t y_begin, int32_t y_end);
+
+	//runs a stencil stage as diagonals of params.wavefront_tile tiles, see params.wavefront
+	void SweepWavefront(ECloudSimStage stage);
+
+	void SweepRows(ECloudSimStage stage);
+
+	//stage run in the same pass as stage by SweepStage(), Done when it has none, see params.fuse_stages
+	ECloudSimStage FusedStage(ECloudSimStage stage) const;
+
+	//SweepStage() with the activity mask on, only runs the tiles that can change and records which of them did
+	void SweepActiveTiles(ECloudSimStage stage);
+	void RunActiveTile(ECloudSimStage stage, int32_t tile_y, int32_t tile_z, std::vector<float>& before);
+	void SkipTile(ECloudSimStage stage, int32_t tile_y, int32_t tile_z);
+
+	FCloudLattice lattice;
+	FCloudSimParams params;
+	FCloudParallelFor parallel_for;
+
+	ECloudAdvectionScheme active_advection_scheme = ECloudAdvectionScheme::Scatter;
+
+	//rebuilt whenever the lattice height, z_world_size or lapse_profile changes
+	FCloudThermodynamics thermodynamics;
+
+	//blocks for the advection channels and the private scatter accumulators, sized to the lattice
+	FCloudScratchArena scratch;
+	std::vector<FCloudChannelArray> private_accumulators;
+	std::vector<uint8_t> private_used;
+	std::atomic<int64_t> scatter_fallback_cells { 0 };
+
+	//set by SweepStage() while a fused pair is running, RunBox() runs it over each plane straight after the stage it was given
+	ECloudSimStage fused_stage = ECloudSimStage::Done;
+
+	//see params.activity_mask, activity_params holds the settings the mask was last valid for
+	FCloudActivityMask activity;
+	FCloudSimParams activity_params;
+	bool activity_active = false;
+	std::atomic<bool> activity_reset { true };
+	std::atomic<int32_t> active_tiles[(int32_t)ECloudSimStage::Done] = {};
+	std::atomic<int32_t> num_tiles { 0 };
+
+	std::atomic<int64_t> cells_processed { 0 };
+	std::atomic<int32_t> completed_steps { 0 };
+};
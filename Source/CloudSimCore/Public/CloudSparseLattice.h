@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudLattice.h"
+#include <memory>
+#include <vector>
+
+//bricks are cubes of CloudBrickSize cells along each side
+static constexpr int32_t CloudBrickBits = 3;
+static constexpr int32_t CloudBrickSize = 1 << CloudBrickBits;
+static constexpr int32_t CloudBrickMask = CloudBrickSize - 1;
+static constexpr int32_t CloudBrickCells = CloudBrickSize * CloudBrickSize * CloudBrickSize;
+
+//every channel of one brick, cells stored x fastest, then y, then z
+struct FCloudBrick
+{
+	alignas(CloudChannelAlignment) float values[(int32_t)ECloudChannel::Num][CloudBrickCells];
+
+	static inline int32_t CellIndex(int32_t local_x, int32_t local_y, int32_t local_z)
+	{
+		return local_x + (local_y << CloudBrickBits) + (local_z << (2 * CloudBrickBits));
+	}
+};
+
+//sparse lattice made of bricks that are only allocated where there is something in the sky
+//a flat table over every brick position of the lattice points at the allocated bricks, cells in a brick that is not allocated are 0
+//the table costs one int per CloudBrickCells cells, so memory follows the number of allocated bricks rather than the size of the lattice
+class CLOUDSIMCORE_API FCloudSparseLattice
+{
+public:
+	//sizes the brick table for a lattice of the given size with no bricks allocated
+	void Init(int32_t in_x_size, int32_t in_y_size, int32_t in_z_size);
+
+	//frees every brick, leaving the table in place
+	void Zero();
+
+	//frees every brick and the table
+	void Empty();
+
+	//makes this lattice an exact copy of other
+	void CopyFrom(const FCloudSparseLattice& other);
+
+	//sizes the lattice to match dense and allocates a brick wherever a cell of dense holds a value further than threshold from 0
+	void LoadFrom(const FCloudLattice& dense, float threshold);
+
+	//writes every cell into dense, which is resized to match, cells in unallocated bricks become 0
+	//the advection channels are left out, as dense only holds them part way through a step
+	void StoreTo(FCloudLattice& dense) const;
+
+	inline int32_t BrickIndex(int32_t brick_x, int32_t brick_y, int32_t brick_z) const
+	{
+		return brick_x + (brick_y * bricks_x) + (brick_z * bricks_x * bricks_y);
+	}
+
+	//brick table index holding a cell
+	inline int32_t BrickIndexOfCell(int32_t x, int32_t y, int32_t z) const
+	{
+		return BrickIndex(x >> CloudBrickBits, y >> CloudBrickBits, z >> CloudBrickBits);
+	}
+
+	//nullptr when the brick is not allocated
+	inline FCloudBrick* FindBrick(int32_t brick)
+	{
+		const int32_t slot = slots[brick];
+		return slot < 0 ? nullptr : pool[slot].get();
+	}
+
+	inline const FCloudBrick* FindBrick(int32_t brick) const
+	{
+		const int32_t slot = slots[brick];
+		return slot < 0 ? nullptr : pool[slot].get();
+	}
+
+	//allocates the brick with every value at 0 if it is not allocated yet, not safe to call from more than one thread at a time
+	FCloudBrick& FindOrAddBrick(int32_t brick);
+
+	void FreeBrick(int32_t brick);
+
+	//value of a cell, 0 outside the lattice or in a brick that is not allocated
+	inline float Get(ECloudChannel channel, int32_t x, int32_t y, int32_t z) const
+	{
+		if(!IsValidCell(x, y, z))
+		{
+			return 0.f;
+		}
+		const FCloudBrick* brick = FindBrick(BrickIndexOfCell(x, y, z));
+		return brick ? brick->values[(int32_t)channel][FCloudBrick::CellIndex(x & CloudBrickMask, y & CloudBrickMask, z & CloudBrickMask)] : 0.f;
+	}
+
+	//writes a cell, allocating its brick if needed
+	void Set(ECloudChannel channel, int32_t x, int32_t y, int32_t z, float value);
+
+	inline bool IsValidCell(int32_t x, int32_t y, int32_t z) const
+	{
+		return x >= 0 && x < x_size && y >= 0 && y < y_size && z >= 0 && z < z_size;
+	}
+
+	//fills out with the table index of every allocated brick in ascending order, which is z, then y, then x brick order
+	void CollectBricks(std::vector<int32_t>& out) const;
+
+	inline int32_t NumBricks() const { return (int32_t)slots.size(); }
+	inline int32_t NumAllocatedBricks() const { return (int32_t)pool.size() - (int32_t)free_slots.size(); }
+
+	//total bytes held by the bricks and the table
+	size_t GetAllocatedSize() const;
+
+	int32_t GetXSize() const { return x_size; }
+	int32_t GetYSize() const { return y_size; }
+	int32_t GetZSize() const { return z_size; }
+
+	int32_t GetBricksX() const { return bricks_x; }
+	int32_t GetBricksY() const { return bricks_y; }
+	int32_t GetBricksZ() const { return bricks_z; }
+
+private:
+	int32_t x_size = 0;
+	int32_t y_size = 0;
+	int32_t z_size = 0;
+
+	int32_t bricks_x = 0;
+	int32_t bricks_y = 0;
+	int32_t bricks_z = 0;
+
+	//pool slot of each brick position, -1 when the brick is not allocated
+	std::vector<int32_t> slots;
+
+	//freed bricks keep their pool slot, which is handed out again before the pool grows
+	std::vector<std::unique_ptr<FCloudBrick>> pool;
+	std::vector<int32_t> free_slots;
+};
@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudSolver.h"
+#include "CloudSparseLattice.h"
+#include <atomic>
+
+//the cloud simulation run over a FCloudSparseLattice, so the cost of a step follows the amount of cloud rather than the size of the sky
+//every stage runs the same per cell maths as FCloudSolver, but only over the allocated bricks:
+//- at the start of a step every brick that can be reached by the velocity and diffusion stencils from an allocated brick is added
+//  as a one brick dilation band, anything the stencils would carry further than that in one step is dropped
+//- the scatter allocates the bricks it adds water into
+//- the phase transition leaves clear air clear, cells with no vapor or droplets are skipped rather than pulled towards w_max
+//- bricks with every velocity and water value within params.sparse_threshold of 0 are freed at the end of each step
+//stencils always update in place and the per cell kernels are used throughout, so double_buffered, padded and use_simd are ignored
+class CLOUDSIMCORE_API FCloudSparseSolver
+{
+public:
+	FCloudSparseSolver();
+
+	//sizes the lattice with no bricks allocated
+	void Init(int32_t x_size, int32_t y_size, int32_t z_size);
+
+	FCloudSparseLattice& GetLattice() { return lattice; }
+	const FCloudSparseLattice& GetLattice() const { return lattice; }
+
+	FCloudSimParams& GetParams() { return params; }
+	const FCloudSimParams& GetParams() const { return params; }
+
+	void SetParallelFor(const FCloudParallelFor& in_parallel_for) { parallel_for = in_parallel_for; }
+
+	//applies advection scheme changes from the params, only call between steps
+	void ApplyPendingSettings();
+
+	ECloudAdvectionScheme GetActiveAdvectionScheme() const { return active_advection_scheme; }
+
+	//runs a whole stage over the allocated bricks, finishes it and returns the stage that follows it
+	//Velocity adds the dilation band first and Transition frees empty bricks once it is done
+	//returns stage itself if there is nothing to run
+	ECloudSimStage SweepStage(ECloudSimStage stage);
+
+	//applies pending settings and sweeps every stage of one step
+	void RunStep();
+
+	//max amount of water vapor a cell at height z can hold, see FCloudSolver::MaxWaterVapor()
+	float MaxWaterVapor(int32_t z) const { return thermodynamics.MaxWaterVapor(z); }
+
+	//cells run and steps finished since the last call, safe to call while other threads are simulating
+	int64_t TakeCellsProcessed() { return cells_processed.exchange(0); }
+	int32_t TakeCompletedSteps() { return completed_steps.exchange(0); }
+
+private:
+	//allocates every brick the stencils can reach from an allocated brick
+	void Dilate();
+
+	//frees every brick with nothing left in it
+	void Prune();
+
+	//lists the allocated bricks, in table order and split up by brick row along y
+	void CollectBricks();
+
+	//velocity and diffusion, a task per slab of brick rows along y, each walked z, then y, then x like FCloudSolver
+	void SweepStencil(ECloudSimStage stage);
+
+	//the scatter on one thread, walking every allocated cell in the same order as FCloudSolver
+	void SweepScatter();
+
+	//stages where every cell only writes itself, a task per batch of bricks
+	void SweepBricks(ECloudSimStage stage);
+
+	void RunBrick(ECloudSimStage stage, int32_t brick_index);
+
+	//nullptr when the brick is outside the lattice along x or z, or not allocated
+	const FCloudBrick* FindBrick(int32_t brick_x, int32_t brick_y, int32_t brick_z) const;
+
+	FCloudSparseLattice lattice;
+	FCloudSimParams params;
+	FCloudParallelFor parallel_for;
+
+	ECloudAdvectionScheme active_advection_scheme = ECloudAdvectionScheme::Scatter;
+	FCloudThermodynamics thermodynamics;
+
+	std::vector<int32_t> bricks;
+	std::vector<std::vector<int32_t>> bricks_by_y;
+
+	std::atomic<int64_t> cells_processed { 0 };
+	std::atomic<int32_t> completed_steps { 0 };
+};
@@ -0,0 +1,136 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include "CloudLattice.h"
+#include "CloudPackedLattice.h"
+#include "CloudSimParallel.h"
+#include "CloudSolver.h"
+#include "CloudSparseLattice.h"
+#include <vector>
+
+//single channel texel formats FCloudTextureWriter can fill
+enum class ECloudTextureFormat : uint8_t
+{
+	//8 bit unsigned normalised, values are clamped to [0, 1] and rounded to the nearest of 256 steps, PF_G8 in the engine
+	R8,
+	//IEEE 754 half float, rounded to the nearest even value, PF_R16F in the engine
+	R16F,
+
+	Num
+};
+
+//convert count values, each multiplied by scale first, NaN becomes 0 in R8 and stays NaN in R16F
+CLOUDSIMCORE_API void CloudConvertToR8(const float* values, uint8_t* out_texels, int32_t count, float scale);
+CLOUDSIMCORE_API void CloudConvertToR16F(const float* values, uint16_t* out_texels, int32_t count, float scale);
+
+//where each z slice of a lattice goes in a 2D texture
+//slices are tiles of x by y texels placed left to right, tiles_x to a row, then top to bottom, so a material can sample the lattice
+//as a pseudo volume, with tiles_x at 1 the slices follow each other down the texture, which is also how a volume texture's data is laid out
+struct CLOUDSIMCORE_API FCloudTextureLayout
+{
+	FCloudCellCoord size;
+	int32_t tiles_x = 1;
+	int32_t tiles_y = 1;
+	ECloudTextureFormat format = ECloudTextureFormat::R8;
+
+	//picks tiles_x so the atlas comes out as close to square as it can, unless in_tiles_x is above 0
+	static FCloudTextureLayout Make(FCloudCellCoord in_size, ECloudTextureFormat in_format, int32_t in_tiles_x = 0);
+
+	int32_t GetWidth() const { return size.x * tiles_x; }
+	int32_t GetHeight() const { return size.y * tiles_y; }
+	int32_t GetBytesPerTexel() const { return format == ECloudTextureFormat::R16F ? 2 : 1; }
+	int32_t GetRowPitch() const { return GetWidth() * GetBytesPerTexel(); }
+	size_t GetDataSize() const { return (size_t)GetRowPitch() * GetHeight(); }
+
+	//texel of the atlas the first cell of slice z lands on
+	int32_t GetSliceX(int32_t z) const { return (z % tiles_x) * size.x; }
+	int32_t GetSliceY(int32_t z) const { return (z / tiles_x) * size.y; }
+
+	//byte offset of the texel cell (0, y, z) lands on
+	inline size_t Offset(int32_t y, int32_t z) const
+	{
+		return ((size_t)(GetSliceY(z) + y) * GetRowPitch()) + ((size_t)GetSliceX(z) * GetBytesPerTexel());
+	}
+
+	bool operator==(const FCloudTextureLayout& other) const
+	{
+		return size.x == other.size.x && size.y == other.size.y && size.z == other.size.z && tiles_x == other.tiles_x && tiles_y == other.tiles_y && format == other.format;
+	}
+
+	bool operator!=(const FCloudTextureLayout& other) const { return !(*this == other); }
+};
+
+//box of texels of a texture, in texels from its top left corner
+struct FCloudTextureRegion
+{
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t width = 0;
+	int32_t height = 0;
+};
+
+//fills a texture with one channel of a lattice in bulk, a row at a time through the converters above
+//rows are read straight out of a linear dense lattice, other lattices unpack or gather each row into a scratch row first
+//a channel the lattice does not hold, like an unattached advection channel, writes 0
+class CLOUDSIMCORE_API FCloudTextureWriter
+{
+public:
+	//rows are spread over parallel_for in batches of at least min_batch_size cells, serial until one is set
+	void SetParallelFor(const FCloudParallelFor& in_parallel_for) { parallel_for = in_parallel_for; }
+	void SetMinBatchSize(int32_t in_min_batch_size) { min_batch_size = in_min_batch_size; }
+
+	//out_texels must hold layout.GetDataSize() bytes, tiles past the last slice are set to 0
+	//returns false and writes nothing if layout.size is not the size of the lattice
+	bool Write(const FCloudLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, uint8_t* out_texels) const;
+	bool Write(const FCloudSparseLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, uint8_t* out_texels) const;
+	bool Write(const FCloudPackedLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, uint8_t* out_texels) const;
+
+	//rows of a slice checked for changes together, 0 checks whole slices
+	void SetRegionRows(int32_t in_region_rows) { region_rows = in_region_rows; }
+
+	//writes into the writer's own copy of the texture, which stands for what was last uploaded, and fills out_regions with the parts that changed
+	//each slice is split into bands of region rows, a band is only rewritten when one of its texels has moved by more than threshold,
+	//measured after scale in the texture's own format, so smaller changes build up in the lattice until they cross it
+	//bands that changed are merged down a slice and across neighbouring slices, the first write or a new layout changes the whole texture
+	//returns false and changes nothing if layout.size is not the size of the lattice
+	bool WriteChanged(const FCloudLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, float threshold, std::vector<FCloudTextureRegion>& out_regions);
+	bool WriteChanged(const FCloudSparseLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, float threshold, std::vector<FCloudTextureRegion>& out_regions);
+	bool WriteChanged(const FCloudPackedLattice& lattice, ECloudChannel channel, float scale, const FCloudTextureLayout& layout, float threshold, std::vector<FCloudTextureRegion>& out_regions);
+
+	//forgets the copy, so the next WriteChanged() changes the whole texture, for when the texture it stands for has been recreated
+	void Invalidate();
+
+	//the copy WriteChanged() writes into, laid out as its last layout
+	const std::vector<uint8_t>& GetTexels() const { return texels; }
+	const FCloudTextureLayout& GetLayout() const { return texels_layout; }
+
+	//bytes between the rows PackRegions() writes, enough for the widest region
+	int32_t GetPackedRowPitch(const std::vector<FCloudTextureRegion>& regions) const;
+
+	//rows PackRegions() writes, the sum of the heights of the regions
+	static int32_t GetPackedRows(const std::vector<FCloudTextureRegion>& regions);
+
+	//copies each region out of the copy into out_texels at the left edge, the regions one after another down a buffer of
+	//GetPackedRows() rows of GetPackedRowPitch() bytes, so only what changed needs uploading
+	void PackRegions(const std::vector<FCloudTextureRegion>& regions, uint8_t* out_texels) const;
+
+private:
+	//runs read_row(y, z, scratch) for every row, which returns the x values of the row, either scratch filled in or the lattice's own storage
+	template<typename TReadRow>
+	void WriteRows(const FCloudTextureLayout& layout, float scale, uint8_t* out_texels, const TReadRow& read_row) const;
+
+	template<typename TReadRow>
+	void WriteChangedRows(const FCloudTextureLayout& layout, float scale, float threshold, std::vector<FCloudTextureRegion>& out_regions, const TReadRow& read_row);
+
+	FCloudParallelFor parallel_for = FCloudParallelFor::Serial();
+	int32_t min_batch_size = 4096;
+	int32_t region_rows = 8;
+
+	std::vector<uint8_t> texels;
+	FCloudTextureLayout texels_layout;
+
+	//one per band, set when the band changed on the last write
+	std::vector<uint8_t> changed_bands;
+};
@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CloudSimCoreDefines.h"
+#include <vector>
+
+//one layer of the temperature profile, from base_height meters up to the base of the next layer the temperature falls by lapse_rate kelvin per meter
+//a negative lapse_rate is an inversion, where the air warms with height and caps the clouds below it
+struct FCloudLapseLayer
+{
+	float base_height = 0.f;
+	float lapse_rate = 0.006f;
+
+	bool operator==(const FCloudLapseLayer& other) const { return base_height == other.base_height && lapse_rate == other.lapse_rate; }
+	bool operator!=(const FCloudLapseLayer& other) const { return !(*this == other); }
+};
+
+//temperature of the air with height, the default is ~300K at the ground falling by 0.6K every 100m like the original simulation
+struct FCloudLapseProfile
+{
+	//temperature at the bottom of the lattice in kelvin
+	float surface_temperature = 300.f;
+
+	//layers in order of base_height, the first layer also covers anything below its base and the last one carries on up forever
+	//with no layers the temperature is surface_temperature all the way up
+	std::vector<FCloudLapseLayer> layers = { FCloudLapseLayer() };
+
+	bool operator==(const FCloudLapseProfile& other) const { return surface_temperature == other.surface_temperature && layers == other.layers; }
+	bool operator!=(const FCloudLapseProfile& other) const { return !(*this == other); }
+};
+
+//temperature and max water vapor for every z level of a lattice, which only depend on height
+//the solvers rebuild the tables when the lattice height, world height or profile changes, so the phase transition only looks them up
+class CLOUDSIMCORE_API FCloudThermodynamics
+{
+public:
+	//rebuilds the tables for a lattice z_size cells tall covering z_world_size meters, returns false if nothing had changed
+	bool Update(int32_t z_size, float z_world_size, const FCloudLapseProfile& profile);
+
+	//z is clamped to the lattice, 0 if the tables are empty
+	inline float Temperature(int32_t z) const { return temperatures.empty() ? 0.f : temperatures[Clamp(z)]; }
+	inline float MaxWaterVapor(int32_t z) const { return max_water_vapor.empty() ? 0.f : max_water_vapor[Clamp(z)]; }
+
+	const std::vector<float>& GetTemperatures() const { return temperatures; }
+	const std::vector<float>& GetMaxWaterVapor() const { return max_water_vapor; }
+
+	//temperature in kelvin height meters above the bottom of the lattice
+	static float TemperatureAt(float height, const FCloudLapseProfile& profile);
+
+	//height of the bottom of cell z, in meters
+	static float HeightOf(int32_t z, int32_t z_size, float z_world_size);
+
+	//w_max = 217.0 * exp[19.482 - 4303.4 / (T-29.5)] / T in double precision as the original simulation worked it out, used for the tables
+	static float MaxWaterVaporAt(float temperature);
+
+	//w_max for a whole field of per cell temperatures through the polynomial exp of CloudSimKernels::SaturationRange()
+	//within 3.3e-6 relative of MaxWaterVaporAt() from 120K to 340K
+	static void MaxWaterVaporField(const float* temperature, float* out_max_water_vapor, int32_t count);
+
+private:
+	inline int32_t Clamp(int32_t z) const { return z < 0 ? 0 : (z >= (int32_t)temperatures.size() ? (int32_t)temperatures.size() - 1 : z); }
+
+	int32_t z_size = -1;
+	float z_world_size = 0.f;
+	FCloudLapseProfile profile;
+
+	std::vector<float> temperatures;
+	std::vector<float> max_water_vapor;
+};
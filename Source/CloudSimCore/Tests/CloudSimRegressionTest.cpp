@@ -0,0 +1,327 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+//checks every solver configuration that promises results identical to the serial scalar solver really gives them
+//a few steps are run from each scenario in both advection schemes and every stored value compared bit for bit,
+//the 16 bit packed solver can't match so it is only held to a bounded error instead
+//only built by the standalone CMake build, UnrealBuildTool picks up every source file in the module so the whole file is compiled out there
+#if defined(CLOUDSIM_STANDALONE) && CLOUDSIM_STANDALONE
+
+#include "CloudPackedSolver.h"
+#include "CloudSimBenchmark.h"
+#include "CloudSimParallel.h"
+#include "CloudSolver.h"
+#include "CloudSparseSolver.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr int32_t x_size = 37;
+	constexpr int32_t y_size = 21;
+	constexpr int32_t z_size = 13;
+	constexpr int32_t num_steps = 4;
+
+	//the velocity and water channels, the only ones that carry over from one step to the next
+	constexpr int32_t num_stored_channels = (int32_t)ECloudChannel::WaterDroplets + 1;
+
+	//worst error the 16 bit packed solver may reach, see MaxError()
+	constexpr double max_packed_error = 0.01;
+
+	//range either side of 0 of the Fixed16 channels, wide enough for the water the scenarios build up over num_steps
+	constexpr float packed_fixed_range = 8192.f;
+
+	const char* SchemeName(ECloudAdvectionScheme scheme)
+	{
+		return scheme == ECloudAdvectionScheme::Scatter ? "Scatter" : "Gather";
+	}
+
+	const char* ScenarioName(ECloudScenario scenario)
+	{
+		switch(scenario)
+		{
+		case(ECloudScenario::VaporSource):
+			return "VaporSource";
+		case(ECloudScenario::HalfandHalf):
+			return "HalfandHalf";
+		case(ECloudScenario::DifferentDensities):
+			return "DifferentDensities";
+		}
+		return "";
+	}
+
+	//the reference the other configurations are held to, one thread and the per cell kernels
+	FCloudSimParams ReferenceParams(ECloudAdvectionScheme scheme)
+	{
+		FCloudSimParams params;
+		params.use_simd = false;
+		params.advection_scheme = scheme;
+		//slow enough that the water doesn't all condense in the first step
+		params.phase_transition_rate = 0.5f;
+		return params;
+	}
+
+	//a scenario's starting state, with a random wind over the lower x half if add_wind so the rest stays still and activity tiles get skipped
+	//the wind drives the velocities far outside what 16 bits can hold within a few steps, so the packed checks run without it
+	FCloudLattice MakeStart(ECloudScenario scenario, bool add_wind)
+	{
+		FCloudLattice start;
+		start.Init(x_size, y_size, z_size);
+		CloudFillScenario(start, scenario);
+		if(!add_wind)
+		{
+			return start;
+		}
+
+		std::mt19937 rng((uint32_t)scenario + 1);
+		std::uniform_real_distribution<float> wind(-3.f, 8.f);
+		for(int32_t z = 0; z < z_size; z++)
+		{
+			for(int32_t y = 0; y < y_size; y++)
+			{
+				for(int32_t x = 0; x < x_size / 2; x++)
+				{
+					for(int32_t c = (int32_t)ECloudChannel::VelocityX; c <= (int32_t)ECloudChannel::VelocityZ; c++)
+					{
+						start.Channel((ECloudChannel)c)[start.Index(x, y, z)] = wind(rng);
+					}
+				}
+			}
+		}
+		return start;
+	}
+
+	//copies the stored channels of from into to cell by cell, so the two can differ in padding and cell order
+	void CopyCells(const FCloudLattice& from, FCloudLattice& to)
+	{
+		for(int32_t c = 0; c < num_stored_channels; c++)
+		{
+			for(int32_t z = 0; z < z_size; z++)
+			{
+				for(int32_t y = 0; y < y_size; y++)
+				{
+					for(int32_t x = 0; x < x_size; x++)
+					{
+						to.Channel((ECloudChannel)c)[to.Index(x, y, z)] = from.Channel((ECloudChannel)c)[from.Index(x, y, z)];
+					}
+				}
+			}
+		}
+	}
+
+	//runs the dense solver from start and returns where it ends up in a plain linear lattice
+	FCloudLattice RunDense(const FCloudSimParams& params, int32_t num_threads, const FCloudLattice& start)
+	{
+		FCloudSolver solver;
+		solver.GetParams() = params;
+		if(num_threads > 1)
+		{
+			solver.SetParallelFor(FCloudParallelFor::ThreadPool(num_threads));
+		}
+		solver.Init(x_size, y_size, z_size);
+		CopyCells(start, solver.GetLattice());
+		for(int32_t step = 0; step < num_steps; step++)
+		{
+			solver.RunStep();
+		}
+
+		FCloudLattice result;
+		result.Init(x_size, y_size, z_size);
+		CopyCells(solver.GetLattice(), result);
+		return result;
+	}
+
+	FCloudLattice RunSparse(const FCloudSimParams& params, int32_t num_threads, const FCloudLattice& start)
+	{
+		FCloudSparseSolver solver;
+		solver.GetParams() = params;
+		if(num_threads > 1)
+		{
+			solver.SetParallelFor(FCloudParallelFor::ThreadPool(num_threads));
+		}
+		solver.Init(x_size, y_size, z_size);
+		solver.GetLattice().LoadFrom(start, params.sparse_threshold);
+		for(int32_t step = 0; step < num_steps; step++)
+		{
+			solver.RunStep();
+		}
+
+		FCloudLattice result;
+		solver.GetLattice().StoreTo(result);
+		return result;
+	}
+
+	FCloudLattice RunPacked(const FCloudSimParams& params, const FCloudLattice& start)
+	{
+		FCloudPackedSolver solver;
+		solver.GetParams() = params;
+		solver.Init(x_size, y_size, z_size);
+		solver.GetLattice().LoadFrom(start);
+		for(int32_t step = 0; step < num_steps; step++)
+		{
+			solver.RunStep();
+		}
+
+		FCloudLattice result;
+		solver.GetLattice().StoreTo(result);
+		return result;
+	}
+
+	//prints the first value of result that isn't bit for bit the same as expected, returns whether there was one
+	bool FindMismatch(const FCloudLattice& expected, const FCloudLattice& result, const std::string& name)
+	{
+		for(int32_t c = 0; c < num_stored_channels; c++)
+		{
+			for(int32_t z = 0; z < z_size; z++)
+			{
+				for(int32_t y = 0; y < y_size; y++)
+				{
+					for(int32_t x = 0; x < x_size; x++)
+					{
+						const float a = expected.Channel((ECloudChannel)c)[expected.Index(x, y, z)];
+						const float b = result.Channel((ECloudChannel)c)[result.Index(x, y, z)];
+						if(std::memcmp(&a, &b, sizeof(float)) != 0)
+						{
+							std::printf("FAIL %s: channel %d cell (%d, %d, %d) is %.9g, expected %.9g\n", name.c_str(), c, x, y, z, b, a);
+							return true;
+						}
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+	//largest error of result against expected over the stored channels, relative to the expected value or to floor for values closer to 0 than that
+	double MaxError(const FCloudLattice& expected, const FCloudLattice& result, double floor)
+	{
+		double max_error = 0;
+		for(int32_t c = 0; c < num_stored_channels; c++)
+		{
+			for(int32_t i = 0; i < expected.Num(); i++)
+			{
+				const double a = expected.Channel((ECloudChannel)c)[i];
+				const double b = result.Channel((ECloudChannel)c)[i];
+				const double error = std::fabs(a - b) / std::max(floor, std::fabs(a));
+				//written so a NaN counts as the worst error
+				if(!(error <= max_error))
+				{
+					max_error = error;
+				}
+			}
+		}
+		return max_error;
+	}
+
+	struct FExactConfig
+	{
+		const char* name;
+		std::function<FCloudLattice(FCloudSimParams params, const FCloudLattice& start)> run;
+	};
+}
+
+int main()
+{
+	const std::vector<FExactConfig> configs = {
+		{ "threads", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.min_batch_size = 64;
+			return RunDense(params, 4, start);
+		} },
+		{ "simd", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.use_simd = true;
+			return RunDense(params, 1, start);
+		} },
+		{ "padded", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.padded = true;
+			return RunDense(params, 1, start);
+		} },
+		{ "morton", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.cell_order = ECloudCellOrder::Morton;
+			return RunDense(params, 1, start);
+		} },
+		{ "blocked", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.stencil_block = { 8, 4, 4 };
+			return RunDense(params, 1, start);
+		} },
+		{ "wavefront", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.wavefront = true;
+			params.wavefront_tile = { 8, 8, 4 };
+			return RunDense(params, 4, start);
+		} },
+		{ "fused", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.fuse_stages = true;
+			return RunDense(params, 1, start);
+		} },
+		{ "activity", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.activity_mask = true;
+			params.activity_threshold = 0.f;
+			return RunDense(params, 1, start);
+		} },
+		{ "release_scratch", [](FCloudSimParams params, const FCloudLattice& start) {
+			params.release_scratch = true;
+			return RunDense(params, 1, start);
+		} },
+		{ "sparse", [](FCloudSimParams params, const FCloudLattice& start) {
+			//nothing counts as clear air, so every brick stays allocated
+			params.sparse_threshold = -1.f;
+			return RunSparse(params, 4, start);
+		} },
+		{ "packed_float32", [](FCloudSimParams params, const FCloudLattice& start) {
+			return RunPacked(params, start);
+		} },
+	};
+
+	int32_t failures = 0;
+	int32_t checks = 0;
+	for(ECloudAdvectionScheme scheme : { ECloudAdvectionScheme::Scatter, ECloudAdvectionScheme::Gather })
+	{
+		for(ECloudScenario scenario : { ECloudScenario::VaporSource, ECloudScenario::HalfandHalf, ECloudScenario::DifferentDensities })
+		{
+			const FCloudLattice start = MakeStart(scenario, true);
+			const FCloudSimParams params = ReferenceParams(scheme);
+			const FCloudLattice expected = RunDense(params, 1, start);
+			const std::string prefix = std::string(SchemeName(scheme)) + " " + ScenarioName(scenario) + " ";
+
+			for(const FExactConfig& config : configs)
+			{
+				checks++;
+				if(FindMismatch(expected, config.run(params, start), prefix + config.name))
+				{
+					failures++;
+				}
+			}
+
+			const FCloudLattice still_start = MakeStart(scenario, false);
+			const FCloudLattice still_expected = RunDense(params, 1, still_start);
+			for(ECloudPrecision precision : { ECloudPrecision::Float16, ECloudPrecision::Fixed16 })
+			{
+				FCloudSimParams packed_params = params;
+				for(int32_t c = 0; c < num_stored_channels; c++)
+				{
+					packed_params.precision[c] = precision;
+					packed_params.fixed_range[c] = packed_fixed_range;
+				}
+				//Fixed16 steps are the same size everywhere in its range, so its error is taken relative to the range instead
+				const double floor = precision == ECloudPrecision::Float16 ? 1e-3 : packed_fixed_range;
+				const double error = MaxError(still_expected, RunPacked(packed_params, still_start), floor);
+				const char* precision_name = precision == ECloudPrecision::Float16 ? "packed_float16" : "packed_fixed16";
+				checks++;
+				if(!(error <= max_packed_error))
+				{
+					std::printf("FAIL %s%s: max error %g, allowed %g\n", prefix.c_str(), precision_name, error, max_packed_error);
+					failures++;
+				}
+			}
+		}
+	}
+
+	std::printf("%d of %d checks passed\n", checks - failures, checks);
+	return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,219 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CloudSimBenchmarkCommandlet.h"
+#include "CloudSimBenchmark.h"
+#include "CloudSimulator.h"
+#include "HAL/PlatformMemory.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include <sstream>
+
+DEFINE_LOG_CATEGORY_STATIC(LogCloudSimBenchmark, Log, All);
+
+UCloudSimBenchmarkCommandlet::UCloudSimBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UCloudSimBenchmarkCommandlet::Main(const FString& Params)
+{
+	FCloudScenarioConfig config;
+	config.warmup_steps = 5;
+
+	FString size_string;
+	if(FParse::Value(*Params, TEXT("Size="), size_string))
+	{
+		FCloudCellCoord size;
+		if(sscanf(TCHAR_TO_ANSI(*size_string), "%dx%dx%d", &size.x, &size.y, &size.z) != 3 || size.x <= 0 || size.y <= 0 || size.z <= 0)
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -Size=%s, expected XxYxZ"), *size_string);
+			return 1;
+		}
+		config.size = size;
+	}
+
+	FString scenario_string;
+	if(FParse::Value(*Params, TEXT("Scenario="), scenario_string) && !ParseCloudScenario(TCHAR_TO_UTF8(*scenario_string), config.scenario))
+	{
+		UE_LOG(LogCloudSimBenchmark, Error, TEXT("Unknown -Scenario=%s, expected VaporSource, HalfandHalf or DifferentDensities"), *scenario_string);
+		return 1;
+	}
+
+	FParse::Value(*Params, TEXT("Steps="), config.steps);
+	FParse::Value(*Params, TEXT("Warmup="), config.warmup_steps);
+	config.steps = FMath::Max(config.steps, 1);
+	config.warmup_steps = FMath::Max(config.warmup_steps, 0);
+
+	FString scheme_string;
+	if(FParse::Value(*Params, TEXT("Scheme="), scheme_string))
+	{
+		if(scheme_string.Equals(TEXT("Gather"), ESearchCase::IgnoreCase))
+		{
+			config.params.advection_scheme = ECloudAdvectionScheme::Gather;
+		}
+		else if(!scheme_string.Equals(TEXT("Scatter"), ESearchCase::IgnoreCase))
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Unknown -Scheme=%s, expected Scatter or Gather"), *scheme_string);
+			return 1;
+		}
+	}
+	config.params.double_buffered = FParse::Param(*Params, TEXT("DoubleBuffered"));
+	config.params.use_simd = !FParse::Param(*Params, TEXT("NoSimd"));
+	config.sparse = FParse::Param(*Params, TEXT("Sparse"));
+	FParse::Value(*Params, TEXT("SparseThreshold="), config.params.sparse_threshold);
+	config.params.activity_mask = FParse::Param(*Params, TEXT("Activity"));
+	FParse::Value(*Params, TEXT("ActivityThreshold="), config.params.activity_threshold);
+
+	FString order_string;
+	if(FParse::Value(*Params, TEXT("Order="), order_string) && !ParseCloudCellOrder(TCHAR_TO_UTF8(*order_string), config.params.cell_order))
+	{
+		UE_LOG(LogCloudSimBenchmark, Error, TEXT("Unknown -Order=%s, expected Linear or Morton"), *order_string);
+		return 1;
+	}
+	FString block_string;
+	if(FParse::Value(*Params, TEXT("Block="), block_string))
+	{
+		FCloudCellCoord& block = config.params.stencil_block;
+		if(sscanf(TCHAR_TO_ANSI(*block_string), "%dx%dx%d", &block.x, &block.y, &block.z) != 3)
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -Block=%s, expected XxYxZ"), *block_string);
+			return 1;
+		}
+	}
+	config.params.fuse_stages = FParse::Param(*Params, TEXT("Fuse"));
+	config.params.private_scatter = FParse::Param(*Params, TEXT("PrivateScatter"));
+	config.params.coloured_scatter = FParse::Param(*Params, TEXT("ColouredScatter"));
+	FString scatter_tile_string;
+	if(FParse::Value(*Params, TEXT("ScatterTile="), scatter_tile_string))
+	{
+		FCloudCellCoord& tile = config.params.scatter_tile;
+		if(sscanf(TCHAR_TO_ANSI(*scatter_tile_string), "%dx%dx%d", &tile.x, &tile.y, &tile.z) != 3)
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -ScatterTile=%s, expected XxYxZ"), *scatter_tile_string);
+			return 1;
+		}
+	}
+	config.params.release_scratch = FParse::Param(*Params, TEXT("ReleaseScratch"));
+	config.params.wavefront = FParse::Param(*Params, TEXT("Wavefront"));
+	FString tile_string;
+	if(FParse::Value(*Params, TEXT("WavefrontTile="), tile_string))
+	{
+		FCloudCellCoord& tile = config.params.wavefront_tile;
+		if(sscanf(TCHAR_TO_ANSI(*tile_string), "%dx%dx%d", &tile.x, &tile.y, &tile.z) != 3)
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -WavefrontTile=%s, expected XxYxZ"), *tile_string);
+			return 1;
+		}
+	}
+
+	FString packed_string;
+	if(FParse::Value(*Params, TEXT("Packed="), packed_string, false))
+	{
+		TArray<FString> names;
+		packed_string.ParseIntoArray(names, TEXT(","));
+		ECloudPrecision velocity;
+		ECloudPrecision water;
+		if(names.Num() < 1 || names.Num() > 2 || !ParseCloudPrecision(TCHAR_TO_UTF8(*names[0]), velocity) || !ParseCloudPrecision(TCHAR_TO_UTF8(*names.Last()), water))
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -Packed=%s, expected Float32, Float16 or Fixed16 for velocity and optionally water"), *packed_string);
+			return 1;
+		}
+		for(int32 channel = 0; channel < (int32)ECloudChannel::AdvectWaterVapor; channel++)
+		{
+			config.params.precision[channel] = channel < (int32)ECloudChannel::WaterVapor ? velocity : water;
+		}
+		config.packed = true;
+	}
+	FString range_string;
+	if(FParse::Value(*Params, TEXT("FixedRange="), range_string, false))
+	{
+		float velocity;
+		float water;
+		if(sscanf(TCHAR_TO_ANSI(*range_string), "%f,%f", &velocity, &water) != 2 || velocity <= 0.f || water <= 0.f)
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -FixedRange=%s, expected velocity,water"), *range_string);
+			return 1;
+		}
+		for(int32 channel = 0; channel < (int32)ECloudChannel::AdvectWaterVapor; channel++)
+		{
+			config.params.fixed_range[channel] = channel < (int32)ECloudChannel::WaterVapor ? velocity : water;
+		}
+	}
+	FString texture_string;
+	if(FParse::Value(*Params, TEXT("Texture="), texture_string))
+	{
+		if(!ParseCloudTextureFormat(TCHAR_TO_UTF8(*texture_string), config.texture_format))
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -Texture=%s, expected R8 or R16F"), *texture_string);
+			return 1;
+		}
+		config.write_texture = true;
+	}
+	FString regions_string;
+	if(FParse::Value(*Params, TEXT("TextureRegions="), regions_string, false))
+	{
+		if(sscanf(TCHAR_TO_ANSI(*regions_string), "%d,%f", &config.texture_region_rows, &config.texture_threshold) != 2)
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Bad -TextureRegions=%s, expected rows,threshold"), *regions_string);
+			return 1;
+		}
+	}
+
+	//the task graph is what the game runs on, an explicit thread count gives numbers that do not depend on the machine's worker setup
+	int32 threads = 0;
+	const FCloudParallelFor parallel_for = FParse::Value(*Params, TEXT("Threads="), threads) ? (threads == 1 ? FCloudParallelFor::Serial() : FCloudParallelFor::ThreadPool(threads)) : CloudTaskGraphParallelFor();
+
+	if(FParse::Param(*Params, TEXT("TuneBlocks")))
+	{
+		const FCloudBlockTuneResult tune = CloudTuneStencilBlock(config.size, config.params, parallel_for);
+		for(const FCloudBlockTiming& timing : tune.timings)
+		{
+			UE_LOG(LogCloudSimBenchmark, Display, TEXT("Block %dx%dx%d: %.1f us"), timing.block.x, timing.block.y, timing.block.z, timing.p50_us);
+		}
+		UE_LOG(LogCloudSimBenchmark, Display, TEXT("Running with block %dx%dx%d"), tune.best.x, tune.best.y, tune.best.z);
+		config.params.stencil_block = tune.best;
+	}
+
+	UE_LOG(LogCloudSimBenchmark, Display, TEXT("Running %s on a %s %dx%dx%d lattice for %d steps across %d threads"), UTF8_TO_TCHAR(CloudScenarioName(config.scenario)), config.sparse ? TEXT("sparse") : (config.packed ? TEXT("packed") : TEXT("dense")), config.size.x, config.size.y, config.size.z, config.steps, parallel_for.max_tasks);
+
+	FCloudScenarioReport report = RunCloudScenario(config, parallel_for);
+	report.peak_memory_bytes = FPlatformMemory::GetStats().PeakUsedPhysical;
+
+	std::ostringstream json;
+	WriteCloudScenarioJson(json, report);
+	std::ostringstream csv;
+	WriteCloudScenarioCsv(csv, report);
+
+	UE_LOG(LogCloudSimBenchmark, Display, TEXT("%s"), UTF8_TO_TCHAR(json.str().c_str()));
+
+	TArray<TPair<FString, FString>> outputs;
+	FString output;
+	if(FParse::Value(*Params, TEXT("Output="), output))
+	{
+		outputs.Emplace(output, UTF8_TO_TCHAR(FPaths::GetExtension(output).Equals(TEXT("csv"), ESearchCase::IgnoreCase) ? csv.str().c_str() : json.str().c_str()));
+	}
+	else
+	{
+		const FString base = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("CloudSimBenchmarks"), FString::Printf(TEXT("%s_%s"), UTF8_TO_TCHAR(CloudScenarioName(config.scenario)), *FDateTime::Now().ToString()));
+		outputs.Emplace(base + TEXT(".json"), UTF8_TO_TCHAR(json.str().c_str()));
+		outputs.Emplace(base + TEXT(".csv"), UTF8_TO_TCHAR(csv.str().c_str()));
+	}
+
+	for(const TPair<FString, FString>& file : outputs)
+	{
+		if(!FFileHelper::SaveStringToFile(file.Value, *file.Key))
+		{
+			UE_LOG(LogCloudSimBenchmark, Error, TEXT("Could not write %s"), *file.Key);
+			return 1;
+		}
+		UE_LOG(LogCloudSimBenchmark, Display, TEXT("Wrote %s"), *file.Key);
+	}
+
+	return 0;
+}
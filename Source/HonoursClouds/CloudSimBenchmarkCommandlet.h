@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CloudSimBenchmarkCommandlet.generated.h"
+
+//runs the cloud solver headless and writes a performance report, for build and perf machines without a viewport
+//UnrealEditor-Cmd HonoursClouds.uproject -run=CloudSimBenchmark -Size=64x64x32 -Scenario=VaporSource -Steps=200 -Output=Report.json
+//  -Size=XxYxZ           lattice size (default 50x50x16)
+//  -Scenario=name        VaporSource, HalfandHalf or DifferentDensities (default VaporSource)
+//  -Steps=n              full steps measured (default 100)
+//  -Warmup=n             full steps run first and not measured (default 5)
+//  -Threads=n            run on the solver's own pool of n threads instead of the task graph
+//  -Scheme=name          Scatter or Gather advection (default Scatter)
+//  -DoubleBuffered       double buffer the stencil stages
+//  -NoSimd               use the per cell kernels
+//  -Sparse               run the sparse brick solver
+//  -SparseThreshold=f    values closer to 0 than this count as clear air in the sparse solver (default 0.000001)
+//  -Activity             skip tiles of the dense lattice whose inputs have not changed
+//  -ActivityThreshold=f  changes no bigger than this do not mark a tile to be run again (default 0)
+//  -Order=name          Linear or Morton cell order of the dense lattice (default Linear)
+//  -Block=XxYxZ          stencil block size of the dense solver, 0 along an axis for the whole lattice (default 0x0x0)
+//  -Wavefront           run the stencil stages of the dense solver as diagonals of tiles, same result, more threads busy on thin lattices
+//  -WavefrontTile=XxYxZ  size of the wavefront tiles, 0 along an axis for one tile per thread (default 0x0x0)
+//  -Fuse                run diffusion in the same pass as velocity and the phase transition in the same pass as Advect2
+//  -ColouredScatter     run the scatter on every thread as parity coloured tiles, cells reaching past their tile use per task accumulators
+//  -ScatterTile=XxYxZ   size of the coloured scatter tiles, 0 along an axis for 16 (default 0x0x0)
+//  -PrivateScatter      run the scatter on every thread, each into its own accumulators that are summed afterwards
+//  -ReleaseScratch      free the advection scratch blocks after every step instead of keeping them for the next
+//  -TuneBlocks           time a range of stencil block sizes first and run with the fastest
+//  -Packed=v[,w]         run the packed solver, velocity and water stored as Float32, Float16 or Fixed16, and report the error per channel
+//  -FixedRange=v,w       range either side of 0 of Fixed16 velocity and water channels (default 256,64)
+//  -Texture=format       write the droplets into an R8 or R16F texture atlas after every step, like native_texture, and time it
+//  -TextureRegions=n,f   bands of n rows of each slice count as uploaded when a texel moved by more than f (default 8,0)
+//  -Output=path          .csv writes csv, anything else json, by default both are written to Saved/CloudSimBenchmarks
+UCLASS()
+class HONOURSCLOUDS_API UCloudSimBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UCloudSimBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
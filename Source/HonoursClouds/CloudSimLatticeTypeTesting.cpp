@@ -2,250 +2,79 @@
 
 
 #include "CloudSimLatticeTypeTesting.h"
+#include "HAL/PlatformMisc.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include <sstream>
 
 // Sets default values
 ACloudSimLatticeTypeTesting::ACloudSimLatticeTypeTesting()
 {
- 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
-	PrimaryActorTick.bCanEverTick = true;
-
+	//the suite is run on request, nothing needs to happen every frame
+	PrimaryActorTick.bCanEverTick = false;
 }
 
 // Called when the game starts or when spawned
 void ACloudSimLatticeTypeTesting::BeginPlay()
 {
 	Super::BeginPlay();
-}
-
-// Called every frame
-void ACloudSimLatticeTypeTesting::Tick(float DeltaTime)
-{
-	Super::Tick(DeltaTime);
-	PopulateArray();
-	TransitionArray();
-
-	//PopulateVector();
-	//TransitionVector();
-	//Vlattice.clear();
 
-	//PopulateList();
-	//TransitionList();
-	//Llattice.clear();
-}
-
-void ACloudSimLatticeTypeTesting::PopulateArray()
-{
+	if(run_on_begin_play)
 	{
-		SCOPE_CYCLE_COUNTER(STAT_PopulateArray1);
-		for(int x = 0; x < 10; x++)
-		{
-			for(int y = 0; y < 10; y++)
-			{
-				for(int z = 0; z < 10; z++)
-				{
-					Alattice[x][y][z] = rand() % 1000;
-				}
-			}	
-		}
+		RunBenchmarkSuite();
 	}
 }
 
-void ACloudSimLatticeTypeTesting::TransitionArray()
+FString ACloudSimLatticeTypeTesting::RunBenchmarkSuite()
 {
-	{
-		SCOPE_CYCLE_COUNTER(STAT_TransitionArray1);
-		for(int x = 0; x < 10; x++)
-		{
-			for(int y = 0; y < 10; y++)
-			{
-				for(int z = 0; z < 10; z++)
-				{
-					Alattice[x][y][z] = (Alattice[x + 1][y][z] / 6) + (Alattice[x - 1][y][z] / 6) + (Alattice[x][y + 1][z] / 6) + (Alattice[x][y - 1][z] / 6) + (Alattice[x][y][z + 1] / 6) + (Alattice[x][y][z - 1] / 6);
-				}
-			}	
-		}
-	}
-}
+	SCOPE_CYCLE_COUNTER(STAT_LatticeTest_Suite);
 
-void ACloudSimLatticeTypeTesting::PopulateVector()
-{
+	FCloudBenchConfig config;
+	config.warmup = FMath::Max(warmup, 0);
+	config.repetitions = FMath::Max(repetitions, 1);
+
+	config.sizes.clear();
+	for(const FIntVector& size : sizes)
 	{
-		SCOPE_CYCLE_COUNTER(STAT_PopulateVector1);
-		for(int x = 0; x < x_size; x++)
+		if(size.X > 0 && size.Y > 0 && size.Z > 0)
 		{
-			Vlattice.push_back(std::vector<std::vector<float>>(y_size));
-			for(int y = 0; y < y_size; y++)
-			{
-				Vlattice[x].push_back(std::vector<float>(z_size));
-				for(int z = 0; z < z_size; z++)
-				{
-					Vlattice[x][y].push_back(rand() % 1000);
-				}
-			}
+			config.sizes.push_back({ size.X, size.Y, size.Z });
 		}
 	}
-}
 
-void ACloudSimLatticeTypeTesting::TransitionVector()
-{
+	config.layouts.clear();
+	const bool layout_enabled[(int32)ECloudBenchLayout::Num] = { layout_solver, layout_aos, layout_soa, layout_morton, layout_bricked, layout_padded };
+	for(int32 layout = 0; layout < (int32)ECloudBenchLayout::Num; layout++)
 	{
-		SCOPE_CYCLE_COUNTER(STAT_TransitionVector1);
-		int x_minus = 0;
-		int x_plus = 0;
-		int y_minus = 0;
-		int y_plus = 0;
-		int z_minus = 0;
-		int z_plus = 0;
-	
-		for(int x = 0; x < x_size; x++)
+		if(layout_enabled[layout])
 		{
-			x_minus = x - 1;
-			x_plus = x + 1;
-			if (x == 0)
-			{
-				x_minus = 0;
-			}
-			if (x == x_size - 1)
-			{
-				x_plus = x_size - 1;
-			}
-			for(int y = 0; y < y_size; y++)
-			{
-				y_minus = y - 1;
-				y_plus = y + 1;
-				if (y == 0)
-				{
-					y_minus = 0;
-				}
-				if (y == y_size - 1)
-				{
-					y_plus = y_size - 1;
-				}
-				for(int z = 0; z < z_size; z++)
-				{
-					z_minus = z - 1;
-					z_plus = z + 1;
-					if (z == 0)
-					{
-						z_minus = 0;
-					}
-					if (z == z_size - 1)
-					{
-						z_plus = z_size - 1;
-					}
-					Vlattice[x][y][z] = (Vlattice[x_plus][y][z] / 6) + (Vlattice[x_minus][y][z] / 6) + (Vlattice[x][y_plus][z] / 6) + (Vlattice[x][y_minus][z] / 6) + (Vlattice[x][y][z_plus] / 6) + (Vlattice[x][y][z_minus] / 6);
-				}
-			}	
+			config.layouts.push_back((ECloudBenchLayout)layout);
 		}
 	}
-}
 
-void ACloudSimLatticeTypeTesting::PopulateList()
-{
+	config.thread_counts.clear();
+	for(int32 threads : thread_counts)
 	{
-		SCOPE_CYCLE_COUNTER(STAT_PopulateList1);
-		for(int x = 0; x < x_size; x++)
-		{
-			Llattice.push_back(std::list<std::list<float>>(y_size));
-			std::list<std::list<std::list<float>>>::iterator x_iterator = Llattice.begin();
-			std::advance(x_iterator, x);
-			for(int y = 0; y < y_size; y++)
-			{
-				(*(x_iterator)).push_back(std::list<float>(z_size));
-				std::list<std::list<float>>::iterator y_iterator = (*(x_iterator)).begin();
-				std::advance(y_iterator, y);
-				for(int z = 0; z < z_size; z++)
-				{
-					(*(y_iterator)).push_back(rand() % 1000);
-				}
-			}
-		}
+		config.thread_counts.push_back(threads > 0 ? threads : FPlatformMisc::NumberOfCoresIncludingHyperthreads());
 	}
-}
 
-void ACloudSimLatticeTypeTesting::TransitionList()
-{
+	UE_LOG(LogTemp, Log, TEXT("%s"), UTF8_TO_TCHAR(CloudBenchTableHeader().c_str()));
+	const std::vector<FCloudBenchResult> results = RunCloudBenchmarks(config, [](const FCloudBenchResult& result)
 	{
-		SCOPE_CYCLE_COUNTER(STAT_TransitionList1);
-		std::list<std::list<std::list<float>>>::iterator x_plus_access1;
-		std::list<std::list<std::list<float>>>::iterator x_minus_access1;
-		std::list<std::list<float>>::iterator x_plus_access2;
-		std::list<std::list<float>>::iterator x_minus_access2;
-		std::list<std::list<float>>::iterator y_plus_access;
-		std::list<std::list<float>>::iterator y_minus_access;
-		std::list<float>::iterator x_plus;
-		std::list<float>::iterator x_minus;
-		std::list<float>::iterator y_plus;
-		std::list<float>::iterator y_minus;
-		std::list<float>::iterator z_plus;
-		std::list<float>::iterator z_minus;
-	
-		for(int x = 0; x < x_size; x++)
-		{
-			std::list<std::list<std::list<float>>>::iterator x_iterator = Llattice.begin();
-			std::advance(x_iterator, x);
-
-			x_plus_access1 = x_iterator;
-			x_minus_access1 = x_iterator;
-			if(x > 0)
-			{
-				std::advance(x_minus_access1, -1);
-			}
-			if(x < x_size - 1)
-			{
-				std::advance(x_plus_access1, 1);
-			}
-		
-			for(int y = 0; y < y_size; y++)
-			{
-				std::list<std::list<float>>::iterator y_iterator = (*(x_iterator)).begin();
-				std::advance(y_iterator, y);
+		UE_LOG(LogTemp, Log, TEXT("%s"), UTF8_TO_TCHAR(FormatCloudBenchResult(result).c_str()));
+	});
 
-				x_plus_access2 = (*(x_plus_access1)).begin();
-				std::advance(x_plus_access2, y);
-				x_minus_access2 = (*(x_minus_access1)).begin();
-				std::advance(x_minus_access2, y);
+	std::ostringstream csv;
+	WriteCloudBenchCsv(csv, results);
 
-				y_plus_access = y_iterator;
-				y_minus_access = y_iterator;
-				if(y > 0)
-				{
-					std::advance(y_minus_access, -1);
-				}
-				if(y < y_size - 1)
-				{
-					std::advance(y_plus_access, 1);
-				}
-			
-				for(int z = 0; z < z_size; z++)
-				{
-					std::list<float>::iterator z_iterator = (*(y_iterator)).begin();
-					std::advance(z_iterator, z);
-
-					x_plus = (*(x_plus_access2)).begin();
-					std::advance(x_plus, z);
-					x_minus = (*(x_minus_access2)).begin();
-					std::advance(x_minus, z);
-
-					y_plus = (*(y_plus_access)).begin();
-					std::advance(y_plus, z);
-					y_minus = (*(y_minus_access)).begin();
-					std::advance(y_minus, z);
-
-					z_plus = z_iterator;
-					z_minus = z_iterator;
-					if(z > 0)
-					{
-						std::advance(z_minus, -1);
-					}
-					if(z < z_size - 1)
-					{
-						std::advance(z_plus, 1);
-					}
-
-					(*(z_iterator)) = ((*(x_plus)) / 6) + ((*(x_minus)) / 6) + ((*(y_plus)) / 6) + ((*(y_minus)) / 6) + ((*(z_plus)) / 6) + ((*(z_minus)) / 6);
-				}
-			}
-		}
+	const FString path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("CloudSimBenchmarks"), FString::Printf(TEXT("LatticeLayouts_%s.csv"), *FDateTime::Now().ToString()));
+	if(!FFileHelper::SaveStringToFile(UTF8_TO_TCHAR(csv.str().c_str()), *path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not write lattice benchmark results to %s"), *path);
+		return FString();
 	}
-}
\ No newline at end of file
+
+	UE_LOG(LogTemp, Log, TEXT("Lattice benchmark results written to %s"), *path);
+	return path;
+}
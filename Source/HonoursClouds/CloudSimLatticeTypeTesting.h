@@ -4,22 +4,21 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "CloudSimBenchmark.h"
 #include "CloudSimLatticeTypeTesting.generated.h"
 
 DECLARE_STATS_GROUP(TEXT("Cloud_Simulator_LatticeTest"), STATGROUP_LatticeTest, STATCAT_Advanced);
-DECLARE_CYCLE_STAT(TEXT("LatticeTest - PopulateArray"), STAT_PopulateArray1, STATGROUP_LatticeTest);
-DECLARE_CYCLE_STAT(TEXT("LatticeTest - TransitionArray"), STAT_TransitionArray1, STATGROUP_LatticeTest);
-DECLARE_CYCLE_STAT(TEXT("LatticeTest - PopulateVector"), STAT_PopulateVector1, STATGROUP_LatticeTest);
-DECLARE_CYCLE_STAT(TEXT("LatticeTest - TransitionVector"), STAT_TransitionVector1, STATGROUP_LatticeTest);
-DECLARE_CYCLE_STAT(TEXT("LatticeTest - PopulateList"), STAT_PopulateList1, STATGROUP_LatticeTest);
-DECLARE_CYCLE_STAT(TEXT("LatticeTest - TransitionList"), STAT_TransitionList1, STATGROUP_LatticeTest);
+DECLARE_CYCLE_STAT(TEXT("LatticeTest - Benchmark Suite"), STAT_LatticeTest_Suite, STATGROUP_LatticeTest);
 
+//runs the lattice layout benchmark suite from CloudSimBenchmark.h in the editor or a packaged build
+//every combination of size, layout, thread count and stage is timed and written to a csv in the project's Saved/CloudSimBenchmarks folder
+//the same suite is run outside the engine by the cloudsim_bench executable of the standalone CloudSimCore build
 UCLASS()
 class HONOURSCLOUDS_API ACloudSimLatticeTypeTesting : public AActor
 {
 	GENERATED_BODY()
-	
-public:	
+
+public:
 	// Sets default values for this actor's properties
 	ACloudSimLatticeTypeTesting();
 
@@ -27,35 +26,47 @@ protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
-public:	
-	// Called every frame
-	virtual void Tick(float DeltaTime) override;
-
-	int x_size = 100;
-	int y_size = 100;
-	int z_size = 100;
-	
-	UFUNCTION(BlueprintCallable)
-	void PopulateArray();
-	
+public:
+	//runs the whole suite on the game thread, this blocks until every combination has been measured
+	//returns the path of the csv written
 	UFUNCTION(BlueprintCallable)
-	void TransitionArray();
+	FString RunBenchmarkSuite();
 
-	UFUNCTION(BlueprintCallable)
-	void PopulateVector();
-	
-	UFUNCTION(BlueprintCallable)
-	void TransitionVector();
-	
-	UFUNCTION(BlueprintCallable)
-	void PopulateList();
-	
-	UFUNCTION(BlueprintCallable)
-	void TransitionList();
-	
-	float Alattice[200][200][200];
-	
-	std::vector<std::vector<std::vector<float>>> Vlattice;
-	
-	std::list<std::list<std::list<float>>> Llattice;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool run_on_begin_play = false;
+
+	//lattice sizes to measure
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FIntVector> sizes = { FIntVector(50, 50, 16), FIntVector(100, 100, 32) };
+
+	//layouts to measure, see ECloudBenchLayout
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool layout_solver = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool layout_aos = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool layout_soa = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool layout_morton = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool layout_bricked = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool layout_padded = true;
+
+	//worker thread counts to measure, 0 uses every core
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<int32> thread_counts = { 1, 0 };
+
+	//samples thrown away before measuring
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 warmup = 3;
+
+	//samples measured for each combination
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 repetitions = 20;
 };
@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CloudSimWorker.h"
+#include "CloudSimulator.h"
+#include "HAL/RunnableThread.h"
+
+FCloudSimWorker::FCloudSimWorker(ACloudSimulator* in_simulator, float in_min_step_interval)
+	: simulator(in_simulator)
+	, min_step_interval(FMath::Max(in_min_step_interval, 0.f))
+{
+	thread = FRunnableThread::Create(this, TEXT("CloudSimWorker"), 0, TPri_BelowNormal);
+}
+
+FCloudSimWorker::~FCloudSimWorker()
+{
+	if(thread)
+	{
+		//Kill calls Stop() and then waits for Run() to return
+		thread->Kill(true);
+		delete thread;
+		thread = nullptr;
+	}
+}
+
+uint32 FCloudSimWorker::Run()
+{
+	while(!stopping.load(std::memory_order_relaxed))
+	{
+		const double step_start = FPlatformTime::Seconds();
+
+		simulator->RunFullStep();
+		steps_completed.fetch_add(1, std::memory_order_relaxed);
+
+		//sleep in short pieces so a stop request is never kept waiting for long
+		while(!stopping.load(std::memory_order_relaxed))
+		{
+			const double remaining = min_step_interval - (FPlatformTime::Seconds() - step_start);
+			if(remaining <= 0.0)
+			{
+				break;
+			}
+			FPlatformProcess::Sleep((float)FMath::Min(remaining, 0.01));
+		}
+	}
+	return 0;
+}
+
+void FCloudSimWorker::Stop()
+{
+	stopping.store(true, std::memory_order_relaxed);
+}
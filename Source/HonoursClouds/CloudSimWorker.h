@@ -0,0 +1,57 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "CloudLattice.h"
+#include "CloudPackedLattice.h"
+#include "CloudSparseLattice.h"
+#include <atomic>
+
+class ACloudSimulator;
+class FRunnableThread;
+
+//finished simulation step handed from the background thread to the game thread
+//once published it is never written again until the game thread has moved on to a newer one
+struct FCloudSnapshot
+{
+	FCloudLattice lattice;
+
+	//used instead of lattice when the step was run by the sparse solver
+	FCloudSparseLattice sparse_lattice;
+	bool sparse = false;
+
+	//used instead of lattice when the step was run by the packed solver
+	FCloudPackedLattice packed_lattice;
+	bool packed = false;
+
+	//number of steps the worker had finished when this snapshot was taken, 0 means nothing has been published yet
+	int32 step = 0;
+};
+
+//background thread that runs whole simulation steps back to back through ACloudSimulator::RunFullStep()
+//the thread is started by the constructor and stopped, waiting for the current step to finish, by the destructor
+class HONOURSCLOUDS_API FCloudSimWorker : public FRunnable
+{
+public:
+	FCloudSimWorker(ACloudSimulator* in_simulator, float in_min_step_interval);
+	virtual ~FCloudSimWorker() override;
+
+	//FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+	int32 GetStepsCompleted() const { return steps_completed.load(std::memory_order_relaxed); }
+
+private:
+	ACloudSimulator* simulator;
+
+	//shortest time in seconds between the start of two steps
+	float min_step_interval;
+
+	std::atomic<bool> stopping { false };
+	std::atomic<int32> steps_completed { 0 };
+
+	FRunnableThread* thread = nullptr;
+};
@@ -1,8 +1,39 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 #include "CloudSimulator.h"
+#include "CloudSimBenchmark.h"
 #include "Engine/Texture2D.h"
+#include "Materials/MaterialInstanceDynamic.h"
 #include "../../Plugins/Developer/RiderLink/Source/RD/thirdparty/clsocket/src/ActiveSocket.h"
 #include "Kismet/GameplayStatics.h"
+#include "Async/ParallelFor.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "ProfilingDebugging/CountersTrace.h"
+
+UE_TRACE_CHANNEL_DEFINE(CloudSimChannel)
+
+TRACE_DECLARE_INT_COUNTER(CloudSimCellsProcessed, TEXT("CloudSim/CellsProcessed"));
+TRACE_DECLARE_INT_COUNTER(CloudSimActiveTiles, TEXT("CloudSim/ActiveTiles"));
+TRACE_DECLARE_FLOAT_COUNTER(CloudSimStepsPerSecond, TEXT("CloudSim/StepsPerSecond"));
+TRACE_DECLARE_MEMORY_COUNTER(CloudSimLatticeMemory, TEXT("CloudSim/LatticeMemory"));
+
+//cycle stat for stat CloudSimulator plus a matching Insights event on the CloudSim trace channel
+#define CLOUDSIM_SCOPE(Name) \
+	SCOPE_CYCLE_COUNTER(STAT_CloudSim_##Name); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(CloudSim_##Name, CloudSimChannel)
+
+FCloudParallelFor CloudTaskGraphParallelFor()
+{
+	FCloudParallelFor parallel_for;
+	parallel_for.run = [](int32_t num_tasks, const std::function<void(int32_t)>& body)
+	{
+		ParallelFor(num_tasks, [&body](int32 task)
+		{
+			body(task);
+		}, num_tasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+	};
+	parallel_for.max_tasks = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	return parallel_for;
+}
 
 // Sets default values
 ACloudSimulator::ACloudSimulator()
@@ -28,24 +59,23 @@ void ACloudSimulator::BeginPlay()
 	DynamicMaterial = UMaterialInstanceDynamic::Create(CustomMaterial, NULL);
 	PlaneMesh->SetMaterial(0, DynamicMaterial);
 
-	//Initialise empty cell for default population
-	FCloudCellData empty_cell;
-	empty_cell.velocity = FVector3f(0,0,0);
-	empty_cell.water_vapor = 0.f;
-	empty_cell.water_droplets = 0.f;
-	
-	FAdvectionData empty_advection;
-	empty_advection.A_water_droplets = 0.f;
-	empty_advection.A_water_vapor = 0.f;
-	empty_cell.advection_data = empty_advection;
-	
-	F2DArray empty_2Darray;
-	empty_2Darray.nested_array_2D.Init(empty_cell, z_sim_size);
+	//run the solver's parallel sweeps on the task graph
+	cloud_solver.SetParallelFor(CloudTaskGraphParallelFor());
+	sparse_solver.SetParallelFor(CloudTaskGraphParallelFor());
+	packed_solver.SetParallelFor(CloudTaskGraphParallelFor());
+	texture_writer.SetParallelFor(CloudTaskGraphParallelFor());
 
-	F3DArray empty_3Darray;
-	empty_3Darray.nested_array_3D.Init(empty_2Darray, y_sim_size);
-	
-	cloud_lattice.Init(empty_3Darray, x_sim_size);
+	//allocate the lattice, every channel starts at 0
+	ApplyPendingSettings();
+	if(auto_tune_blocks)
+	{
+		const FCloudBlockTuneResult tune = CloudTuneStencilBlock({ x_sim_size, y_sim_size, z_sim_size }, cloud_solver.GetParams(), CloudTaskGraphParallelFor());
+		stencil_block = FIntVector(tune.best.x, tune.best.y, tune.best.z);
+		cloud_solver.GetParams().stencil_block = tune.best;
+		UE_LOG(LogTemp, Log, TEXT("Cloud simulation stencil block tuned to %dx%dx%d"), stencil_block.X, stencil_block.Y, stencil_block.Z);
+	}
+	cloud_solver.Init(x_sim_size, y_sim_size, z_sim_size);
+	SetLatticeMemoryStat();
 
 	//set default camera to free cam
 	cameraID = 0;
@@ -75,7 +105,36 @@ void ACloudSimulator::BeginPlay()
 // Called every frame
 void ACloudSimulator::Tick(float DeltaTime)
 {
-	Super::Tick(DeltaTime);
+	//the native texture pass moves on to the next stage before the blueprint ticks, so the blueprint never sees the Texture stage
+	//while the background thread runs it only ever draws a snapshot, the live lattice is being written, and before the first one there is nothing to draw
+	if(currentStage == EStage::Texture && native_texture)
+	{
+		if(!async_worker || read_snapshot)
+		{
+			CLOUDSIM_SCOPE(Texture);
+			WriteCloudTexture();
+		}
+		currentStage = sim_type == 0 ? EStage::Velocity : EStage::Test;
+		ResetSim();
+	}
+
+	//otherwise the Texture stage is drawn by the blueprint, which runs inside Super::Tick and reads the old nested cloud_lattice
+	if(currentStage == EStage::Texture)
+	{
+		CLOUDSIM_SCOPE(Texture);
+		FillLegacyLattice();
+		Super::Tick(DeltaTime);
+	}
+	else
+	{
+		if(cloud_lattice.Num() > 0)
+		{
+			cloud_lattice.Empty();
+		}
+		Super::Tick(DeltaTime);
+	}
+
+	UpdateStats(DeltaTime);
 
 	//get player controller to detect key presses
 	APlayerController* PlayerController = UGameplayStatics::GetPlayerController(this, 0);
@@ -100,6 +159,8 @@ void ACloudSimulator::Tick(float DeltaTime)
 		//if player presses Z key switch to cloud simulation
 		if(PlayerController->IsInputKeyDown(EKeys::Z))
 		{
+			//the lattice is about to be refilled, the background thread is restarted further down
+			StopAsyncSimulation();
 			sim_type = 0;
 			per_length = update_length / (x_sim_size * y_sim_size * z_sim_size * 6);
 			ZeroLattice();
@@ -111,6 +172,9 @@ void ACloudSimulator::Tick(float DeltaTime)
 		//if player presses X key switch to half and half testing
 		if(PlayerController->IsInputKeyDown(EKeys::X))
 		{
+			//the tests write straight into the dense lattice
+			StopAsyncSimulation();
+			SetStorageActive(false, false);
 			sim_type = 1;
 			per_length = update_length / (x_sim_size * y_sim_size * z_sim_size * 2);
 			currentStage = EStage::Test;
@@ -120,6 +184,8 @@ void ACloudSimulator::Tick(float DeltaTime)
 		//if player presses C key switch to different densities testing
 		if(PlayerController->IsInputKeyDown(EKeys::C))
 		{
+			StopAsyncSimulation();
+			SetStorageActive(false, false);
 			sim_type = 2;
 			per_length = update_length / (x_sim_size * y_sim_size * z_sim_size * 2);
 			currentStage = EStage::Test;
@@ -139,11 +205,57 @@ void ACloudSimulator::Tick(float DeltaTime)
 
 	//calculate how many cells to loop through this frame by dividing delta time by per length (then add 1 in case of values <0
 	//only if the current stage isn't texture as this occurs in blueprints
+	//when a frame budget is set the amount of work is taken from the measured cost of the current stage instead
 	if(currentStage != EStage::Texture)
 	{
-		iteration_length = (DeltaTime / per_length) + 1;
+		iteration_length = use_frame_budget ? BudgetedIterationLength(DeltaTime) : (DeltaTime / per_length) + 1;
+	}
+
+	//start or stop the background simulation thread when async mode is switched, it only runs the cloud simulation
+	const bool want_async = async_simulation && sim_type == 0;
+	if(want_async && !async_worker)
+	{
+		StartAsyncSimulation();
+	}
+	else if(!want_async && async_worker)
+	{
+		StopAsyncSimulation();
 	}
 
+	//the background thread owns the lattice, so all that is left to do here is hand it the settings for its next step
+	//and hand finished steps to the texture pass
+	if(async_worker)
+	{
+		PostAsyncSettings();
+
+		//wait for the blueprint to finish drawing the current snapshot before swapping in a newer one
+		if(currentStage != EStage::Texture && snapshots.IsDirty())
+		{
+			snapshots.SwapReadBuffers();
+			read_snapshot = &snapshots.Read();
+			currentStage = EStage::Texture;
+			ResetSim();
+		}
+		return;
+	}
+
+	//only change buffering mode and advection scheme between simulation steps so a half finished stage never loses its data
+	if(currentStage == EStage::Velocity && iteration_num == 0)
+	{
+		ApplyPendingSettings();
+		SetStorageActive(sparse_storage && sim_type == 0, packed_storage && !sparse_storage && sim_type == 0);
+		if(use_frame_budget && !full_sweep && !sparse_active && !packed_active)
+		{
+			CheckFrameBudget(DeltaTime);
+		}
+	}
+
+	//time the slice of work done this frame so the frame budget can learn what a cell of this stage costs
+	const EStage timed_stage = currentStage;
+	const bool timed = timed_stage != EStage::Texture && !((full_sweep || sparse_active || packed_active) && sim_type == 0);
+	const int32 timed_start_cell = iteration_num;
+	const double timed_start = FPlatformTime::Seconds();
+
 	//switch between sim and testing
 	switch(sim_type)
 	{
@@ -152,6 +264,13 @@ void ACloudSimulator::Tick(float DeltaTime)
 		break;
 		
 	case(0):
+		//run the whole current stage at once across every core, the sparse and packed solvers can only run whole stages
+		if((full_sweep || sparse_active || packed_active) && currentStage != EStage::Texture)
+		{
+			RunStageFullSweep(currentStage);
+			break;
+		}
+
 		//switch between current stage of simulation
 		switch(currentStage)
 		{
@@ -201,25 +320,402 @@ void ACloudSimulator::Tick(float DeltaTime)
 		}
 		break;
 	}
+
+	if(timed)
+	{
+		//the cursor goes back to 0 when a stage finishes, in which case it covered every cell left in the stage
+		const int32 end_cell = currentStage == timed_stage ? iteration_num : cloud_solver.GetLattice().Num();
+		RecordStageCost(timed_stage, end_cell - timed_start_cell, FPlatformTime::Seconds() - timed_start);
+	}
+}
+
+void ACloudSimulator::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	StopAsyncSimulation();
+
+	Super::EndPlay(EndPlayReason);
 }
 
 //sets every cell in the lattice to a value of 0
 void ACloudSimulator::ZeroLattice()
 {
-	for(int x = 0; x < x_sim_size; x++)
+	//the lattice belongs to the background thread while it runs
+	if(async_worker)
 	{
-		for(int y = 0; y < y_sim_size; y++)
+		return;
+	}
+	if(sparse_active)
+	{
+		sparse_solver.GetLattice().Zero();
+		SetLatticeMemoryStat();
+		return;
+	}
+	if(packed_active)
+	{
+		packed_solver.GetLattice().Zero();
+		return;
+	}
+	cloud_solver.GetLattice().Zero();
+	cloud_solver.MarkAllActive();
+}
+
+//copies the values of a single cell out of the lattice for use in blueprints
+FCloudCellData ACloudSimulator::GetCellData(int x, int y, int z) const
+{
+	FCloudCellData cell_data;
+	cell_data.velocity = FVector3f(0,0,0);
+	cell_data.water_vapor = 0.f;
+	cell_data.water_droplets = 0.f;
+	cell_data.advection_data.A_water_vapor = 0.f;
+	cell_data.advection_data.A_water_droplets = 0.f;
+
+	//while the background thread is running the live lattice is being written, so read the newest finished step instead,
+	//and nothing until the first one has been picked up
+	if(async_worker && !read_snapshot)
+	{
+		return cell_data;
+	}
+	const bool from_snapshot = async_worker.IsValid();
+	if(from_snapshot ? read_snapshot->sparse : sparse_active)
+	{
+		const FCloudSparseLattice& sparse_lattice = from_snapshot ? read_snapshot->sparse_lattice : sparse_solver.GetLattice();
+		cell_data.velocity = FVector3f(sparse_lattice.Get(ECloudChannel::VelocityX, x, y, z), sparse_lattice.Get(ECloudChannel::VelocityY, x, y, z), sparse_lattice.Get(ECloudChannel::VelocityZ, x, y, z));
+		cell_data.water_vapor = sparse_lattice.Get(ECloudChannel::WaterVapor, x, y, z);
+		cell_data.water_droplets = sparse_lattice.Get(ECloudChannel::WaterDroplets, x, y, z);
+		cell_data.advection_data.A_water_vapor = sparse_lattice.Get(ECloudChannel::AdvectWaterVapor, x, y, z);
+		cell_data.advection_data.A_water_droplets = sparse_lattice.Get(ECloudChannel::AdvectWaterDroplets, x, y, z);
+		return cell_data;
+	}
+
+	//the packed lattice does not keep the advection accumulators, so they read as 0
+	if(from_snapshot ? read_snapshot->packed : packed_active)
+	{
+		const FCloudPackedLattice& packed_lattice = from_snapshot ? read_snapshot->packed_lattice : packed_solver.GetLattice();
+		cell_data.velocity = FVector3f(packed_lattice.Get(ECloudChannel::VelocityX, x, y, z), packed_lattice.Get(ECloudChannel::VelocityY, x, y, z), packed_lattice.Get(ECloudChannel::VelocityZ, x, y, z));
+		cell_data.water_vapor = packed_lattice.Get(ECloudChannel::WaterVapor, x, y, z);
+		cell_data.water_droplets = packed_lattice.Get(ECloudChannel::WaterDroplets, x, y, z);
+		return cell_data;
+	}
+
+	const FCloudLattice& lattice = from_snapshot ? read_snapshot->lattice : cloud_solver.GetLattice();
+
+	if(!lattice.IsValidCell(x, y, z))
+	{
+		return cell_data;
+	}
+
+	const int32 i = lattice.Index(x, y, z);
+	cell_data.velocity = FVector3f(lattice.Channel(ECloudChannel::VelocityX)[i], lattice.Channel(ECloudChannel::VelocityY)[i], lattice.Channel(ECloudChannel::VelocityZ)[i]);
+	cell_data.water_vapor = lattice.Channel(ECloudChannel::WaterVapor)[i];
+	cell_data.water_droplets = lattice.Channel(ECloudChannel::WaterDroplets)[i];
+
+	//the advection channels are only attached while a step is in its advection stages, otherwise they read as 0
+	if(lattice.HasChannel(ECloudChannel::AdvectWaterVapor))
+	{
+		cell_data.advection_data.A_water_vapor = lattice.Channel(ECloudChannel::AdvectWaterVapor)[i];
+		cell_data.advection_data.A_water_droplets = lattice.Channel(ECloudChannel::AdvectWaterDroplets)[i];
+	}
+	return cell_data;
+}
+
+template<typename TVisit>
+void ACloudSimulator::VisitReadLattice(TVisit&& visit) const
+{
+	//while the background thread is running the live lattice is being written, so read the newest finished step instead,
+	//and nothing until the first one has been picked up
+	if(async_worker && !read_snapshot)
+	{
+		return;
+	}
+	const bool from_snapshot = async_worker.IsValid();
+	if(from_snapshot ? read_snapshot->sparse : sparse_active)
+	{
+		visit(from_snapshot ? read_snapshot->sparse_lattice : sparse_solver.GetLattice());
+	}
+	else if(from_snapshot ? read_snapshot->packed : packed_active)
+	{
+		visit(from_snapshot ? read_snapshot->packed_lattice : packed_solver.GetLattice());
+	}
+	else
+	{
+		visit(from_snapshot ? read_snapshot->lattice : cloud_solver.GetLattice());
+	}
+}
+
+//single values of any lattice, 0 outside it or in a channel it does not hold
+static float ReadCell(const FCloudLattice& lattice, ECloudChannel channel, int32 x, int32 y, int32 z)
+{
+	return lattice.IsValidCell(x, y, z) && lattice.HasChannel(channel) ? lattice.Channel(channel)[lattice.Index(x, y, z)] : 0.f;
+}
+
+static float ReadCell(const FCloudSparseLattice& lattice, ECloudChannel channel, int32 x, int32 y, int32 z)
+{
+	return lattice.Get(channel, x, y, z);
+}
+
+static float ReadCell(const FCloudPackedLattice& lattice, ECloudChannel channel, int32 x, int32 y, int32 z)
+{
+	return lattice.Get(channel, x, y, z);
+}
+
+//the test modes and the simulation both pick the cell up on their next pass, the activity mask is reset so no tile is skipped
+bool ACloudSimulator::SetCellData(int x, int y, int z, const FCloudCellData& cell_data)
+{
+	if(async_worker)
+	{
+		return false;
+	}
+
+	//indexed by ECloudChannel
+	const float values[(int32)ECloudChannel::Num] = { cell_data.velocity.X, cell_data.velocity.Y, cell_data.velocity.Z, cell_data.water_vapor, cell_data.water_droplets,
+		cell_data.advection_data.A_water_vapor, cell_data.advection_data.A_water_droplets };
+
+	if(sparse_active || packed_active)
+	{
+		if(sparse_active ? !sparse_solver.GetLattice().IsValidCell(x, y, z) : !packed_solver.GetLattice().IsValidCell(x, y, z))
 		{
-			for(int z = 0; z < z_sim_size; z++)
+			return false;
+		}
+		//the packed lattice ignores the advection channels it does not store
+		for(int32 channel = 0; channel < (int32)ECloudChannel::Num; channel++)
+		{
+			if(sparse_active)
 			{
-				cloud_lattice[x][y][z].velocity = FVector3f(0,0,0);
-				cloud_lattice[x][y][z].water_droplets = 0.f;
-				cloud_lattice[x][y][z].water_vapor = 0.f;
-				cloud_lattice[x][y][z].advection_data.A_water_droplets = 0.f;
-				cloud_lattice[x][y][z].advection_data.A_water_vapor = 0.f;
+				sparse_solver.GetLattice().Set((ECloudChannel)channel, x, y, z, values[channel]);
+			}
+			else
+			{
+				packed_solver.GetLattice().Set((ECloudChannel)channel, x, y, z, values[channel]);
+			}
+		}
+		return true;
+	}
+
+	FCloudLattice& lattice = cloud_solver.GetLattice();
+	if(!lattice.IsValidCell(x, y, z))
+	{
+		return false;
+	}
+	const int32 i = lattice.Index(x, y, z);
+	for(int32 channel = 0; channel < (int32)ECloudChannel::Num; channel++)
+	{
+		if(lattice.HasChannel((ECloudChannel)channel))
+		{
+			lattice.Channel((ECloudChannel)channel)[i] = values[channel];
+		}
+	}
+	cloud_solver.MarkAllActive();
+	return true;
+}
+
+FIntVector ACloudSimulator::GetLatticeSize() const
+{
+	FIntVector size(0, 0, 0);
+	VisitReadLattice([&size](const auto& lattice)
+	{
+		size = FIntVector(lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize());
+	});
+	return size;
+}
+
+FVector ACloudSimulator::WorldToLattice(FVector WorldLocation) const
+{
+	const FVector local = GetActorTransform().InverseTransformPosition(WorldLocation);
+	const FIntVector size = GetLatticeSize();
+	const FVector cell_size(x_world_size / FMath::Max(size.X, 1), y_world_size / FMath::Max(size.Y, 1), z_world_size / FMath::Max(size.Z, 1));
+	return (local / cell_size) - FVector(0.5);
+}
+
+FCloudCellData ACloudSimulator::SampleCellData(FVector LatticePosition) const
+{
+	FCloudCellData sample;
+	sample.velocity = FVector3f(0,0,0);
+	sample.water_vapor = 0.f;
+	sample.water_droplets = 0.f;
+	sample.advection_data.A_water_vapor = 0.f;
+	sample.advection_data.A_water_droplets = 0.f;
+
+	VisitReadLattice([&sample, LatticePosition](const auto& lattice)
+	{
+		const FIntVector size(lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize());
+		if(size.X <= 0 || size.Y <= 0 || size.Z <= 0)
+		{
+			return;
+		}
+
+		//the cell below the position along each axis, the one above it and how far between the two the position is
+		int32 low[3];
+		int32 high[3];
+		float weight[3];
+		for(int32 axis = 0; axis < 3; axis++)
+		{
+			const double position = FMath::Clamp(LatticePosition[axis], 0.0, (double)(size[axis] - 1));
+			low[axis] = FMath::FloorToInt(position);
+			high[axis] = FMath::Min(low[axis] + 1, size[axis] - 1);
+			weight[axis] = (float)(position - low[axis]);
+		}
+
+		float values[(int32)ECloudChannel::Num] = {};
+		for(int32 corner = 0; corner < 8; corner++)
+		{
+			const int32 x = corner & 1 ? high[0] : low[0];
+			const int32 y = corner & 2 ? high[1] : low[1];
+			const int32 z = corner & 4 ? high[2] : low[2];
+			const float corner_weight = (corner & 1 ? weight[0] : 1.f - weight[0]) * (corner & 2 ? weight[1] : 1.f - weight[1]) * (corner & 4 ? weight[2] : 1.f - weight[2]);
+			for(int32 channel = 0; channel < (int32)ECloudChannel::Num; channel++)
+			{
+				values[channel] += ReadCell(lattice, (ECloudChannel)channel, x, y, z) * corner_weight;
+			}
+		}
+
+		sample.velocity = FVector3f(values[(int32)ECloudChannel::VelocityX], values[(int32)ECloudChannel::VelocityY], values[(int32)ECloudChannel::VelocityZ]);
+		sample.water_vapor = values[(int32)ECloudChannel::WaterVapor];
+		sample.water_droplets = values[(int32)ECloudChannel::WaterDroplets];
+		sample.advection_data.A_water_vapor = values[(int32)ECloudChannel::AdvectWaterVapor];
+		sample.advection_data.A_water_droplets = values[(int32)ECloudChannel::AdvectWaterDroplets];
+	});
+	return sample;
+}
+
+static_assert((int32)ECellChannel::AdvectWaterDroplets + 1 == (int32)ECloudChannel::Num, "ECellChannel must mirror ECloudChannel");
+
+void ACloudSimulator::GetChannelSlice(ECellChannel Channel, int z, TArray<float>& Values) const
+{
+	Values.Reset();
+	VisitReadLattice([&Values, Channel, z](const auto& lattice)
+	{
+		if(z < 0 || z >= lattice.GetZSize())
+		{
+			return;
+		}
+		Values.SetNumUninitialized(lattice.GetXSize() * lattice.GetYSize());
+		int32 i = 0;
+		for(int32 y = 0; y < lattice.GetYSize(); y++)
+		{
+			for(int32 x = 0; x < lattice.GetXSize(); x++)
+			{
+				Values[i++] = ReadCell(lattice, (ECloudChannel)Channel, x, y, z);
+			}
+		}
+	});
+}
+
+//the value of a cell a channel is kept in
+static float& CellValue(FCloudCellData& cell, ECellChannel channel)
+{
+	switch(channel)
+	{
+	case(ECellChannel::VelocityX): return cell.velocity.X;
+	case(ECellChannel::VelocityY): return cell.velocity.Y;
+	case(ECellChannel::VelocityZ): return cell.velocity.Z;
+	case(ECellChannel::WaterVapor): return cell.water_vapor;
+	case(ECellChannel::WaterDroplets): return cell.water_droplets;
+	case(ECellChannel::AdvectWaterVapor): return cell.advection_data.A_water_vapor;
+	default: return cell.advection_data.A_water_droplets;
+	}
+}
+
+//a slice of a channel at a time through GetChannelSlice(), so the blueprint sees the same lattice the accessors do
+void ACloudSimulator::FillLegacyLattice()
+{
+	const FIntVector size = GetLatticeSize();
+	cloud_lattice.SetNum(size.X);
+	for(int32 x = 0; x < size.X; x++)
+	{
+		TArray<F2DArray>& column = cloud_lattice[x].nested_array_3D;
+		column.SetNum(size.Y);
+		for(int32 y = 0; y < size.Y; y++)
+		{
+			column[y].nested_array_2D.SetNumZeroed(size.Z);
+		}
+	}
+
+	TArray<float> slice;
+	for(int32 channel = 0; channel < (int32)ECloudChannel::Num; channel++)
+	{
+		for(int32 z = 0; z < size.Z; z++)
+		{
+			GetChannelSlice((ECellChannel)channel, z, slice);
+			if(slice.Num() != size.X * size.Y)
+			{
+				continue;
+			}
+			for(int32 y = 0; y < size.Y; y++)
+			{
+				for(int32 x = 0; x < size.X; x++)
+				{
+					CellValue(cloud_lattice[x].nested_array_3D[y].nested_array_2D[z], (ECellChannel)channel) = slice[(y * size.X) + x];
+				}
 			}
 		}
-	}	
+	}
+}
+
+//converts the whole lattice in one go and hands the regions of it that changed to the render thread in a single update
+void ACloudSimulator::WriteCloudTexture()
+{
+	const ECloudTextureFormat format = texture_format == EDensityTextureFormat::R16F ? ECloudTextureFormat::R16F : ECloudTextureFormat::R8;
+	texture_writer.SetMinBatchSize(min_batch_size);
+	texture_writer.SetRegionRows(texture_region_rows);
+
+	std::vector<FCloudTextureRegion> regions;
+	auto write = [&](const auto& lattice)
+	{
+		const FCloudTextureLayout layout = FCloudTextureLayout::Make({ lattice.GetXSize(), lattice.GetYSize(), lattice.GetZSize() }, format, texture_tiles_x);
+		if(layout.GetDataSize() == 0)
+		{
+			return;
+		}
+
+		//a new texture starts out undefined, so the writer's copy of the last upload no longer stands for it
+		const EPixelFormat pixel_format = format == ECloudTextureFormat::R16F ? PF_R16F : PF_G8;
+		if(!CustomTexture || CustomTexture->GetSizeX() != layout.GetWidth() || CustomTexture->GetSizeY() != layout.GetHeight() || CustomTexture->GetPixelFormat() != pixel_format)
+		{
+			CustomTexture = UTexture2D::CreateTransient(layout.GetWidth(), layout.GetHeight(), pixel_format);
+			CustomTexture->SRGB = false;
+			CustomTexture->Filter = TF_Bilinear;
+			CustomTexture->AddressX = TA_Clamp;
+			CustomTexture->AddressY = TA_Clamp;
+			CustomTexture->UpdateResource();
+			texture_writer.Invalidate();
+		}
+		if(DynamicMaterial)
+		{
+			DynamicMaterial->SetTextureParameterValue(texture_parameter, CustomTexture);
+			DynamicMaterial->SetVectorParameterValue(texture_layout_parameter, FLinearColor(layout.tiles_x, layout.tiles_y, layout.size.z, 0.f));
+		}
+
+		texture_writer.WriteChanged(lattice, ECloudChannel::WaterDroplets, texture_density_scale, layout, texture_change_threshold, regions);
+	};
+
+	VisitReadLattice(write);
+
+	const int32 pitch = texture_writer.GetPackedRowPitch(regions);
+	const int32 upload_bytes = pitch * FCloudTextureWriter::GetPackedRows(regions);
+	SET_DWORD_STAT(STAT_CloudSim_TextureUploadBytes, upload_bytes);
+	if(upload_bytes == 0)
+	{
+		return;
+	}
+
+	//the upload is read on the render thread some time later, so the changed regions are packed into a buffer of their own
+	//which the render thread frees once it is done, each region starting on its own rows at the left edge
+	uint8* texels = (uint8*)FMemory::Malloc(upload_bytes);
+	texture_writer.PackRegions(regions, texels);
+
+	FUpdateTextureRegion2D* update_regions = new FUpdateTextureRegion2D[regions.size()];
+	int32 packed_row = 0;
+	for(int32 region = 0; region < (int32)regions.size(); region++)
+	{
+		const FCloudTextureRegion& changed = regions[region];
+		update_regions[region] = FUpdateTextureRegion2D(changed.x, changed.y, 0, packed_row, changed.width, changed.height);
+		packed_row += changed.height;
+	}
+	CustomTexture->UpdateTextureRegions(0, (uint32)regions.size(), update_regions, pitch, texture_writer.GetLayout().GetBytesPerTexel(), texels, [](uint8* SrcData, const FUpdateTextureRegion2D* Regions)
+	{
+		FMemory::Free(SrcData);
+		delete[] Regions;
+	});
 }
 
 //reset the simulation by resetting the current iteration and the x, y, and z iterators
@@ -261,6 +757,16 @@ bool ACloudSimulator::ProgressSim()
 //Tests to ensure writing to texture works
 void ACloudSimulator::HalfandHalf(int iteration_start)
 {
+	if(async_worker)
+	{
+		return;
+	}
+
+	CLOUDSIM_SCOPE(Test);
+
+	//the tests write straight into the lattice, behind the back of the activity mask
+	cloud_solver.MarkAllActive();
+
 	//commented out code showing how this function operated before optimisation was included
 	/*
 	for(int x = 0; x < x_sim_size; x++)
@@ -282,19 +788,23 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 	}
 	*/
 	
+	float* water_droplets = cloud_solver.GetLattice().Channel(ECloudChannel::WaterDroplets);
+
 	while(iteration_num <= (iteration_start + iteration_length))
 	{
+		const int32 i = cloud_solver.GetLattice().Index(current_x, current_y, current_z);
+
 		switch(currentHalf)
 		{
 			//positive x fiiled
 			case(0):
 				if(current_x > (x_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				break;
 
@@ -302,11 +812,11 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 			case(1):
 				if(current_x < (x_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				break;
 
@@ -314,11 +824,11 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 			case(2):
 				if(current_y > (y_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				break;
 
@@ -326,11 +836,11 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 			case(3):
 				if(current_y < (y_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				break;
 
@@ -338,11 +848,11 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 			case(4):
 				if(current_z > (z_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				break;
 
@@ -350,11 +860,11 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 			case(5):
 				if(current_z < (z_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				break;
 		}
@@ -377,9 +887,23 @@ void ACloudSimulator::HalfandHalf(int iteration_start)
 //makes each quarter a different density
 void ACloudSimulator::DifferentDensities(int iteration_start)
 {
+	if(async_worker)
+	{
+		return;
+	}
+
+	CLOUDSIM_SCOPE(Test);
+
+	//the tests write straight into the lattice, behind the back of the activity mask
+	cloud_solver.MarkAllActive();
+
+	float* water_droplets = cloud_solver.GetLattice().Channel(ECloudChannel::WaterDroplets);
+
 	//0, 0.1, 0.25, 0.4, 0.55, 0.7, 0.85, 1
 	while(iteration_num <= (iteration_start + iteration_length))
 	{
+		const int32 i = cloud_solver.GetLattice().Index(current_x, current_y, current_z);
+
 		//-z
 		if(current_z < (z_sim_size / 2))
 		{
@@ -389,12 +913,12 @@ void ACloudSimulator::DifferentDensities(int iteration_start)
 				//-y
 				if(current_y < (y_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0;
+					water_droplets[i] = 0;
 				}
 				//+y
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0.1;
+					water_droplets[i] = 0.1;
 				}
 			}
 			//+x
@@ -403,12 +927,12 @@ void ACloudSimulator::DifferentDensities(int iteration_start)
 				//-y
 				if(current_y < (y_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0.25;
+					water_droplets[i] = 0.25;
 				}
 				//+y
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0.4;
+					water_droplets[i] = 0.4;
 				}
 			}
 		}
@@ -421,12 +945,12 @@ void ACloudSimulator::DifferentDensities(int iteration_start)
 				//-y
 				if(current_y < (y_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0.55;
+					water_droplets[i] = 0.55;
 				}
 				//+y
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0.7;
+					water_droplets[i] = 0.7;
 				}
 			}
 			//+x
@@ -435,12 +959,12 @@ void ACloudSimulator::DifferentDensities(int iteration_start)
 				//-y
 				if(current_y < (y_sim_size / 2))
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 0.85;
+					water_droplets[i] = 0.85;
 				}
 				//+y
 				else
 				{
-					cloud_lattice[current_x][current_y][current_z].water_droplets = 1;
+					water_droplets[i] = 1;
 				}
 			}
 		}
@@ -457,18 +981,33 @@ void ACloudSimulator::DifferentDensities(int iteration_start)
 //Adds water vapor into system from a vapor source
 void ACloudSimulator::AddFromVaporSource()
 {
-	for(int x = 0; x < x_sim_size; x++)
+	if(async_worker)
 	{
-		for(int y = 0; y < y_sim_size; y++)
-		{
-			cloud_lattice[x][y][0].water_vapor += 0.1;
-		}
-	} 
+		return;
+	}
+	if(sparse_active)
+	{
+		CloudAddVaporSource(sparse_solver.GetLattice());
+		SetLatticeMemoryStat();
+		return;
+	}
+	if(packed_active)
+	{
+		CloudAddVaporSource(packed_solver.GetLattice());
+		return;
+	}
+	CloudAddVaporSource(cloud_solver.GetLattice());
+	cloud_solver.MarkAllActive();
 }
 
 //Updates the local velocity of each cell based on viscosity and pressure effects
 void ACloudSimulator::AlterVelocity(int iteration_start)
 {
+	if(async_worker)
+	{
+		return;
+	}
+
 	//commented out code showing how this function operated before optimisation was included
 	/*
 	for(int x = 0; x < x_sim_size; x++)
@@ -502,41 +1041,22 @@ void ACloudSimulator::AlterVelocity(int iteration_start)
 	}
 	*/
 
-	while(iteration_num <= (iteration_start + iteration_length))
+	CLOUDSIM_SCOPE(Velocity);
+	//run this frame's share of whole rows, then move on to the next stage once the whole lattice has been covered
+	if(ProgressStageRows(EStage::Velocity, iteration_start))
 	{
-		FVector3f cell_zminus = FVector3f(0,0,0);
-		FVector3f cell_xminus_zplus = FVector3f(0,0,0);
-		FVector3f cell_xplus_zminus = FVector3f(0,0,0);
-
-		if(current_z > 0)
-		{
-			cell_zminus = cloud_lattice[current_x][current_y][current_z-1].velocity;
-			if(current_x < x_sim_size-1)
-			{
-				cell_xplus_zminus = cloud_lattice[current_x+1][current_y][current_z-1].velocity;
-			}
-		}
-		if(current_x > 0 && current_z < z_sim_size-1)
-		{
-			cell_xminus_zplus = cloud_lattice[current_x-1][current_y][current_z+1].velocity;
-		}
-				
-		//V*(x,y,z) = V(x,y,z) + Kv[V(x,y,z-1) - 6V(x,y,z)] + Kp[-V(x-1,y,z+1) - V(x+1,y,z-1)]
-		//Where: V* = velocity we're trying to calculate, V = current velocity, (x,y,z) = cell position in lattice, Kv = viscosity ratio, Kp = coefficient of pressure effect
-		cloud_lattice[current_x][current_y][current_z].velocity = cloud_lattice[current_x][current_y][current_z].velocity + (K_viscosity_ratio * (cell_zminus) - (6 * cloud_lattice[current_x][current_y][current_z].velocity)) + (K_pressure_effect * ((-1 * cell_xminus_zplus) - cell_xplus_zminus));
-
-		//progress simulation to next step, if simulation stage finished, progress to next stage and return from function
-		if(ProgressSim())
-		{
-			currentStage = EStage::Diffuse;
-			return;
-		}
-	}
-}
+		currentStage = FinishStage(EStage::Velocity);
+	}
+}
 
 //Updates the amount of water vapor in each cell based on diffusion rules
 void ACloudSimulator::DiffuseWaterVapour(int iteration_start)
 {
+	if(async_worker)
+	{
+		return;
+	}
+
 	//commented out code showing how this function operated before optimisation was included
 	/*
 	for(int x = 0; x < x_sim_size; x++)
@@ -556,27 +1076,21 @@ void ACloudSimulator::DiffuseWaterVapour(int iteration_start)
 	}
 	*/
 
-	while(iteration_num <= (iteration_start + iteration_length))
+	CLOUDSIM_SCOPE(Diffuse);
+	if(ProgressStageRows(EStage::Diffuse, iteration_start))
 	{
-		float zminus = 0.f;
-		if(current_z > 0){zminus = cloud_lattice[current_x][current_y][current_z-1].water_vapor;}
-				
-		//Wv*(x,y,z) = Wv(x,y,z) + Kdw[Wv(x,y,z) - 6Wv(x,y,z)]
-		//Where: Wv* = water vapor we're trying to calculate, Wv = current water vapor, (x,y,z) = cell position in lattice, Kdw = coefficient of water vapor diffusion
-		cloud_lattice[current_x][current_y][current_z].water_vapor = cloud_lattice[current_x][current_y][current_z].water_vapor + (K_water_vapour_diffusion * (zminus) - (6 * cloud_lattice[current_x][current_y][current_z].water_vapor));
-
-		//progress simulation to next step, if simulation stage finished, progress to next stage and return from function
-		if(ProgressSim())
-		{
-			currentStage = EStage::Advect1;
-			return;
-		}
+		currentStage = FinishStage(EStage::Diffuse);
 	}
 }
 
 //moves values of each cell to a different cell based on local velocity
 void ACloudSimulator::Advection(int iteration_start)
 {
+	if(async_worker)
+	{
+		return;
+	}
+
 	//commented out code showing how this function operated before optimisation was included
 	/*
 	//loop through lattice to calculate advection data for current time step
@@ -644,91 +1158,40 @@ void ACloudSimulator::Advection(int iteration_start)
 	}
 	*/
 
-	//define variables outside of switch statement to avoid errors
-	int l = 0;
-	int m = 0;
-	int n = 0;
-
-	float weightX = 0;
-	float weightY = 0;
-	float weightZ = 0;
-	
-	while(iteration_num <= (iteration_start + iteration_length))
+	//this function runs both advection passes
+	if(currentStage != EStage::Advect1 && currentStage != EStage::Advect2)
 	{
-		switch(currentStage)
-		{
-		default:
-			GEngine->AddOnScreenDebugMessage(-1, 2.f, FColor::Red, FString("Error in Advection Stage."));
-			break;
-
-		case(EStage::Advect1):
-			//l, m, and n are the x, y and z integer portions of velocity
-			l = (int)cloud_lattice[current_x][current_y][current_z].velocity.X;
-			m = (int)cloud_lattice[current_x][current_y][current_z].velocity.Y;
-			n = (int)cloud_lattice[current_x][current_y][current_z].velocity.Z;
-
-			if((l > 0 && l < x_sim_size-1) && (m > 0 && m < y_sim_size-1) && (n > 0 && n < z_sim_size-1))
-			{
-				//weightX, weightY and weightZ are the x, y and z fractional portions of velocity
-				weightX = cloud_lattice[current_x][current_y][current_z].velocity.X - l;
-				weightY = cloud_lattice[current_x][current_y][current_z].velocity.X - m;
-				weightZ = cloud_lattice[current_x][current_y][current_z].velocity.X - n;
-
-				//Add cell values to adjacent cells weighted based on velocity
-				cloud_lattice[l][m][n].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * ((1 - weightX) * (1 - weightY) * (1 - weightZ));
-				cloud_lattice[l][m][n].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * ((1 - weightX) * (1 - weightY) * (1 - weightZ));
-
-				cloud_lattice[l+1][m][n].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * (weightX * (1 - weightY) * (1 - weightZ));
-				cloud_lattice[l+1][m][n].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * (weightX * (1 - weightY) * (1 - weightZ));
-
-				cloud_lattice[l][m+1][n].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * ((1 - weightX) * weightY * (1 - weightZ));
-				cloud_lattice[l][m+1][n].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * ((1 - weightX) * weightY * (1 - weightZ));
-
-				cloud_lattice[l][m][n+1].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * ((1 - weightX) * (1 - weightY) * weightZ);
-				cloud_lattice[l][m][n+1].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * ((1 - weightX) * (1 - weightY) * weightZ);
-
-				cloud_lattice[l+1][m+1][n].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * (weightX * weightY * (1 - weightZ));
-				cloud_lattice[l+1][m+1][n].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * (weightX * weightY * (1 - weightZ));
-
-				cloud_lattice[l+1][m][n+1].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * ((1 - weightX) * weightY * weightZ);
-				cloud_lattice[l+1][m][n+1].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * ((1 - weightX) * weightY * weightZ);
-
-				cloud_lattice[l][m+1][n+1].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * (weightX * (1 - weightY) * weightZ);
-				cloud_lattice[l][m+1][n+1].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * (weightX * (1 - weightY) * weightZ);
-
-				cloud_lattice[l+1][m+1][n+1].advection_data.A_water_vapor += cloud_lattice[current_x][current_y][current_z].water_vapor * (weightX * weightY * weightZ);
-				cloud_lattice[l+1][m+1][n+1].advection_data.A_water_droplets += cloud_lattice[current_x][current_y][current_z].water_droplets * (weightX * weightY * weightZ);
-			}
+		GEngine->AddOnScreenDebugMessage(-1, 2.f, FColor::Red, FString("Error in Advection Stage."));
+		return;
+	}
 
-			//progress simulation to next step, if simulation stage finished, progress to next stage and return from function
-			if(ProgressSim())
-			{
-				currentStage = EStage::Advect2;
-				return;
-			}
-			break;
+	const EStage stage = currentStage;
+	bool finished;
+	if(stage == EStage::Advect1)
+	{
+		CLOUDSIM_SCOPE(Advect1);
+		finished = ProgressStageRows(stage, iteration_start);
+	}
+	else
+	{
+		CLOUDSIM_SCOPE(Advect2);
+		finished = ProgressStageRows(stage, iteration_start);
+	}
 
-		case(EStage::Advect2):
-			//add advection data onto current data then zero advection data
-			cloud_lattice[current_x][current_y][current_z].water_vapor += cloud_lattice[current_x][current_y][current_z].advection_data.A_water_vapor;
-			cloud_lattice[current_x][current_y][current_z].advection_data.A_water_vapor = 0.f;
-			cloud_lattice[current_x][current_y][current_z].water_droplets += cloud_lattice[current_x][current_y][current_z].advection_data.A_water_droplets;
-			cloud_lattice[current_x][current_y][current_z].advection_data.A_water_droplets = 0.f;
-
-			//progress simulation to next step, if simulation stage finished, progress to next stage and return from function
-			if(ProgressSim())
-			{
-				currentStage = EStage::Transition;
-				return;
-			}
-			break;
-		}
+	if(finished)
+	{
+		currentStage = FinishStage(stage);
 	}
 }
 
 //turns water vapour into water droplets based on phase transition rules (condensation/evaporation), and adjusts other variables accordingly
 void ACloudSimulator::PhaseTransition(int iteration_start)
 {
+	if(async_worker)
+	{
+		return;
+	}
+
 	//commented out code showing how this function operated before optimisation was included
 	/*
 	float avg_max = 0;
@@ -769,31 +1232,517 @@ void ACloudSimulator::PhaseTransition(int iteration_start)
 	//GEngine->AddOnScreenDebugMessage(-1, 2.f, FColor::Red, text);
 	*/
 
-	while(iteration_num <= (iteration_start + iteration_length))
+	CLOUDSIM_SCOPE(Transition);
+	if(ProgressStageRows(EStage::Transition, iteration_start))
 	{
-		//temperature at surface level is ~300K and decreases by 0.6K every 100m up
-		//calculate meter length of each cell (z / z_sim_size) * z_world_size
-		//divide by 100 and multiply by 0.6 to determine how much the temperature has decreased
-		//take away from 300 to determine current temperature at this cell
-		float temperature = 300 - ((((current_z / z_sim_size) * z_world_size) / 100) * 0.6);
-				
-		//w_max = 217.0 * exp[19.482 - 4303.4 / (T-29.5)] / T
-		//Where: w_max = max amount of water vapor in cell, T = cell temperature
-		float w_max = (217 * exp((19.482 - (4303.4/(temperature - 29.5))))) / temperature;
+		currentStage = FinishStage(EStage::Transition);
+	}
+}
+
+//publishes the per frame counters to stat CloudSimulator and Insights
+void ACloudSimulator::UpdateStats(float DeltaTime)
+{
+	//cells are counted by whichever thread ran them, the total is taken once a frame
+	const int32 cells = (int32)(cloud_solver.TakeCellsProcessed() + sparse_solver.TakeCellsProcessed() + packed_solver.TakeCellsProcessed());
+	SET_DWORD_STAT(STAT_CloudSim_CellsProcessed, cells);
+	TRACE_COUNTER_SET(CloudSimCellsProcessed, cells);
+
+	//tiles run by the latest sweep of each stage, the sparse and packed solvers do not use tiles, and the mask is not read while the worker writes it
+	int32 active_tiles = 0;
+	if(!async_worker && !sparse_active && !packed_active)
+	{
+		for(int32 stage = 0; stage < (int32)ECloudSimStage::Done; stage++)
+		{
+			active_tiles += cloud_solver.GetActiveTiles((ECloudSimStage)stage);
+		}
+	}
+	SET_DWORD_STAT(STAT_CloudSim_ActiveTiles, active_tiles);
+	TRACE_COUNTER_SET(CloudSimActiveTiles, active_tiles);
 
-		//Wl* = Wl + a(Wv - w_max)
-		//Where: Wl* = new amount of water droplets, Wl = current amount of water droplets, a = phase transition rate constant, Wv = current amount of water vapor
-		cloud_lattice[current_x][current_y][current_z].water_droplets = cloud_lattice[current_x][current_y][current_z].water_droplets + (phase_transition_rate * (cloud_lattice[current_x][current_y][current_z].water_vapor - w_max));
+	//steps per second are averaged over windows of about a second
+	step_rate_timer += DeltaTime;
+	if(step_rate_timer >= 1.f)
+	{
+		steps_per_second = (cloud_solver.TakeCompletedSteps() + sparse_solver.TakeCompletedSteps() + packed_solver.TakeCompletedSteps()) / step_rate_timer;
+		step_rate_timer = 0.f;
+	}
+	SET_FLOAT_STAT(STAT_CloudSim_StepsPerSecond, steps_per_second);
+	TRACE_COUNTER_SET(CloudSimStepsPerSecond, steps_per_second);
+}
+
+//the dense lattice only changes size when it is allocated or its layout is switched, the sparse lattice changes every step
+void ACloudSimulator::SetLatticeMemoryStat()
+{
+	const size_t lattice_memory = cloud_solver.GetAllocatedSize() + sparse_solver.GetLattice().GetAllocatedSize() + packed_solver.GetAllocatedSize();
+	SET_MEMORY_STAT(STAT_CloudSim_LatticeMemory, lattice_memory);
+	TRACE_COUNTER_SET(CloudSimLatticeMemory, (int64)lattice_memory);
+}
 
-		//Wv* = Wv - a(Wv - w_max)
-		//Where: Wv* = new amount of water vapor, Wv = current amount of water vapor, a = phase transition rate constant
-		cloud_lattice[current_x][current_y][current_z].water_vapor = cloud_lattice[current_x][current_y][current_z].water_vapor - (phase_transition_rate * (cloud_lattice[current_x][current_y][current_z].water_vapor - w_max));
+//copies the simulation settings into the solver and applies the ones that may only change between simulation steps
+void ACloudSimulator::ApplyPendingSettings()
+{
+	ApplySimParams(MakeSimParams());
+}
 
-		//progress simulation to next step, if simulation stage finished, progress to next stage and return from function
-		if(ProgressSim())
+FCloudSimParams ACloudSimulator::MakeSimParams() const
+{
+	FCloudSimParams params;
+	params.viscosity_ratio = K_viscosity_ratio;
+	params.pressure_effect = K_pressure_effect;
+	params.vapour_diffusion = K_water_vapour_diffusion;
+	params.phase_transition_rate = phase_transition_rate;
+	params.z_world_size = z_world_size;
+	params.lapse_profile.surface_temperature = surface_temperature;
+	params.lapse_profile.layers.clear();
+	for(const FLapseLayer& layer : lapse_layers)
+	{
+		params.lapse_profile.layers.push_back({ layer.base_height, layer.lapse_rate });
+	}
+	params.use_simd = use_simd;
+	params.min_batch_size = min_batch_size;
+	params.double_buffered = double_buffered_stencils;
+	params.advection_scheme = (ECloudAdvectionScheme)advection_scheme;
+	params.padded = padded_lattice;
+	params.boundary = (ECloudBoundary)boundary;
+	params.inflow[(int32)ECloudChannel::VelocityX] = inflow_velocity.X;
+	params.inflow[(int32)ECloudChannel::VelocityY] = inflow_velocity.Y;
+	params.inflow[(int32)ECloudChannel::VelocityZ] = inflow_velocity.Z;
+	params.inflow[(int32)ECloudChannel::WaterVapor] = inflow_water_vapor;
+	params.cell_order = (ECloudCellOrder)cell_order;
+	params.stencil_block = { stencil_block.X, stencil_block.Y, stencil_block.Z };
+	params.fuse_stages = fuse_stages;
+	params.wavefront = wavefront_stencils;
+	params.wavefront_tile = { wavefront_tile.X, wavefront_tile.Y, wavefront_tile.Z };
+	params.private_scatter = private_scatter;
+	params.coloured_scatter = coloured_scatter;
+	params.scatter_tile = { scatter_tile.X, scatter_tile.Y, scatter_tile.Z };
+	params.release_scratch = release_advection_scratch;
+	params.activity_mask = activity_mask;
+	params.activity_threshold = activity_threshold;
+	params.sparse_threshold = sparse_threshold;
+	for(int32 channel = 0; channel < (int32)ECloudChannel::AdvectWaterVapor; channel++)
+	{
+		const bool velocity = channel < (int32)ECloudChannel::WaterVapor;
+		params.precision[channel] = (ECloudPrecision)(velocity ? velocity_precision : water_precision);
+		params.fixed_range[channel] = velocity ? velocity_fixed_range : water_fixed_range;
+	}
+	return params;
+}
+
+void ACloudSimulator::ApplySimParams(const FCloudSimParams& params)
+{
+	cloud_solver.GetParams() = params;
+	sparse_solver.GetParams() = params;
+	packed_solver.GetParams() = params;
+
+	const size_t old_lattice_memory = cloud_solver.GetAllocatedSize() + packed_solver.GetAllocatedSize();
+	cloud_solver.ApplyPendingSettings();
+	sparse_solver.ApplyPendingSettings();
+	packed_solver.ApplyPendingSettings();
+	if(sparse_active || cloud_solver.GetAllocatedSize() + packed_solver.GetAllocatedSize() != old_lattice_memory)
+	{
+		SetLatticeMemoryStat();
+	}
+}
+
+//the solver being switched away from hands the lattice back to cloud_solver before the other one takes it
+void ACloudSimulator::SetStorageActive(bool in_sparse_active, bool in_packed_active)
+{
+	if(!in_sparse_active)
+	{
+		SetSparseActive(false);
+	}
+	if(!in_packed_active)
+	{
+		SetPackedActive(false);
+	}
+	SetSparseActive(in_sparse_active);
+	SetPackedActive(in_packed_active);
+}
+
+//the solver that is not in use keeps no lattice, so switching costs a conversion but no extra memory while running
+void ACloudSimulator::SetSparseActive(bool in_sparse_active)
+{
+	if(sparse_active == in_sparse_active)
+	{
+		return;
+	}
+
+	if(in_sparse_active)
+	{
+		sparse_solver.GetLattice().LoadFrom(cloud_solver.GetLattice(), sparse_solver.GetParams().sparse_threshold);
+		cloud_solver.GetLattice().Empty();
+		cloud_solver.ReleaseScratch();
+	}
+	else
+	{
+		sparse_solver.GetLattice().StoreTo(cloud_solver.GetLattice());
+		sparse_solver.GetLattice().Empty();
+		cloud_solver.MarkAllActive();
+	}
+
+	sparse_active = in_sparse_active;
+	SetLatticeMemoryStat();
+}
+
+//converts through the dense lattice like SetSparseActive(), each switch rounds the lattice to the packed precisions once
+void ACloudSimulator::SetPackedActive(bool in_packed_active)
+{
+	if(packed_active == in_packed_active)
+	{
+		return;
+	}
+
+	if(in_packed_active)
+	{
+		packed_solver.GetLattice().LoadFrom(cloud_solver.GetLattice());
+		cloud_solver.GetLattice().Empty();
+		cloud_solver.ReleaseScratch();
+		packed_solver.ApplyPendingSettings();
+	}
+	else
+	{
+		packed_solver.GetLattice().StoreTo(cloud_solver.GetLattice());
+		packed_solver.GetLattice().Empty();
+		packed_solver.ApplyPendingSettings();
+		cloud_solver.MarkAllActive();
+	}
+
+	packed_active = in_packed_active;
+	SetLatticeMemoryStat();
+}
+
+//folds the time taken by a slice of cells into the moving average cost per cell of a stage
+void ACloudSimulator::RecordStageCost(EStage stage, int32 cells, double seconds)
+{
+	if(cells <= 0 || stage >= NumStages)
+	{
+		return;
+	}
+
+	const float cost = (float)(seconds * 1000000.0 / cells);
+	float& average = stage_cell_cost_us[stage];
+	average = average > 0.f ? FMath::Lerp(average, cost, frame_budget_smoothing) : cost;
+}
+
+float ACloudSimulator::GetStageCellCost(TEnumAsByte<EStage> stage) const
+{
+	return stage < NumStages ? stage_cell_cost_us[stage] : 0.f;
+}
+
+//number of cells the current stage can get through in frame_budget_us
+int ACloudSimulator::BudgetedIterationLength(float DeltaTime) const
+{
+	const float cost = stage_cell_cost_us[currentStage];
+
+	//nothing measured for this stage yet, start from the old fixed estimate
+	if(cost <= 0.f)
+	{
+		return (DeltaTime / per_length) + 1;
+	}
+
+	//the stage loops run iteration_length + 1 cells
+	const int32 cells = FMath::Clamp((int32)(frame_budget_us / cost), 1, FMath::Max(cloud_solver.GetLattice().Num(), 1));
+	return cells - 1;
+}
+
+//estimates how long a whole step takes at the current frame budget and warns when it is longer than update_length
+void ACloudSimulator::CheckFrameBudget(float DeltaTime)
+{
+	float step_cost_us = 0.f;
+	for(int32 stage = EStage::Velocity; stage <= EStage::Transition; stage++)
+	{
+		//gathering finishes in Advect1 and never runs Advect2
+		if(stage == EStage::Advect2 && cloud_solver.GetActiveAdvectionScheme() == ECloudAdvectionScheme::Gather)
+		{
+			continue;
+		}
+		//wait until every stage has been measured at least once
+		if(stage_cell_cost_us[stage] <= 0.f)
 		{
-			currentStage = EStage::Texture;
 			return;
 		}
+		step_cost_us += stage_cell_cost_us[stage] * cloud_solver.GetLattice().Num();
+	}
+
+	//each frame does at most frame_budget_us of work, the blueprint texture pass is not included
+	const float frames = FMath::CeilToFloat(step_cost_us / FMath::Max(frame_budget_us, 1.f));
+	estimated_step_time = frames * DeltaTime;
+
+	const bool was_over_budget = over_budget;
+	over_budget = estimated_step_time > update_length;
+	if(over_budget)
+	{
+		const FString message = FString::Printf(TEXT("Cloud step needs about %.2fs at %.0fus per frame, update length is %.2fs"), estimated_step_time, frame_budget_us, update_length);
+		GEngine->AddOnScreenDebugMessage((uint64)GetUniqueID(), 2.f, FColor::Yellow, message);
+		if(!was_over_budget)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s"), *message);
+		}
+	}
+}
+
+//runs a whole stage in one call
+void ACloudSimulator::RunStageFullSweep(TEnumAsByte<EStage> stage)
+{
+	if(async_worker)
+	{
+		return;
+	}
+
+	const EStage next_stage = SweepStage(stage);
+	if(next_stage == stage)
+	{
+		GEngine->AddOnScreenDebugMessage(-1, 2.f, FColor::Red, FString("Error in Full Sweep Stage."));
+		return;
+	}
+
+	currentStage = next_stage;
+	ResetSim();
+}
+
+//stage conversions between the blueprint enum and the solver, Test has no solver stage and Texture is where a finished step ends up
+static ECloudSimStage ToSolverStage(EStage stage)
+{
+	switch(stage)
+	{
+	case(EStage::Velocity): return ECloudSimStage::Velocity;
+	case(EStage::Diffuse): return ECloudSimStage::Diffuse;
+	case(EStage::Advect1): return ECloudSimStage::Advect1;
+	case(EStage::Advect2): return ECloudSimStage::Advect2;
+	case(EStage::Transition): return ECloudSimStage::Transition;
+	default: return ECloudSimStage::Done;
 	}
-}
\ No newline at end of file
+}
+
+static EStage FromSolverStage(ECloudSimStage stage)
+{
+	switch(stage)
+	{
+	case(ECloudSimStage::Velocity): return EStage::Velocity;
+	case(ECloudSimStage::Diffuse): return EStage::Diffuse;
+	case(ECloudSimStage::Advect1): return EStage::Advect1;
+	case(ECloudSimStage::Advect2): return EStage::Advect2;
+	case(ECloudSimStage::Transition): return EStage::Transition;
+	default: return EStage::Texture;
+	}
+}
+
+int ACloudSimulator::GetActiveTiles(TEnumAsByte<EStage> stage) const
+{
+	return async_worker || sparse_active || packed_active ? 0 : cloud_solver.GetActiveTiles(ToSolverStage(stage));
+}
+
+bool ACloudSimulator::IsCellActive(int x, int y, int z, TEnumAsByte<EStage> stage) const
+{
+	const ECloudSimStage solver_stage = ToSolverStage(stage);
+	if(async_worker || sparse_active || packed_active || solver_stage == ECloudSimStage::Done || !cloud_solver.GetLattice().IsValidCell(x, y, z))
+	{
+		return false;
+	}
+	if(!cloud_solver.IsActivityMaskActive())
+	{
+		return true;
+	}
+
+	const FCloudActivityMask& activity = cloud_solver.GetActivityMask();
+	const int32 tile = activity.TileOfRow(y, z);
+	return tile >= 0 && activity.Has(tile, (ECloudActivity)((uint16)ECloudActivity::RanVelocity << (int32)solver_stage));
+}
+
+//runs a stage over the box [Begin, End) of the lattice, clamped to its size, see FCloudSolver::RunStage()
+void ACloudSimulator::RunStage(TEnumAsByte<EStage> stage, FIntVector Begin, FIntVector End)
+{
+	if(ToSolverStage(stage) == ECloudSimStage::Done || async_worker)
+	{
+		return;
+	}
+	if(sparse_active || packed_active)
+	{
+		GEngine->AddOnScreenDebugMessage(-1, 2.f, FColor::Red, FString("RunStage needs a dense lattice, turn off sparse_storage and packed_storage."));
+		return;
+	}
+	if(Begin.X <= 0 && Begin.Y <= 0 && Begin.Z <= 0)
+	{
+		cloud_solver.BeginStage(ToSolverStage(stage));
+	}
+	cloud_solver.RunStage(ToSolverStage(stage), { Begin.X, Begin.Y, Begin.Z }, { End.X, End.Y, End.Z });
+}
+
+//time slicing in whole rows, runs at least as many cells as the per cell loop would have done this frame and moves the cursor on
+//returns true once the last row of the lattice has been run, leaving the cursor reset for the next stage
+bool ACloudSimulator::ProgressStageRows(EStage stage, int iteration_start)
+{
+	FCloudSimCursor cursor;
+	cursor.x = current_x;
+	cursor.y = current_y;
+	cursor.z = current_z;
+	cursor.iteration = iteration_num;
+
+	const bool finished = cloud_solver.ProgressStageRows(ToSolverStage(stage), cursor, (iteration_start + iteration_length + 1) - iteration_num);
+
+	current_x = cursor.x;
+	current_y = cursor.y;
+	current_z = cursor.z;
+	iteration_num = cursor.iteration;
+	return finished;
+}
+
+//swaps any buffers the stage wrote into and returns the stage that follows it
+EStage ACloudSimulator::FinishStage(EStage stage)
+{
+	return FromSolverStage(cloud_solver.FinishStage(ToSolverStage(stage)));
+}
+
+//only touches the solver, so it is also safe to call from the background simulation thread
+EStage ACloudSimulator::SweepStage(EStage stage)
+{
+	switch(stage)
+	{
+	default:
+		return stage;
+
+	case(EStage::Velocity):
+	{
+		CLOUDSIM_SCOPE(Velocity);
+		return FromSolverStage(SweepSolverStage(ECloudSimStage::Velocity));
+	}
+
+	case(EStage::Diffuse):
+	{
+		CLOUDSIM_SCOPE(Diffuse);
+		return FromSolverStage(SweepSolverStage(ECloudSimStage::Diffuse));
+	}
+
+	case(EStage::Advect1):
+	{
+		CLOUDSIM_SCOPE(Advect1);
+		return FromSolverStage(SweepSolverStage(ECloudSimStage::Advect1));
+	}
+
+	case(EStage::Advect2):
+	{
+		CLOUDSIM_SCOPE(Advect2);
+		return FromSolverStage(SweepSolverStage(ECloudSimStage::Advect2));
+	}
+
+	case(EStage::Transition):
+	{
+		CLOUDSIM_SCOPE(Transition);
+		return FromSolverStage(SweepSolverStage(ECloudSimStage::Transition));
+	}
+	}
+}
+
+ECloudSimStage ACloudSimulator::SweepSolverStage(ECloudSimStage stage)
+{
+	if(sparse_active)
+	{
+		return sparse_solver.SweepStage(stage);
+	}
+	return packed_active ? packed_solver.SweepStage(stage) : cloud_solver.SweepStage(stage);
+}
+
+void ACloudSimulator::StartAsyncSimulation()
+{
+	if(async_worker)
+	{
+		return;
+	}
+
+	//the worker always starts from the beginning of a step, whatever the time sliced path had done of the current one is kept
+	//but the rest of that step is dropped, the Texture stage is left too as there is nothing to draw until the first snapshot
+	snapshots.Reset();
+	read_snapshot = nullptr;
+	published_steps = 0;
+	currentStage = EStage::Velocity;
+	ResetSim();
+	PostAsyncSettings();
+
+	async_worker = MakeUnique<FCloudSimWorker>(this, async_min_step_interval);
+}
+
+void ACloudSimulator::StopAsyncSimulation()
+{
+	if(!async_worker)
+	{
+		return;
+	}
+
+	//blocks until the step being simulated has finished, so the lattice is left holding the last published step
+	async_worker.Reset();
+	read_snapshot = nullptr;
+	if(currentStage != EStage::Texture)
+	{
+		currentStage = EStage::Velocity;
+	}
+	ResetSim();
+}
+
+int ACloudSimulator::GetAsyncStepsCompleted() const
+{
+	return async_worker ? async_worker->GetStepsCompleted() : 0;
+}
+
+//runs every simulation stage back to back on the calling thread and publishes the result
+void ACloudSimulator::RunFullStep()
+{
+	CLOUDSIM_SCOPE(Step);
+
+	FCloudSimSettings settings;
+	{
+		FScopeLock lock(&pending_settings_lock);
+		settings = pending_settings;
+	}
+	ApplySimParams(settings.params);
+	SetStorageActive(settings.sparse_storage, settings.packed_storage);
+
+	//each stage goes through SweepStage() rather than FCloudSolver::RunStep() so it shows up in the stats
+	EStage stage = EStage::Velocity;
+	while(stage != EStage::Texture)
+	{
+		stage = SweepStage(stage);
+	}
+
+	PublishSnapshot();
+}
+
+//the properties are read here on the game thread, the worker only ever sees the copy
+void ACloudSimulator::PostAsyncSettings()
+{
+	FCloudSimSettings settings;
+	settings.params = MakeSimParams();
+	settings.sparse_storage = sparse_storage;
+	settings.packed_storage = packed_storage && !sparse_storage;
+
+	FScopeLock lock(&pending_settings_lock);
+	pending_settings = MoveTemp(settings);
+}
+
+//copies the lattice into the free slot of the triple buffer, the game thread picks it up on its next tick without either side waiting
+void ACloudSimulator::PublishSnapshot()
+{
+	FCloudSnapshot& snapshot = snapshots.GetWriteBuffer();
+	snapshot.sparse = sparse_active;
+	snapshot.packed = packed_active;
+	if(sparse_active)
+	{
+		snapshot.sparse_lattice.CopyFrom(sparse_solver.GetLattice());
+		snapshot.lattice.Empty();
+		snapshot.packed_lattice.Empty();
+	}
+	else if(packed_active)
+	{
+		snapshot.packed_lattice.CopyFrom(packed_solver.GetLattice());
+		snapshot.lattice.Empty();
+		snapshot.sparse_lattice.Empty();
+	}
+	else
+	{
+		snapshot.lattice.CopyFrom(cloud_solver.GetLattice());
+		snapshot.sparse_lattice.Empty();
+		snapshot.packed_lattice.Empty();
+	}
+	snapshot.step = ++published_steps;
+	snapshots.SwapWriteBuffers();
+}
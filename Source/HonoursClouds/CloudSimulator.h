@@ -8,8 +8,36 @@
 #include "Components/VolumetricCloudComponent.h"
 #include "GameFramework/Actor.h"
 #include "Engine/Texture2D.h"
+#include "CloudSolver.h"
+#include "CloudPackedSolver.h"
+#include "CloudSparseSolver.h"
+#include "CloudTextureWriter.h"
+#include "CloudSimWorker.h"
+#include "Containers/TripleBuffer.h"
+#include "Trace/Trace.h"
 #include "CloudSimulator.generated.h"
 
+DECLARE_STATS_GROUP(TEXT("Cloud_Simulator"), STATGROUP_CloudSimulator, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Velocity"), STAT_CloudSim_Velocity, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Diffuse"), STAT_CloudSim_Diffuse, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Advect1"), STAT_CloudSim_Advect1, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Advect2"), STAT_CloudSim_Advect2, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Transition"), STAT_CloudSim_Transition, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Test"), STAT_CloudSim_Test, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Texture"), STAT_CloudSim_Texture, STATGROUP_CloudSimulator);
+DECLARE_CYCLE_STAT(TEXT("CloudSim - Step (async)"), STAT_CloudSim_Step, STATGROUP_CloudSimulator);
+DECLARE_DWORD_COUNTER_STAT(TEXT("CloudSim - Cells Processed"), STAT_CloudSim_CellsProcessed, STATGROUP_CloudSimulator);
+DECLARE_DWORD_COUNTER_STAT(TEXT("CloudSim - Active Tiles"), STAT_CloudSim_ActiveTiles, STATGROUP_CloudSimulator);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("CloudSim - Steps Per Second"), STAT_CloudSim_StepsPerSecond, STATGROUP_CloudSimulator);
+DECLARE_MEMORY_STAT(TEXT("CloudSim - Lattice Memory"), STAT_CloudSim_LatticeMemory, STATGROUP_CloudSimulator);
+DECLARE_DWORD_COUNTER_STAT(TEXT("CloudSim - Texture Upload Bytes"), STAT_CloudSim_TextureUploadBytes, STATGROUP_CloudSimulator);
+
+//trace channel for the simulator's Insights events, enable with -trace=cpu,CloudSim
+UE_TRACE_CHANNEL_EXTERN(CloudSimChannel, HONOURSCLOUDS_API)
+
+//runs the solver's parallel sweeps on the task graph, using every worker thread plus the calling thread
+HONOURSCLOUDS_API FCloudParallelFor CloudTaskGraphParallelFor();
+
 //struct to store advection data
 USTRUCT(BlueprintType)
 struct FAdvectionData
@@ -23,6 +51,21 @@ struct FAdvectionData
 	float A_water_droplets;
 };
 
+//one layer of the temperature profile, mirrors FCloudLapseLayer in CloudThermodynamics.h
+USTRUCT(BlueprintType)
+struct FLapseLayer
+{
+	GENERATED_BODY()
+
+	//meters above the bottom of the simulation the layer starts at
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	float base_height = 0.f;
+
+	//kelvin the temperature falls by every meter up, negative for an inversion
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	float lapse_rate = 0.006f;
+};
+
 //struct to store cell data
 USTRUCT(BlueprintType)
 struct FCloudCellData
@@ -42,7 +85,7 @@ struct FCloudCellData
 	FAdvectionData advection_data;
 };
 
-//struct to store an array to create a 2D array
+//struct to store an array to create a 2D array, only used by the deprecated cloud_lattice
 USTRUCT(BlueprintType)
 struct F2DArray
 {
@@ -50,19 +93,9 @@ struct F2DArray
 
 	UPROPERTY(BlueprintReadWrite)
 	TArray<FCloudCellData> nested_array_2D;
-
-	FCloudCellData& operator[] (int32 i)
-	{
-		return nested_array_2D[i];
-	}
-
-	void Add(FCloudCellData cell_data)
-	{
-		nested_array_2D.Add(cell_data);
-	}
 };
 
-//struct to store a 2D array to create a 3D array
+//struct to store a 2D array to create a 3D array, only used by the deprecated cloud_lattice
 USTRUCT(BlueprintType)
 struct F3DArray
 {
@@ -70,16 +103,6 @@ struct F3DArray
 
 	UPROPERTY(BlueprintReadWrite)
 	TArray<F2DArray> nested_array_3D;
-
-	F2DArray& operator[] (int32 i)
-	{
-		return nested_array_3D[i];
-	}
-
-	void Add(F2DArray nested_array)
-	{
-		nested_array_3D.Add(nested_array);
-	}
 };
 
 //enum for every stage
@@ -95,6 +118,85 @@ enum EStage
 	Texture UMETA(DisplayName = "Texture")
 };
 
+//how water is moved along the velocity field, mirrors ECloudAdvectionScheme in CloudSolver.h
+UENUM(BlueprintType)
+enum class EAdvectionScheme : uint8
+{
+	//each cell adds its water into the 8 cells around the position given by its velocity (Advect1), then the totals are folded back in (Advect2)
+	Scatter UMETA(DisplayName = "Scatter"),
+	//each cell traces back along its velocity and takes the trilinearly interpolated water found there, finishing in a single pass with no Advect2
+	Gather UMETA(DisplayName = "Gather")
+};
+
+//what the halo around a padded lattice holds, mirrors ECloudBoundary in CloudLattice.h
+UENUM(BlueprintType)
+enum class EBoundaryCondition : uint8
+{
+	//nothing outside the lattice, gives the same result as an unpadded lattice
+	Zero UMETA(DisplayName = "Zero"),
+	//cells outside the lattice copy the nearest cell inside it
+	Clamp UMETA(DisplayName = "Clamp"),
+	//the lattice wraps round onto its opposite side
+	Periodic UMETA(DisplayName = "Periodic"),
+	//cells outside the lattice hold inflow_velocity and inflow_water_vapor
+	Inflow UMETA(DisplayName = "Inflow")
+};
+
+//order the dense lattice stores its cells in, mirrors ECloudCellOrder in CloudLattice.h
+UENUM(BlueprintType)
+enum class ECellOrder : uint8
+{
+	//x fastest, then y, then z, so rows run through the vectorised kernels
+	Linear UMETA(DisplayName = "Linear"),
+	//bits of x, y and z interleaved, so cells close in every direction are close in memory, every cell runs the per cell kernels
+	Morton UMETA(DisplayName = "Morton")
+};
+
+//how packed_storage keeps a channel, mirrors ECloudPrecision in CloudPackedLattice.h
+UENUM(BlueprintType)
+enum class EStoragePrecision : uint8
+{
+	//32 bit float, the same as the dense lattice
+	Float32 UMETA(DisplayName = "Float32"),
+	//16 bit half float, about 3 significant figures, overflows past 65504
+	Float16 UMETA(DisplayName = "Float16"),
+	//16 bit fixed point, evenly spaced steps out to the fixed range either side of 0, clamped beyond it
+	Fixed16 UMETA(DisplayName = "Fixed16")
+};
+
+//value stored per cell, mirrors ECloudChannel in CloudLattice.h
+UENUM(BlueprintType)
+enum class ECellChannel : uint8
+{
+	VelocityX UMETA(DisplayName = "Velocity X"),
+	VelocityY UMETA(DisplayName = "Velocity Y"),
+	VelocityZ UMETA(DisplayName = "Velocity Z"),
+	WaterVapor UMETA(DisplayName = "Water Vapor"),
+	WaterDroplets UMETA(DisplayName = "Water Droplets"),
+	//only held while a step is in its advection stages, 0 otherwise
+	AdvectWaterVapor UMETA(DisplayName = "Advect Water Vapor"),
+	AdvectWaterDroplets UMETA(DisplayName = "Advect Water Droplets")
+};
+
+//texel format of the cloud texture, mirrors ECloudTextureFormat in CloudTextureWriter.h
+UENUM(BlueprintType)
+enum class EDensityTextureFormat : uint8
+{
+	//8 bits, densities from 0 to 1 in 256 steps, anything outside is clamped
+	R8 UMETA(DisplayName = "R8"),
+	//16 bit half float, keeps densities above 1 and about 3 significant figures
+	R16F UMETA(DisplayName = "R16F")
+};
+
+//settings handed from the game thread to the background thread, which copies them at the start of each step
+//so it never reads the blueprint properties while they may be changing
+struct FCloudSimSettings
+{
+	FCloudSimParams params;
+	bool sparse_storage = false;
+	bool packed_storage = false;
+};
+
 UCLASS()
 class HONOURSCLOUDS_API ACloudSimulator : public AActor
 {
@@ -108,6 +210,9 @@ protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	// Called when the actor is removed, stops the background simulation thread
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 	// Called every frame
 	virtual void Tick(float DeltaTime) override;
@@ -153,6 +258,17 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void PhaseTransition(int iteration_start);
 
+	//runs an entire simulation stage in one call, splitting the lattice into slabs that are processed in parallel
+	//gives the same result as running the stage through the time sliced functions above
+	UFUNCTION(BlueprintCallable)
+	void RunStageFullSweep(TEnumAsByte<EStage> stage);
+
+	//runs one stage over the box of cells from Begin up to but not including End, in the same order ProgressSim() walks them
+	//does not move the cursor or finish the stage, buffers written by the stage are only swapped once the stage is finished
+	//a box starting at the first cell of the lattice refreshes the halo of a padded lattice first
+	UFUNCTION(BlueprintCallable)
+	void RunStage(TEnumAsByte<EStage> stage, FIntVector Begin, FIntVector End);
+
 	//number of cells in lattice
 	UPROPERTY(BlueprintReadWrite)
 	int x_sim_size = 50;
@@ -168,8 +284,178 @@ public:
 	float y_world_size = 1000.f;
 	float z_world_size = 1000.f;
 
-	//3D vector lattice
+	//temperature at the bottom of the simulation in kelvin, the temperature with height sets how much water vapor each level can hold
+	//changes are applied at the start of the next simulation step
+	UPROPERTY(BlueprintReadWrite)
+	float surface_temperature = 300.f;
+
+	//layers of the temperature profile in order of base_height, the default falls by 0.6K every 100m all the way up
+	UPROPERTY(BlueprintReadWrite)
+	TArray<FLapseLayer> lapse_layers = { FLapseLayer() };
+
+	//the simulation itself lives in the engine free CloudSimCore module, this actor feeds it settings and drives its stages
+	//the lattice is a flat structure-of-arrays, see CloudLattice.h for the layout
+	FCloudSolver cloud_solver;
+
+	//when true AlterVelocity and DiffuseWaterVapour read the front buffers and write the back buffers, swapping when the stage ends
+	//this makes the result independent of traversal order, when false cells are updated in place as before
+	//changes are applied at the start of the next simulation step
+	UPROPERTY(BlueprintReadWrite)
+	bool double_buffered_stencils = false;
+
+	//when true the lattice stores a one cell halo holding boundary, so the velocity and diffusion stages run without edge checks
+	//with a Zero boundary the result is the same as without the halo, changes are applied at the start of the next simulation step
+	UPROPERTY(BlueprintReadWrite)
+	bool padded_lattice = false;
+
+	UPROPERTY(BlueprintReadWrite)
+	EBoundaryCondition boundary = EBoundaryCondition::Zero;
+
+	//values held outside the lattice by an Inflow boundary
+	UPROPERTY(BlueprintReadWrite)
+	FVector3f inflow_velocity = FVector3f(0,0,0);
+
+	UPROPERTY(BlueprintReadWrite)
+	float inflow_water_vapor = 0.f;
+
+	//changes are applied at the start of the next simulation step, a Morton lattice ignores padded_lattice and activity_mask
+	UPROPERTY(BlueprintReadWrite)
+	ECellOrder cell_order = ECellOrder::Linear;
+
+	//cells along x, y and z the velocity and diffusion stages finish before moving on to the next block, 0 along an axis for the whole lattice
+	//the result is the same for every block size, blocking x drops the velocity stage of an unpadded linear lattice to the per cell kernels
+	UPROPERTY(BlueprintReadWrite)
+	FIntVector stencil_block = FIntVector(0, 0, 0);
+
+	//when true BeginPlay times a range of stencil block sizes on the lattice and keeps the fastest in stencil_block
+	UPROPERTY(BlueprintReadWrite)
+	bool auto_tune_blocks = false;
+
+	//when true diffusion runs in the same pass over the lattice as the velocity stage, and the phase transition in the same pass as Advect2
+	//the result is unchanged, the Diffuse and Transition stats then read 0 and their time shows up under Velocity and Advect2
+	//changes are applied at the start of the next simulation step, ignored while activity_mask, sparse_storage or packed_storage is on
+	UPROPERTY(BlueprintReadWrite)
+	bool fuse_stages = false;
+
+	//when true the velocity and diffusion stages run as diagonals of wavefront_tile tiles, each diagonal spread over the task graph
+	//gives the same result as the in place sweep while keeping more threads busy on lattices thin along y, ignored while activity_mask is on
+	//changes are applied at the start of the next simulation step
+	UPROPERTY(BlueprintReadWrite)
+	bool wavefront_stencils = false;
+
+	//0 along an axis splits the lattice into one tile per worker thread along it
+	UPROPERTY(BlueprintReadWrite)
+	FIntVector wavefront_tile = FIntVector(0, 0, 0);
+
+	//when true full sweeps of the scatter run over the task graph, each task adding into its own accumulators which are then summed in task order
+	//results differ from the single threaded scatter in the last bits but repeat exactly for the same number of worker threads
+	//costs two extra lattice sized buffers per task while Advect1 runs, changes are applied at the start of the next simulation step, ignored while activity_mask is on
+	UPROPERTY(BlueprintReadWrite)
+	bool private_scatter = false;
+
+	//when true full sweeps of the scatter run over the task graph as tiles coloured by parity, the tiles of a colour running at once
+	//cells whose velocity points within half a tile of their own tile add straight into the lattice, the rest use per task accumulators like private_scatter
+	//the result repeats exactly for the same scatter_tile and worker thread count, takes priority over private_scatter, ignored while activity_mask is on
+	UPROPERTY(BlueprintReadWrite)
+	bool coloured_scatter = false;
+
+	//cells along each axis of a coloured scatter tile, 0 along an axis for 16
 	UPROPERTY(BlueprintReadWrite)
+	FIntVector scatter_tile = FIntVector(0, 0, 0);
+
+	//the advection accumulators are only allocated from Advect1 until they have been folded into the water, and kept for the next step
+	//when true they are freed at the end of every step instead, so only the lattice itself stays allocated between steps
+	UPROPERTY(BlueprintReadWrite)
+	bool release_advection_scratch = false;
+
+	//when true the cloud simulation runs on sparse_solver, which only stores and steps the 8x8x8 bricks of sky that hold something
+	//the lattice is converted at the start of the next simulation step, and back to dense for the test modes
+	//every stage is run as a full sweep while it is on, padded_lattice and double_buffered_stencils are ignored
+	UPROPERTY(BlueprintReadWrite)
+	bool sparse_storage = false;
+
+	//values closer to 0 than this count as clear air, bricks holding nothing else are freed at the end of each step
+	UPROPERTY(BlueprintReadWrite)
+	float sparse_threshold = 1e-6f;
+
+	//runs the simulation instead of cloud_solver while sparse_storage is on, see CloudSparseSolver.h
+	FCloudSparseSolver sparse_solver;
+
+	//when true the cloud simulation runs on packed_solver, which stores velocity and water at 16 bits and does the maths in floats
+	//a large lattice then takes a little over half the memory, converted at the start of the next simulation step like sparse_storage,
+	//which wins if both are on, every stage is run as a full sweep and only the simulation coefficients and advection_scheme apply
+	UPROPERTY(BlueprintReadWrite)
+	bool packed_storage = false;
+
+	UPROPERTY(BlueprintReadWrite)
+	EStoragePrecision velocity_precision = EStoragePrecision::Float16;
+
+	UPROPERTY(BlueprintReadWrite)
+	EStoragePrecision water_precision = EStoragePrecision::Float16;
+
+	//range either side of 0 a Fixed16 channel holds, in cells per step for velocity
+	UPROPERTY(BlueprintReadWrite)
+	float velocity_fixed_range = 256.f;
+
+	UPROPERTY(BlueprintReadWrite)
+	float water_fixed_range = 64.f;
+
+	//runs the simulation instead of cloud_solver while packed_storage is on, see CloudPackedSolver.h
+	FCloudPackedSolver packed_solver;
+
+	//when true cloud_solver tracks which tiles of 4 rows by 4 planes have changed and each stage skips the tiles it would leave as they are
+	//with activity_threshold at 0 the result is the same as running every tile, changes are applied at the start of the next simulation step
+	//only full sweeps skip tiles, time sliced stages and RunStage() still run every cell
+	UPROPERTY(BlueprintReadWrite)
+	bool activity_mask = false;
+
+	//changes no bigger than this do not mark a tile to be run again, above 0 small changes stop spreading and the result drifts
+	UPROPERTY(BlueprintReadWrite)
+	float activity_threshold = 0.f;
+
+	//tiles run by the last sweep of a stage, out of every tile of the lattice when activity_mask is off
+	UFUNCTION(BlueprintPure)
+	int GetActiveTiles(TEnumAsByte<EStage> stage) const;
+
+	//true if the tile holding the cell was run by the last sweep of a stage, for drawing the activity mask while debugging
+	//false while async_simulation is running, as the mask is being written by the background thread
+	UFUNCTION(BlueprintPure)
+	bool IsCellActive(int x, int y, int z, TEnumAsByte<EStage> stage) const;
+
+	//the lattice lives in native memory inside cloud_solver, sparse_solver or packed_solver, so garbage collection, PIE and duplicating
+	//the actor do not walk or copy it, blueprints reach it through the functions below, the only reflected copy is the deprecated cloud_lattice
+	//while async_simulation is running they read the newest finished step, and an empty lattice of size 0 until the first one arrives
+
+	//copies the values of a single cell out of the lattice for use in blueprints
+	UFUNCTION(BlueprintPure)
+	FCloudCellData GetCellData(int x, int y, int z) const;
+
+	//writes the velocity and water of a single cell, and its advection values while they are held, returns false outside the lattice
+	//or while async_simulation is running, when the lattice belongs to the background thread
+	UFUNCTION(BlueprintCallable)
+	bool SetCellData(int x, int y, int z, const FCloudCellData& cell_data);
+
+	//cells along each axis of the lattice
+	UFUNCTION(BlueprintPure)
+	FIntVector GetLatticeSize() const;
+
+	//position in cells of a point in the world, the lattice fills x_world_size by y_world_size by z_world_size from the actor's origin
+	//along its axes, with the centre of cell (0, 0, 0) half a cell in from the corner
+	UFUNCTION(BlueprintPure)
+	FVector WorldToLattice(FVector WorldLocation) const;
+
+	//values at a position in cells, trilinearly interpolated between the 8 cells around it, positions outside the lattice take the nearest cells
+	UFUNCTION(BlueprintPure)
+	FCloudCellData SampleCellData(FVector LatticePosition) const;
+
+	//copies one channel of the z slice into Values, x fastest, then y, empty if the slice is outside the lattice
+	UFUNCTION(BlueprintCallable)
+	void GetChannelSlice(ECellChannel Channel, int z, TArray<float>& Values) const;
+
+	//copy of the lattice in the old nested layout, cloud_lattice[x][y][z], kept for the Texture graph of CloudSimulator1_Blueprint which still reads it
+	//only filled while the blueprint draws the Texture stage, with native_texture off, and emptied once the stage is over, writes to it are lost
+	//the graph has to be rewired to GetChannelSlice() or GetCellData() by hand in the editor, after which this can be removed
+	UPROPERTY(BlueprintReadWrite, Transient, meta = (DeprecatedProperty, DeprecationMessage = "Read the lattice through GetChannelSlice() or GetCellData() instead."))
 	TArray<F3DArray> cloud_lattice;
 
 	//constant coefficients
@@ -204,7 +490,183 @@ public:
 	UPROPERTY(BlueprintReadWrite)
 	int current_z = 0;
 
+	//when true each tick runs one whole stage with RunStageFullSweep() instead of time slicing it with ProgressSim()
+	UPROPERTY(BlueprintReadWrite)
+	bool full_sweep = false;
+
+	//smallest number of cells handed to a single task during a full sweep
+	UPROPERTY(BlueprintReadWrite)
+	int min_batch_size = 4096;
+
+	//scheme used by the advection stage, changes are applied at the start of the next simulation step
+	UPROPERTY(BlueprintReadWrite)
+	EAdvectionScheme advection_scheme = EAdvectionScheme::Scatter;
+
+	//when true whole rows of the velocity, diffusion and phase transition stages are run with the vectorised kernels in CloudSimKernels.h
+	//both paths give identical results, the switch exists so they can be compared
+	UPROPERTY(BlueprintReadWrite)
+	bool use_simd = true;
+
+	//when true a background thread runs whole simulation steps back to back instead of Tick advancing the stages
+	//each finished step is published as a snapshot which GetCellData() and the texture pass read, so neither side waits for the other,
+	//cells read as 0 until the first one arrives, and the functions that run stages or write cells do nothing while the thread owns the lattice
+	//the other settings are copied for the thread every tick and picked up at the start of its next step
+	UPROPERTY(BlueprintReadWrite)
+	bool async_simulation = false;
+
+	//shortest time in seconds between the start of two background steps, 0 runs them back to back
+	//read when the background thread starts
+	UPROPERTY(BlueprintReadWrite)
+	float async_min_step_interval = 0.f;
+
+	//number of steps the background thread has finished since it was started
+	UFUNCTION(BlueprintPure)
+	int GetAsyncStepsCompleted() const;
+
+	//when true the time sliced stages do as many cells each frame as fit in frame_budget_us, using a measured cost per cell for each stage
+	//instead of assuming every cell of every stage costs update_length / (cells * 6)
+	UPROPERTY(BlueprintReadWrite)
+	bool use_frame_budget = false;
+
+	//time in microseconds the simulation may take each frame
+	UPROPERTY(BlueprintReadWrite)
+	float frame_budget_us = 4000.f;
+
+	//weight given to the newest measurement in the moving average cost per cell, between 0 and 1
+	UPROPERTY(BlueprintReadWrite)
+	float frame_budget_smoothing = 0.1f;
+
+	//seconds a whole step is expected to take at the current budget, updated at the start of each step
+	UPROPERTY(BlueprintReadOnly)
+	float estimated_step_time = 0.f;
+
+	//true when estimated_step_time is longer than update_length
+	UPROPERTY(BlueprintReadOnly)
+	bool over_budget = false;
+
+	//moving average cost of one cell in microseconds, 0 until the stage has been measured
+	UFUNCTION(BlueprintPure)
+	float GetStageCellCost(TEnumAsByte<EStage> stage) const;
+
+	//whole simulation steps finished per second, averaged over about a second
+	UPROPERTY(BlueprintReadOnly)
+	float steps_per_second = 0.f;
+
+	//when true the Texture stage is done here, writing the water droplets of the whole lattice into CustomTexture and uploading the parts
+	//that changed, moving on to the next stage before the blueprint ticks, when false the stage is left to the blueprint as before
+	UPROPERTY(BlueprintReadWrite)
+	bool native_texture = true;
+
+	UPROPERTY(BlueprintReadWrite)
+	EDensityTextureFormat texture_format = EDensityTextureFormat::R8;
+
+	//droplet density is multiplied by this before being written, R8 then clamps it to [0, 1]
+	UPROPERTY(BlueprintReadWrite)
+	float texture_density_scale = 1.f;
+
+	//z slices placed side by side across the texture before starting the next row of them, 0 for the squarest texture
+	UPROPERTY(BlueprintReadWrite)
+	int texture_tiles_x = 0;
+
+	//rows of each slice checked for changes together, changed bands are merged into as few upload regions as they can be, 0 for whole slices
+	UPROPERTY(BlueprintReadWrite)
+	int texture_region_rows = 8;
+
+	//a band is only uploaded once one of its texels has moved by more than this since it was last uploaded, in density after texture_density_scale
+	//0 uploads every change, above 0 small changes wait in the lattice until they add up
+	UPROPERTY(BlueprintReadWrite)
+	float texture_change_threshold = 0.f;
+
+	//texture parameter of DynamicMaterial CustomTexture is bound to
+	UPROPERTY(BlueprintReadWrite)
+	FName texture_parameter = TEXT("CloudTexture");
+
+	//vector parameter of DynamicMaterial given the slices across, slices down and number of slices, for sampling the texture as a volume
+	UPROPERTY(BlueprintReadWrite)
+	FName texture_layout_parameter = TEXT("CloudTextureLayout");
+
+	//writes the water droplets into CustomTexture as a 2D atlas of z slices, creating the texture when the size or format has changed
+	//only the regions that changed since the last call are uploaded, reads the newest finished step while async_simulation is on, does not move the stage on
+	UFUNCTION(BlueprintCallable)
+	void WriteCloudTexture();
+
+private:
+	friend class FCloudSimWorker;
+
+	//runs one stage over the whole lattice and returns the stage that follows it, or the same stage if it cannot be swept
+	EStage SweepStage(EStage stage);
+
+	//bridges from the time sliced stage functions to the solver, moving the blueprint cursor along with it
+	bool ProgressStageRows(EStage stage, int iteration_start);
+	EStage FinishStage(EStage stage);
+
+	//copies settings into the solver and applies the ones that may only change between simulation steps
+	void ApplyPendingSettings();
+
+	//solver settings taken from the blueprint properties, only called on the game thread
+	FCloudSimParams MakeSimParams() const;
+
+	//hands params to every solver and applies them, on whichever thread owns the lattice
+	void ApplySimParams(const FCloudSimParams& params);
+
+	//moves the lattice between cloud_solver and sparse_solver or packed_solver, called at the start of each step and before the test modes
+	void SetStorageActive(bool in_sparse_active, bool in_packed_active);
+	void SetSparseActive(bool in_sparse_active);
+	void SetPackedActive(bool in_packed_active);
+	bool sparse_active = false;
+	bool packed_active = false;
+
+	//runs a stage on whichever solver holds the lattice
+	ECloudSimStage SweepSolverStage(ECloudSimStage stage);
+
+	//stats, see STATGROUP_CloudSimulator
+	void UpdateStats(float DeltaTime);
+	void SetLatticeMemoryStat();
+	float step_rate_timer = 0.f;
+
+	//background simulation, see async_simulation
+	void StartAsyncSimulation();
+	void StopAsyncSimulation();
+	void RunFullStep();
+	void PublishSnapshot();
+
+	TUniquePtr<FCloudSimWorker> async_worker;
+
+	//the worker writes to one slot while the game thread reads another, the third holds the newest step not yet picked up
+	TTripleBuffer<FCloudSnapshot> snapshots;
+
+	//snapshot the texture pass is currently drawing, only used on the game thread
+	const FCloudSnapshot* read_snapshot = nullptr;
+
+	//only used on the background thread
+	int32 published_steps = 0;
+
+	//calls visit with the lattice blueprints and the texture pass read, the newest finished step while async_simulation is running,
+	//otherwise whichever of the dense, sparse or packed lattice holds the simulation
+	template<typename TVisit>
+	void VisitReadLattice(TVisit&& visit) const;
+
+	//settings for the next step of the worker, written by PostAsyncSettings() every tick and copied by RunFullStep()
+	void PostAsyncSettings();
+	FCriticalSection pending_settings_lock;
+	FCloudSimSettings pending_settings;
+
+	//copies the lattice into cloud_lattice for the blueprint's Texture graph through GetChannelSlice()
+	void FillLegacyLattice();
+
+	//converts the lattice for WriteCloudTexture()
+	FCloudTextureWriter texture_writer;
+
+	//frame budget, see use_frame_budget
+	static constexpr int32 NumStages = EStage::Texture + 1;
+	float stage_cell_cost_us[NumStages] = {};
+	void RecordStageCost(EStage stage, int32 cells, double seconds);
+	int BudgetedIterationLength(float DeltaTime) const;
+	void CheckFrameBudget(float DeltaTime);
+
+public:
 	//plane texture render variables
+	UPROPERTY(BlueprintReadOnly, Transient)
 	UTexture2D* CustomTexture;
 	UMaterial* CustomMaterial;
 	UMaterialInstanceDynamic* DynamicMaterial;
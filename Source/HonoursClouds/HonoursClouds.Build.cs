@@ -8,7 +8,7 @@ public class HonoursClouds : ModuleRules
 	{
 		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
 	
-		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore" });
+		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore", "CloudSimCore" });
 
 		PrivateDependencyModuleNames.AddRange(new string[] {  });
 